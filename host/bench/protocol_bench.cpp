@@ -0,0 +1,864 @@
+// Throughput and latency of the link on Linux:
+//   handshake  guard line to ready session over a socketpair, FdConnection on
+//              the device end and PeerLink on the client end, per cipher
+//   resume     full ephemeral handshake against one resumed from its ticket
+//   seal/open  CryptoEcdhAes per AEAD and nonce mode across payload sizes
+//   parse      Protocol::appendReceived of a ready RawProtocol per frame size,
+//              fed in 512-byte reads as FdConnection does, byte against
+//              varint framing for frames that fit both
+//   send       Protocol::send of a ready raw session against calling
+//              sendFrame() directly and against the old semaphore take/give,
+//              and a send parked before the handshake
+//   metrics    LinkMetrics updates of one frame, from 1, 2 and 4 threads,
+//              against the CPU of that frame through FdConnection and PeerLink
+//   compress   plaintext bytes of the parameter dump and guard line to its
+//              last message on a HostDevice, with and without Batching and
+//              Compression, then CPU of the LZ encoder and decoder per
+//              compressible frame
+//   pool       FdConnection start() and P-256 handshake latency without and
+//              with the keypair pool
+//   dispatch   MessageDispatcher per client message type, with ParameterSync's
+//              handlers and no link
+//   random     CryptoEcdhAes construction and RAM per connection with the
+//              shared RandomService against its own seeded DRBG, and fill()
+//              from one and two threads
+//   curves     P-256 against X25519: keygen, shared secret and session key,
+//              and the bytes of a whole ephemeral handshake
+// Numbers are for comparing builds on one machine; the device is far slower.
+//
+//   protocol_bench [scale] [section...]   scale multiplies the iteration
+//                                         counts (default 1); all sections
+//                                         run when none is named
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <semaphore>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+#include "esp_log.h"
+#include "crypto_ecdh_aes.hpp"
+#include "device/host_device.hpp"
+#include "fd_connection.hpp"
+#include "host/loopback_server.hpp"
+#include "keypair_pool.hpp"
+#include "random_service.hpp"
+#include "link_metrics.hpp"
+#include "pb_encode.h"
+#include "proto-model/Handshake.pb.h"
+#include "protocol/raw_protocol.hpp"
+#include "peer/peer_link.hpp"
+#include "peer/peer_messages.hpp"
+#include "protocol/compression_dict.hpp"
+#include "protocol/lz_codec.hpp"
+#include "sdkconfig.h"
+
+using Clock = std::chrono::steady_clock;
+
+static double elapsedNs(Clock::time_point since) {
+    return std::chrono::duration<double, std::nano>(Clock::now() - since).count();
+}
+
+static int64_t cpuNs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return int64_t(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+static const size_t kPayloads[] = {16, 64, 240, 1024, 4000};
+
+struct Stats {
+    double min, median, mean, max;
+};
+
+static Stats stats(std::vector<double> v) {
+    std::sort(v.begin(), v.end());
+    double sum = 0;
+    for (double x : v) sum += x;
+    return {v.front(), v[v.size() / 2], sum / v.size(), v.back()};
+}
+
+// --- handshake -----------------------------------------------------------------
+
+struct Cipher {
+    const char* name;
+    uint32_t caps;
+};
+
+static const Cipher kCiphers[] = {
+    {"raw", linkcaps::CipherRaw},
+    {"passphrase aes-gcm", linkcaps::CipherPassphrase},
+    {"passphrase chacha", linkcaps::CipherPassphrase | linkcaps::ChaChaPoly},
+    {"ephemeral p256 aes-gcm", linkcaps::CipherEphemeral},
+    {"ephemeral binary x25519 chacha", linkcaps::CipherEphemeral | linkcaps::BinaryHandshake |
+                                       linkcaps::CurveX25519 | linkcaps::ChaChaPoly},
+    {"ephemeral binary x25519 counter", linkcaps::CipherEphemeral | linkcaps::BinaryHandshake |
+                                        linkcaps::CurveX25519 | linkcaps::CounterNonce},
+};
+
+static void benchHandshake(int iterations) {
+    printf("\nhandshake (guard line to ready, us)\n");
+    printf("  %-34s %8s %8s %8s %8s\n", "cipher", "min", "median", "mean", "max");
+    LoopbackServer loopback;
+    std::unique_ptr<FdConnection> conn;
+    loopback.setOnFdReady([&](int fd) {
+        conn = std::make_unique<FdConnection>(fd, CONFIG_PASSPHRASE);
+        return conn->start() == ESP_OK;
+    });
+    for (const Cipher& c : kCiphers) {
+        std::vector<double> us;
+        for (int i = 0; i < iterations; i++) {
+            PeerLink peer(loopback.connect(LoopbackServer::Transport::SocketPair));
+            auto t0 = Clock::now();
+            bool ok = peer.connect(c.caps, CONFIG_PASSPHRASE);
+            double t = elapsedNs(t0) / 1000;
+            peer.close();
+            conn.reset();
+            if (!ok) {
+                printf("  %-34s handshake failed\n", c.name);
+                us.clear();
+                break;
+            }
+            us.push_back(t);
+        }
+        if (us.empty()) continue;
+        Stats st = stats(us);
+        printf("  %-34s %8.0f %8.0f %8.0f %8.0f\n", c.name, st.min, st.median, st.mean, st.max);
+    }
+}
+
+// --- resumption ----------------------------------------------------------------
+
+static const Cipher kResumeCaps[] = {
+    {"p256 protobuf", linkcaps::CipherEphemeral | linkcaps::Resume},
+    {"p256 binary", linkcaps::CipherEphemeral | linkcaps::BinaryHandshake | linkcaps::Resume},
+    {"x25519 binary", linkcaps::CipherEphemeral | linkcaps::BinaryHandshake | linkcaps::CurveX25519 |
+                      linkcaps::Resume},
+};
+
+// Each round is a full handshake that yields a ticket, then a session that
+// redeems it, so no ticket runs out of uses.
+static void benchResume(int iterations) {
+    printf("\nresumption (guard line to ready, us)\n");
+    printf("  %-16s %-8s %8s %8s %8s %8s\n", "cipher", "session", "min", "median", "mean", "max");
+    LoopbackServer loopback;
+    std::unique_ptr<FdConnection> conn;
+    loopback.setOnFdReady([&](int fd) {
+        conn = std::make_unique<FdConnection>(fd, CONFIG_PASSPHRASE);
+        return conn->start() == ESP_OK;
+    });
+    for (const Cipher& c : kResumeCaps) {
+        std::vector<double> full, resumed;
+        for (int i = 0; i < iterations; i++) {
+            PeerLink::Ticket ticket;
+            for (std::vector<double>* into : {&full, &resumed}) {
+                PeerLink peer(loopback.connect(LoopbackServer::Transport::SocketPair));
+                peer.resumeWith(ticket);
+                auto t0 = Clock::now();
+                bool ok = peer.connect(c.caps, CONFIG_PASSPHRASE) && peer.resumed() == (into == &resumed);
+                double t = elapsedNs(t0) / 1000;
+                ticket = peer.ticket();
+                peer.close();
+                conn.reset();
+                if (!ok) {
+                    printf("  %-16s %s handshake failed\n", c.name, into == &full ? "full" : "resumed");
+                    return;
+                }
+                into->push_back(t);
+            }
+        }
+        Stats f = stats(full);
+        Stats r = stats(resumed);
+        printf("  %-16s %-8s %8.0f %8.0f %8.0f %8.0f\n", c.name, "full", f.min, f.median, f.mean, f.max);
+        printf("  %-16s %-8s %8.0f %8.0f %8.0f %8.0f  (%.1fx faster)\n", "", "resumed", r.min, r.median, r.mean,
+               r.max, f.median / r.median);
+    }
+}
+
+// --- seal / open ---------------------------------------------------------------
+
+// Device and client ends of one ephemeral session.
+static bool makePair(CryptoEcdhAes& device, CryptoEcdhAes& client, Aead::Kind aead, bool counter) {
+    uint8_t dk[CryptoEcdhAes::kMaxPublicKeyLen];
+    uint8_t ck[CryptoEcdhAes::kMaxPublicKeyLen];
+    if (!device.select_aead(aead) || !client.select_aead(aead)) return false;
+    size_t dn = device.write_public_key(dk, sizeof(dk));
+    size_t cn = client.write_public_key(ck, sizeof(ck));
+    if (!dn || !cn || !device.apply_other_public_raw(ck, cn) || !client.apply_other_public_raw(dk, dn)) return false;
+    return !counter || (device.enable_counter_nonces(CryptoEcdhAes::Side::Device) &&
+                        client.enable_counter_nonces(CryptoEcdhAes::Side::Client));
+}
+
+static void benchSealOpen(int scale) {
+    printf("\nseal/open (device seals, client opens; 1-byte header as AAD)\n");
+    printf("  %-22s %6s %10s %10s %10s %10s\n", "aead / nonce", "bytes", "seal ns", "seal MB/s", "open ns", "open MB/s");
+    const uint8_t aad[1] = {0};
+    for (Aead::Kind kind : {Aead::Kind::AesGcm, Aead::Kind::ChaChaPoly}) {
+        for (bool counter : {false, true}) {
+            CryptoEcdhAes device(CryptoEcdhAes::Mode::EPHEMERAL);
+            CryptoEcdhAes client(CryptoEcdhAes::Mode::EPHEMERAL);
+            const char* name = kind == Aead::Kind::AesGcm ? (counter ? "aes-gcm / counter" : "aes-gcm / random")
+                                                          : (counter ? "chacha / counter" : "chacha / random");
+            if (!makePair(device, client, kind, counter)) {
+                printf("  %-22s not available\n", name);
+                continue;
+            }
+            for (size_t size : kPayloads) {
+                const int n = scale * static_cast<int>(std::max<size_t>(200, (2u << 20) / size));
+                std::vector<uint8_t> plain(size, 0x5A);
+                std::vector<std::vector<uint8_t>> frames(n, std::vector<uint8_t>(size + device.overhead()));
+
+                auto t0 = Clock::now();
+                for (auto& f : frames) {
+                    memcpy(f.data() + device.nonce_field_len(), plain.data(), size);
+                    if (!device.seal(f.data(), size, aad, sizeof(aad))) abort();
+                }
+                double sealNs = elapsedNs(t0) / n;
+
+                t0 = Clock::now();
+                for (auto& f : frames) {
+                    uint8_t* out;
+                    size_t outLen;
+                    if (!client.open(f.data(), f.size(), out, outLen, aad, sizeof(aad))) abort();
+                }
+                double openNs = elapsedNs(t0) / n;
+                printf("  %-22s %6zu %10.0f %10.1f %10.0f %10.1f\n", name, size, sealNs, size * 1e3 / sealNs,
+                       openNs, size * 1e3 / openNs);
+            }
+        }
+    }
+}
+
+// --- frame parse ---------------------------------------------------------------
+
+// A RawProtocol before its handshake; frames reach recvCb unchanged.
+template <typename P = RawProtocol>
+static std::unique_ptr<P> startRaw(uint32_t caps, size_t& received) {
+    auto p = std::make_unique<P>(CONFIG_PASSPHRASE);
+    p->negotiate(caps, caps, true);
+    p->init([](const uint8_t*, size_t) {}, [&received](std::span<const uint8_t>) { received++; });
+    return p;
+}
+
+// Feeds the client hello; true once the session is ready.
+static bool finishRaw(RawProtocol& p, uint32_t caps) {
+    pModel_HandshakeResponse hello = pModel_HandshakeResponse_init_zero;
+    strncpy(hello.text, CONFIG_PASSPHRASE, sizeof(hello.text) - 1);
+    uint8_t body[pModel_HandshakeResponse_size];
+    pb_ostream_t os = pb_ostream_from_buffer(body, sizeof(body));
+    if (!pb_encode(&os, pModel_HandshakeResponse_fields, &hello)) return false;
+    FrameCodec codec;
+    codec.setFraming((caps & linkcaps::FramingVarint) ? FrameCodec::Framing::Varint : FrameCodec::Framing::Byte);
+    uint8_t frame[FrameCodec::kMaxHeaderLen + sizeof(body)];
+    size_t h = codec.encodeHeader(os.bytes_written, frame);
+    memcpy(frame + h, body, os.bytes_written);
+    p.appendReceived(frame, h + os.bytes_written);
+    return p.sessionState() == Protocol::State::Ready;
+}
+
+// A RawProtocol past its handshake.
+template <typename P = RawProtocol>
+static std::unique_ptr<P> readyRaw(uint32_t caps, size_t& received) {
+    auto p = startRaw<P>(caps, received);
+    return finishRaw(*p, caps) ? std::move(p) : nullptr;
+}
+
+// One framing and frame size: ns per frame, 0 if the session did not start.
+static double parseNs(uint32_t caps, size_t size, int n) {
+    size_t received = 0;
+    auto p = readyRaw(caps, received);
+    if (!p) return 0;
+    FrameCodec codec;
+    codec.setFraming((caps & linkcaps::FramingVarint) ? FrameCodec::Framing::Varint : FrameCodec::Framing::Byte);
+    std::vector<uint8_t> stream;
+    stream.reserve(n * (size + FrameCodec::kMaxHeaderLen));
+    for (int i = 0; i < n; i++) {
+        uint8_t header[FrameCodec::kMaxHeaderLen];
+        size_t h = codec.encodeHeader(size, header);
+        stream.insert(stream.end(), header, header + h);
+        stream.insert(stream.end(), size, static_cast<uint8_t>(i));
+    }
+
+    received = 0;
+    auto t0 = Clock::now();
+    for (size_t off = 0; off < stream.size(); off += 512) {
+        p->appendReceived(stream.data() + off, std::min<size_t>(512, stream.size() - off));
+    }
+    double ns = elapsedNs(t0) / n;
+    if (received != static_cast<size_t>(n)) printf("  lost frames: %zu of %d\n", received, n);
+    return ns;
+}
+
+// Sizes up to 255 bytes run in both framings; larger ones need varint.
+static void benchParse(int scale) {
+    printf("\nparse (appendReceived, 512-byte reads, raw session)\n");
+    printf("  %-8s %6s %10s %10s\n", "framing", "bytes", "ns/frame", "MB/s");
+    for (size_t size : kPayloads) {
+        const int n = scale * static_cast<int>(std::max<size_t>(500, (4u << 20) / size));
+        for (uint32_t framing : {0u, uint32_t(linkcaps::FramingVarint)}) {
+            if (!framing && size > FrameCodec::kMaxByteFrame) continue;
+            double ns = parseNs(linkcaps::CipherRaw | framing, size, n);
+            if (ns == 0) {
+                printf("  raw handshake failed\n");
+                return;
+            }
+            printf("  %-8s %6zu %10.0f %10.1f\n", framing ? "varint" : "byte", size, ns, size * 1e3 / ns);
+        }
+    }
+}
+
+// --- send gate -----------------------------------------------------------------
+
+// Can also call sendFrame() directly, past the state gate of Protocol::send().
+class GateProbe : public RawProtocol {
+public:
+    using RawProtocol::RawProtocol;
+    bool direct(const uint8_t* data, size_t len) { return sendFrame(data, len); }
+};
+
+// ns per 64-byte frame of a raw session whose write callback drops the bytes,
+// so what is left is framing plus the gate. The semaphore row models the
+// take/give pair every send used to make; on FreeRTOS those are kernel calls
+// and cost more than std::binary_semaphore does here.
+static void benchSendGate(int scale) {
+    printf("\nsend gate (raw session, 64-byte frames, write dropped, ns/frame)\n");
+    printf("  %-28s %10s %10s\n", "path", "ns/frame", "over direct");
+    size_t received = 0;
+    auto p = readyRaw<GateProbe>(linkcaps::CipherRaw, received);
+    if (!p) {
+        printf("  raw handshake failed\n");
+        return;
+    }
+    const std::vector<uint8_t> payload(64, 0x5A);
+    const int n = 2000000 * scale;
+    std::binary_semaphore sendReady(1);
+    auto time = [&](auto&& sendOne) {
+        auto t0 = Clock::now();
+        for (int i = 0; i < n; i++) sendOne();
+        return elapsedNs(t0) / n;
+    };
+    const double direct = time([&] { p->direct(payload.data(), payload.size()); });
+    const double gated = time([&] { p->send(payload.data(), payload.size()); });
+    const double semaphore = time([&] {
+        sendReady.acquire();
+        sendReady.release();
+        p->direct(payload.data(), payload.size());
+    });
+    printf("  %-28s %10.1f\n", "sendFrame", direct);
+    printf("  %-28s %10.1f %10.1f\n", "send, ready", gated, gated - direct);
+    printf("  %-28s %10.1f %10.1f\n", "take/give + sendFrame", semaphore, semaphore - direct);
+
+    // Before the handshake a send parks the frame instead of blocking.
+    double parkedNs = 0;
+    const int rounds = 2000 * scale;
+    for (int r = 0; r < rounds; r++) {
+        auto q = startRaw<GateProbe>(linkcaps::CipherRaw, received);
+        auto t0 = Clock::now();
+        for (int i = 0; i < 16; i++) q->send(payload.data(), payload.size());
+        parkedNs += elapsedNs(t0);
+        if (!finishRaw(*q, linkcaps::CipherRaw)) {
+            printf("  raw handshake failed\n");
+            return;
+        }
+    }
+    parkedNs /= rounds * 16.0;
+    printf("  %-28s %10.1f %10.1f\n", "send, parked", parkedNs, parkedNs - direct);
+}
+
+// --- metrics -------------------------------------------------------------------
+
+// The LinkMetrics updates of one frame out and one in, as FdConnection and the
+// protocols make them.
+static void frameMetrics(uint32_t size, int64_t enqueuedUs) {
+    LinkMetrics& m = linkMetrics();
+    m.noteSendQueueDepth(1);
+    LinkMetrics::add(m.framesOut);
+    LinkMetrics::add(m.bytesOut, size);
+    m.frameLatency.record(static_cast<uint32_t>(osport::nowUs() - enqueuedUs));
+    LinkMetrics::add(m.bytesIn, size);
+    LinkMetrics::add(m.framesIn);
+}
+
+// CPU per frame, so threads that share the counters are measured the same on
+// one core and many.
+static double metricsNs(int threads, int n) {
+    std::vector<std::thread> workers;
+    int64_t cpu0 = cpuNs();
+    for (int t = 0; t < threads; t++) {
+        workers.emplace_back([n] {
+            const int64_t enqueued = osport::nowUs();
+            for (int i = 0; i < n; i++) frameMetrics(64, enqueued);
+        });
+    }
+    for (auto& w : workers) w.join();
+    return double(cpuNs() - cpu0) / (double(n) * threads);
+}
+
+// CPU per 64-byte frame of a ready ephemeral AES-GCM session: enqueueSend,
+// seal and write on the device, read and open on the client in this process.
+static double framePathNs(int n) {
+    LoopbackServer loopback;
+    std::unique_ptr<FdConnection> conn;
+    loopback.setOnFdReady([&](int fd) {
+        conn = std::make_unique<FdConnection>(fd, CONFIG_PASSPHRASE);
+        return conn->start() == ESP_OK;
+    });
+    PeerLink peer(loopback.connect(LoopbackServer::Transport::SocketPair));
+    if (!peer.connect(linkcaps::CipherEphemeral, CONFIG_PASSPHRASE)) return 0;
+    while (!conn->isReady()) std::this_thread::yield();
+
+    int received = 0;
+    std::thread reader([&] {
+        std::vector<uint8_t> msg;
+        while (received < n && peer.receive(msg, 2000)) received++;
+    });
+    const std::vector<uint8_t> payload(64, 0x5A);
+    int64_t cpu0 = cpuNs();
+    for (int i = 0; i < n; i++) {
+        while (conn->sendQueueDepth() >= 8) std::this_thread::yield();
+        conn->enqueueSend(payload.data(), payload.size());
+    }
+    reader.join();
+    double ns = double(cpuNs() - cpu0) / n;
+    peer.close();
+    conn.reset();
+    return received == n ? ns : 0;
+}
+
+static void benchMetrics(int scale) {
+    printf("\nmetrics (updates of one frame out and in, CPU ns; overhead against a 64-byte frame end to end)\n");
+    printf("  %-8s %12s %12s %10s\n", "threads", "metrics ns", "frame ns", "overhead");
+    const double frameNs = framePathNs(5000 * scale);
+    if (frameNs == 0) {
+        printf("  frame path failed\n");
+        return;
+    }
+    for (int threads : {1, 2, 4}) {
+        double ns = metricsNs(threads, 500000 * scale);
+        double pct = 100 * ns / frameNs;
+        printf("  %-8d %12.1f %12.0f %9.2f%%%s\n", threads, ns, frameNs, pct, pct > 1 ? "  over the 1% target" : "");
+    }
+}
+
+// --- compression ---------------------------------------------------------------
+
+static const Cipher kDumpCaps[] = {
+    {"frames", linkcaps::CipherEphemeral | linkcaps::FramingVarint},
+    {"batching", linkcaps::CipherEphemeral | linkcaps::FramingVarint | linkcaps::Batching},
+    {"compression", linkcaps::CipherEphemeral | linkcaps::FramingVarint | linkcaps::Compression},
+    {"batching compression", linkcaps::CipherEphemeral | linkcaps::FramingVarint | linkcaps::Batching |
+                             linkcaps::Compression},
+};
+
+// The frames of the parameter dump on a fresh device that ParameterSync
+// would compress, as they arrive without Compression.
+static std::vector<std::vector<uint8_t>> compressibleFrames(uint32_t caps) {
+    HostDevice dev;
+    PeerLink peer(dev.connect());
+    std::vector<std::vector<uint8_t>> out;
+    if (!peer.connect(caps, CONFIG_PASSPHRASE)) return out;
+    const size_t params = dev.store.listMeta().size();
+    size_t infos = 0, values = 0;
+    std::vector<uint8_t> frame;
+    std::vector<std::vector<uint8_t>> msgs;
+    while ((infos < params || values < params) && peer.receive(frame, 2000)) {
+        msgs.clear();
+        if (!peermsg::unpack(frame.data(), frame.size(), msgs)) break;
+        for (const auto& msg : msgs) {
+            if (peermsg::type(msg) == MessageType::ParameterInfo) infos++;
+            else values++;
+        }
+        MessageType t = peermsg::type(frame);
+        if (t == MessageType::ParameterInfo || t == MessageType::String || t == MessageType::Batch) out.push_back(frame);
+    }
+    return out;
+}
+
+static void benchCompression(int scale) {
+    printf("\ncompression (parameter dump of an ephemeral varint session; guard line to its last message, us)\n");
+    printf("  %-22s %8s %7s %8s %8s %8s\n", "caps", "bytes", "ratio", "min", "median", "mean");
+    size_t plainBytes = 0;
+    for (const Cipher& c : kDumpCaps) {
+        std::vector<double> us;
+        size_t wire = 0;
+        for (int i = 0; i < 10 * scale; i++) {
+            HostDevice dev;
+            PeerLink peer(dev.connect());
+            auto t0 = Clock::now();
+            bool ok = peer.connect(c.caps, CONFIG_PASSPHRASE) &&
+                      peermsg::readDump(peer, dev.store.listMeta().size(), 2000, &wire);
+            double t = elapsedNs(t0) / 1000;
+            if (!ok) {
+                printf("  %-22s dump failed\n", c.name);
+                us.clear();
+                break;
+            }
+            us.push_back(t);
+        }
+        if (us.empty()) continue;
+        if (plainBytes == 0) plainBytes = wire;
+        Stats st = stats(us);
+        printf("  %-22s %8zu %6.0f%% %8.0f %8.0f %8.0f\n", c.name, wire, 100.0 * wire / plainBytes, st.min, st.median,
+               st.mean);
+    }
+
+    printf("\n  LZ alone on the compressible dump frames (CPU ns per frame)\n");
+    printf("  %-22s %6s %8s %8s %7s %10s %10s\n", "frames of", "count", "in B", "out B", "ratio", "encode", "decode");
+    for (int k = 0; k < 2; k++) {
+        const Cipher& c = kDumpCaps[k];
+        const auto frames = compressibleFrames(c.caps);
+        if (frames.empty()) {
+            printf("  %-22s no frames\n", c.name);
+            continue;
+        }
+        lz::Encoder encoder;
+        std::vector<std::vector<uint8_t>> packed(frames.size());
+        size_t in = 0, out = 0;
+        for (size_t i = 0; i < frames.size(); i++) {
+            packed[i].resize(FrameCodec::kMaxVarintFrame);
+            size_t n = encoder.compress(lz::dictionary(), frames[i].data(), frames[i].size(), packed[i].data(),
+                                        packed[i].size());
+            packed[i].resize(n);
+            in += frames[i].size();
+            out += n;
+        }
+        const int reps = std::max(1, int(20000 * scale / frames.size()));
+        std::vector<uint8_t> buf(FrameCodec::kMaxVarintFrame);
+        size_t sink = 0;
+        int64_t cpu0 = cpuNs();
+        for (int r = 0; r < reps; r++) {
+            for (const auto& f : frames) {
+                sink += encoder.compress(lz::dictionary(), f.data(), f.size(), buf.data(), buf.size());
+            }
+        }
+        double encodeNs = double(cpuNs() - cpu0) / (double(reps) * frames.size());
+        cpu0 = cpuNs();
+        for (int r = 0; r < reps; r++) {
+            for (const auto& p : packed) {
+                size_t n = 0;
+                lz::decompress(lz::dictionary(), p.data(), p.size(), buf.data(), buf.size(), n);
+                sink += n;
+            }
+        }
+        double decodeNs = double(cpuNs() - cpu0) / (double(reps) * frames.size());
+        if (sink == 0) printf("  (nothing encoded)\n");
+        printf("  %-22s %6zu %8zu %8zu %6.0f%% %10.0f %10.0f\n", c.name, frames.size(), in, out, 100.0 * out / in,
+               encodeNs, decodeNs);
+    }
+}
+
+// --- keypair pool --------------------------------------------------------------
+
+// P-256 sessions without the pool, then with it started and refilled between
+// sessions, as on an idle device: the first public key of a session (the
+// step the pool replaces), FdConnection construction and start(), and the
+// guard line to ready.
+static void benchKeypairPool(int iterations) {
+    printf("\nkeypair pool (P-256 ephemeral: first public key, connection start, guard line to ready in wall and CPU time; us)\n");
+    printf("  %-8s %-10s %8s %8s %8s %8s\n", "pool", "step", "min", "median", "mean", "max");
+    LoopbackServer loopback;
+    std::unique_ptr<FdConnection> conn;
+    double startUs = 0;
+    loopback.setOnFdReady([&](int fd) {
+        auto t0 = Clock::now();
+        conn = std::make_unique<FdConnection>(fd, CONFIG_PASSPHRASE);
+        bool ok = conn->start() == ESP_OK;
+        startUs = elapsedNs(t0) / 1000;
+        return ok;
+    });
+    for (bool pooled : {false, true}) {
+        if (pooled) keypairPool().start();
+        else keypairPool().stop();
+        std::vector<double> start, handshake, handshakeCpu;
+        for (int i = 0; i < iterations; i++) {
+            // Both runs idle before each session, so only the pool differs.
+            int64_t deadline = osport::nowUs() + 5000000;
+            osport::delayMs(5);
+            while (pooled && keypairPool().available() < KeypairPool::kCapacity && osport::nowUs() < deadline) {
+                osport::delayMs(1);
+            }
+            // On the device the refill task runs below the connection tasks;
+            // host threads have no such priorities, so the refill that take()
+            // triggers is held back until the session is ready.
+            if (pooled) keypairPool().stop();
+            PeerLink peer(loopback.connect(LoopbackServer::Transport::SocketPair));
+            // Wall time on the host is quantized by the read tasks' idle
+            // yields; process CPU over the handshake shows the work itself.
+            auto t0 = Clock::now();
+            int64_t c0 = cpuNs();
+            bool ok = peer.connect(linkcaps::CipherEphemeral | linkcaps::BinaryHandshake, CONFIG_PASSPHRASE);
+            double t = elapsedNs(t0) / 1000;
+            double c = double(cpuNs() - c0) / 1000;
+            if (pooled) keypairPool().start();
+            peer.close();
+            conn.reset();
+            if (!ok) {
+                printf("  handshake failed\n");
+                return;
+            }
+            start.push_back(startUs);
+            handshake.push_back(t);
+            handshakeCpu.push_back(c);
+        }
+        // The step the pool replaces: the first public key of a session.
+        std::vector<double> keypair;
+        for (int i = 0; i < iterations; i++) {
+            int64_t deadline = osport::nowUs() + 5000000;
+            while (pooled && keypairPool().available() < KeypairPool::kCapacity && osport::nowUs() < deadline) {
+                osport::delayMs(1);
+            }
+            CryptoEcdhAes crypto(CryptoEcdhAes::Mode::EPHEMERAL);
+            uint8_t key[CryptoEcdhAes::kMaxPublicKeyLen];
+            auto t0 = Clock::now();
+            bool ok = crypto.write_public_key(key, sizeof(key)) != 0;
+            keypair.push_back(elapsedNs(t0) / 1000);
+            if (!ok) {
+                printf("  keypair failed\n");
+                return;
+            }
+        }
+        const char* name = pooled ? "with" : "without";
+        Stats kp = stats(keypair);
+        printf("  %-8s %-10s %8.1f %8.1f %8.1f %8.1f\n", name, "keypair", kp.min, kp.median, kp.mean, kp.max);
+        name = "";
+        Stats st = stats(start);
+        Stats hs = stats(handshake);
+        printf("  %-8s %-10s %8.0f %8.0f %8.0f %8.0f\n", name, "start", st.min, st.median, st.mean, st.max);
+        Stats hc = stats(handshakeCpu);
+        printf("  %-8s %-10s %8.0f %8.0f %8.0f %8.0f\n", "", "handshake", hs.min, hs.median, hs.mean, hs.max);
+        printf("  %-8s %-10s %8.0f %8.0f %8.0f %8.0f\n", "", "hs cpu", hc.min, hc.median, hc.mean, hc.max);
+    }
+    keypairPool().stop();
+}
+
+// --- dispatch ------------------------------------------------------------------
+
+// ns per client message through MessageDispatcher and ParameterSync's
+// handlers, on the app task's path from DataReceived on, without a link:
+// replies go to a writer that only counts them. Sets write the value the
+// parameter already has, so the store returns before NVS and the broadcast.
+static void benchDispatch(int scale) {
+    printf("\ndispatch (MessageDispatcher + ParameterSync handlers, no link, ns/message)\n");
+    printf("  %-26s %10s\n", "message", "ns/msg");
+    paramstore::ParameterStore store;
+    ESP_ERROR_CHECK(store.begin());
+    store.setupDefaults();
+    ConnectionManager connections(1);
+    ParameterSync sync(store, connections);
+    MessageDispatcher dispatcher;
+    size_t replies = 0;
+    dispatcher.setWriter([](void* ctx, MessageDispatcher::ConnectionId, const uint8_t*, size_t) {
+        ++*static_cast<size_t*>(ctx);
+        return true;
+    }, &replies);
+    sync.registerHandlers(dispatcher);
+    dispatcher.on(MessageType::Message, [](void*, std::span<const uint8_t>, const MessageDispatcher::Reply&) {
+        return true;
+    }, nullptr);
+
+    const auto blink = static_cast<uint32_t>(paramstore::ParameterId::BlinkCount);
+    const auto name = static_cast<uint32_t>(paramstore::ParameterId::DeviceName);
+    const auto setBlink = peermsg::setInt(blink, store.getInt(paramstore::ParameterId::BlinkCount));
+    std::vector<uint8_t> batch{static_cast<uint8_t>(MessageType::Batch)};
+    for (int i = 0; i < 4; i++) {
+        batch.push_back(static_cast<uint8_t>(setBlink.size()));
+        batch.insert(batch.end(), setBlink.begin(), setBlink.end());
+    }
+    struct Row {
+        const char* name;
+        std::vector<uint8_t> message;
+    };
+    const Row rows[] = {
+        {"empty handler", {static_cast<uint8_t>(MessageType::Message)}},
+        {"unknown type", {0x3F, 1, 2, 3}},
+        {"SetInt", setBlink},
+        {"SetString", peermsg::setString(name, store.getString(paramstore::ParameterId::DeviceName).c_str())},
+        {"Batch of 4 SetInt", batch},
+        {"Get 1 id", {static_cast<uint8_t>(MessageType::Get), static_cast<uint8_t>(blink)}},
+    };
+    const auto reply = dispatcher.replyTo(1);
+    const int n = 200000 * scale;
+    for (const Row& row : rows) {
+        auto t0 = Clock::now();
+        for (int i = 0; i < n; i++) dispatcher.dispatch(row.message, reply);
+        printf("  %-26s %10.1f\n", row.name, elapsedNs(t0) / n);
+    }
+    if (replies != size_t(n)) printf("  %zu replies to %d gets\n", replies, n);
+}
+
+// --- random service ------------------------------------------------------------
+
+// What every CryptoEcdhAes constructor used to add before the shared
+// RandomService: its own entropy source and a freshly seeded CTR_DRBG.
+static double perConnectionSeedUs() {
+    mbedtls_entropy_context entropy;
+    mbedtls_ctr_drbg_context drbg;
+    auto t0 = Clock::now();
+    mbedtls_entropy_init(&entropy);
+    mbedtls_ctr_drbg_init(&drbg);
+    const char pers[] = "esp-conf";
+    int ret = mbedtls_ctr_drbg_seed(&drbg, mbedtls_entropy_func, &entropy,
+                                    reinterpret_cast<const unsigned char*>(pers), sizeof(pers) - 1);
+    mbedtls_ctr_drbg_free(&drbg);
+    mbedtls_entropy_free(&entropy);
+    return ret == 0 ? elapsedNs(t0) / 1000 : -1;
+}
+
+// CryptoEcdhAes construction with the shared service against the seeding it
+// replaced, the per-connection RAM both ways (sizes of this build's mbedTLS,
+// which differ from the device's), and fill() of one 12-byte IV from one and
+// from two threads.
+static void benchRandom(int scale) {
+    printf("\nrandom service (per connection, us)\n");
+    printf("  %-28s %8s %8s %8s %8s\n", "step", "min", "median", "mean", "max");
+    randomService();  // seeded once, before the first connection
+    const int iterations = 200 * scale;
+    std::vector<double> ctor, seed;
+    for (int i = 0; i < iterations; i++) {
+        auto t0 = Clock::now();
+        { CryptoEcdhAes crypto(CryptoEcdhAes::Mode::EPHEMERAL); }
+        ctor.push_back(elapsedNs(t0) / 1000);
+        double s = perConnectionSeedUs();
+        if (s < 0) {
+            printf("  ctr_drbg_seed failed\n");
+            return;
+        }
+        seed.push_back(s);
+    }
+    Stats c = stats(ctor);
+    Stats d = stats(seed);
+    printf("  %-28s %8.1f %8.1f %8.1f %8.1f\n", "CryptoEcdhAes(EPHEMERAL)", c.min, c.median, c.mean, c.max);
+    printf("  %-28s %8.1f %8.1f %8.1f %8.1f\n", "+ own entropy and DRBG seed", d.min, d.median, d.mean, d.max);
+
+    const size_t now = sizeof(CryptoEcdhAes) + 2 * sizeof(AesGcmAead);
+    const size_t before = now + sizeof(mbedtls_entropy_context) + sizeof(mbedtls_ctr_drbg_context);
+    printf("  RAM per connection: %zu bytes, %zu with its own entropy and DRBG\n", now, before);
+
+    printf("  %-28s %8s\n", "fill(12 bytes)", "ns");
+    const int n = 200000 * scale;
+    for (int threads : {1, 2}) {
+        std::vector<std::thread> workers;
+        auto t0 = Clock::now();
+        for (int t = 0; t < threads; t++) {
+            workers.emplace_back([n] {
+                uint8_t iv[12];
+                for (int i = 0; i < n; i++) randomService().fill(iv, sizeof(iv));
+            });
+        }
+        for (auto& w : workers) w.join();
+        printf("  %-28s %8.1f\n", threads == 1 ? "1 thread" : "2 threads, per call", elapsedNs(t0) / (double(n) * threads));
+    }
+}
+
+// --- curves --------------------------------------------------------------------
+
+// P-256 against X25519 for the ephemeral handshake: keypair generation and
+// shared secret plus session key on one end, in us, with the keypair pool
+// out of the way; then the bytes a whole handshake puts on the link, guard
+// line included, as the device's link metrics count them.
+static void benchCurves(int iterations) {
+    printf("\ncurves (ephemeral key exchange, one end, us)\n");
+    printf("  %-8s %-14s %8s %8s %8s %8s\n", "curve", "step", "min", "median", "mean", "max");
+    keypairPool().stop();
+    uint8_t key[CryptoEcdhAes::kMaxPublicKeyLen];
+    while (keypairPool().available() > 0) {
+        CryptoEcdhAes drain(CryptoEcdhAes::Mode::EPHEMERAL);
+        drain.write_public_key(key, sizeof(key));
+    }
+    struct Curve {
+        const char* name;
+        CryptoEcdhAes::Curve curve;
+    };
+    for (const Curve& c : {Curve{"p256", CryptoEcdhAes::Curve::P256}, Curve{"x25519", CryptoEcdhAes::Curve::X25519}}) {
+        std::vector<double> keygen, shared;
+        size_t keyLen = 0;
+        for (int i = 0; i < iterations; i++) {
+            CryptoEcdhAes device(CryptoEcdhAes::Mode::EPHEMERAL);
+            CryptoEcdhAes client(CryptoEcdhAes::Mode::EPHEMERAL);
+            uint8_t clientKey[CryptoEcdhAes::kMaxPublicKeyLen];
+            if (!device.select_curve(c.curve) || !client.select_curve(c.curve) ||
+                !client.write_public_key(clientKey, sizeof(clientKey))) {
+                printf("  %-8s keygen failed\n", c.name);
+                return;
+            }
+            auto t0 = Clock::now();
+            keyLen = device.write_public_key(key, sizeof(key));
+            keygen.push_back(elapsedNs(t0) / 1000);
+            t0 = Clock::now();
+            bool ok = keyLen && device.apply_other_public_raw(clientKey, keyLen);
+            shared.push_back(elapsedNs(t0) / 1000);
+            if (!ok) {
+                printf("  %-8s shared secret failed\n", c.name);
+                return;
+            }
+        }
+        Stats k = stats(keygen);
+        Stats x = stats(shared);
+        printf("  %-8s %-14s %8.1f %8.1f %8.1f %8.1f\n", c.name, "keygen", k.min, k.median, k.mean, k.max);
+        printf("  %-8s %-14s %8.1f %8.1f %8.1f %8.1f\n", "", "shared + key", x.min, x.median, x.mean, x.max);
+        printf("  %-8s %-14s %8zu bytes\n", "", "public key", keyLen);
+    }
+
+    printf("\n  %-24s %10s %10s\n", "handshake", "to device", "to client");
+    LoopbackServer loopback;
+    std::unique_ptr<FdConnection> conn;
+    loopback.setOnFdReady([&](int fd) {
+        conn = std::make_unique<FdConnection>(fd, CONFIG_PASSPHRASE);
+        return conn->start() == ESP_OK;
+    });
+    const Cipher handshakes[] = {
+        {"p256 protobuf", linkcaps::CipherEphemeral},
+        {"p256 binary", linkcaps::CipherEphemeral | linkcaps::BinaryHandshake},
+        {"x25519 binary", linkcaps::CipherEphemeral | linkcaps::BinaryHandshake | linkcaps::CurveX25519},
+    };
+    for (const Cipher& h : handshakes) {
+        PeerLink peer(loopback.connect(LoopbackServer::Transport::SocketPair));
+        uint32_t in0 = linkMetrics().bytesIn.load();
+        uint32_t out0 = linkMetrics().bytesOut.load();
+        bool ok = peer.connect(h.caps, CONFIG_PASSPHRASE);
+        while (ok && !conn->isReady()) osport::delayMs(1);
+        uint32_t in = linkMetrics().bytesIn.load() - in0;
+        uint32_t out = linkMetrics().bytesOut.load() - out0;
+        peer.close();
+        conn.reset();
+        if (!ok) {
+            printf("  %-24s handshake failed\n", h.name);
+            continue;
+        }
+        printf("  %-24s %10u %10u\n", h.name, (unsigned)in, (unsigned)out);
+    }
+}
+
+static bool wanted(int argc, char** argv, int first, const char* section) {
+    if (first >= argc) return true;
+    for (int i = first; i < argc; i++) {
+        if (std::string(argv[i]) == section) return true;
+    }
+    return false;
+}
+
+int main(int argc, char** argv) {
+    int scale = 1;
+    int first = 1;
+    if (argc > 1 && atoi(argv[1]) > 0) {
+        scale = atoi(argv[1]);
+        first = 2;
+    }
+    esp_log_level_set("*", ESP_LOG_ERROR);
+    if (wanted(argc, argv, first, "handshake")) benchHandshake(20 * scale);
+    if (wanted(argc, argv, first, "resume")) benchResume(20 * scale);
+    if (wanted(argc, argv, first, "seal")) benchSealOpen(scale);
+    if (wanted(argc, argv, first, "parse")) benchParse(scale);
+    if (wanted(argc, argv, first, "send")) benchSendGate(scale);
+    if (wanted(argc, argv, first, "metrics")) benchMetrics(scale);
+    if (wanted(argc, argv, first, "compress")) benchCompression(scale);
+    if (wanted(argc, argv, first, "pool")) benchKeypairPool(20 * scale);
+    if (wanted(argc, argv, first, "dispatch")) benchDispatch(scale);
+    if (wanted(argc, argv, first, "random")) benchRandom(scale);
+    if (wanted(argc, argv, first, "curves")) benchCurves(50 * scale);
+    return 0;
+}
@@ -0,0 +1,107 @@
+#pragma once
+#include <atomic>
+#include <string>
+#include <thread>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "connection_manager.hpp"
+#include "app_command_pool.hpp"
+#include "message_dispatcher.hpp"
+#include "parameter_store.cpp"
+#include "parameter_sync.cpp"
+#include "host/loopback_server.hpp"
+
+// The device side of main.cpp on Linux: ParameterStore with its defaults,
+// ParameterSync, MessageDispatcher and ConnectionManager, with an app thread
+// that handles AppCommands the way appTask does. Clients come in through a
+// LoopbackServer; connect() returns the client end of a new session.
+class HostDevice {
+public:
+    explicit HostDevice(size_t maxConnections = CONFIG_MAX_CLIENT_CONNECTIONS)
+        : connections(maxConnections), sync(store, connections) {
+        ESP_ERROR_CHECK(store.begin());
+        store.setupDefaults();
+
+        dispatcher.setWriter([](void* ctx, MessageDispatcher::ConnectionId to, const uint8_t* data, size_t len) {
+            return static_cast<HostDevice*>(ctx)->connections.sendTo(to, data, len);
+        }, this);
+        sync.registerHandlers(dispatcher);
+
+        connections.setGreeting(linkcaps::BinaryHandshake, sync.schemaHashMessage());
+        connections.setReadyCallback([this](ConnectionManager::ConnectionId id) {
+            commands.post(AppCommandType::SendAllParameters, id);
+        });
+        connections.setCloseCallback([this](ConnectionManager::ConnectionId id) {
+            commands.post(AppCommandType::CleanupConnection, id);
+        });
+        connections.setDataCallback([this](ConnectionManager::ConnectionId id, const uint8_t* data, size_t len) {
+            commands.post(commands.acquire(AppCommandType::DataReceived, id, data, len));
+        });
+
+        loopback.setOnFdReady([this](int fd) {
+            lastId = connections.add(fd, store.getString(paramstore::ParameterId::PassPhrase));
+            return lastId != ConnectionManager::kNoConnection;
+        });
+
+        commands.start();
+        running_ = true;
+        appThread_ = std::thread([this] { appLoop(); });
+    }
+
+    ~HostDevice() {
+        loopback.stop();
+        connections.stopAll();
+        running_ = false;
+        appThread_.join();
+    }
+
+    HostDevice(const HostDevice&) = delete;
+    HostDevice& operator=(const HostDevice&) = delete;
+
+    // Client fd of a new socketpair session, -1 on failure. lastId tells
+    // which connection it became (kNoConnection when it was rejected).
+    int connect() { return loopback.connect(LoopbackServer::Transport::SocketPair); }
+
+    // Waits until `count` sessions completed the handshake.
+    bool waitReady(size_t count, uint32_t timeoutMs = 5000) const {
+        int64_t deadline = osport::nowUs() + int64_t(timeoutMs) * 1000;
+        while (connections.readyCount() < count) {
+            if (osport::nowUs() > deadline) return false;
+            osport::delayMs(1);
+        }
+        return true;
+    }
+
+    paramstore::ParameterStore store;
+    ConnectionManager connections;
+    ParameterSync sync;
+    MessageDispatcher dispatcher;
+    AppCommandPool commands;
+    LoopbackServer loopback;
+    std::atomic<ConnectionManager::ConnectionId> lastId{ConnectionManager::kNoConnection};
+
+private:
+    void appLoop() {
+        while (running_) {
+            AppCommandPool::Ptr cmd = commands.receive(50);
+            if (!cmd) continue;
+            switch (cmd->type) {
+                case AppCommandType::CleanupConnection:
+                    connections.remove(cmd->connId);
+                    break;
+                case AppCommandType::DataReceived:
+                    dispatcher.dispatch(cmd->bytes(), dispatcher.replyTo(cmd->connId));
+                    break;
+                case AppCommandType::SendAllParameters:
+                    sync.sendAllParametersInfo(cmd->connId);
+                    sync.sendAllParameters(cmd->connId);
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+
+    std::atomic<bool> running_{false};
+    std::thread appThread_;
+};
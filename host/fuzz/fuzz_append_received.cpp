@@ -0,0 +1,41 @@
+// Protocol::appendReceived with arbitrary byte streams.
+//
+// Input: [selector][len][bytes]...[len][bytes]. The selector picks the session
+// (see fuzz::offeredCaps); bit 6 starts a raw session with a valid hello, so
+// the stream lands in an established session instead of the handshake. Each
+// chunk is one read of len + 1 bytes, the way FdConnection feeds the decoder.
+#include <algorithm>
+#include <cstring>
+#include "fuzz/fuzz_session.hpp"
+#include "pb_encode.h"
+#include "proto-model/Handshake.pb.h"
+#include "protocol/frame_codec.hpp"
+
+static void sendRawHello(Protocol& p) {
+    pModel_HandshakeResponse hello = pModel_HandshakeResponse_init_zero;
+    strncpy(hello.text, CONFIG_PASSPHRASE, sizeof(hello.text) - 1);
+    uint8_t frame[1 + pModel_HandshakeResponse_size];
+    pb_ostream_t os = pb_ostream_from_buffer(frame + 1, sizeof(frame) - 1);
+    if (!pb_encode(&os, pModel_HandshakeResponse_fields, &hello)) return;
+    // Well under 128 bytes: the same single length byte in both framings.
+    frame[0] = static_cast<uint8_t>(os.bytes_written);
+    p.appendReceived(frame, 1 + os.bytes_written);
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size == 0) return 0;
+    const uint8_t selector = data[0];
+    const bool established = selector & (1u << 6);
+    auto p = fuzz::startSession(established ? selector & ~3u : selector);
+    if (!p) return 0;
+    if (established) sendRawHello(*p);
+    data++;
+    size--;
+    while (size > 1) {
+        size_t n = std::min<size_t>(size_t(data[0]) + 1, size - 1);
+        p->appendReceived(data + 1, n);
+        data += 1 + n;
+        size -= 1 + n;
+    }
+    return 0;
+}
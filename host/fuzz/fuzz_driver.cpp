@@ -0,0 +1,69 @@
+// Runs a fuzz target without libFuzzer (GCC, or clang without the runtime):
+//
+//   fuzz_x FILE|DIR...   replays corpus files or crash reproducers
+//   fuzz_x [-runs=N]     N pseudo-random inputs, default 1000, same every run
+//
+// Only crashes and sanitizer reports count; there is no coverage feedback.
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <vector>
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size);
+
+static void runFile(const std::filesystem::path& path) {
+    std::ifstream in(path, std::ios::binary);
+    std::vector<uint8_t> data((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+    LLVMFuzzerTestOneInput(data.data(), data.size());
+}
+
+// xorshift64: the same inputs on every run and machine.
+static uint64_t next(uint64_t& s) {
+    s ^= s << 13;
+    s ^= s >> 7;
+    s ^= s << 17;
+    return s;
+}
+
+int main(int argc, char** argv) {
+    long runs = 1000;
+    size_t files = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "-runs=", 6) == 0) {
+            runs = atol(argv[i] + 6);
+            continue;
+        }
+        std::filesystem::path path(argv[i]);
+        if (std::filesystem::is_directory(path)) {
+            for (auto& entry : std::filesystem::directory_iterator(path)) {
+                if (entry.is_regular_file()) {
+                    runFile(entry.path());
+                    files++;
+                }
+            }
+        } else {
+            runFile(path);
+            files++;
+        }
+    }
+    if (files) {
+        fprintf(stderr, "%zu input(s) replayed\n", files);
+        return 0;
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    std::vector<uint8_t> data;
+    for (long r = 0; r < runs; r++) {
+        // Mostly short inputs, some longer than a byte-framed frame.
+        size_t size = next(seed) % ((r % 8) ? 300 : 5000);
+        data.resize(size);
+        for (auto& b : data) b = static_cast<uint8_t>(next(seed));
+        LLVMFuzzerTestOneInput(data.data(), data.size());
+    }
+    fprintf(stderr, "%ld random input(s) run\n", runs);
+    return 0;
+}
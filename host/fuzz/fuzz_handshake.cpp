@@ -0,0 +1,71 @@
+// The handshake parsers (RawProtocol, PassphraseAesProtocol and
+// EcdhAesProtocol, protobuf and binary hello) with an arbitrary first frame.
+//
+// Input: [selector][payload]. The selector picks the session (see
+// fuzz::offeredCaps). Bit 6 binds the payload to the right passphrase so it
+// gets past that check: for the ephemeral hello it becomes text2 of a
+// HandshakeRequest, for the binary hello [flags][key or resume offer].
+// Passphrase sessions get the frame sealed with the caps-bound passphrase
+// key, so parseHandshake sees the payload and not a failed decryption.
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#include "crypto_ecdh_aes.hpp"
+#include "fuzz/fuzz_session.hpp"
+#include "pb_encode.h"
+#include "proto-model/Handshake.pb.h"
+#include "protocol/frame_codec.hpp"
+
+static std::vector<uint8_t> boundHello(uint32_t caps, const uint8_t* data, size_t size) {
+    const std::string pass = CONFIG_PASSPHRASE;
+    std::vector<uint8_t> out;
+    if (caps & linkcaps::BinaryHandshake) {
+        out = {1, size ? data[0] : uint8_t(0), static_cast<uint8_t>(pass.size())};
+        out.insert(out.end(), pass.begin(), pass.end());
+        if (size) out.insert(out.end(), data + 1, data + size);
+        return out;
+    }
+    pModel_HandshakeRequest req = pModel_HandshakeRequest_init_zero;
+    strncpy(req.text, pass.c_str(), sizeof(req.text) - 1);
+    memcpy(req.text2, data, std::min(size, sizeof(req.text2) - 1));
+    out.resize(pModel_HandshakeRequest_size);
+    pb_ostream_t os = pb_ostream_from_buffer(out.data(), out.size());
+    if (!pb_encode(&os, pModel_HandshakeRequest_fields, &req)) return {};
+    out.resize(os.bytes_written);
+    return out;
+}
+
+static bool sealWithPassphrase(uint32_t offered, uint32_t caps, std::vector<uint8_t>& payload) {
+    CryptoEcdhAes crypto(CryptoEcdhAes::Mode::PASSPHRASE, CONFIG_PASSPHRASE);
+    if (!crypto.select_aead((caps & linkcaps::ChaChaPoly) ? Aead::Kind::ChaChaPoly : Aead::Kind::AesGcm) ||
+        !crypto.bind_caps(offered, caps)) {
+        return false;
+    }
+    std::vector<uint8_t> sealed(payload.size() + crypto.overhead());
+    std::copy(payload.begin(), payload.end(), sealed.begin() + crypto.nonce_field_len());
+    if (!crypto.seal(sealed.data(), payload.size())) return false;
+    payload.swap(sealed);
+    return true;
+}
+
+extern "C" int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (size == 0) return 0;
+    const uint8_t selector = data[0];
+    auto p = fuzz::startSession(selector);
+    if (!p) return 0;
+    const uint32_t caps = p->caps();
+
+    std::vector<uint8_t> payload;
+    if ((selector & (1u << 6)) && (caps & linkcaps::CipherEphemeral)) payload = boundHello(caps, data + 1, size - 1);
+    else payload.assign(data + 1, data + size);
+    if ((caps & linkcaps::CipherPassphrase) && !sealWithPassphrase(fuzz::offeredCaps(selector), caps, payload)) return 0;
+
+    FrameCodec codec;
+    codec.setFraming((caps & linkcaps::FramingVarint) ? FrameCodec::Framing::Varint : FrameCodec::Framing::Byte);
+    payload.resize(std::min(payload.size(), codec.maxFrame()));
+    uint8_t header[FrameCodec::kMaxHeaderLen];
+    size_t h = codec.encodeHeader(payload.size(), header);
+    p->appendReceived(header, h);
+    p->appendReceived(payload.data(), payload.size());
+    return 0;
+}
@@ -0,0 +1,48 @@
+#pragma once
+#include <cstdint>
+#include <memory>
+#include <span>
+#include "esp_log.h"
+#include "protocol/config_protocol.hpp"
+#include "protocol/link_caps.hpp"
+#include "protocol/protocol.hpp"
+#include "sdkconfig.h"
+
+// Device-side sessions for the fuzz targets: the first input byte picks what
+// the client offered on its guard line, the device accepts it as
+// FdConnection would, and the protocol starts with writes and received
+// messages discarded. No FdConnection or threads, so a run is one input.
+namespace fuzz {
+
+//   bits 0-1  cipher: raw, passphrase, ephemeral, ephemeral binary hello
+//   bit 2     varint framing
+//   bit 3     ChaCha20-Poly1305
+//   bit 4     counter nonces
+//   bit 5     X25519
+//   bit 7     session resumption
+// Bit 6 is left to each target.
+inline uint32_t offeredCaps(uint8_t selector) {
+    static constexpr uint32_t kCiphers[] = {linkcaps::CipherRaw, linkcaps::CipherPassphrase, linkcaps::CipherEphemeral,
+                                            linkcaps::CipherEphemeral | linkcaps::BinaryHandshake};
+    uint32_t caps = kCiphers[selector & 3];
+    if (selector & (1u << 2)) caps |= linkcaps::FramingVarint;
+    if (selector & (1u << 3)) caps |= linkcaps::ChaChaPoly;
+    if (selector & (1u << 4)) caps |= linkcaps::CounterNonce;
+    if (selector & (1u << 5)) caps |= linkcaps::CurveX25519;
+    if (selector & (1u << 7)) caps |= linkcaps::Resume;
+    return caps;
+}
+
+inline std::unique_ptr<Protocol> startSession(uint8_t selector) {
+    static const bool quiet = (esp_log_level_set("*", ESP_LOG_NONE), true);
+    (void)quiet;
+    const uint32_t offered = offeredCaps(selector);
+    uint32_t accepted = acceptCaps(offered, true);
+    std::unique_ptr<Protocol> p = createProtocol(accepted, CONFIG_PASSPHRASE);
+    if (!p) return nullptr;
+    p->negotiate(offered, accepted, true);
+    p->init([](const uint8_t*, size_t) {}, [](std::span<const uint8_t>) {});
+    return p;
+}
+
+} // namespace fuzz
@@ -0,0 +1,327 @@
+#include "peer/peer_link.hpp"
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <poll.h>
+#include <unistd.h>
+#include "esp_log.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/platform_util.h"
+#include "os_port.hpp"
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "proto-model/Handshake.pb.h"
+
+static const char* TAG = "PeerLink";
+
+// Binary hello of linkcaps::BinaryHandshake and the resume offer, see EcdhAesProtocol.
+static constexpr uint8_t kBinaryVersion = 1;
+static constexpr uint8_t kFlagResume = 1u << 0;
+static constexpr uint8_t kFlagTicket = 1u << 1;
+static constexpr size_t kTicketLen = 16;
+static constexpr size_t kNonceLen = 16;
+static constexpr const char* kResumePrefix = "resume:";
+
+static bool decodeBase64(const char* in, uint8_t* out, size_t outLen) {
+    size_t olen = 0;
+    return mbedtls_base64_decode(out, outLen, &olen, reinterpret_cast<const unsigned char*>(in), strlen(in)) == 0 &&
+           olen == outLen;
+}
+
+static size_t encodeBase64(const uint8_t* in, size_t inLen, char* out, size_t outLen) {
+    size_t olen = 0;
+    if (mbedtls_base64_encode(reinterpret_cast<unsigned char*>(out), outLen, &olen, in, inLen) != 0) return 0;
+    return olen;
+}
+
+PeerLink::PeerLink(int fd) : _fd(fd) {}
+
+PeerLink::~PeerLink() {
+    close();
+    mbedtls_platform_zeroize(_ticket.secret.data(), _ticket.secret.size());
+    mbedtls_platform_zeroize(_resume.secret.data(), _resume.secret.size());
+}
+
+void PeerLink::close() {
+    if (_fd >= 0) {
+        ::close(_fd);
+        _fd = -1;
+    }
+}
+
+bool PeerLink::connect(uint32_t caps, const std::string& passPhrase, uint32_t timeoutMs) {
+    char guard[32];
+    int n = caps ? snprintf(guard, sizeof(guard), "guard:%x\n", (unsigned)caps) : snprintf(guard, sizeof(guard), "guard\n");
+    if (!writeAll(reinterpret_cast<const uint8_t*>(guard), n)) return false;
+
+    uint8_t headerLen = 0;
+    if (!readBytes(&headerLen, 1, timeoutMs)) {
+        ESP_LOGE(TAG, "No session header");
+        return false;
+    }
+    uint8_t header[4] = {};
+    if (headerLen != 0 && (headerLen != sizeof(header) || !readBytes(header, sizeof(header), timeoutMs))) {
+        ESP_LOGE(TAG, "Bad session header length %u", (unsigned)headerLen);
+        return false;
+    }
+    // A plain guard line keeps the device's default cipher, which the header does not name.
+    _caps = headerLen ? header[0] | (header[1] << 8) | (header[2] << 16) | (uint32_t(header[3]) << 24)
+                      : (caps & linkcaps::kCipherMask);
+    _offered = headerLen ? caps : 0;
+    _resumed = false;
+    _codec.setFraming((_caps & linkcaps::FramingVarint) ? FrameCodec::Framing::Varint : FrameCodec::Framing::Byte);
+
+    if (_caps & linkcaps::CipherRaw) return handshakeRaw(passPhrase, timeoutMs);
+    if (_caps & linkcaps::CipherPassphrase) return handshakePassphrase(passPhrase, timeoutMs);
+    if (_caps & linkcaps::CipherEphemeral) {
+        return (_caps & linkcaps::BinaryHandshake) ? handshakeBinary(passPhrase, timeoutMs)
+                                                   : handshakeEphemeral(passPhrase, timeoutMs);
+    }
+    ESP_LOGE(TAG, "Device accepted no cipher (caps=0x%08x)", (unsigned)_caps);
+    return false;
+}
+
+bool PeerLink::handshakeRaw(const std::string& passPhrase, uint32_t timeoutMs) {
+    pModel_HandshakeResponse hello = pModel_HandshakeResponse_init_zero;
+    strncpy(hello.text, passPhrase.c_str(), sizeof(hello.text) - 1);
+    uint8_t buffer[pModel_HandshakeRequest_size];
+    pb_ostream_t os = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    if (!pb_encode(&os, pModel_HandshakeResponse_fields, &hello) || !writeFrame(buffer, os.bytes_written)) return false;
+
+    std::vector<uint8_t> frame;
+    if (!readFrame(frame, timeoutMs)) return false;
+    pModel_HandshakeRequest reply = pModel_HandshakeRequest_init_zero;
+    pb_istream_t is = pb_istream_from_buffer(frame.data(), frame.size());
+    return pb_decode(&is, pModel_HandshakeRequest_fields, &reply) && strcmp(reply.text, "HANDSHAKE") == 0;
+}
+
+bool PeerLink::handshakePassphrase(const std::string& passPhrase, uint32_t timeoutMs) {
+    _crypto = std::make_unique<CryptoEcdhAes>(CryptoEcdhAes::Mode::PASSPHRASE, passPhrase.c_str());
+    if (!_crypto->select_aead((_caps & linkcaps::ChaChaPoly) ? Aead::Kind::ChaChaPoly : Aead::Kind::AesGcm) ||
+        !bindCaps()) {
+        return false;
+    }
+    _encrypted = true;
+
+    pModel_HandshakeResponse hello = pModel_HandshakeResponse_init_zero;
+    strncpy(hello.text, "HANDSHAKE", sizeof(hello.text) - 1);
+    uint8_t buffer[pModel_HandshakeRequest_size];
+    pb_ostream_t os = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    if (!pb_encode(&os, pModel_HandshakeResponse_fields, &hello) || !send(buffer, os.bytes_written)) return false;
+
+    std::vector<uint8_t> msg;
+    if (!receive(msg, timeoutMs)) return false;
+    pModel_HandshakeRequest reply = pModel_HandshakeRequest_init_zero;
+    pb_istream_t is = pb_istream_from_buffer(msg.data(), msg.size());
+    return pb_decode(&is, pModel_HandshakeRequest_fields, &reply) && strcmp(reply.text, "HANDSHAKE") == 0;
+}
+
+bool PeerLink::handshakeEphemeral(const std::string& passPhrase, uint32_t timeoutMs) {
+    _crypto = std::make_unique<CryptoEcdhAes>(CryptoEcdhAes::Mode::EPHEMERAL);
+    _crypto->select_curve((_caps & linkcaps::CurveX25519) ? CryptoEcdhAes::Curve::X25519 : CryptoEcdhAes::Curve::P256);
+    if (!_crypto->select_aead((_caps & linkcaps::ChaChaPoly) ? Aead::Kind::ChaChaPoly : Aead::Kind::AesGcm)) return false;
+
+    pModel_HandshakeRequest hello = pModel_HandshakeRequest_init_zero;
+    strncpy(hello.text, passPhrase.c_str(), sizeof(hello.text) - 1);
+    uint8_t clientNonce[kNonceLen];
+    if (offersResume()) {
+        _crypto->random_bytes(clientNonce, sizeof(clientNonce));
+        size_t n = strlen(kResumePrefix);
+        memcpy(hello.text2, kResumePrefix, n);
+        n += encodeBase64(_resume.id.data(), _resume.id.size(), hello.text2 + n, sizeof(hello.text2) - n);
+        hello.text2[n++] = ':';
+        encodeBase64(clientNonce, sizeof(clientNonce), hello.text2 + n, sizeof(hello.text2) - n);
+    } else {
+        _crypto->get_encoded_public_key(hello.text2, sizeof(hello.text2));
+    }
+    uint8_t buffer[pModel_HandshakeRequest_size];
+    pb_ostream_t os = pb_ostream_from_buffer(buffer, sizeof(buffer));
+    if (!pb_encode(&os, pModel_HandshakeRequest_fields, &hello) || !writeFrame(buffer, os.bytes_written)) return false;
+
+    std::vector<uint8_t> frame;
+    if (!readFrame(frame, timeoutMs)) return false;
+    pModel_HandshakeRequest reply = pModel_HandshakeRequest_init_zero;
+    pb_istream_t is = pb_istream_from_buffer(frame.data(), frame.size());
+    if (!pb_decode(&is, pModel_HandshakeRequest_fields, &reply)) {
+        ESP_LOGE(TAG, "Bad handshake reply (%u bytes)", (unsigned)frame.size());
+        return false;
+    }
+    if (offersResume()) {
+        uint8_t deviceNonce[kNonceLen];
+        if (strncmp(reply.text2, kResumePrefix, strlen(kResumePrefix)) != 0 ||
+            !decodeBase64(reply.text2 + strlen(kResumePrefix), deviceNonce, sizeof(deviceNonce)) ||
+            !applyResumed(clientNonce, deviceNonce)) {
+            return false;
+        }
+    } else {
+        std::vector<uint8_t> devicePublic(reply.text2, reply.text2 + strlen(reply.text2));
+        if (!_crypto->apply_other_public(devicePublic)) return false;
+        uint8_t id[kTicketLen];
+        if (reply.text[0] && decodeBase64(reply.text, id, sizeof(id))) keepTicket(id);
+    }
+    if (!bindCaps()) return false;
+    if ((_caps & linkcaps::CounterNonce) && !_crypto->enable_counter_nonces(CryptoEcdhAes::Side::Client)) return false;
+    _encrypted = true;
+    return true;
+}
+
+bool PeerLink::handshakeBinary(const std::string& passPhrase, uint32_t timeoutMs) {
+    _crypto = std::make_unique<CryptoEcdhAes>(CryptoEcdhAes::Mode::EPHEMERAL);
+    _crypto->select_curve((_caps & linkcaps::CurveX25519) ? CryptoEcdhAes::Curve::X25519 : CryptoEcdhAes::Curve::P256);
+    if (!_crypto->select_aead((_caps & linkcaps::ChaChaPoly) ? Aead::Kind::ChaChaPoly : Aead::Kind::AesGcm)) return false;
+
+    uint8_t hello[3 + 255 + CryptoEcdhAes::kMaxPublicKeyLen];
+    if (passPhrase.size() > 255) return false;
+    const bool resume = offersResume();
+    size_t n = 0;
+    hello[n++] = kBinaryVersion;
+    hello[n++] = resume ? kFlagResume : 0;
+    hello[n++] = static_cast<uint8_t>(passPhrase.size());
+    memcpy(hello + n, passPhrase.data(), passPhrase.size());
+    n += passPhrase.size();
+    uint8_t clientNonce[kNonceLen];
+    if (resume) {
+        _crypto->random_bytes(clientNonce, sizeof(clientNonce));
+        memcpy(hello + n, _resume.id.data(), _resume.id.size());
+        memcpy(hello + n + _resume.id.size(), clientNonce, sizeof(clientNonce));
+        n += _resume.id.size() + sizeof(clientNonce);
+    } else {
+        size_t keyLen = _crypto->write_public_key(hello + n, sizeof(hello) - n);
+        if (keyLen == 0) return false;
+        n += keyLen;
+    }
+    if (!writeFrame(hello, n)) return false;
+
+    std::vector<uint8_t> reply;
+    if (!readFrame(reply, timeoutMs) || reply.size() < 2 || reply[0] != kBinaryVersion) return false;
+    const bool ticket = reply[1] & kFlagTicket;
+    size_t pos = 2 + (ticket ? kTicketLen : 0);
+    if (reply.size() <= pos) return false;
+    if (resume) {
+        if (!(reply[1] & kFlagResume) || reply.size() - pos != kNonceLen ||
+            !applyResumed(clientNonce, reply.data() + pos)) {
+            return false;
+        }
+    } else {
+        if (!_crypto->apply_other_public_raw(reply.data() + pos, reply.size() - pos)) return false;
+        if (ticket) keepTicket(reply.data() + 2);
+    }
+    if (!bindCaps()) return false;
+    if ((_caps & linkcaps::CounterNonce) && !_crypto->enable_counter_nonces(CryptoEcdhAes::Side::Client)) return false;
+    _encrypted = true;
+    return true;
+}
+
+bool PeerLink::applyResumed(const uint8_t* clientNonce, const uint8_t* deviceNonce) {
+    uint8_t salt[2 * kNonceLen];
+    memcpy(salt, clientNonce, kNonceLen);
+    memcpy(salt + kNonceLen, deviceNonce, kNonceLen);
+    if (!_crypto->apply_resumed_key(_resume.secret.data(), _resume.secret.size(), salt, sizeof(salt))) return false;
+    _resumed = true;
+    return true;
+}
+
+void PeerLink::keepTicket(const uint8_t* id) {
+    memcpy(_ticket.id.data(), id, _ticket.id.size());
+    _ticket.valid = _crypto->export_resumption_secret(_ticket.secret.data(), _ticket.secret.size());
+}
+
+bool PeerLink::bindCaps() {
+    return !_offered || _crypto->bind_caps(_offered, _caps);
+}
+
+bool PeerLink::send(const uint8_t* data, size_t len) {
+    return _encrypted ? sealAndWrite(data, len) : writeFrame(data, len);
+}
+
+bool PeerLink::receive(std::vector<uint8_t>& msg, uint32_t timeoutMs) {
+    if (!readFrame(msg, timeoutMs)) return false;
+    return !_encrypted || openFrame(msg);
+}
+
+bool PeerLink::writeAll(const uint8_t* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = ::write(_fd, data, len);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) {
+            ESP_LOGE(TAG, "write failed: errno=%d", errno);
+            return false;
+        }
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool PeerLink::writeFrame(const uint8_t* data, size_t len) {
+    uint8_t frame[FrameCodec::kMaxHeaderLen + FrameCodec::kMaxVarintFrame];
+    size_t headerLen = _codec.encodeHeader(len, frame);
+    if (headerLen == 0) return false;
+    memcpy(frame + headerLen, data, len);
+    return writeAll(frame, headerLen + len);
+}
+
+size_t PeerLink::frameAad(size_t sealedLen, uint8_t* out) const {
+    return (_caps & linkcaps::CounterNonce) ? _codec.encodeHeader(sealedLen, out) : 0;
+}
+
+bool PeerLink::sealAndWrite(const uint8_t* data, size_t len) {
+    std::vector<uint8_t> buf(len + _crypto->overhead());
+    memcpy(buf.data() + _crypto->nonce_field_len(), data, len);
+    uint8_t aad[FrameCodec::kMaxHeaderLen];
+    size_t aadLen = frameAad(buf.size(), aad);
+    return _crypto->seal(buf.data(), len, aad, aadLen) && writeFrame(buf.data(), buf.size());
+}
+
+bool PeerLink::openFrame(std::vector<uint8_t>& frame) {
+    uint8_t aad[FrameCodec::kMaxHeaderLen];
+    size_t aadLen = frameAad(frame.size(), aad);
+    uint8_t* plain = nullptr;
+    size_t plainLen = 0;
+    if (!_crypto->open(frame.data(), frame.size(), plain, plainLen, aad, aadLen)) return false;
+    frame.assign(plain, plain + plainLen);
+    return true;
+}
+
+bool PeerLink::readMore(uint32_t timeoutMs) {
+    pollfd pfd{_fd, POLLIN, 0};
+    int ready = ::poll(&pfd, 1, timeoutMs == osport::kWaitForever ? -1 : static_cast<int>(timeoutMs));
+    if (ready <= 0) return false;
+    uint8_t buf[1024];
+    ssize_t n = ::read(_fd, buf, sizeof(buf));
+    if (n <= 0) return false;
+    _rx.insert(_rx.end(), buf, buf + n);
+    return true;
+}
+
+bool PeerLink::readBytes(uint8_t* out, size_t len, uint32_t timeoutMs) {
+    int64_t deadline = osport::nowUs() + int64_t(timeoutMs) * 1000;
+    while (_rx.size() < len) {
+        int64_t left = deadline - osport::nowUs();
+        if (left <= 0 || !readMore(static_cast<uint32_t>(left / 1000) + 1)) return false;
+    }
+    memcpy(out, _rx.data(), len);
+    _rx.erase(_rx.begin(), _rx.begin() + len);
+    return true;
+}
+
+bool PeerLink::readFrame(std::vector<uint8_t>& frame, uint32_t timeoutMs) {
+    int64_t deadline = osport::nowUs() + int64_t(timeoutMs) * 1000;
+    for (;;) {
+        size_t frameLen = 0;
+        size_t headerLen = 0;
+        auto res = _codec.decodeHeader(_rx.data(), _rx.size(), frameLen, headerLen);
+        if (res == FrameCodec::Result::Error) {
+            ESP_LOGE(TAG, "Malformed frame length");
+            return false;
+        }
+        if (res == FrameCodec::Result::Ok && _rx.size() >= headerLen + frameLen) {
+            frame.assign(_rx.begin() + headerLen, _rx.begin() + headerLen + frameLen);
+            _rx.erase(_rx.begin(), _rx.begin() + headerLen + frameLen);
+            return true;
+        }
+        int64_t left = deadline - osport::nowUs();
+        if (left <= 0 || !readMore(static_cast<uint32_t>(left / 1000) + 1)) return false;
+    }
+}
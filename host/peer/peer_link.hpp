@@ -0,0 +1,90 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+#include "crypto_ecdh_aes.hpp"
+#include "protocol/frame_codec.hpp"
+#include "protocol/link_caps.hpp"
+
+// Client side of the link over a connected fd: guard line, session header,
+// the handshake of the accepted cipher, then framed and sealed messages. It
+// reuses the device's FrameCodec and CryptoEcdhAes, so host tests can drive
+// FdConnection and the protocols end to end over a LoopbackServer fd.
+class PeerLink {
+public:
+    // Takes ownership of fd.
+    explicit PeerLink(int fd);
+    ~PeerLink();
+
+    PeerLink(const PeerLink&) = delete;
+    PeerLink& operator=(const PeerLink&) = delete;
+
+    // Sends "guard:<caps>" (a plain "guard" when caps is 0), reads the
+    // session header and completes the handshake of the accepted cipher.
+    bool connect(uint32_t caps, const std::string& passPhrase, uint32_t timeoutMs = 5000);
+
+    // Ticket the device issued in the last full ephemeral handshake that
+    // offered linkcaps::Resume; `valid` is false if there was none.
+    struct Ticket {
+        std::array<uint8_t, 16> id{};
+        std::array<uint8_t, 32> secret{};
+        bool valid = false;
+    };
+    const Ticket& ticket() const { return _ticket; }
+    // A connect() offering linkcaps::Resume redeems `t` instead of running ECDH.
+    void resumeWith(const Ticket& t) { _resume = t; }
+    // True if the last connect() was resumed from a ticket.
+    bool resumed() const { return _resumed; }
+
+    // Capabilities the device accepted; 0 before connect().
+    uint32_t caps() const { return _caps; }
+    int fd() const { return _fd; }
+
+    // Writes one message as one frame, sealed when the cipher encrypts.
+    bool send(const uint8_t* data, size_t len);
+    bool send(const std::vector<uint8_t>& msg) { return send(msg.data(), msg.size()); }
+    // Next message of the session, opened when the cipher encrypts. False on
+    // timeout, a closed fd or a frame that does not authenticate.
+    bool receive(std::vector<uint8_t>& msg, uint32_t timeoutMs);
+
+    void close();
+
+private:
+    bool writeAll(const uint8_t* data, size_t len);
+    bool writeFrame(const uint8_t* data, size_t len);
+    bool sealAndWrite(const uint8_t* data, size_t len);
+    // Appends whatever arrives within timeoutMs to _rx.
+    bool readMore(uint32_t timeoutMs);
+    bool readBytes(uint8_t* out, size_t len, uint32_t timeoutMs);
+    // Next raw frame, still sealed.
+    bool readFrame(std::vector<uint8_t>& frame, uint32_t timeoutMs);
+    bool openFrame(std::vector<uint8_t>& frame);
+    size_t frameAad(size_t sealedLen, uint8_t* out) const;
+
+    bool handshakeRaw(const std::string& passPhrase, uint32_t timeoutMs);
+    bool handshakePassphrase(const std::string& passPhrase, uint32_t timeoutMs);
+    bool handshakeEphemeral(const std::string& passPhrase, uint32_t timeoutMs);
+    bool handshakeBinary(const std::string& passPhrase, uint32_t timeoutMs);
+    // Mixes the guard line into the session key, as the device does.
+    bool bindCaps();
+    bool offersResume() const { return (_caps & linkcaps::Resume) && _resume.valid; }
+    // Keys the session from _resume and the two nonces.
+    bool applyResumed(const uint8_t* clientNonce, const uint8_t* deviceNonce);
+    // Keeps the ticket of a full handshake for the next session.
+    void keepTicket(const uint8_t* id);
+
+    int _fd;
+    uint32_t _caps = 0;
+    // Caps sent on the guard line; 0 for a plain "guard".
+    uint32_t _offered = 0;
+    bool _encrypted = false;
+    FrameCodec _codec;
+    std::vector<uint8_t> _rx;
+    std::unique_ptr<CryptoEcdhAes> _crypto;
+    Ticket _ticket;
+    Ticket _resume;
+    bool _resumed = false;
+};
@@ -0,0 +1,114 @@
+#pragma once
+#include <cstdint>
+#include <cstring>
+#include <vector>
+#include "message_type.cpp"
+#include "pb_decode.h"
+#include "pb_encode.h"
+#include "Parameters.pb.h"
+#include "peer/peer_link.hpp"
+#include "protocol/compression_dict.hpp"
+#include "protocol/lz_codec.hpp"
+
+// Client messages of the parameter protocol: [MessageType][protobuf].
+namespace peermsg {
+
+template <typename Msg>
+inline std::vector<uint8_t> encode(MessageType type, const pb_msgdesc_t* fields, const Msg& msg) {
+    std::vector<uint8_t> out(1 + 512);
+    out[0] = static_cast<uint8_t>(type);
+    pb_ostream_t os = pb_ostream_from_buffer(out.data() + 1, out.size() - 1);
+    if (!pb_encode(&os, fields, &msg)) return {};
+    out.resize(1 + os.bytes_written);
+    return out;
+}
+
+inline std::vector<uint8_t> setInt(uint32_t id, int32_t value) {
+    pModel_IntParameter msg = pModel_IntParameter_init_zero;
+    msg.id = id;
+    msg.value = value;
+    return encode(MessageType::SetInt, pModel_IntParameter_fields, msg);
+}
+
+inline std::vector<uint8_t> setString(uint32_t id, const char* value) {
+    pModel_StringParameter msg = pModel_StringParameter_init_zero;
+    msg.id = id;
+    msg.value.size = static_cast<pb_size_t>(strnlen(value, sizeof(msg.value.bytes)));
+    memcpy(msg.value.bytes, value, msg.value.size);
+    return encode(MessageType::SetString, pModel_StringParameter_fields, msg);
+}
+
+inline MessageType type(const std::vector<uint8_t>& msg) {
+    return static_cast<MessageType>(msg.empty() ? 0xFF : msg[0]);
+}
+
+// Decodes an Int message; false for any other type.
+inline bool decodeInt(const std::vector<uint8_t>& msg, pModel_IntParameter& out) {
+    if (type(msg) != MessageType::Int) return false;
+    out = pModel_IntParameter_init_zero;
+    pb_istream_t is = pb_istream_from_buffer(msg.data() + 1, msg.size() - 1);
+    return pb_decode(&is, pModel_IntParameter_fields, &out);
+}
+
+inline bool readVarint(const uint8_t* data, size_t len, size_t& pos, size_t& value) {
+    value = 0;
+    for (int shift = 0; pos < len && shift < 28; shift += 7) {
+        uint8_t b = data[pos++];
+        value |= size_t(b & 0x7F) << shift;
+        if (!(b & 0x80)) return true;
+    }
+    return false;
+}
+
+// Appends the messages of one received frame to `out`: a Compressed frame is
+// inflated and a Batch frame split; anything else is a message of its own.
+inline bool unpack(const uint8_t* data, size_t len, std::vector<std::vector<uint8_t>>& out) {
+    if (len == 0) return false;
+    size_t pos = 1;
+    if (data[0] == static_cast<uint8_t>(MessageType::Compressed)) {
+        size_t rawLen = 0;
+        if (len < 3 || (data[1] | (data[2] << 8)) != lz::kDictionaryId) return false;
+        pos = 3;
+        if (!readVarint(data, len, pos, rawLen)) return false;
+        std::vector<uint8_t> raw(rawLen);
+        size_t n = 0;
+        if (!lz::decompress(lz::dictionary(), data + pos, len - pos, raw.data(), raw.size(), n) || n != rawLen) {
+            return false;
+        }
+        return unpack(raw.data(), raw.size(), out);
+    }
+    if (data[0] != static_cast<uint8_t>(MessageType::Batch)) {
+        out.emplace_back(data, data + len);
+        return true;
+    }
+    while (pos < len) {
+        size_t n = 0;
+        if (!readVarint(data, len, pos, n) || n > len - pos) return false;
+        out.emplace_back(data + pos, data + pos + n);
+        pos += n;
+    }
+    return true;
+}
+
+// Reads the dump that follows the handshake: one ParameterInfo and one value
+// per parameter, also when they come in Batch or Compressed frames.
+// `wireBytes`, if given, gets the size of the frames as received.
+inline bool readDump(PeerLink& peer, size_t params, uint32_t timeoutMs = 2000, size_t* wireBytes = nullptr) {
+    size_t infos = 0, values = 0;
+    std::vector<uint8_t> frame;
+    std::vector<std::vector<uint8_t>> msgs;
+    if (wireBytes) *wireBytes = 0;
+    while ((infos < params || values < params) && peer.receive(frame, timeoutMs)) {
+        if (wireBytes) *wireBytes += frame.size();
+        msgs.clear();
+        if (!unpack(frame.data(), frame.size(), msgs)) return false;
+        for (const auto& msg : msgs) {
+            MessageType t = type(msg);
+            if (t == MessageType::ParameterInfo) infos++;
+            else if (t != MessageType::SchemaHash) values++;
+        }
+    }
+    return infos == params && values == params;
+}
+
+} // namespace peermsg
@@ -0,0 +1,298 @@
+// Client side of the link as a command-line tool: completes the handshake of
+// any cipher with PeerLink, prints the parameter dump, applies sets and shows
+// the broadcasts that follow. The device can be in this process, another
+// process (peer_sim --serve) or a real ESP32 behind a serial port.
+//
+//   peer_sim [--local | --tcp [HOST:]PORT | --dev PATH] [--caps LIST]
+//            [--pass PHRASE] [--set ID=VALUE]... [--watch SECONDS]
+//   peer_sim --serve PORT
+//
+//   --local        a HostDevice in this process over a socketpair (default)
+//   --tcp          a device listening on TCP, e.g. peer_sim --serve
+//   --dev          a serial device, e.g. /dev/rfcomm0 bound to the SPP server
+//   --serve        only the device side, on 127.0.0.1:PORT until Ctrl-C
+//   --caps         comma-separated: raw passphrase ephemeral binary x25519
+//                  chacha counter varint (default ephemeral)
+//   --pass         bound phrase (default CONFIG_PASSPHRASE)
+//   --set          parameter id and value; the type comes from the dump
+//   --watch        how long to print broadcasts after the sets (default 1)
+#include <arpa/inet.h>
+#include <atomic>
+#include <chrono>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <string>
+#include <sys/socket.h>
+#include <termios.h>
+#include <thread>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "device/host_device.hpp"
+#include "esp_log.h"
+#include "peer/peer_link.hpp"
+#include "peer/peer_messages.hpp"
+
+static std::atomic<bool> interrupted{false};
+
+static void usage() {
+    fprintf(stderr,
+            "usage: peer_sim [--local | --tcp [HOST:]PORT | --dev PATH] [--caps LIST] [--pass PHRASE]\n"
+            "                [--set ID=VALUE]... [--watch SECONDS]\n"
+            "       peer_sim --serve PORT\n"
+            "caps: raw passphrase ephemeral binary x25519 chacha counter varint\n");
+    exit(2);
+}
+
+static uint32_t parseCaps(const std::string& list) {
+    static const std::pair<const char*, uint32_t> kNames[] = {
+        {"raw", linkcaps::CipherRaw},          {"passphrase", linkcaps::CipherPassphrase},
+        {"ephemeral", linkcaps::CipherEphemeral}, {"binary", linkcaps::BinaryHandshake},
+        {"x25519", linkcaps::CurveX25519},      {"chacha", linkcaps::ChaChaPoly},
+        {"counter", linkcaps::CounterNonce},    {"varint", linkcaps::FramingVarint},
+    };
+    uint32_t caps = 0;
+    size_t pos = 0;
+    while (pos <= list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        std::string name = list.substr(pos, end - pos);
+        bool found = false;
+        for (auto& [n, cap] : kNames) {
+            if (name == n) {
+                caps |= cap;
+                found = true;
+            }
+        }
+        if (!found) {
+            fprintf(stderr, "unknown cap '%s'\n", name.c_str());
+            usage();
+        }
+        pos = end + 1;
+    }
+    return caps;
+}
+
+static int connectTcp(const std::string& target) {
+    std::string host = "127.0.0.1";
+    std::string port = target;
+    size_t colon = target.rfind(':');
+    if (colon != std::string::npos) {
+        host = target.substr(0, colon);
+        port = target.substr(colon + 1);
+    }
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(static_cast<uint16_t>(atoi(port.c_str())));
+    if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+        fprintf(stderr, "bad address %s\n", host.c_str());
+        return -1;
+    }
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0 || ::connect(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0) {
+        perror("connect");
+        if (fd >= 0) ::close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int openSerial(const char* path) {
+    int fd = ::open(path, O_RDWR | O_NOCTTY);
+    if (fd < 0) {
+        perror(path);
+        return -1;
+    }
+    if (isatty(fd)) {
+        termios tio{};
+        tcgetattr(fd, &tio);
+        cfmakeraw(&tio);
+        tcsetattr(fd, TCSANOW, &tio);
+    }
+    return fd;
+}
+
+static int serve(uint16_t port) {
+    HostDevice dev;
+    if (dev.loopback.startTcp(port) != ESP_OK) return 1;
+    printf("device on 127.0.0.1:%u, Ctrl-C to stop\n", (unsigned)port);
+    fflush(stdout);
+    signal(SIGINT, [](int) { interrupted = true; });
+    while (!interrupted) std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    return 0;
+}
+
+struct Param {
+    std::string name;
+    uint32_t type = 0;   // paramstore::ParamType
+};
+
+template <typename Msg>
+static bool decode(const std::vector<uint8_t>& msg, const pb_msgdesc_t* fields, Msg& out) {
+    pb_istream_t is = pb_istream_from_buffer(msg.data() + 1, msg.size() - 1);
+    return pb_decode(&is, fields, &out);
+}
+
+static const char* nameOf(const std::map<uint32_t, Param>& params, uint32_t id) {
+    auto it = params.find(id);
+    return it != params.end() ? it->second.name.c_str() : "?";
+}
+
+static void print(const std::vector<uint8_t>& msg, std::map<uint32_t, Param>& params) {
+    static const char* kTypes[] = {"int", "float", "string", "bool"};
+    switch (peermsg::type(msg)) {
+        case MessageType::ParameterInfo: {
+            pModel_ParameterInfo info = pModel_ParameterInfo_init_zero;
+            if (!decode(msg, pModel_ParameterInfo_fields, info)) break;
+            Param& p = params[info.id];
+            p.name.assign(reinterpret_cast<const char*>(info.name.bytes), info.name.size);
+            p.type = info.type;
+            printf("info   %3u %-18s %-6s %s [%g..%g] %.*s\n", (unsigned)info.id, p.name.c_str(),
+                   info.type < 4 ? kTypes[info.type] : "?", info.editable ? "rw" : "ro", info.min_value,
+                   info.max_value, (int)info.description.size, reinterpret_cast<const char*>(info.description.bytes));
+            return;
+        }
+        case MessageType::Int: {
+            pModel_IntParameter v = pModel_IntParameter_init_zero;
+            if (!decode(msg, pModel_IntParameter_fields, v)) break;
+            printf("value  %3u %-18s %d\n", (unsigned)v.id, nameOf(params, v.id), (int)v.value);
+            return;
+        }
+        case MessageType::Float: {
+            pModel_FloatParameter v = pModel_FloatParameter_init_zero;
+            if (!decode(msg, pModel_FloatParameter_fields, v)) break;
+            printf("value  %3u %-18s %g\n", (unsigned)v.id, nameOf(params, v.id), (double)v.value);
+            return;
+        }
+        case MessageType::String: {
+            pModel_StringParameter v = pModel_StringParameter_init_zero;
+            if (!decode(msg, pModel_StringParameter_fields, v)) break;
+            printf("value  %3u %-18s \"%.*s\"\n", (unsigned)v.id, nameOf(params, v.id), (int)v.value.size,
+                   reinterpret_cast<const char*>(v.value.bytes));
+            return;
+        }
+        case MessageType::Boolean: {
+            pModel_BooleanParameter v = pModel_BooleanParameter_init_zero;
+            if (!decode(msg, pModel_BooleanParameter_fields, v)) break;
+            printf("value  %3u %-18s %s\n", (unsigned)v.id, nameOf(params, v.id), v.value ? "true" : "false");
+            return;
+        }
+        case MessageType::SchemaHash: {
+            printf("schema ");
+            for (size_t i = 1; i < msg.size(); i++) printf("%02x", msg[i]);
+            printf("\n");
+            return;
+        }
+        default:
+            break;
+    }
+    printf("msg    type 0x%02x, %zu bytes\n", msg.empty() ? 0 : msg[0], msg.size());
+}
+
+// The dump has no end marker: it is over when nothing arrives for quietMs.
+static void readDump(PeerLink& peer, std::map<uint32_t, Param>& params, uint32_t quietMs) {
+    std::vector<uint8_t> msg;
+    while (peer.receive(msg, quietMs)) print(msg, params);
+    fflush(stdout);
+}
+
+static void watch(PeerLink& peer, std::map<uint32_t, Param>& params, double seconds) {
+    const int64_t until = osport::nowUs() + int64_t(seconds * 1e6);
+    std::vector<uint8_t> msg;
+    while (osport::nowUs() < until) {
+        if (peer.receive(msg, 100)) print(msg, params);
+    }
+    fflush(stdout);
+}
+
+static std::vector<uint8_t> setMessage(uint32_t id, const std::string& value, const std::map<uint32_t, Param>& params) {
+    auto it = params.find(id);
+    auto type = static_cast<paramstore::ParamType>(it != params.end() ? it->second.type : 0);
+    switch (type) {
+        case paramstore::ParamType::Float: {
+            pModel_FloatParameter msg = pModel_FloatParameter_init_zero;
+            msg.id = id;
+            msg.value = strtof(value.c_str(), nullptr);
+            return peermsg::encode(MessageType::SetFloat, pModel_FloatParameter_fields, msg);
+        }
+        case paramstore::ParamType::String:
+            return peermsg::setString(id, value.c_str());
+        case paramstore::ParamType::Bool: {
+            pModel_BooleanParameter msg = pModel_BooleanParameter_init_zero;
+            msg.id = id;
+            msg.value = value == "1" || value == "true";
+            return peermsg::encode(MessageType::SetBoolean, pModel_BooleanParameter_fields, msg);
+        }
+        case paramstore::ParamType::Int:
+            break;
+    }
+    return peermsg::setInt(id, static_cast<int32_t>(strtol(value.c_str(), nullptr, 0)));
+}
+
+int main(int argc, char** argv) {
+    enum class Target { Local, Tcp, Dev } target = Target::Local;
+    std::string where;
+    uint32_t caps = linkcaps::CipherEphemeral;
+    std::string pass = CONFIG_PASSPHRASE;
+    std::vector<std::pair<uint32_t, std::string>> sets;
+    double watchS = 1;
+
+    for (int i = 1; i < argc; i++) {
+        std::string arg = argv[i];
+        auto value = [&]() -> std::string {
+            if (i + 1 >= argc) usage();
+            return argv[++i];
+        };
+        if (arg == "--local") target = Target::Local;
+        else if (arg == "--tcp") { target = Target::Tcp; where = value(); }
+        else if (arg == "--dev") { target = Target::Dev; where = value(); }
+        else if (arg == "--serve") return serve(static_cast<uint16_t>(atoi(value().c_str())));
+        else if (arg == "--caps") caps = parseCaps(value());
+        else if (arg == "--pass") pass = value();
+        else if (arg == "--watch") watchS = atof(value().c_str());
+        else if (arg == "--set") {
+            std::string s = value();
+            size_t eq = s.find('=');
+            if (eq == std::string::npos) usage();
+            sets.emplace_back(static_cast<uint32_t>(atoi(s.substr(0, eq).c_str())), s.substr(eq + 1));
+        } else usage();
+    }
+    esp_log_level_set("*", ESP_LOG_WARN);
+
+    std::unique_ptr<HostDevice> dev;
+    int fd = -1;
+    switch (target) {
+        case Target::Local:
+            dev = std::make_unique<HostDevice>();
+            fd = dev->connect();
+            break;
+        case Target::Tcp: fd = connectTcp(where); break;
+        case Target::Dev: fd = openSerial(where.c_str()); break;
+    }
+    if (fd < 0) return 1;
+
+    PeerLink peer(fd);
+    int64_t t0 = osport::nowUs();
+    if (!peer.connect(caps, pass)) {
+        fprintf(stderr, "handshake failed\n");
+        return 1;
+    }
+    printf("session caps=0x%08x, handshake %.1f ms\n", (unsigned)peer.caps(), (osport::nowUs() - t0) / 1000.0);
+
+    std::map<uint32_t, Param> params;
+    readDump(peer, params, 500);
+    for (auto& [id, value] : sets) {
+        if (!peer.send(setMessage(id, value, params))) {
+            fprintf(stderr, "send failed\n");
+            return 1;
+        }
+    }
+    watch(peer, params, watchS);
+    return 0;
+}
@@ -0,0 +1,200 @@
+// Heap allocations of the device per message: global operator new/delete are
+// wrapped with counters, and a scripted session runs through FdConnection,
+// the protocol, ParameterSync and ParameterStore:
+//   handshake  guard line to the end of the parameter dump, per session
+//   set        a client SetInt until its broadcast comes back, per set
+//   telemetry  a store.setInt on the device until the client has it, per update
+//   recv       a 64-byte client frame to FdConnection's data callback and no
+//              further (read task, frame decoder, decryption), per frame of
+//              a raw, passphrase and ephemeral session
+// The client (PeerLink) runs in this process too; its calls are left out of
+// the count. mbedTLS allocates with calloc, which is not counted. A stage
+// over its budget fails the test; lower a budget when a change beats it.
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <new>
+#include <vector>
+#include "check.hpp"
+#include "device/host_device.hpp"
+#include "esp_log.h"
+#include "fd_connection.hpp"
+#include "host/loopback_server.hpp"
+#include "peer/peer_link.hpp"
+#include "peer/peer_messages.hpp"
+
+namespace {
+
+std::atomic<uint64_t> allocs{0};
+std::atomic<uint64_t> bytes{0};
+thread_local bool inClient = false;
+
+void* counted(size_t n) {
+    if (!inClient) {
+        allocs.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+    if (void* p = malloc(n ? n : 1)) return p;
+    throw std::bad_alloc();
+}
+
+void* countedAligned(size_t n, std::align_val_t al) {
+    if (!inClient) {
+        allocs.fetch_add(1, std::memory_order_relaxed);
+        bytes.fetch_add(n, std::memory_order_relaxed);
+    }
+    size_t a = static_cast<size_t>(al);
+    if (void* p = aligned_alloc(a, (n + a - 1) / a * a)) return p;
+    throw std::bad_alloc();
+}
+
+// PeerLink calls on this thread: client work, not counted.
+struct Client {
+    Client() { inClient = true; }
+    ~Client() { inClient = false; }
+};
+
+struct Counts {
+    uint64_t allocs;
+    uint64_t bytes;
+};
+
+Counts now() {
+    return {allocs.load(), bytes.load()};
+}
+
+} // namespace
+
+void* operator new(size_t n) { return counted(n); }
+void* operator new[](size_t n) { return counted(n); }
+void* operator new(size_t n, std::align_val_t al) { return countedAligned(n, al); }
+void* operator new[](size_t n, std::align_val_t al) { return countedAligned(n, al); }
+void operator delete(void* p) noexcept { free(p); }
+void operator delete[](void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+void operator delete[](void* p, size_t) noexcept { free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, std::align_val_t) noexcept { free(p); }
+void operator delete(void* p, size_t, std::align_val_t) noexcept { free(p); }
+void operator delete[](void* p, size_t, std::align_val_t) noexcept { free(p); }
+
+using paramstore::ParameterId;
+
+static constexpr int kMessages = 200;
+static constexpr uint32_t kCaps = linkcaps::CipherEphemeral | linkcaps::FramingVarint;
+
+struct Budget {
+    const char* stage;
+    double allocsPerMsg;
+    double bytesPerMsg;
+};
+
+static void report(const Budget& b, Counts from, Counts to, int messages) {
+    double a = double(to.allocs - from.allocs) / messages;
+    double n = double(to.bytes - from.bytes) / messages;
+    printf("%-10s %5d msgs  %8.1f allocs/msg (budget %6.1f)  %9.1f bytes/msg (budget %8.1f)\n", b.stage, messages, a,
+           b.allocsPerMsg, n, b.bytesPerMsg);
+    if (a > b.allocsPerMsg) fprintf(stderr, "%s: %.1f allocations per message, budget %.1f\n", b.stage, a, b.allocsPerMsg);
+    if (n > b.bytesPerMsg) fprintf(stderr, "%s: %.1f bytes per message, budget %.1f\n", b.stage, n, b.bytesPerMsg);
+    CHECK(a <= b.allocsPerMsg);
+    CHECK(n <= b.bytesPerMsg);
+}
+
+// Reads until `value` arrives for `id`.
+static bool waitFor(PeerLink& peer, ParameterId id, int32_t value) {
+    Client client;
+    std::vector<uint8_t> msg;
+    pModel_IntParameter v;
+    while (peer.receive(msg, 2000)) {
+        if (peermsg::decodeInt(msg, v) && v.id == static_cast<uint32_t>(id) && v.value == value) return true;
+    }
+    return false;
+}
+
+// Guard line, handshake and dump of one session on `dev`.
+static void handshake(HostDevice& dev, PeerLink& peer) {
+    Client client;
+    REQUIRE(peer.connect(kCaps, CONFIG_PASSPHRASE));
+    REQUIRE(peermsg::readDump(peer, dev.store.listMeta().size()));
+}
+
+static void receive(const Budget& b, uint32_t caps) {
+    LoopbackServer loopback;
+    std::unique_ptr<FdConnection> conn;
+    std::atomic<int> frames{0};
+    loopback.setOnFdReady([&](int fd) {
+        conn = std::make_unique<FdConnection>(fd, CONFIG_PASSPHRASE);
+        conn->setDataCallback([&frames](const uint8_t*, size_t) { frames++; });
+        return conn->start() == ESP_OK;
+    });
+    PeerLink peer(loopback.connect(LoopbackServer::Transport::SocketPair));
+    {
+        Client client;
+        REQUIRE(peer.connect(caps, CONFIG_PASSPHRASE));
+    }
+    while (!conn->isReady()) osport::delayMs(1);
+
+    // The first round wraps the decoder's ring, which allocates its scratch
+    // buffer once; the second is measured.
+    const std::vector<uint8_t> payload(64, 0x5A);
+    Counts r0{};
+    for (int round = 1; round <= 2; round++) {
+        r0 = now();
+        for (int n = 0; n < kMessages; n++) {
+            Client client;
+            REQUIRE(peer.send(payload));
+        }
+        int64_t deadline = osport::nowUs() + 5000000;
+        while (frames.load() < round * kMessages && osport::nowUs() < deadline) osport::delayMs(1);
+        REQUIRE(frames.load() == round * kMessages);
+    }
+    report(b, r0, now(), kMessages);
+    {
+        Client client;
+        peer.close();
+    }
+    conn.reset();
+}
+
+int main() {
+    esp_log_level_set("*", ESP_LOG_WARN);
+    // One-time setup (keypair pool, passphrase cache, function-local
+    // statics) is paid by a session on a device of its own; a closed client
+    // is only noticed on the next write, so it cannot share the device.
+    {
+        HostDevice warmup;
+        PeerLink peer(warmup.connect());
+        handshake(warmup, peer);
+    }
+
+    HostDevice dev;
+    Counts c0 = now();
+    PeerLink peer(dev.connect());
+    handshake(dev, peer);
+    report({"handshake", 400, 48000}, c0, now(), 1);
+
+    const auto blink = static_cast<uint32_t>(ParameterId::BlinkCount);
+    Counts s0 = now();
+    for (int n = 0; n < kMessages; n++) {
+        int32_t value = 2 + n % 2;
+        {
+            Client client;
+            REQUIRE(peer.send(peermsg::setInt(blink, value)));
+        }
+        REQUIRE(waitFor(peer, ParameterId::BlinkCount, value));
+    }
+    report({"set", 6, 256}, s0, now(), kMessages);
+
+    Counts t0 = now();
+    for (int n = 1; n <= kMessages; n++) {
+        dev.store.setInt(ParameterId::Uptime, n);
+        REQUIRE(waitFor(peer, ParameterId::Uptime, n));
+    }
+    report({"telemetry", 5, 224}, t0, now(), kMessages);
+
+    receive({"recv raw", 0, 0}, linkcaps::CipherRaw);
+    receive({"recv pass", 0, 0}, linkcaps::CipherPassphrase);
+    receive({"recv ecdh", 0, 0}, linkcaps::CipherEphemeral);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,32 @@
+#pragma once
+#include <cstdio>
+#include <cstdlib>
+
+// Minimal assertions for the host tests: a failed CHECK reports and counts,
+// CHECK_RESULT() turns the count into the process exit code for ctest.
+namespace check {
+inline int& failures() {
+    static int n = 0;
+    return n;
+}
+} // namespace check
+
+#define CHECK(cond)                                                              \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            fprintf(stderr, "%s:%d: CHECK failed: %s\n", __FILE__, __LINE__, #cond); \
+            check::failures()++;                                                 \
+        }                                                                        \
+    } while (0)
+
+// Aborts the test: later steps depend on this one.
+#define REQUIRE(cond)                                                            \
+    do {                                                                         \
+        if (!(cond)) {                                                           \
+            fprintf(stderr, "%s:%d: REQUIRE failed: %s\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                             \
+        }                                                                        \
+    } while (0)
+
+#define CHECK_RESULT()                                                           \
+    (check::failures() ? (fprintf(stderr, "%d check(s) failed\n", check::failures()), 1) : 0)
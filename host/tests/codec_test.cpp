@@ -0,0 +1,151 @@
+// FrameCodec length prefixes and FrameDecoder reassembly: every length of
+// both framings round-trips, the limits and malformed varints are refused,
+// and random frame streams come out whole whatever the read sizes and
+// however the ring wraps.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <vector>
+#include "check.hpp"
+#include "protocol/frame_codec.hpp"
+#include "protocol/frame_decoder.hpp"
+
+using Framing = FrameCodec::Framing;
+using Result = FrameCodec::Result;
+
+static FrameCodec codecFor(Framing f) {
+    FrameCodec codec;
+    codec.setFraming(f);
+    return codec;
+}
+
+static void roundTripEveryLength() {
+    for (Framing f : {Framing::Byte, Framing::Varint}) {
+        FrameCodec codec = codecFor(f);
+        for (size_t len = 0; len <= codec.maxFrame(); len++) {
+            uint8_t header[FrameCodec::kMaxHeaderLen];
+            size_t h = codec.encodeHeader(len, header);
+            size_t expected = f == Framing::Byte ? 1 : (len < 128 ? 1 : 2);
+            CHECK(h == expected);
+            size_t frameLen = 0, headerLen = 0;
+            CHECK(codec.decodeHeader(header, h, frameLen, headerLen) == Result::Ok);
+            CHECK(frameLen == len);
+            CHECK(headerLen == h);
+            // One byte short of the prefix is never a complete header.
+            if (h > 1) CHECK(codec.decodeHeader(header, h - 1, frameLen, headerLen) == Result::NeedMore);
+        }
+    }
+}
+
+static void limits() {
+    uint8_t header[FrameCodec::kMaxHeaderLen];
+    FrameCodec byte = codecFor(Framing::Byte);
+    CHECK(byte.maxFrame() == FrameCodec::kMaxByteFrame);
+    CHECK(byte.encodeHeader(FrameCodec::kMaxByteFrame + 1, header) == 0);
+
+    FrameCodec varint = codecFor(Framing::Varint);
+    CHECK(varint.maxFrame() == FrameCodec::kMaxVarintFrame);
+    CHECK(varint.encodeHeader(FrameCodec::kMaxVarintFrame + 1, header) == 0);
+
+    size_t frameLen = 0, headerLen = 0;
+    CHECK(varint.decodeHeader(header, 0, frameLen, headerLen) == Result::NeedMore);
+    CHECK(byte.decodeHeader(header, 0, frameLen, headerLen) == Result::NeedMore);
+
+    // 4097, one past the limit.
+    const uint8_t tooLong[] = {0x81, 0x20};
+    CHECK(varint.decodeHeader(tooLong, sizeof(tooLong), frameLen, headerLen) == Result::Error);
+    // 0 and 1 with a redundant continuation byte.
+    const uint8_t overlong0[] = {0x80, 0x00};
+    const uint8_t overlong1[] = {0x81, 0x80, 0x00};
+    CHECK(varint.decodeHeader(overlong0, sizeof(overlong0), frameLen, headerLen) == Result::Error);
+    CHECK(varint.decodeHeader(overlong1, sizeof(overlong1), frameLen, headerLen) == Result::Error);
+    // Continuation bits past kMaxHeaderLen.
+    const uint8_t endless[] = {0xFF, 0xFF, 0xFF};
+    CHECK(varint.decodeHeader(endless, sizeof(endless), frameLen, headerLen) == Result::Error);
+    // The byte framing reads any first byte as a length.
+    CHECK(byte.decodeHeader(endless, 1, frameLen, headerLen) == Result::Ok);
+    CHECK(frameLen == 0xFF);
+}
+
+// Frames of random sizes, pushed in random read sizes: each comes out once,
+// in order and unchanged, also when it wraps around the end of the ring.
+static void decoderRandomStreams() {
+    std::mt19937 rng(7);
+    for (Framing f : {Framing::Byte, Framing::Varint}) {
+        FrameCodec codec = codecFor(f);
+        FrameDecoder decoder;
+        std::vector<std::vector<uint8_t>> sent;
+        std::vector<uint8_t> stream;
+        for (int i = 0; i < 2000; i++) {
+            size_t len = rng() % (codec.maxFrame() + 1);
+            if (i % 100 == 0) len = codec.maxFrame();
+            std::vector<uint8_t> frame(len);
+            for (auto& b : frame) b = static_cast<uint8_t>(rng());
+            uint8_t header[FrameCodec::kMaxHeaderLen];
+            size_t h = codec.encodeHeader(len, header);
+            stream.insert(stream.end(), header, header + h);
+            stream.insert(stream.end(), frame.begin(), frame.end());
+            sent.push_back(std::move(frame));
+        }
+
+        size_t next = 0;
+        bool intact = true;
+        for (size_t off = 0; off < stream.size();) {
+            size_t chunk = std::min<size_t>(1 + rng() % 700, stream.size() - off);
+            const uint8_t* data = stream.data() + off;
+            size_t left = chunk;
+            while (left > 0) {
+                size_t taken = decoder.push(data, left);
+                data += taken;
+                left -= taken;
+                CHECK(decoder.drain(codec, [&](std::span<uint8_t> frame) {
+                    if (next >= sent.size() || frame.size() != sent[next].size() ||
+                        memcmp(frame.data(), sent[next].data(), frame.size()) != 0) {
+                        intact = false;
+                    }
+                    next++;
+                }));
+            }
+            off += chunk;
+        }
+        CHECK(intact);
+        CHECK(next == sent.size());
+        CHECK(decoder.size() == 0);
+    }
+}
+
+static void decoderMalformed() {
+    FrameCodec codec = codecFor(Framing::Varint);
+    FrameDecoder decoder;
+    const uint8_t bad[] = {0x80, 0x00, 1, 2, 3};
+    decoder.push(bad, sizeof(bad));
+    int frames = 0;
+    CHECK(!decoder.drain(codec, [&](std::span<uint8_t>) { frames++; }));
+    CHECK(frames == 0);
+    CHECK(decoder.size() == 0);
+
+    // The buffer was dropped, so the next good frame decodes.
+    const uint8_t good[] = {2, 0xAA, 0xBB};
+    decoder.push(good, sizeof(good));
+    CHECK(decoder.drain(codec, [&](std::span<uint8_t> frame) {
+        frames++;
+        CHECK(frame.size() == 2 && frame[0] == 0xAA && frame[1] == 0xBB);
+    }));
+    CHECK(frames == 1);
+
+    // A header alone, then a partial body: nothing yet, nothing lost.
+    const uint8_t partial[] = {0x90, 0x01, 1, 2};
+    decoder.push(partial, sizeof(partial));
+    CHECK(decoder.drain(codec, [&](std::span<uint8_t>) { frames++; }));
+    CHECK(frames == 1);
+    CHECK(decoder.size() == sizeof(partial));
+}
+
+int main() {
+    roundTripEveryLength();
+    limits();
+    decoderRandomStreams();
+    decoderMalformed();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,164 @@
+// CryptoEcdhAes primitives on their own: HKDF-SHA256 against the RFC 5869
+// vectors and its refusals, ChaCha20-Poly1305 against RFC 8439, and seal()
+// on one thread while open() runs on another, as the send and read tasks of
+// a session do, for both AEAD backends.
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+#include "check.hpp"
+#include "crypto_ecdh_aes.hpp"
+
+static std::vector<uint8_t> fromHex(const char* hex) {
+    std::vector<uint8_t> out;
+    for (size_t i = 0; hex[i] && hex[i + 1]; i += 2) {
+        out.push_back(static_cast<uint8_t>(std::stoul(std::string(hex + i, 2), nullptr, 16)));
+    }
+    return out;
+}
+
+static void hkdfVectors() {
+    const std::vector<uint8_t> ikm(22, 0x0b);
+    uint8_t okm[42];
+
+    // Test case 1.
+    const auto salt = fromHex("000102030405060708090a0b0c");
+    const char info[] = "\xf0\xf1\xf2\xf3\xf4\xf5\xf6\xf7\xf8\xf9";
+    REQUIRE(CryptoEcdhAes::hkdf_sha256(salt.data(), salt.size(), ikm.data(), ikm.size(), info, okm, sizeof(okm)));
+    CHECK(memcmp(okm, fromHex("3cb25f25faacd57a90434f64d0362f2a2d2d0a90cf1a5a4c5db02d56ecc4c5bf"
+                              "34007208d5b887185865").data(), sizeof(okm)) == 0);
+
+    // Test case 3: no salt, empty info.
+    REQUIRE(CryptoEcdhAes::hkdf_sha256(nullptr, 0, ikm.data(), ikm.size(), "", okm, sizeof(okm)));
+    CHECK(memcmp(okm, fromHex("8da4e775a563c18f715f802a063c5a31b8a11f5c5ee1879ec3454e5f3c738d2d"
+                              "9d201395faa4b61a96c8").data(), sizeof(okm)) == 0);
+
+    // Output is prefix-stable, which apply_resumed_key() relies on.
+    uint8_t shortOkm[16];
+    REQUIRE(CryptoEcdhAes::hkdf_sha256(nullptr, 0, ikm.data(), ikm.size(), "", shortOkm, sizeof(shortOkm)));
+    CHECK(memcmp(okm, shortOkm, sizeof(shortOkm)) == 0);
+}
+
+static void hkdfRefusals() {
+    const uint8_t ikm[32] = {1};
+    std::vector<uint8_t> out(255 * 32 + 1, 0xAA);
+    CHECK(!CryptoEcdhAes::hkdf_sha256(nullptr, 0, ikm, sizeof(ikm), "info", out.data(), out.size()));
+    const std::string longInfo(65, 'i');
+    CHECK(!CryptoEcdhAes::hkdf_sha256(nullptr, 0, ikm, sizeof(ikm), longInfo.c_str(), out.data(), 32));
+    CHECK(CryptoEcdhAes::hkdf_sha256(nullptr, 0, ikm, sizeof(ikm), longInfo.c_str() + 1, out.data(), 32));
+}
+
+#if defined(MBEDTLS_CHACHAPOLY_C)
+// RFC 8439 section 2.8.2, through the backend and back.
+static void chachaPolyVector() {
+    std::vector<uint8_t> key(32);
+    for (size_t i = 0; i < key.size(); i++) key[i] = static_cast<uint8_t>(0x80 + i);
+    const auto nonce = fromHex("070000004041424344454647");
+    const auto aad = fromHex("50515253c0c1c2c3c4c5c6c7");
+    const std::string text = "Ladies and Gentlemen of the class of '99: If I could offer you only one tip for "
+                             "the future, sunscreen would be it.";
+    const auto cipher = fromHex("d31a8d34648e60db7b86afbc53ef7ec2a4aded51296e08fea9e2b5a736ee62d6"
+                                "3dbea45e8ca9671282fafb69da92728b1a71de0a9e060b2905d6a5b67ecd3b36"
+                                "92ddbd7f2d778b8c9803aee328091b58fab324e4fad675945585808b4831d7bc"
+                                "3ff4def08e4b7a9de576d26586cec64b6116");
+    const auto tag = fromHex("1ae10b594f09e26a7e902ecbd0600691");
+
+    auto aead = Aead::create(Aead::Kind::ChaChaPoly);
+    REQUIRE(aead && aead->set_key(key.data(), key.size()));
+    CHECK(!aead->set_key(key.data(), 16));
+    std::vector<uint8_t> buf(text.begin(), text.end());
+    uint8_t out[Aead::kTagLen];
+    REQUIRE(aead->seal(nonce.data(), aad.data(), aad.size(), buf.data(), buf.size(), out));
+    CHECK(buf == cipher);
+    CHECK(memcmp(out, tag.data(), sizeof(out)) == 0);
+
+    REQUIRE(aead->open(nonce.data(), aad.data(), aad.size(), buf.data(), buf.size(), tag.data()));
+    CHECK(std::string(buf.begin(), buf.end()) == text);
+
+    // A flipped bit in the ciphertext, the AAD or the tag is refused.
+    std::vector<uint8_t> bad = cipher;
+    bad[10] ^= 1;
+    CHECK(!aead->open(nonce.data(), aad.data(), aad.size(), bad.data(), bad.size(), tag.data()));
+    bad = cipher;
+    auto badAad = aad;
+    badAad[0] ^= 1;
+    CHECK(!aead->open(nonce.data(), badAad.data(), badAad.size(), bad.data(), bad.size(), tag.data()));
+    auto badTag = tag;
+    badTag[15] ^= 1;
+    CHECK(!aead->open(nonce.data(), aad.data(), aad.size(), bad.data(), bad.size(), badTag.data()));
+}
+#endif
+
+using Frame = std::vector<uint8_t>;
+
+static Frame sealText(CryptoEcdhAes& from, const std::string& text) {
+    Frame f(text.size() + from.overhead());
+    memcpy(f.data() + from.nonce_field_len(), text.data(), text.size());
+    if (!from.seal(f.data(), text.size())) return {};
+    return f;
+}
+
+static bool openText(CryptoEcdhAes& to, Frame& f, const std::string& text) {
+    uint8_t* plain;
+    size_t plainLen;
+    return to.open(f.data(), f.size(), plain, plainLen) && plainLen == text.size() &&
+           memcmp(plain, text.data(), plainLen) == 0;
+}
+
+static std::string textOf(int i) {
+    return "frame " + std::to_string(i) + std::string(i % 200, static_cast<char>('a' + i % 26));
+}
+
+// The device seals its frames on one thread while it opens the client's on
+// another; every frame must come out intact on both sides.
+static void concurrentSealOpen(Aead::Kind kind, bool counterNonces) {
+    constexpr int kFrames = 5000;
+    CryptoEcdhAes device{CryptoEcdhAes::Mode::EPHEMERAL};
+    CryptoEcdhAes client{CryptoEcdhAes::Mode::EPHEMERAL};
+    REQUIRE(device.select_aead(kind) && client.select_aead(kind));
+    uint8_t dk[CryptoEcdhAes::kMaxPublicKeyLen];
+    uint8_t ck[CryptoEcdhAes::kMaxPublicKeyLen];
+    size_t dn = device.write_public_key(dk, sizeof(dk));
+    size_t cn = client.write_public_key(ck, sizeof(ck));
+    REQUIRE(dn && cn && device.apply_other_public_raw(ck, cn) && client.apply_other_public_raw(dk, dn));
+    if (counterNonces) {
+        REQUIRE(device.enable_counter_nonces(CryptoEcdhAes::Side::Device));
+        REQUIRE(client.enable_counter_nonces(CryptoEcdhAes::Side::Client));
+    }
+
+    std::vector<Frame> up;
+    for (int i = 0; i < kFrames; i++) up.push_back(sealText(client, textOf(i)));
+
+    std::vector<Frame> down(kFrames);
+    std::atomic<int> opened{0};
+    std::thread reader([&] {
+        for (int i = 0; i < kFrames; i++) {
+            if (openText(device, up[i], textOf(i))) opened++;
+        }
+    });
+    for (int i = 0; i < kFrames; i++) down[i] = sealText(device, textOf(i));
+    reader.join();
+    CHECK(opened.load() == kFrames);
+
+    int intact = 0;
+    for (int i = 0; i < kFrames; i++) {
+        if (!down[i].empty() && openText(client, down[i], textOf(i))) intact++;
+    }
+    CHECK(intact == kFrames);
+}
+
+int main() {
+    hkdfVectors();
+    hkdfRefusals();
+    concurrentSealOpen(Aead::Kind::AesGcm, false);
+    concurrentSealOpen(Aead::Kind::AesGcm, true);
+#if defined(MBEDTLS_CHACHAPOLY_C)
+    chachaPolyVector();
+    concurrentSealOpen(Aead::Kind::ChaChaPoly, false);
+    concurrentSealOpen(Aead::Kind::ChaChaPoly, true);
+#endif
+    return CHECK_RESULT();
+}
@@ -0,0 +1,212 @@
+// MessageDispatcher with ParameterSync's handlers, without a link: every
+// registered type (SetInt, SetFloat, SetString, SetBoolean, Get, Batch) on
+// well-formed, short and malformed payloads, types nobody handles, and the
+// registration refusals. Replies are captured from the dispatcher's writer,
+// so a Get answered past the Reply shows up as a missing answer.
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+#include "check.hpp"
+#include "esp_log.h"
+#include "connection_manager.hpp"
+#include "message_dispatcher.hpp"
+#include "parameter_store.cpp"
+#include "parameter_sync.cpp"
+#include "peer/peer_messages.hpp"
+
+using paramstore::ParameterId;
+using Message = std::vector<uint8_t>;
+
+struct Fixture {
+    paramstore::ParameterStore store;
+    ConnectionManager connections{1};
+    ParameterSync sync{store, connections};
+    MessageDispatcher dispatcher;
+    std::vector<Message> replies;
+    MessageDispatcher::ConnectionId repliedTo = ConnectionManager::kNoConnection;
+
+    Fixture() {
+        ESP_ERROR_CHECK(store.begin());
+        store.setupDefaults();
+        dispatcher.setWriter([](void* ctx, MessageDispatcher::ConnectionId to, const uint8_t* data, size_t len) {
+            auto* self = static_cast<Fixture*>(ctx);
+            self->repliedTo = to;
+            self->replies.emplace_back(data, data + len);
+            return true;
+        }, this);
+        sync.registerHandlers(dispatcher);
+    }
+
+    bool dispatch(const Message& m, MessageDispatcher::ConnectionId from = 7) {
+        return dispatcher.dispatch(m, dispatcher.replyTo(from));
+    }
+};
+
+static Message setFloat(uint32_t id, float value) {
+    pModel_FloatParameter msg = pModel_FloatParameter_init_zero;
+    msg.id = id;
+    msg.value = value;
+    return peermsg::encode(MessageType::SetFloat, pModel_FloatParameter_fields, msg);
+}
+
+static Message setBool(uint32_t id, bool value) {
+    pModel_BooleanParameter msg = pModel_BooleanParameter_init_zero;
+    msg.id = id;
+    msg.value = value;
+    return peermsg::encode(MessageType::SetBoolean, pModel_BooleanParameter_fields, msg);
+}
+
+static Message get(std::initializer_list<uint32_t> ids) {
+    Message m{static_cast<uint8_t>(MessageType::Get)};
+    for (uint32_t id : ids) {
+        do {
+            uint8_t b = id & 0x7F;
+            id >>= 7;
+            m.push_back(id ? (b | 0x80) : b);
+        } while (id);
+    }
+    return m;
+}
+
+static Message batch(std::initializer_list<Message> inner) {
+    Message m{static_cast<uint8_t>(MessageType::Batch)};
+    for (auto& i : inner) {
+        m.push_back(static_cast<uint8_t>(i.size()));
+        m.insert(m.end(), i.begin(), i.end());
+    }
+    return m;
+}
+
+static uint32_t id(ParameterId p) {
+    return static_cast<uint32_t>(p);
+}
+
+static void sets() {
+    Fixture f;
+    CHECK(f.dispatch(peermsg::setInt(id(ParameterId::BlinkCount), 5)));
+    CHECK(f.store.getInt(ParameterId::BlinkCount) == 5);
+    // Clamped to the parameter's range.
+    CHECK(f.dispatch(peermsg::setInt(id(ParameterId::BlinkCount), 42)));
+    CHECK(f.store.getInt(ParameterId::BlinkCount) == 9);
+    CHECK(f.dispatch(peermsg::setString(id(ParameterId::DeviceName), "bench")));
+    CHECK(f.store.getString(ParameterId::DeviceName) == "bench");
+    CHECK(f.dispatch(setBool(id(ParameterId::LedEnabled), false)));
+    CHECK(!f.store.getBool(ParameterId::LedEnabled));
+    // No float parameter is defined: a float for an int one changes nothing.
+    CHECK(f.dispatch(setFloat(id(ParameterId::BlinkCount), 2.0f)));
+    CHECK(f.store.getInt(ParameterId::BlinkCount) == 9);
+
+    // Read-only and unknown ids are refused by every set.
+    CHECK(!f.dispatch(peermsg::setInt(id(ParameterId::Uptime), 1)));
+    CHECK(!f.dispatch(peermsg::setString(id(ParameterId::ExampleText), "x")));
+    CHECK(!f.dispatch(setBool(id(ParameterId::ExampleBool), false)));
+    CHECK(!f.dispatch(setFloat(id(ParameterId::Uptime), 1.0f)));
+    CHECK(!f.dispatch(peermsg::setInt(0xFFFF, 1)));
+    CHECK(f.store.getInt(ParameterId::Uptime) == 0);
+    // Sets never answer the sender; the store broadcasts the change.
+    CHECK(f.replies.empty());
+}
+
+static void gets() {
+    Fixture f;
+    CHECK(f.dispatch(get({id(ParameterId::BlinkCount), 0xFFFF, id(ParameterId::LedEnabled)}), 3));
+    REQUIRE(f.replies.size() == 2);
+    CHECK(f.repliedTo == 3);
+    pModel_IntParameter v;
+    CHECK(peermsg::decodeInt(f.replies[0], v) && v.id == id(ParameterId::BlinkCount) && v.value == 3);
+    CHECK(peermsg::type(f.replies[1]) == MessageType::Boolean);
+
+    // No ids: every value, through the Reply as well.
+    f.replies.clear();
+    CHECK(f.dispatch(get({}), 4));
+    CHECK(f.replies.size() == f.store.listMeta().size());
+    CHECK(f.repliedTo == 4);
+
+    // A varint cut short answers what came before it and fails.
+    f.replies.clear();
+    Message cut = get({id(ParameterId::BlinkCount)});
+    cut.push_back(0x80);
+    CHECK(!f.dispatch(cut));
+    CHECK(f.replies.size() == 1);
+}
+
+static void batches() {
+    Fixture f;
+    CHECK(f.dispatch(batch({peermsg::setInt(id(ParameterId::BlinkCount), 4), setBool(id(ParameterId::LedEnabled), false),
+                            get({id(ParameterId::BlinkCount)})})));
+    CHECK(f.store.getInt(ParameterId::BlinkCount) == 4);
+    CHECK(!f.store.getBool(ParameterId::LedEnabled));
+    pModel_IntParameter v;
+    CHECK(f.replies.size() == 1 && peermsg::decodeInt(f.replies[0], v) && v.value == 4);
+
+    // A failing entry fails the batch but the others still run.
+    CHECK(!f.dispatch(batch({peermsg::setInt(id(ParameterId::Uptime), 1), peermsg::setInt(id(ParameterId::BlinkCount), 6)})));
+    CHECK(f.store.getInt(ParameterId::BlinkCount) == 6);
+
+    // Nested batches are refused, the rest of the outer one is not.
+    CHECK(!f.dispatch(batch({batch({peermsg::setInt(id(ParameterId::BlinkCount), 2)}),
+                             peermsg::setInt(id(ParameterId::BlinkCount), 7)})));
+    CHECK(f.store.getInt(ParameterId::BlinkCount) == 7);
+
+    const uint8_t b = static_cast<uint8_t>(MessageType::Batch);
+    CHECK(f.dispatch({b}));                 // empty batch
+    CHECK(!f.dispatch({b, 5, 0x04, 0x08}));  // entry longer than the frame
+    CHECK(!f.dispatch({b, 0}));             // zero-length entry
+    CHECK(!f.dispatch({b, 0x80}));          // length cut short
+    CHECK(!f.dispatch({b, 0x80, 0x80, 0x80, 0x01}));  // length past 16 bits
+    CHECK(f.store.getInt(ParameterId::BlinkCount) == 7);
+}
+
+static void shortAndUnknown() {
+    Fixture f;
+    CHECK(!f.dispatch({}));
+    // A type byte alone is an empty protobuf: id 0 (PassPhrase, a string)
+    // with a zero value, which the int, float and bool sets leave alone.
+    const std::string pass = f.store.getString(ParameterId::PassPhrase);
+    for (MessageType t : {MessageType::SetInt, MessageType::SetFloat, MessageType::SetBoolean}) {
+        CHECK(f.dispatch({static_cast<uint8_t>(t)}));
+    }
+    CHECK(f.store.getString(ParameterId::PassPhrase) == pass);
+    // Cut in the middle of the protobuf.
+    Message m = peermsg::setString(id(ParameterId::DeviceName), "truncated");
+    m.resize(m.size() - 3);
+    CHECK(!f.dispatch(m));
+    CHECK(f.store.getString(ParameterId::DeviceName) != "truncated");
+    Message garbage{static_cast<uint8_t>(MessageType::SetInt), 0xFF, 0xFF, 0xFF};
+    CHECK(!f.dispatch(garbage));
+
+    uint32_t before = f.dispatcher.unhandled();
+    for (uint8_t t : {uint8_t(MessageType::Int), uint8_t(MessageType::HandshakeRequest), uint8_t(0x3F), uint8_t(0x40),
+                      uint8_t(0xFF)}) {
+        CHECK(!f.dispatch({t, 1, 2, 3}));
+    }
+    CHECK(f.dispatcher.unhandled() == before + 5);
+    CHECK(f.replies.empty());
+}
+
+static bool accept(void*, std::span<const uint8_t>, const MessageDispatcher::Reply&) {
+    return true;
+}
+
+static void registration() {
+    MessageDispatcher d;
+    CHECK(!d.on(MessageType::Batch, accept, nullptr));  // built in
+    CHECK(d.on(MessageType::Message, accept, nullptr));
+    CHECK(!d.on(MessageType::Message, accept, nullptr));
+    CHECK(!d.on(static_cast<MessageType>(MessageDispatcher::kMaxTypes), accept, nullptr));
+    CHECK(!d.on(MessageType::Disconnect, nullptr, nullptr));
+    // No writer: handlers still run, replies go nowhere.
+    CHECK(d.dispatch(std::vector<uint8_t>{uint8_t(MessageType::Message)}, d.replyTo(1)));
+    CHECK(!d.replyTo(1).send(nullptr, 0));
+}
+
+int main() {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    sets();
+    gets();
+    batches();
+    shortAndUnknown();
+    registration();
+    return CHECK_RESULT();
+}
@@ -0,0 +1,135 @@
+// 1, 4 and 16 ephemeral clients on one device: every parameter change is
+// broadcast to all of them. Reports CPU time per change (device and the
+// in-process clients together, so compare runs, not absolute numbers) and
+// checks that a client over the limit is refused with its fd closed once and
+// that clients can leave in the middle of a broadcast.
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <ctime>
+#include <memory>
+#include <thread>
+#include <vector>
+#include <unistd.h>
+#include "check.hpp"
+#include "device/host_device.hpp"
+#include "peer/peer_link.hpp"
+#include "peer/peer_messages.hpp"
+
+using paramstore::ParameterId;
+
+static constexpr int kChanges = 500;
+// Half of FdConnection's send queue.
+static constexpr size_t kMaxQueued = 8;
+static constexpr uint32_t kCaps = linkcaps::CipherEphemeral | linkcaps::FramingVarint;
+
+static int64_t cpuUs() {
+    timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return int64_t(ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
+
+// Reads until `last` arrives for Uptime; counts the Uptime values on the way.
+static void readChanges(PeerLink& peer, int32_t last, std::atomic<int>& received) {
+    const auto id = static_cast<uint32_t>(ParameterId::Uptime);
+    std::vector<uint8_t> msg;
+    pModel_IntParameter v;
+    while (peer.receive(msg, 5000)) {
+        if (!peermsg::decodeInt(msg, v) || v.id != id) continue;
+        received++;
+        if (v.value == last) return;
+    }
+}
+
+static void runLoad(size_t clients) {
+    HostDevice dev(clients);
+    const size_t params = dev.store.listMeta().size();
+    std::vector<std::unique_ptr<PeerLink>> peers;
+    // One at a time, so only one initial dump is in flight.
+    for (size_t i = 0; i < clients; i++) {
+        peers.push_back(std::make_unique<PeerLink>(dev.connect()));
+        REQUIRE(peers.back()->connect(kCaps, CONFIG_PASSPHRASE));
+        REQUIRE(peermsg::readDump(*peers.back(), params, 10000));
+    }
+
+    std::atomic<int> received{0};
+    std::vector<std::thread> readers;
+    for (auto& peer : peers) readers.emplace_back(readChanges, std::ref(*peer), kChanges, std::ref(received));
+
+    int64_t cpu0 = cpuUs();
+    int64_t wall0 = osport::nowUs();
+    // Uptime starts at 0, so 1..kChanges are all changes. Paced like a
+    // producer that watches the queues: a full one drops frames after its
+    // timeout, which is right for a device but not what is measured here.
+    for (int i = 1; i <= kChanges; i++) {
+        while (dev.connections.sendQueueDepth() >= kMaxQueued) std::this_thread::yield();
+        dev.store.setInt(ParameterId::Uptime, i);
+    }
+    for (auto& t : readers) t.join();
+    int64_t cpu = cpuUs() - cpu0;
+    int64_t wall = osport::nowUs() - wall0;
+
+    const int expected = kChanges * static_cast<int>(clients);
+    printf("clients=%2zu  changes=%d  delivered=%d/%d  cpu/change=%6.1f us  cpu/change/client=%5.1f us  wall=%lld ms\n",
+           clients, kChanges, received.load(), expected, double(cpu) / kChanges, double(cpu) / expected,
+           (long long)(wall / 1000));
+    CHECK(received.load() == expected);
+}
+
+// A client over the limit is refused: the device keeps serving the others
+// and LoopbackServer, which still owns the refused fd, closes it once.
+static void runRejection() {
+    HostDevice dev(1);
+    PeerLink first(dev.connect());
+    REQUIRE(first.connect(kCaps, CONFIG_PASSPHRASE));
+
+    PeerLink second(dev.connect());
+    CHECK(dev.lastId.load() == ConnectionManager::kNoConnection);
+    uint8_t byte;
+    CHECK(::read(second.fd(), &byte, 1) == 0);
+    CHECK(dev.connections.size() == 1);
+
+    dev.store.setInt(ParameterId::BlinkCount, 5);
+    std::vector<uint8_t> msg;
+    pModel_IntParameter v;
+    bool seen = false;
+    while (!seen && first.receive(msg, 2000)) {
+        seen = peermsg::decodeInt(msg, v) && v.id == static_cast<uint32_t>(ParameterId::BlinkCount) && v.value == 5;
+    }
+    CHECK(seen);
+}
+
+// Clients leave while changes are still being broadcast to them: stop()
+// must not reset the send pool under a producer that is queueing a frame.
+static void runStopUnderLoad() {
+    constexpr size_t kClients = 4;
+    HostDevice dev(kClients);
+    const size_t params = dev.store.listMeta().size();
+    std::vector<std::unique_ptr<PeerLink>> peers;
+    for (size_t i = 0; i < kClients; i++) {
+        peers.push_back(std::make_unique<PeerLink>(dev.connect()));
+        REQUIRE(peers.back()->connect(kCaps, CONFIG_PASSPHRASE));
+        REQUIRE(peermsg::readDump(*peers.back(), params, 10000));
+    }
+
+    std::atomic<bool> producing{true};
+    std::thread producer([&]{
+        for (int32_t i = 1; producing.load(); i = i % 99999 + 1) dev.store.setInt(ParameterId::Uptime, i);
+    });
+    for (auto& peer : peers) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(20));
+        peer->close();
+    }
+    int64_t deadline = osport::nowUs() + 5000000;
+    while (dev.connections.size() > 0 && osport::nowUs() < deadline) std::this_thread::yield();
+    producing = false;
+    producer.join();
+    CHECK(dev.connections.size() == 0);
+}
+
+int main() {
+    runRejection();
+    runStopUnderLoad();
+    for (size_t clients : {1, 4, 16}) runLoad(clients);
+    return CHECK_RESULT();
+}
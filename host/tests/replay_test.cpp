@@ -0,0 +1,208 @@
+// Counter nonces and the 64-frame replay window: ReplayWindow on its own, up
+// to the top of the sequence space, then an ECDH device/client pair whose
+// sealed frames arrive duplicated, reordered, too old, from the wrong
+// direction or with a header (the AAD) that does not match, and a pair whose
+// guard line was rewritten.
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "check.hpp"
+#include "crypto_ecdh_aes.hpp"
+#include "protocol/frame_codec.hpp"
+#include "protocol/link_caps.hpp"
+#include "replay_window.hpp"
+
+using Frame = std::vector<uint8_t>;
+
+static void windowInOrderAndDuplicates() {
+    ReplayWindow w;
+    CHECK(w.check(0));
+    w.accept(0);
+    CHECK(!w.check(0));
+    for (uint64_t seq = 1; seq < 200; seq++) {
+        CHECK(w.check(seq));
+        w.accept(seq);
+        CHECK(!w.check(seq));
+        CHECK(!w.check(seq - 1));
+    }
+    w.reset();
+    CHECK(w.check(0));
+}
+
+static void windowReordered() {
+    ReplayWindow w;
+    w.accept(10);
+    // Everything below the highest but inside the window is still fresh once.
+    for (uint64_t seq : {3, 9, 0, 7}) {
+        CHECK(w.check(seq));
+        w.accept(seq);
+        CHECK(!w.check(seq));
+    }
+    CHECK(w.check(8));
+    CHECK(w.check(11));
+}
+
+static void windowEdges() {
+    ReplayWindow w;
+    w.accept(100);
+    CHECK(w.check(100 - (ReplayWindow::kSize - 1)));
+    CHECK(!w.check(100 - ReplayWindow::kSize));
+    CHECK(!w.check(0));
+
+    // A shift of 63 keeps the oldest bit, 64 drops it together with the
+    // window, after which the old number is out of range anyway.
+    ReplayWindow a;
+    a.accept(0);
+    a.accept(63);
+    CHECK(!a.check(0));
+    ReplayWindow b;
+    b.accept(0);
+    b.accept(64);
+    CHECK(!b.check(0));
+    CHECK(b.check(1));
+    b.accept(1000);
+    CHECK(b.check(999));
+    CHECK(!b.check(64));
+}
+
+// The sender stops at UINT64_MAX instead of wrapping; the receiver must not
+// treat small numbers after the top of the range as newer.
+static void windowWrap() {
+    ReplayWindow w;
+    w.accept(UINT64_MAX - 1);
+    CHECK(w.check(UINT64_MAX));
+    w.accept(UINT64_MAX);
+    CHECK(!w.check(UINT64_MAX));
+    CHECK(!w.check(UINT64_MAX - 1));
+    CHECK(w.check(UINT64_MAX - (ReplayWindow::kSize - 1)));
+    CHECK(!w.check(UINT64_MAX - ReplayWindow::kSize));
+    CHECK(!w.check(0));
+    CHECK(!w.check(1));
+
+    ReplayWindow j;
+    j.accept(0);
+    j.accept(UINT64_MAX);
+    CHECK(!j.check(0));
+    CHECK(j.check(UINT64_MAX - 2));
+}
+
+// Device and client ends of one ephemeral session with counter nonces.
+struct Pair {
+    CryptoEcdhAes device{CryptoEcdhAes::Mode::EPHEMERAL};
+    CryptoEcdhAes client{CryptoEcdhAes::Mode::EPHEMERAL};
+    FrameCodec codec;
+
+    // With `offered` set both ends bind their guard line as the protocols
+    // do; `seen` is the line as it reached the device.
+    bool init(uint32_t offered = 0, uint32_t seen = 0, uint32_t accepted = 0) {
+        uint8_t dk[CryptoEcdhAes::kMaxPublicKeyLen];
+        uint8_t ck[CryptoEcdhAes::kMaxPublicKeyLen];
+        size_t dn = device.write_public_key(dk, sizeof(dk));
+        size_t cn = client.write_public_key(ck, sizeof(ck));
+        if (!dn || !cn || !device.apply_other_public_raw(ck, cn) || !client.apply_other_public_raw(dk, dn)) return false;
+        if (offered && (!device.bind_caps(seen, accepted) || !client.bind_caps(offered, accepted))) return false;
+        return device.enable_counter_nonces(CryptoEcdhAes::Side::Device) &&
+               client.enable_counter_nonces(CryptoEcdhAes::Side::Client);
+    }
+
+    // As the protocols do: the frame's length prefix is the AAD.
+    Frame seal(CryptoEcdhAes& from, const std::string& text) {
+        Frame f(text.size() + from.overhead());
+        memcpy(f.data() + from.nonce_field_len(), text.data(), text.size());
+        uint8_t aad[FrameCodec::kMaxHeaderLen];
+        size_t aadLen = codec.encodeHeader(f.size(), aad);
+        if (!from.seal(f.data(), text.size(), aad, aadLen)) return {};
+        return f;
+    }
+
+    // Works on a copy: open() decrypts in place.
+    bool open(CryptoEcdhAes& to, Frame f, std::string* text = nullptr, size_t aadLen = SIZE_MAX) {
+        uint8_t aad[FrameCodec::kMaxHeaderLen];
+        size_t n = codec.encodeHeader(f.size(), aad);
+        uint8_t* plain;
+        size_t plainLen;
+        if (!to.open(f.data(), f.size(), plain, plainLen, aad, aadLen == SIZE_MAX ? n : aadLen)) return false;
+        if (text) text->assign(reinterpret_cast<const char*>(plain), plainLen);
+        return true;
+    }
+};
+
+static void sessionFrames() {
+    Pair p;
+    REQUIRE(p.init());
+    CHECK(p.client.nonce_field_len() == CryptoEcdhAes::kSeqLen);
+
+    std::vector<Frame> up;
+    for (int i = 0; i < 100; i++) up.push_back(p.seal(p.client, "frame " + std::to_string(i)));
+    for (auto& f : up) REQUIRE(!f.empty());
+
+    std::string text;
+    CHECK(p.open(p.device, up[0], &text) && text == "frame 0");
+    CHECK(!p.open(p.device, up[0]));                  // duplicate
+    CHECK(p.open(p.device, up[5], &text) && text == "frame 5");
+    CHECK(p.open(p.device, up[2]));                   // reordered, inside the window
+    CHECK(!p.open(p.device, up[2]));
+    CHECK(p.open(p.device, up[99]));
+    CHECK(p.open(p.device, up[99 - 63]));             // oldest still in the window
+    CHECK(!p.open(p.device, up[99 - 64]));            // fell out of it
+    CHECK(!p.open(p.device, up[1]));
+
+    // A frame only authenticates in the direction it was sealed for.
+    Frame down = p.seal(p.device, "down 0");
+    CHECK(!p.open(p.device, down));
+    CHECK(!p.open(p.client, up[0]));
+    CHECK(p.open(p.client, down, &text) && text == "down 0");
+}
+
+// A forged frame must not move the window: its sequence number stays usable
+// for the genuine frame.
+static void sessionForgery() {
+    Pair p;
+    REQUIRE(p.init());
+    Frame f0 = p.seal(p.client, "first");
+    Frame f1 = p.seal(p.client, "second");
+
+    CHECK(!p.open(p.device, f1, nullptr, 0));         // header left out of the AAD
+
+    Frame body = f1;
+    body[CryptoEcdhAes::kSeqLen] ^= 1;
+    CHECK(!p.open(p.device, body));
+    Frame seq = f1;
+    seq[CryptoEcdhAes::kSeqLen - 1] ^= 1;             // now claims seq 0
+    CHECK(!p.open(p.device, seq));
+
+    CHECK(p.open(p.device, f1));
+    CHECK(p.open(p.device, f0));
+}
+
+// The caps of the guard line are mixed into the key: a line rewritten on the
+// way, here with ChaChaPoly stripped, leaves the two ends with different keys.
+static void sessionCapsBinding() {
+    const uint32_t accepted = linkcaps::CipherEphemeral | linkcaps::CounterNonce;
+    const uint32_t offered = accepted | linkcaps::ChaChaPoly;
+    Pair same;
+    REQUIRE(same.init(offered, offered, accepted));
+    CHECK(same.open(same.device, same.seal(same.client, "caps")));
+    CHECK(same.open(same.client, same.seal(same.device, "caps")));
+
+    Pair stripped;
+    REQUIRE(stripped.init(offered, accepted, accepted));
+    CHECK(!stripped.open(stripped.device, stripped.seal(stripped.client, "caps")));
+    CHECK(!stripped.open(stripped.client, stripped.seal(stripped.device, "caps")));
+
+    // Binding after counter nonces would desync the nonce prefixes.
+    CHECK(!same.device.bind_caps(offered, accepted));
+}
+
+int main() {
+    windowInOrderAndDuplicates();
+    windowReordered();
+    windowEdges();
+    windowWrap();
+    sessionFrames();
+    sessionForgery();
+    sessionCapsBinding();
+    return CHECK_RESULT();
+}
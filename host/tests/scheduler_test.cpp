@@ -0,0 +1,164 @@
+// JobScheduler on the host backend: jobs run in order of their due time, a
+// fixed period does not drift, a job that fell behind skips its missed runs
+// instead of bursting, overruns are counted against the budget, and once,
+// kDone, cancel and jobs added from a job behave as documented.
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <mutex>
+#include <vector>
+#include "check.hpp"
+#include "esp_log.h"
+#include "job_scheduler.hpp"
+#include "os_port.hpp"
+
+// Start times of a job's runs, written on the scheduler task.
+struct Runs {
+    mutable std::mutex mtx;
+    std::vector<int64_t> at;
+
+    void mark() {
+        std::lock_guard<std::mutex> lock(mtx);
+        at.push_back(osport::nowUs());
+    }
+    std::vector<int64_t> get() const {
+        std::lock_guard<std::mutex> lock(mtx);
+        return at;
+    }
+};
+
+// Cancels and waits out a run that may still be in progress.
+static void stop(JobScheduler& jobs, JobScheduler::JobId id) {
+    jobs.cancel(id);
+    osport::delayMs(20);
+}
+
+// Due first runs first, whatever the order of add(); a job added with an
+// earlier due time while the task waits for a later one cuts the wait short.
+static void deadlineOrder(JobScheduler& jobs) {
+    std::mutex mtx;
+    std::vector<int> order;
+    auto record = [&](int n) {
+        return [&, n] {
+            std::lock_guard<std::mutex> lock(mtx);
+            order.push_back(n);
+        };
+    };
+    jobs.once("late", 60, record(3));
+    jobs.once("early", 20, record(1));
+    jobs.once("middle", 40, record(2));
+    osport::delayMs(5);
+    jobs.once("now", 0, record(0));
+    osport::delayMs(120);
+    std::lock_guard<std::mutex> lock(mtx);
+    CHECK(order == std::vector<int>({0, 1, 2, 3}));
+}
+
+// Runs are due against the previous due time, so the n-th run of a 10 ms job
+// starts near first + n * 10 ms, however late each one started.
+static void periodWithoutDrift(JobScheduler& jobs) {
+    Runs runs;
+    const int64_t addedUs = osport::nowUs();
+    auto id = jobs.every("period", 10, 0, [&] {
+        runs.mark();
+        osport::delayMs(2);  // a run that takes time must not push the next ones
+    });
+    osport::delayMs(405);
+    stop(jobs, id);
+    auto at = runs.get();
+    REQUIRE(at.size() >= 30);
+    CHECK(at.size() <= 41);
+    const size_t n = at.size() - 1;
+    printf("period: %zu runs, %.0f us apart on average, jitter max %u us\n", at.size(), double(at[n] - at[0]) / n,
+           (unsigned)jobs.stats(id).jitterMaxUs);
+    // Drift would add up over the runs; the last one still starts close to
+    // its slot, and no run starts before it.
+    const int64_t slotUs = addedUs + int64_t(n + 1) * 10000;
+    CHECK(at[n] >= slotUs);
+    CHECK(at[n] - slotUs < 8000);
+    JobScheduler::Stats s = jobs.stats(id);
+    CHECK(s.runs == at.size());
+    CHECK(s.overruns == 0);  // no budget
+    CHECK(s.runMaxUs >= 2000);
+}
+
+// One 60 ms stall of a 5 ms job: afterwards the job resumes its period from
+// the end of the stall instead of running the dozen missed slots back to back.
+static void skipMissedRuns(JobScheduler& jobs) {
+    Runs runs;
+    std::atomic<int> n{0};
+    auto id = jobs.every("stall", 5, 0, [&] {
+        runs.mark();
+        if (++n == 3) osport::delayMs(60);
+    });
+    osport::delayMs(150);
+    stop(jobs, id);
+    auto at = runs.get();
+    REQUIRE(at.size() >= 6);
+    int burst = 0;
+    for (size_t i = 4; i < at.size(); i++) {
+        if (at[i] - at[i - 1] < 2000) burst++;
+    }
+    CHECK(burst <= 1);
+    CHECK(at.size() < 150 / 5);
+}
+
+// Every other run takes 3 ms against a 1 ms budget.
+static void overruns(JobScheduler& jobs) {
+    std::atomic<int> n{0};
+    auto id = jobs.every("budget", 5, 1000, [&] {
+        if (++n % 2 == 0) osport::delayMs(3);
+    });
+    osport::delayMs(100);
+    stop(jobs, id);
+    JobScheduler::Stats s = jobs.stats(id);
+    printf("overruns: %u of %u runs, run max %u us\n", (unsigned)s.overruns, (unsigned)s.runs, (unsigned)s.runMaxUs);
+    REQUIRE(s.runs >= 6);
+    CHECK(s.runs == uint32_t(n.load()));
+    // Host threads can be preempted, so a short run may overrun too.
+    CHECK(s.overruns >= s.runs / 2);
+    CHECK(s.overruns < s.runs);
+    CHECK(s.runMaxUs >= 3000);
+}
+
+static void lifecycle(JobScheduler& jobs) {
+    // once runs once; a job returning kDone stops; its slot is reused.
+    std::atomic<int> once{0};
+    auto first = jobs.once("once", 0, [&] { once++; });
+    std::atomic<int> countdown{3};
+    auto done = jobs.add("countdown", 0, 0, [&] { return --countdown > 0 ? 1u : JobScheduler::kDone; });
+    osport::delayMs(40);
+    CHECK(once.load() == 1);
+    CHECK(countdown.load() == 0);
+    CHECK(jobs.stats(done).runs == 3);
+    auto reused = jobs.once("reuse", 0, [] {});
+    CHECK(reused == first || reused == done);
+
+    // cancel stops a periodic job; a job may add another from its run.
+    std::atomic<int> ticks{0};
+    std::atomic<int> child{0};
+    auto tick = jobs.every("tick", 2, 0, [&] {
+        if (++ticks == 1) jobs.once("child", 0, [&] { child++; });
+    });
+    osport::delayMs(30);
+    stop(jobs, tick);
+    int after = ticks.load();
+    CHECK(after > 1);
+    CHECK(child.load() == 1);
+    osport::delayMs(30);
+    CHECK(ticks.load() == after);
+}
+
+int main() {
+    esp_log_level_set("*", ESP_LOG_WARN);
+    // Runs for the life of the process, as on the device.
+    auto* jobs = new JobScheduler();
+    REQUIRE(jobs->start());
+    deadlineOrder(*jobs);
+    periodWithoutDrift(*jobs);
+    skipMissedRuns(*jobs);
+    overruns(*jobs);
+    lifecycle(*jobs);
+    return CHECK_RESULT();
+}
@@ -0,0 +1,84 @@
+// One client session per cipher over a socketpair: handshake, the initial
+// ParameterInfo and value dump (batched and compressed where offered), then a
+// set that comes back as a broadcast.
+#include <cstdio>
+#include "check.hpp"
+#include "device/host_device.hpp"
+#include "peer/peer_link.hpp"
+#include "peer/peer_messages.hpp"
+
+using paramstore::ParameterId;
+
+static void runSession(const char* name, uint32_t caps) {
+    fprintf(stderr, "--- %s (caps=0x%x)\n", name, (unsigned)caps);
+    HostDevice dev;
+    PeerLink peer(dev.connect());
+    REQUIRE(peer.connect(caps, CONFIG_PASSPHRASE));
+    CHECK((peer.caps() & linkcaps::kCipherMask) == (caps & linkcaps::kCipherMask));
+    CHECK((peer.caps() & linkcaps::CounterNonce) == (caps & linkcaps::CounterNonce));
+    REQUIRE(dev.waitReady(1));
+
+    CHECK(peermsg::readDump(peer, dev.store.listMeta().size()));
+
+    std::vector<uint8_t> msg;
+    const auto id = static_cast<uint32_t>(ParameterId::BlinkCount);
+    REQUIRE(peer.send(peermsg::setInt(id, 7)));
+    pModel_IntParameter echo;
+    bool echoed = false;
+    while (!echoed && peer.receive(msg, 2000)) {
+        echoed = peermsg::decodeInt(msg, echo) && echo.id == id;
+    }
+    CHECK(echoed && echo.value == 7);
+    CHECK(dev.store.getInt(ParameterId::BlinkCount) == 7);
+
+    // Read-only: refused, so nothing is broadcast and the device's value stays.
+    REQUIRE(peer.send(peermsg::setInt(static_cast<uint32_t>(ParameterId::LinkBytesIn), 12345)));
+    REQUIRE(peer.send(peermsg::setInt(id, 8)));
+    echoed = false;
+    while (!echoed && peer.receive(msg, 2000)) {
+        if (!peermsg::decodeInt(msg, echo)) continue;
+        CHECK(echo.id != static_cast<uint32_t>(ParameterId::LinkBytesIn) || echo.value != 12345);
+        echoed = echo.id == id && echo.value == 8;
+    }
+    CHECK(echoed);
+    CHECK(dev.store.getInt(ParameterId::LinkBytesIn) != 12345);
+}
+
+// A full handshake that offers Resume leaves a ticket; the next session
+// redeems it instead of running ECDH and carries the dump all the same.
+static void runResumed(const char* name, uint32_t caps) {
+    fprintf(stderr, "--- %s (caps=0x%x)\n", name, (unsigned)caps);
+    HostDevice dev;
+    PeerLink::Ticket ticket;
+    {
+        PeerLink full(dev.connect());
+        REQUIRE(full.connect(caps, CONFIG_PASSPHRASE));
+        CHECK(!full.resumed());
+        CHECK(peermsg::readDump(full, dev.store.listMeta().size()));
+        ticket = full.ticket();
+    }
+    REQUIRE(ticket.valid);
+    PeerLink resumed(dev.connect());
+    resumed.resumeWith(ticket);
+    REQUIRE(resumed.connect(caps, CONFIG_PASSPHRASE));
+    CHECK(resumed.resumed());
+    CHECK(peermsg::readDump(resumed, dev.store.listMeta().size()));
+}
+
+int main() {
+    runSession("raw", linkcaps::CipherRaw);
+    runSession("passphrase", linkcaps::CipherPassphrase);
+    runSession("passphrase chacha varint", linkcaps::CipherPassphrase | linkcaps::ChaChaPoly | linkcaps::FramingVarint);
+    runSession("ephemeral", linkcaps::CipherEphemeral);
+    runSession("ephemeral binary x25519 chacha", linkcaps::CipherEphemeral | linkcaps::BinaryHandshake |
+               linkcaps::CurveX25519 | linkcaps::ChaChaPoly | linkcaps::FramingVarint);
+    runSession("ephemeral counter nonces", linkcaps::CipherEphemeral | linkcaps::CounterNonce);
+    runSession("ephemeral binary counter nonces chacha varint", linkcaps::CipherEphemeral | linkcaps::BinaryHandshake |
+               linkcaps::CounterNonce | linkcaps::ChaChaPoly | linkcaps::FramingVarint);
+    runSession("ephemeral batching compression", linkcaps::CipherEphemeral | linkcaps::FramingVarint |
+               linkcaps::Batching | linkcaps::Compression);
+    runResumed("ephemeral resumed", linkcaps::CipherEphemeral | linkcaps::Resume);
+    runResumed("ephemeral binary resumed counter nonces chacha", linkcaps::CipherEphemeral |
+               linkcaps::BinaryHandshake | linkcaps::Resume | linkcaps::CounterNonce | linkcaps::ChaChaPoly);
+    return CHECK_RESULT();
+}
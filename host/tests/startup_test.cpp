@@ -0,0 +1,122 @@
+// StartupOrchestrator on the host backend: validate() refuses unknown,
+// duplicate and cyclic dependencies; with several workers no stage starts
+// before the stages it needs have finished; a failed stage skips everything
+// behind it and nothing else; and an orchestrator can be destroyed as soon
+// as run() returns, while its workers are still on their way out.
+#include <atomic>
+#include <cstdio>
+#include <memory>
+#include <string>
+#include <vector>
+#include "check.hpp"
+#include "esp_log.h"
+#include "os_port.hpp"
+#include "startup_orchestrator.hpp"
+
+static void refusals() {
+    {
+        StartupOrchestrator s;
+        s.add("a", {}, [] { return true; });
+        s.add("b", {"missing"}, [] { return true; });
+        CHECK(!s.validate());
+        CHECK(!s.run(2));
+    }
+    {
+        StartupOrchestrator s;
+        s.add("a", {}, [] { return true; });
+        s.add("a", {}, [] { return true; });
+        CHECK(!s.validate());
+    }
+    {
+        StartupOrchestrator s;
+        bool ran = false;
+        s.add("root", {}, [&] { return ran = true; });
+        s.add("a", {"root", "c"}, [] { return true; });
+        s.add("b", {"a"}, [] { return true; });
+        s.add("c", {"b"}, [] { return true; });
+        CHECK(!s.validate());
+        CHECK(!s.run(2));
+        CHECK(!ran);
+    }
+}
+
+// Per stage: the order it started and ended in.
+struct Trace {
+    std::atomic<int> clock{0};
+    int start[8] = {};
+    int end[8] = {};
+
+    StartupOrchestrator::StageFn stage(int i, bool ok = true) {
+        return [this, i, ok] {
+            start[i] = ++clock;
+            osport::delayMs(1 + i % 3);
+            end[i] = ++clock;
+            return ok;
+        };
+    }
+};
+
+// Boot-shaped graph, declared out of order:
+//   nvs -> store -> {bt, uart} -> link ; timers ; report <- {link, timers}
+static void ordering(size_t workers) {
+    StartupOrchestrator s;
+    Trace t;
+    enum { Link, Bt, Uart, Store, Nvs, Timers, Report };
+    s.add("link", {"bt", "uart"}, t.stage(Link));
+    s.add("bt", {"store"}, t.stage(Bt));
+    s.add("uart", {"store"}, t.stage(Uart));
+    s.add("store", {"nvs"}, t.stage(Store));
+    s.add("nvs", {}, t.stage(Nvs));
+    s.add("timers", {}, t.stage(Timers));
+    s.add("report", {"link", "timers"}, t.stage(Report));
+    REQUIRE(s.validate());
+    CHECK(s.run(workers));
+
+    const std::vector<std::pair<int, int>> edges = {
+        {Nvs, Store}, {Store, Bt}, {Store, Uart}, {Bt, Link}, {Uart, Link}, {Link, Report}, {Timers, Report}};
+    for (auto [dep, stage] : edges) {
+        CHECK(t.start[dep] > 0 && t.end[dep] < t.start[stage]);
+    }
+    for (int i = Link; i <= Report; i++) CHECK(t.end[i] > t.start[i]);
+}
+
+// store fails: everything that needs it is skipped, the rest still runs.
+static void failure(size_t workers) {
+    StartupOrchestrator s;
+    Trace t;
+    enum { Nvs, Store, Bt, Link, Timers, Led };
+    s.add("nvs", {}, t.stage(Nvs));
+    s.add("store", {"nvs"}, t.stage(Store, false));
+    s.add("bt", {"store"}, t.stage(Bt));
+    s.add("link", {"bt", "timers"}, t.stage(Link));
+    s.add("timers", {}, t.stage(Timers));
+    s.add("led", {"timers"}, t.stage(Led));
+    CHECK(!s.run(workers));
+    CHECK(t.start[Nvs] > 0 && t.start[Store] > 0);
+    CHECK(t.start[Bt] == 0);
+    CHECK(t.start[Link] == 0);
+    CHECK(t.start[Timers] > 0 && t.start[Led] > 0);
+}
+
+// run() returns once its workers have left; deleting the orchestrator right
+// after must never race with a worker still signalling it.
+static void teardown() {
+    int ok = 0;
+    for (int i = 0; i < 300; i++) {
+        auto s = std::make_unique<StartupOrchestrator>();
+        for (const char* name : {"a", "b", "c", "d"}) s->add(name, {}, [] { return true; });
+        if (s->run(4)) ok++;
+    }
+    CHECK(ok == 300);
+}
+
+int main() {
+    esp_log_level_set("*", ESP_LOG_NONE);
+    refusals();
+    for (size_t workers : {1, 2, 4}) {
+        ordering(workers);
+        failure(workers);
+    }
+    teardown();
+    return CHECK_RESULT();
+}
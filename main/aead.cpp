@@ -0,0 +1,86 @@
+#include "aead.hpp"
+#include "esp_log.h"
+
+static const char* TAG = "Aead";
+
+std::unique_ptr<Aead> Aead::create(Kind kind) {
+    switch (kind) {
+        case Kind::AesGcm:
+            return std::make_unique<AesGcmAead>();
+        case Kind::ChaChaPoly:
+#if defined(MBEDTLS_CHACHAPOLY_C)
+            return std::make_unique<ChaChaPolyAead>();
+#else
+            return nullptr;
+#endif
+    }
+    return nullptr;
+}
+
+bool AesGcmAead::set_key(const uint8_t* key, size_t key_len) {
+    int ret = mbedtls_gcm_setkey(&ctx, MBEDTLS_CIPHER_ID_AES, key, key_len * 8);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "gcm_setkey failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+bool AesGcmAead::seal(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                      uint8_t* text, size_t len, uint8_t* tag) {
+    int ret = mbedtls_gcm_crypt_and_tag(&ctx, MBEDTLS_GCM_ENCRYPT, len, nonce, kNonceLen,
+                                        aad, aad_len, text, text, kTagLen, tag);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "gcm_crypt_and_tag failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+bool AesGcmAead::open(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                      uint8_t* text, size_t len, const uint8_t* tag) {
+    int ret = mbedtls_gcm_auth_decrypt(&ctx, len, nonce, kNonceLen, aad, aad_len,
+                                       tag, kTagLen, text, text);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "gcm_auth_decrypt failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+#if defined(MBEDTLS_CHACHAPOLY_C)
+
+bool ChaChaPolyAead::set_key(const uint8_t* key, size_t key_len) {
+    if (key_len != 32) {
+        ESP_LOGE(TAG, "chachapoly needs a 32-byte key, got %u", (unsigned)key_len);
+        return false;
+    }
+    int ret = mbedtls_chachapoly_setkey(&ctx, key);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "chachapoly_setkey failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+bool ChaChaPolyAead::seal(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                          uint8_t* text, size_t len, uint8_t* tag) {
+    int ret = mbedtls_chachapoly_encrypt_and_tag(&ctx, len, nonce, aad, aad_len, text, text, tag);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "chachapoly_encrypt_and_tag failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+bool ChaChaPolyAead::open(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                          uint8_t* text, size_t len, const uint8_t* tag) {
+    int ret = mbedtls_chachapoly_auth_decrypt(&ctx, len, nonce, aad, aad_len, tag, text, text);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "chachapoly_auth_decrypt failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+#endif
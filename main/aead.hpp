@@ -0,0 +1,74 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include "mbedtls/gcm.h"
+#if defined(MBEDTLS_CHACHAPOLY_C)
+#include "mbedtls/chachapoly.h"
+#endif
+
+// Session cipher behind CryptoEcdhAes. Both backends take a 12-byte nonce and
+// produce a 16-byte tag, so the sealed frame layout does not depend on the
+// backend; only the key schedule does. The mbedTLS contexts keep state
+// between the calls of one operation, so an instance must not seal and open
+// on two threads at once; CryptoEcdhAes keeps one per direction.
+class Aead {
+public:
+    enum class Kind : uint8_t { AesGcm, ChaChaPoly };
+
+    static constexpr size_t kNonceLen = 12;
+    static constexpr size_t kTagLen = 16;
+
+    virtual ~Aead() = default;
+
+    // nullptr if the backend is not compiled into mbedTLS.
+    static std::unique_ptr<Aead> create(Kind kind);
+
+    virtual Kind kind() const = 0;
+    // Key length of an ECDH or resumed session (the passphrase key is always 32 bytes).
+    virtual size_t session_key_len() const = 0;
+    virtual bool set_key(const uint8_t* key, size_t key_len) = 0;
+    // In place; tag is written after / read from a separate pointer.
+    virtual bool seal(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                      uint8_t* text, size_t len, uint8_t* tag) = 0;
+    virtual bool open(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+                      uint8_t* text, size_t len, const uint8_t* tag) = 0;
+};
+
+class AesGcmAead : public Aead {
+public:
+    AesGcmAead() { mbedtls_gcm_init(&ctx); }
+    ~AesGcmAead() override { mbedtls_gcm_free(&ctx); }
+
+    Kind kind() const override { return Kind::AesGcm; }
+    size_t session_key_len() const override { return 16; }
+    bool set_key(const uint8_t* key, size_t key_len) override;
+    bool seal(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+              uint8_t* text, size_t len, uint8_t* tag) override;
+    bool open(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+              uint8_t* text, size_t len, const uint8_t* tag) override;
+
+private:
+    mbedtls_gcm_context ctx;
+};
+
+#if defined(MBEDTLS_CHACHAPOLY_C)
+// RFC 8439. Faster than AES-GCM in software, i.e. on targets or builds
+// without the AES accelerator.
+class ChaChaPolyAead : public Aead {
+public:
+    ChaChaPolyAead() { mbedtls_chachapoly_init(&ctx); }
+    ~ChaChaPolyAead() override { mbedtls_chachapoly_free(&ctx); }
+
+    Kind kind() const override { return Kind::ChaChaPoly; }
+    size_t session_key_len() const override { return 32; }
+    bool set_key(const uint8_t* key, size_t key_len) override;
+    bool seal(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+              uint8_t* text, size_t len, uint8_t* tag) override;
+    bool open(const uint8_t* nonce, const uint8_t* aad, size_t aad_len,
+              uint8_t* text, size_t len, const uint8_t* tag) override;
+
+private:
+    mbedtls_chachapoly_context ctx;
+};
+#endif
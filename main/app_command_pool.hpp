@@ -0,0 +1,148 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <span>
+#include "sdkconfig.h"
+#include "esp_log.h"
+#include "os_port.hpp"
+#include "link_metrics.hpp"
+#include "connection_manager.hpp"
+
+#ifndef CONFIG_APP_COMMAND_SLOTS
+#define CONFIG_APP_COMMAND_SLOTS 16
+#endif
+#ifndef CONFIG_APP_COMMAND_PAYLOAD
+#define CONFIG_APP_COMMAND_PAYLOAD 256
+#endif
+
+enum class AppCommandType : uint8_t {
+	CleanupConnection,
+	DataReceived,
+	RestartConnection,
+	RestartServer,
+    SendAllParameters,
+};
+
+// One slot of the pool. The payload is stored inline, so a received frame is
+// copied exactly once, from the protocol's receive buffer into the slot.
+struct AppCommand {
+    static constexpr size_t kMaxPayload = CONFIG_APP_COMMAND_PAYLOAD;
+
+    AppCommandType type = AppCommandType::DataReceived;
+    ConnectionManager::ConnectionId connId = ConnectionManager::kNoConnection;
+    uint16_t len = 0;
+    uint8_t payload[kMaxPayload];
+
+    std::span<const uint8_t> bytes() const { return {payload, len}; }
+};
+
+// Fixed pool of AppCommand slots and the queue that hands them to appTask.
+//
+// acquire() returns a move-only handle; the slot goes back to the pool when
+// the handle is destroyed, whether the command was handled or refused. post()
+// transfers ownership through the queue without copying the slot. The queue
+// holds as many entries as there are slots, and received frames leave the
+// last kControlReserve slots to connection and restart commands, so a burst
+// of data cannot starve a cleanup. An empty pool, a full queue and an
+// oversized frame are each counted in LinkMetrics and the command is dropped,
+// never leaked.
+class AppCommandPool {
+public:
+    struct Release {
+        AppCommandPool* pool;
+        void operator()(AppCommand* cmd) const { pool->release(cmd); }
+    };
+    using Ptr = std::unique_ptr<AppCommand, Release>;
+
+    static constexpr size_t kSlots = CONFIG_APP_COMMAND_SLOTS;
+    static constexpr size_t kControlReserve = 2;
+    static_assert(kSlots > kControlReserve && kSlots <= 255, "APP_COMMAND_SLOTS out of range");
+
+    AppCommandPool() {
+        for (size_t i = 0; i < kSlots; i++) free_[i] = static_cast<uint8_t>(i);
+        freeCount_ = kSlots;
+    }
+
+    AppCommandPool(const AppCommandPool&) = delete;
+    AppCommandPool& operator=(const AppCommandPool&) = delete;
+
+    bool start() { return queue_.create(kSlots); }
+
+    // Empty handle when no slot is free for this type.
+    Ptr acquire(AppCommandType type, ConnectionManager::ConnectionId connId = ConnectionManager::kNoConnection) {
+        AppCommand* cmd = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mtx_);
+            size_t reserve = type == AppCommandType::DataReceived ? kControlReserve : 0;
+            if (freeCount_ > reserve) cmd = &slots_[free_[--freeCount_]];
+        }
+        if (!cmd) {
+            LinkMetrics::add(linkMetrics().appPoolExhausted);
+            return Ptr(nullptr, Release{this});
+        }
+        cmd->type = type;
+        cmd->connId = connId;
+        cmd->len = 0;
+        return Ptr(cmd, Release{this});
+    }
+
+    // Takes a slot and copies data into it in one go.
+    Ptr acquire(AppCommandType type, ConnectionManager::ConnectionId connId, const uint8_t* data, size_t len) {
+        if (len > AppCommand::kMaxPayload) {
+            LinkMetrics::add(linkMetrics().appOversize);
+            ESP_LOGW("AppCommandPool", "Frame of %u bytes exceeds slot payload %u", (unsigned)len, (unsigned)AppCommand::kMaxPayload);
+            return Ptr(nullptr, Release{this});
+        }
+        Ptr cmd = acquire(type, connId);
+        if (cmd) {
+            memcpy(cmd->payload, data, len);
+            cmd->len = static_cast<uint16_t>(len);
+        }
+        return cmd;
+    }
+
+    // Hands the command to appTask; on a full queue the slot returns to the pool.
+    bool post(Ptr cmd) {
+        if (!cmd) return false;
+        if (!queue_.send(cmd.get(), 0)) {
+            LinkMetrics::add(linkMetrics().appQueueFull);
+            ESP_LOGW("AppCommandPool", "Queue full, command %d dropped", (int)cmd->type);
+            return false;
+        }
+        cmd.release();
+        return true;
+    }
+
+    bool post(AppCommandType type, ConnectionManager::ConnectionId connId = ConnectionManager::kNoConnection) {
+        return post(acquire(type, connId));
+    }
+
+    // Blocks for the next command; the returned handle owns the slot.
+    Ptr receive(uint32_t timeoutMs = osport::kWaitForever) {
+        AppCommand* cmd = nullptr;
+        if (!queue_.receive(cmd, timeoutMs)) return Ptr(nullptr, Release{this});
+        return Ptr(cmd, Release{this});
+    }
+
+    size_t waiting() const { return queue_.waiting(); }
+
+    size_t inUse() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return kSlots - freeCount_;
+    }
+
+private:
+    void release(AppCommand* cmd) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        free_[freeCount_++] = static_cast<uint8_t>(cmd - slots_.data());
+    }
+
+    std::array<AppCommand, kSlots> slots_;
+    std::array<uint8_t, kSlots> free_;
+    size_t freeCount_ = 0;
+    mutable std::mutex mtx_;
+    osport::Queue<AppCommand*> queue_;
+};
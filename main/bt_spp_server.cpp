@@ -10,6 +10,7 @@
 #include "esp_spp_api.h"
 #include "esp_vfs.h"      
 #include "sdkconfig.h"
+#include "timeline.hpp"
 
 static const char* TAG = "BtSppServer";
 BtSppServer* BtSppServer::self_ = nullptr;
@@ -26,11 +27,11 @@ static char *bda2str(uint8_t * bda, char *str, size_t size)
     return str;
 }
 
-esp_err_t BtSppServer::start(const char* serverName) {
-	name = serverName;
-	char bda_str[18] = {0};
+esp_err_t BtSppServer::bringUp() {
+    if (up_) return ESP_OK;
     self_ = this;
     esp_err_t ret;
+    TIMELINE_MARK(BtBringUpBegin, 0);
 
     ESP_ERROR_CHECK_WITHOUT_ABORT(esp_bt_controller_mem_release(ESP_BT_MODE_BLE));
 
@@ -70,6 +71,16 @@ esp_err_t BtSppServer::start(const char* serverName) {
     ESP_ERROR_CHECK(esp_bt_gap_set_security_param(ESP_BT_SP_IOCAP_MODE, &iocap, sizeof(iocap)));
     
     if (on_event_) on_event_(Event::GapReady, ESP_OK);
+    up_ = true;
+    TIMELINE_MARK(BtBringUpEnd, 0);
+    return ESP_OK;
+}
+
+esp_err_t BtSppServer::start(const char* serverName) {
+	name = serverName;
+	char bda_str[18] = {0};
+    esp_err_t ret = bringUp();
+    if (ret != ESP_OK) return ret;
 
     ret = esp_spp_register_callback(&BtSppServer::spp_cb);
     if (ret != ESP_OK) {
@@ -84,6 +95,7 @@ esp_err_t BtSppServer::start(const char* serverName) {
     };
 
     ret = esp_spp_enhanced_init(&spp_cfg);
+    TIMELINE_MARK(SppInit, ret);
     if (ret == ESP_OK && on_event_) on_event_(Event::SppInited, ret);
     if (ret != ESP_OK) {
 		 ESP_LOGE(TAG, "%s spp init failed", __func__);
@@ -99,13 +111,14 @@ esp_err_t BtSppServer::start(const char* serverName) {
 }
 
 void BtSppServer::stop() {
-    if (started_) {
+    if (up_) {
         esp_spp_deinit();
         esp_bluedroid_disable();
         esp_bluedroid_deinit();
         esp_bt_controller_disable();
         esp_bt_controller_deinit();
         started_ = false;
+        up_ = false;
     }
 }
 
@@ -180,10 +193,13 @@ void BtSppServer::spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
         ESP_LOGI(TAG, "ESP_SPP_OPEN_EVT");
         break;
     case ESP_SPP_CLOSE_EVT:
-        if (self_->g_fd >= 0) {
-        	close(self_->g_fd);
-        	self_->g_fd = -1;
-    	}
+        for (auto& c : self_->clients_) {
+            if (c.fd >= 0 && c.handle == param->close.handle) {
+                // An accepted fd belongs to its FdConnection, which has closed it.
+                if (c.owned) close(c.fd);
+                c = ClientFd{};
+            }
+        }
         if (self_->on_event_) self_->on_event_(Event::ClientDisconnected, ESP_OK);
         ESP_LOGI(TAG, "ESP_SPP_CLOSE_EVT status:%d handle:%" PRIu32" close_by_remote:%d", param->close.status,
                  param->close.handle, param->close.async);
@@ -192,9 +208,11 @@ void BtSppServer::spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
         if (param->start.status == ESP_SPP_SUCCESS) {
             ESP_LOGI(TAG, "ESP_SPP_START_EVT handle:%" PRIu32" sec_id:%d scn:%d", param->start.handle, param->start.sec_id,
                      param->start.scn);
-            esp_bt_gap_set_device_name(self_->name);
+            esp_bt_gap_set_device_name(self_->name.c_str());
             esp_bt_gap_set_scan_mode(ESP_BT_CONNECTABLE, ESP_BT_GENERAL_DISCOVERABLE);
+            TIMELINE_MARK(SppStarted, param->start.handle);
             if (self_->on_event_) self_->on_event_(Event::SppStarted, param->start.status);
+            if (self_->on_event_) self_->on_event_(Event::Discoverable, ESP_OK);
         } else {
             ESP_LOGE(TAG, "ESP_SPP_START_EVT status:%d", param->start.status);
         }
@@ -207,16 +225,31 @@ void BtSppServer::spp_cb(esp_spp_cb_event_t event, esp_spp_cb_param_t *param) {
                  param->srv_open.handle, bda2str(param->srv_open.rem_bda, bda_str, sizeof(bda_str)));
         if (param->srv_open.status == ESP_SPP_SUCCESS) {
             int fd = param->srv_open.fd; 
-            self_-> g_fd = fd;
+            TIMELINE_MARK(ClientOpen, fd);
+            ClientFd* slot = nullptr;
+            for (auto& c : self_->clients_) {
+                if (c.fd < 0) {
+                    c = ClientFd{param->srv_open.handle, fd, false};
+                    slot = &c;
+                    break;
+                }
+            }
             if (self_->on_event_) self_->on_event_(Event::ClientConnected, ESP_OK);
-            if (self_->on_fd_ready_) self_->on_fd_ready_(fd);
+            // The fd stays ours until taken; ESP_SPP_CLOSE_EVT closes a refused
+            // one, or it is closed here when there was no slot to remember it.
+            if (!self_->on_fd_ready_ || !self_->on_fd_ready_(fd)) {
+                ESP_LOGW(TAG, "Session handle:%" PRIu32" refused, disconnecting", param->srv_open.handle);
+                esp_spp_disconnect(param->srv_open.handle);
+                if (slot) slot->owned = true;
+                else close(fd);
+            }
         }
         break;
     case ESP_SPP_VFS_REGISTER_EVT:
         if (param->vfs_register.status == ESP_SPP_SUCCESS) {
             ESP_LOGI(TAG, "ESP_SPP_VFS_REGISTER_EVT");
             esp_spp_sec_t sec_mask = CONFIG_BT_SPP_SECURE_MODE ? ESP_SPP_SEC_AUTHENTICATE : ESP_SPP_SEC_NONE;
-            esp_err_t ret = esp_spp_start_srv(sec_mask, ESP_SPP_ROLE_SLAVE, 0, self_->name);
+            esp_err_t ret = esp_spp_start_srv(sec_mask, ESP_SPP_ROLE_SLAVE, 0, self_->name.c_str());
             if (ret == ESP_OK && self_->on_event_) self_->on_event_(Event::SppStarted, ret);
             self_->started_ = (ret == ESP_OK);
         } else {
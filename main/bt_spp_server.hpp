@@ -1,5 +1,7 @@
 #pragma once
+#include <array>
 #include <functional>
+#include <string>
 #include "esp_spp_api.h"
 #include "esp_gap_bt_api.h"
 
@@ -11,16 +13,22 @@ public:
         GapReady,
         SppInited,
         SppStarted,
+        Discoverable,
         ClientConnected,
         ClientDisconnected,
         Error
     };
 
     using OnEvent     = std::function<void(Event, int err)>;     
-    using OnFdReady   = std::function<void(int fd)>;             
+    // Returns false if the fd was not taken; the session is then disconnected.
+    using OnFdReady   = std::function<bool(int fd)>;
     using OnAddrShown = std::function<void(const uint8_t bt_addr[6])>;
 
     BtSppServer() = default;
+    // Controller, Bluedroid and GAP. Needs only nvs_flash_init() (PHY
+    // calibration data), so it can run while parameters are still loading.
+    esp_err_t bringUp();
+    // SPP server under serverName; brings the stack up first if needed.
     esp_err_t start(const char* serverName);
     void stop();
 
@@ -29,9 +37,17 @@ public:
     void setOnAddr(OnAddrShown cb)      { on_addr_ = std::move(cb); }
 
 private:
-    const char* name;
+    // Used asynchronously by the SPP callbacks, so owned here.
+    std::string name;
+    bool up_ = false;
     bool started_ = false;
-    int g_fd = -1;
+    struct ClientFd {
+        uint32_t handle = 0;
+        int fd = -1;
+        bool owned = false;   // refused by on_fd_ready_, so still ours to close
+    };
+    // One entry per open SPP session; the server keeps listening while clients are connected.
+    std::array<ClientFd, ESP_SPP_MAX_SESSION> clients_{};
 
     OnEvent on_event_;
     OnFdReady on_fd_ready_;
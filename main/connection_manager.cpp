@@ -0,0 +1,183 @@
+#include "connection_manager.hpp"
+
+#include <algorithm>
+#include "esp_log.h"
+#include "protocol/config_protocol.hpp"
+
+namespace {
+    static const char* TAG = "ConnectionManager";
+}
+
+ConnectionManager::ConnectionManager(size_t maxConnections)
+    : _max(maxConnections), _slots(std::make_shared<const Slots>()) {}
+
+ConnectionManager::~ConnectionManager() {
+    stopAll();
+}
+
+ConnectionManager::ConnectionId ConnectionManager::add(int fd, const std::string& passPhrase) {
+    ConnectionId id;
+    std::shared_ptr<FdConnection> conn;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        if (_slots->size() >= _max) {
+            ESP_LOGW(TAG, "Connection limit %u reached, rejecting fd=%d", (unsigned)_max, fd);
+            return kNoConnection;
+        }
+        id = _nextId++;
+        if (_nextId == kNoConnection) _nextId = 1;
+        conn = std::make_shared<FdConnection>(fd, passPhrase.c_str());
+        conn->setGreeting(_greetingCap, _greeting);
+        auto next = std::make_shared<Slots>(*_slots);
+        next->push_back(Slot{id, conn});
+        _slots = std::move(next);
+    }
+
+    conn->setReadyCallback([this, id](){
+        if (_readyCB) _readyCB(id);
+    });
+    conn->setCloseCallback([this, id](){
+        if (_closeCB) _closeCB(id);
+    });
+    conn->setDataCallback([this, id](const uint8_t* data, size_t len){
+        if (_dataCB) _dataCB(id, data, len);
+    });
+    conn->setLineCallback([c = conn.get()](const std::string& line){
+        ESP_LOGI(TAG, "RX line: %s", line.c_str());
+        c->sendLine("OK");
+    });
+
+    if (conn->start() != ESP_OK) {
+        ESP_LOGE(TAG, "start failed for connection %u", (unsigned)id);
+        remove(id);
+        return kNoConnection;
+    }
+    ESP_LOGI(TAG, "Connection %u added (fd=%d), %u active", (unsigned)id, fd, (unsigned)size());
+    return id;
+}
+
+void ConnectionManager::stop(ConnectionId id) {
+    if (auto conn = find_(id)) conn->stop();
+}
+
+void ConnectionManager::stopAll() {
+    auto slots = slots_();
+    for (auto& slot : *slots) slot.conn->stop();
+}
+
+void ConnectionManager::remove(ConnectionId id) {
+    std::shared_ptr<FdConnection> conn;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto next = std::make_shared<Slots>();
+        next->reserve(_slots->size());
+        for (auto& slot : *_slots) {
+            if (slot.id == id) conn = slot.conn;
+            else next->push_back(slot);
+        }
+        if (conn) _slots = std::move(next);
+    }
+    if (conn) {
+        conn->stop();
+        ESP_LOGI(TAG, "Connection %u removed", (unsigned)id);
+    }
+}
+
+void ConnectionManager::setGreeting(uint32_t cap, std::vector<uint8_t> frame) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    _greetingCap = cap;
+    _greeting = std::make_shared<const std::vector<uint8_t>>(std::move(frame));
+}
+
+void ConnectionManager::broadcast(const uint8_t* data, size_t len) {
+    broadcast(data, len, 0, nullptr, 0);
+}
+
+void ConnectionManager::broadcast(const uint8_t* data, size_t len, uint32_t cap, const uint8_t* alt, size_t altLen) {
+    if (!data || len == 0) return;
+    if (!alt || altLen == 0) cap = 0;
+    std::shared_ptr<const std::vector<uint8_t>> shared;
+    std::shared_ptr<const std::vector<uint8_t>> sharedAlt;
+    auto slots = slots_();
+    for (auto& slot : *slots) {
+        if (!slot.conn->isReady()) continue;
+        if (cap && (slot.conn->caps() & cap)) {
+            if (!sharedAlt) sharedAlt = std::make_shared<const std::vector<uint8_t>>(alt, alt + altLen);
+            slot.conn->enqueueSend(sharedAlt);
+        } else {
+            if (!shared) shared = std::make_shared<const std::vector<uint8_t>>(data, data + len);
+            slot.conn->enqueueSend(shared);
+        }
+    }
+}
+
+bool ConnectionManager::sendTo(ConnectionId id, const uint8_t* data, size_t len) {
+    auto conn = find_(id);
+    if (!conn || !conn->isReady()) return false;
+    return conn->enqueueSend(data, len);
+}
+
+void ConnectionManager::broadcastLine(const std::string& line) {
+    auto slots = slots_();
+    for (auto& slot : *slots) slot.conn->sendLine(line);
+}
+
+size_t ConnectionManager::size() const {
+    return slots_()->size();
+}
+
+size_t ConnectionManager::readyCount() const {
+    size_t n = 0;
+    auto slots = slots_();
+    for (auto& slot : *slots) if (slot.conn->isReady()) n++;
+    return n;
+}
+
+size_t ConnectionManager::sendQueueDepth() const {
+    size_t depth = 0;
+    auto slots = slots_();
+    for (auto& slot : *slots) depth = std::max(depth, slot.conn->sendQueueDepth());
+    return depth;
+}
+
+uint32_t ConnectionManager::caps(ConnectionId id) const {
+    auto conn = find_(id);
+    return conn && conn->isReady() ? conn->caps() : 0;
+}
+
+size_t ConnectionManager::maxPayload(ConnectionId id) const {
+    auto conn = find_(id);
+    return conn ? conn->maxPayload() : 0;
+}
+
+bool ConnectionManager::allLinksFast() const {
+    size_t ready = 0;
+    auto slots = slots_();
+    for (auto& slot : *slots) {
+        if (!slot.conn->isReady()) continue;
+        if (!isFast(slot.conn->caps())) return false;
+        ready++;
+    }
+    return ready > 0;
+}
+
+bool ConnectionManager::anyReadyWith(uint32_t cap) const {
+    auto slots = slots_();
+    for (auto& slot : *slots) {
+        if (slot.conn->isReady() && (slot.conn->caps() & cap)) return true;
+    }
+    return false;
+}
+
+std::shared_ptr<const ConnectionManager::Slots> ConnectionManager::slots_() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    return _slots;
+}
+
+std::shared_ptr<FdConnection> ConnectionManager::find_(ConnectionId id) const {
+    auto slots = slots_();
+    for (auto& slot : *slots) {
+        if (slot.id == id) return slot.conn;
+    }
+    return nullptr;
+}
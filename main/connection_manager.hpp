@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <functional>
+#include "sdkconfig.h"
+#include "fd_connection.hpp"
+
+#ifndef CONFIG_MAX_CLIENT_CONNECTIONS
+#define CONFIG_MAX_CLIENT_CONNECTIONS 2
+#endif
+
+// Owns every client FdConnection. Each connection runs its own protocol
+// session; outgoing parameter traffic is encoded once and fanned out to all
+// sessions that completed the handshake.
+class ConnectionManager {
+public:
+    using ConnectionId = uint32_t;
+    static constexpr ConnectionId kNoConnection = 0;
+
+    using DataCallback  = std::function<void(ConnectionId id, const uint8_t* data, size_t len)>;
+    using ReadyCallback = std::function<void(ConnectionId id)>;
+    using CloseCallback = std::function<void(ConnectionId id)>;
+
+    explicit ConnectionManager(size_t maxConnections = CONFIG_MAX_CLIENT_CONNECTIONS);
+    ~ConnectionManager();
+
+    ConnectionManager(const ConnectionManager&) = delete;
+    ConnectionManager& operator=(const ConnectionManager&) = delete;
+
+    void setDataCallback(DataCallback cb) { _dataCB = std::move(cb); }
+    void setReadyCallback(ReadyCallback cb) { _readyCB = std::move(cb); }
+    void setCloseCallback(CloseCallback cb) { _closeCB = std::move(cb); }
+    // Frame sent right after the handshake reply of every new session that
+    // negotiated `cap`, in the same write as the reply.
+    void setGreeting(uint32_t cap, std::vector<uint8_t> frame);
+
+    // Takes ownership of fd. Returns kNoConnection when the connection limit
+    // is reached or the connection fails to start; fd then stays with the
+    // caller, which knows how to close its transport (e.g. an SPP session).
+    ConnectionId add(int fd, const std::string& passPhrase);
+    // Stops the connection; it is destroyed later by remove().
+    void stop(ConnectionId id);
+    void stopAll();
+    // Stops and destroys the connection.
+    void remove(ConnectionId id);
+
+    // Queues the same payload on every ready connection.
+    void broadcast(const uint8_t* data, size_t len);
+    // Same, but connections that negotiated `cap` get `alt` instead.
+    void broadcast(const uint8_t* data, size_t len, uint32_t cap, const uint8_t* alt, size_t altLen);
+    bool sendTo(ConnectionId id, const uint8_t* data, size_t len);
+    void broadcastLine(const std::string& line);
+
+    size_t size() const;
+    size_t readyCount() const;
+    // Deepest send queue among the connections.
+    size_t sendQueueDepth() const;
+
+    // Negotiated capabilities / payload limit of one session; 0 if it is not ready.
+    uint32_t caps(ConnectionId id) const;
+    size_t maxPayload(ConnectionId id) const;
+    // True when at least one session is ready and every ready session uses a
+    // fast (unencrypted) protocol; producers pick their update rate from it.
+    bool allLinksFast() const;
+    bool anyReadyWith(uint32_t cap) const;
+
+private:
+    struct Slot {
+        ConnectionId id;
+        std::shared_ptr<FdConnection> conn;
+    };
+    using Slots = std::vector<Slot>;
+
+    // The current slot list. add() and remove() publish a new list instead
+    // of editing this one, so callers take it under _mtx and then send,
+    // stop or query outside the lock: a blocking enqueueSend() holds up
+    // neither the other callers nor add()/remove(), and a connection
+    // removed meanwhile stays alive until the last holder drops the list.
+    std::shared_ptr<const Slots> slots_() const;
+    std::shared_ptr<FdConnection> find_(ConnectionId id) const;
+
+    const size_t _max;
+    mutable std::mutex _mtx;
+    std::shared_ptr<const Slots> _slots;
+    ConnectionId _nextId{1};
+
+    DataCallback _dataCB;
+    ReadyCallback _readyCB;
+    CloseCallback _closeCB;
+    uint32_t _greetingCap = 0;
+    std::shared_ptr<const std::vector<uint8_t>> _greeting;
+};
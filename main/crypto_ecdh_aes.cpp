@@ -2,48 +2,58 @@
 #include "esp_log.h"
 #include "mbedtls/base64.h"
 #include "mbedtls/pk.h"
+#include "mbedtls/platform_util.h"
+#include "keypair_pool.hpp"
+#include "passphrase_key_cache.hpp"
+#include "random_service.hpp"
+#include <algorithm>
 #include <cstring>
-#include <sys/_intsup.h>
 #include <vector>
 
 static const char* TAG = "CryptoEcdhAes";
 
 CryptoEcdhAes::CryptoEcdhAes(Mode mode, const char* passPhrase) : mode(mode) {
-	mbedtls_ctr_drbg_init(&ctr_drbg);
-	mbedtls_entropy_init(&entropy);
-	mbedtls_gcm_init(&aes_ctx);
-	const char* pers = "ecdh_aes";
-	mbedtls_ctr_drbg_seed(&ctr_drbg, mbedtls_entropy_func, &entropy,
-	                          (const unsigned char*)pers, strlen(pers));
+	seal_aead = Aead::create(Aead::Kind::AesGcm);
+	open_aead = Aead::create(Aead::Kind::AesGcm);
 	if(mode == Mode::PASSPHRASE) {
-		 std::vector<uint8_t> salt = {0, 1, 2, 3, 4, 5, 6, 7};
-		 derive_key_from_passphrase(passPhrase, salt);
+		 derive_key_from_passphrase(passPhrase);
 	} else {
 	   	 mbedtls_ecdh_init(&ecdh);
-	   	 generate_keypair();
     }
     ESP_LOGI("CryptoEcdhAes", "Initialized in mode: %s",
              (mode == Mode::PASSPHRASE) ? "PASSPHRASE" : "EPHEMERAL");
 }
 
 CryptoEcdhAes::~CryptoEcdhAes() {
+    mbedtls_platform_zeroize(resume_secret, sizeof(resume_secret));
+    mbedtls_platform_zeroize(session_key, sizeof(session_key));
 	if(mode != Mode::PASSPHRASE) {
 		mbedtls_ecdh_free(&ecdh);
     }
-    mbedtls_ctr_drbg_free(&ctr_drbg);
-	mbedtls_entropy_free(&entropy);
-    mbedtls_gcm_free(&aes_ctx);
+}
+
+bool CryptoEcdhAes::select_curve(Curve c) {
+    if (mode != Mode::EPHEMERAL || ecdh_ready) return c == curve;
+    curve = c;
+    return true;
 }
 
 bool CryptoEcdhAes::generate_keypair() {
-    int ret = mbedtls_ecp_group_load(&ecdh.private_ctx.private_mbed_ecdh.private_grp, MBEDTLS_ECP_DP_SECP256R1);
+    const mbedtls_ecp_group_id group = curve == Curve::X25519 ? MBEDTLS_ECP_DP_CURVE25519 : MBEDTLS_ECP_DP_SECP256R1;
+    int ret = mbedtls_ecp_group_load(&ecdh.private_ctx.private_mbed_ecdh.private_grp, group);
     if (ret != 0) {
         ESP_LOGE(TAG, "mbedtls_ecp_group_load failed: %d", ret);
         return false;
     }
+    // The pool only holds P-256 keys; an X25519 keypair is cheap enough to make inline.
+    if (curve == Curve::P256 && keypairPool().take(ecdh.private_ctx.private_mbed_ecdh.private_d, ecdh.private_ctx.private_mbed_ecdh.private_Q)) {
+        ecdh_ready = true;
+        return true;
+    }
+    if (curve == Curve::P256) ESP_LOGD(TAG, "Keypair pool empty, generating inline");
     ret = mbedtls_ecdh_gen_public(&ecdh.private_ctx.private_mbed_ecdh.private_grp, &ecdh.private_ctx.private_mbed_ecdh.private_d,
      &ecdh.private_ctx.private_mbed_ecdh.private_Q,
-                                  mbedtls_ctr_drbg_random, &ctr_drbg);
+                                  RandomService::rng, &randomService());
     if (ret != 0) {
         ESP_LOGE(TAG, "mbedtls_ecdh_gen_public failed: %d", ret);
         return false;
@@ -52,28 +62,33 @@ bool CryptoEcdhAes::generate_keypair() {
     return true;
 }
 
-std::vector<uint8_t> CryptoEcdhAes::get_public_key_raw() {
-    std::vector<uint8_t> buf(65); 
-    size_t olen = 0;
+bool CryptoEcdhAes::ensure_keypair() {
+    return ecdh_ready || generate_keypair();
+}
 
+size_t CryptoEcdhAes::write_public_key(uint8_t* out, size_t out_len) {
+    if (!ensure_keypair()) return 0;
+    size_t olen = 0;
     int ret = mbedtls_ecp_point_write_binary(
         &ecdh.private_ctx.private_mbed_ecdh.private_grp,
         &ecdh.private_ctx.private_mbed_ecdh.private_Q,
         MBEDTLS_ECP_PF_UNCOMPRESSED,   
         &olen,
-        buf.data(), buf.size()
+        out, out_len
     );
-
     if (ret != 0 || olen == 0) {
         ESP_LOGE(TAG, "mbedtls_ecp_point_write_binary failed: %d", ret);
-        return {};
+        return 0;
     }
+    return olen;
+}
 
-    buf.resize(olen);
+std::vector<uint8_t> CryptoEcdhAes::get_public_key_raw() {
+    std::vector<uint8_t> buf(kMaxPublicKeyLen);
+    buf.resize(write_public_key(buf.data(), buf.size()));
     return buf;
 }
 
-
 void CryptoEcdhAes::get_encoded_public_key(char* out, size_t out_len) {
     const std::vector<uint8_t>& pk = get_public_key_raw();
     size_t olen = 0;
@@ -90,22 +105,25 @@ void CryptoEcdhAes::get_encoded_public_key(char* out, size_t out_len) {
 
 bool CryptoEcdhAes::apply_other_public(const std::vector<uint8_t>& other_pubkey_b64) {
     size_t olen = 0;
-    std::vector<uint8_t> other_pubkey_raw(200); 
+    uint8_t other_pubkey_raw[kMaxPublicKeyLen];
     int ret = mbedtls_base64_decode(
-        other_pubkey_raw.data(), other_pubkey_raw.size(), &olen,
+        other_pubkey_raw, sizeof(other_pubkey_raw), &olen,
         other_pubkey_b64.data(), other_pubkey_b64.size()
     );
     if (ret != 0) {
         ESP_LOGE(TAG, "Base64 decode failed: %d", ret);
         return false;
     }
-    
-    other_pubkey_raw.resize(olen);
+    return apply_other_public_raw(other_pubkey_raw, olen);
+}
+
+bool CryptoEcdhAes::apply_other_public_raw(const uint8_t* other_pubkey, size_t len) {
+    if (!ensure_keypair()) return false;
     mbedtls_ecp_point Qp;
     mbedtls_ecp_point_init(&Qp);
 
-    ret = mbedtls_ecp_point_read_binary(&ecdh.private_ctx.private_mbed_ecdh.private_grp, &Qp,
-                                            other_pubkey_raw.data(), other_pubkey_raw.size());
+    int ret = mbedtls_ecp_point_read_binary(&ecdh.private_ctx.private_mbed_ecdh.private_grp, &Qp,
+                                            other_pubkey, len);
     if (ret != 0) {
         ESP_LOGE(TAG, "ecp_point_read_binary failed: %d", ret);
         mbedtls_ecp_point_free(&Qp);
@@ -116,7 +134,7 @@ bool CryptoEcdhAes::apply_other_public(const std::vector<uint8_t>& other_pubkey_
     mbedtls_mpi_init(&shared_secret);
 
     ret = mbedtls_ecdh_compute_shared(&ecdh.private_ctx.private_mbed_ecdh.private_grp, &shared_secret, &Qp, &ecdh.private_ctx.private_mbed_ecdh.private_d,
-                                      mbedtls_ctr_drbg_random, &ctr_drbg);
+                                      RandomService::rng, &randomService());
     mbedtls_ecp_point_free(&Qp);
 
     if (ret != 0) {
@@ -125,9 +143,19 @@ bool CryptoEcdhAes::apply_other_public(const std::vector<uint8_t>& other_pubkey_
         return false;
     }
 
-    std::vector<uint8_t> secret(mbedtls_mpi_size(&shared_secret));
-    mbedtls_mpi_write_binary(&shared_secret, secret.data(), secret.size());
+    std::vector<uint8_t> secret;
+    if (curve == Curve::X25519) {
+        secret.resize(32);
+        ret = mbedtls_mpi_write_binary_le(&shared_secret, secret.data(), secret.size());
+    } else {
+        secret.resize(mbedtls_mpi_size(&shared_secret));
+        ret = mbedtls_mpi_write_binary(&shared_secret, secret.data(), secret.size());
+    }
     mbedtls_mpi_free(&shared_secret);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "mpi_write_binary failed: %d", ret);
+        return false;
+    }
 
     uint8_t hash[32];
     mbedtls_md_context_t md_ctx;
@@ -138,77 +166,198 @@ bool CryptoEcdhAes::apply_other_public(const std::vector<uint8_t>& other_pubkey_
     mbedtls_md_finish(&md_ctx, hash);
     mbedtls_md_free(&md_ctx);
 
-    return aes_init_with_key(hash, 16);
+    resume_ready = hkdf_sha256(nullptr, 0, secret.data(), secret.size(), "esp-conf resume",
+                               resume_secret, sizeof(resume_secret));
+    mbedtls_platform_zeroize(secret.data(), secret.size());
+
+    bool ok = init_session_key(hash, seal_aead->session_key_len());
+    mbedtls_platform_zeroize(hash, sizeof(hash));
+    return ok;
 }
 
-std::vector<uint8_t> CryptoEcdhAes::encrypt_data_whole(const std::vector<uint8_t>& data) {
-    std::vector<uint8_t> iv(12);
-    mbedtls_ctr_drbg_random(&ctr_drbg, iv.data(), iv.size());
+bool CryptoEcdhAes::export_resumption_secret(uint8_t* out, size_t out_len) const {
+    if (!resume_ready || out_len != sizeof(resume_secret)) return false;
+    memcpy(out, resume_secret, sizeof(resume_secret));
+    return true;
+}
 
-    std::vector<uint8_t> output(data.size());
-    std::vector<uint8_t> tag(16);
+bool CryptoEcdhAes::apply_resumed_key(const uint8_t* secret, size_t secret_len,
+                                      const uint8_t* salt, size_t salt_len) {
+    // HKDF output is prefix-stable: the 16-byte AES-GCM key is the first half of the ChaCha one.
+    uint8_t key[32];
+    const size_t key_len = seal_aead->session_key_len();
+    if (!hkdf_sha256(salt, salt_len, secret, secret_len, "esp-conf session", key, key_len)) return false;
+    bool ok = init_session_key(key, key_len);
+    mbedtls_platform_zeroize(key, sizeof(key));
+    return ok;
+}
 
-    mbedtls_gcm_crypt_and_tag(&aes_ctx, MBEDTLS_GCM_ENCRYPT,
-                              data.size(), iv.data(), iv.size(),
-                              nullptr, 0, data.data(),
-                              output.data(), tag.size(), tag.data());
+bool CryptoEcdhAes::bind_caps(uint32_t offered, uint32_t accepted) {
+    if (!key_ready || counter_nonces) return false;
+    uint8_t salt[8];
+    for (int i = 0; i < 4; i++) {
+        salt[i] = static_cast<uint8_t>(offered >> (8 * i));
+        salt[4 + i] = static_cast<uint8_t>(accepted >> (8 * i));
+    }
+    uint8_t key[32];
+    const size_t key_len = session_key_len;
+    bool ok = hkdf_sha256(salt, sizeof(salt), session_key, session_key_len, "esp-conf caps", key, key_len) &&
+              init_session_key(key, key_len);
+    mbedtls_platform_zeroize(key, sizeof(key));
+    return ok;
+}
 
-    std::vector<uint8_t> full;
-    full.reserve(iv.size() + output.size() + tag.size());
-    full.insert(full.end(), iv.begin(), iv.end());
-    full.insert(full.end(), output.begin(), output.end());
-    full.insert(full.end(), tag.begin(), tag.end());
-    return full;
+void CryptoEcdhAes::random_bytes(uint8_t* out, size_t len) {
+    randomService().fill(out, len);
 }
 
-std::vector<uint8_t> CryptoEcdhAes::decrypt_data_whole(const std::vector<uint8_t>& encrypted) {
-    if (encrypted.size() < 12 + 16) {
-        return {};
+bool CryptoEcdhAes::hkdf_sha256(const uint8_t* salt, size_t salt_len,
+                                const uint8_t* ikm, size_t ikm_len,
+                                const char* info, uint8_t* out, size_t out_len) {
+    const mbedtls_md_info_t* md = mbedtls_md_info_from_type(MBEDTLS_MD_SHA256);
+    static const uint8_t zero_salt[32] = {};
+    if (!salt || salt_len == 0) {
+        salt = zero_salt;
+        salt_len = sizeof(zero_salt);
+    }
+    size_t info_len = strlen(info);
+    if (out_len > 255 * 32 || info_len > 64) return false;
+
+    // Every exit below goes through the cleanup at the end, so neither PRK
+    // nor a partial output is left behind on failure.
+    uint8_t prk[32];
+    uint8_t t[32];
+    uint8_t block[32 + 64 + 1];
+    size_t t_len = 0;
+    size_t done = 0;
+    bool ok = mbedtls_md_hmac(md, salt, salt_len, ikm, ikm_len, prk) == 0;
+
+    // T(i) = HMAC(PRK, T(i-1) | info | i)
+    for (uint8_t i = 1; ok && done < out_len; i++) {
+        memcpy(block, t, t_len);
+        memcpy(block + t_len, info, info_len);
+        block[t_len + info_len] = i;
+        ok = mbedtls_md_hmac(md, prk, sizeof(prk), block, t_len + info_len + 1, t) == 0;
+        if (!ok) break;
+        t_len = sizeof(t);
+        size_t n = std::min(out_len - done, t_len);
+        memcpy(out + done, t, n);
+        done += n;
     }
-    const uint8_t* iv = encrypted.data();
-    size_t iv_len = 12;
+    mbedtls_platform_zeroize(prk, sizeof(prk));
+    mbedtls_platform_zeroize(t, sizeof(t));
+    mbedtls_platform_zeroize(block, sizeof(block));
+    if (!ok) mbedtls_platform_zeroize(out, out_len);
+    return ok;
+}
 
-    const uint8_t* tag = encrypted.data() + encrypted.size() - 16;
-    const uint8_t* ciphertext = encrypted.data() + iv_len;
-    size_t ciphertext_len = encrypted.size() - iv_len - 16;
+static void write_seq(uint8_t* out, uint64_t seq) {
+    for (int i = 7; i >= 0; i--) {
+        out[i] = static_cast<uint8_t>(seq);
+        seq >>= 8;
+    }
+}
 
-    std::vector<uint8_t> output(ciphertext_len);
+static uint64_t read_seq(const uint8_t* in) {
+    uint64_t seq = 0;
+    for (int i = 0; i < 8; i++) seq = (seq << 8) | in[i];
+    return seq;
+}
 
-    int ret = mbedtls_gcm_auth_decrypt(&aes_ctx, ciphertext_len,
-                                       iv, iv_len, nullptr, 0,
-                                       tag, 16, ciphertext, output.data());
-    if (ret != 0) {
-        ESP_LOGE(TAG, "gcm_auth_decrypt failed: %d", ret);
-        return {};
-    }
-    return output;
-}
-
-bool CryptoEcdhAes::derive_key_from_passphrase(const std::string& passphrase, const std::vector<uint8_t>& salt) {
-    uint8_t out[32];
-    int ret = mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA256,
-                                        (const unsigned char*)passphrase.data(),
-                                        passphrase.size(),
-                                        salt.data(),
-                                        salt.size(),
-                                        10000,
-                                        sizeof(out),
-                                        out);
-    if (ret != 0) {
-        ESP_LOGE(TAG, "pbkdf2 failed: %d", ret);
+bool CryptoEcdhAes::enable_counter_nonces(Side side) {
+    if (!key_ready) return false;
+    const char* d2c = "esp-conf nonce d2c";
+    const char* c2d = "esp-conf nonce c2d";
+    const char* send_info = side == Side::Device ? d2c : c2d;
+    const char* recv_info = side == Side::Device ? c2d : d2c;
+    if (!hkdf_sha256(nullptr, 0, session_key, session_key_len, send_info, send_prefix, sizeof(send_prefix)) ||
+        !hkdf_sha256(nullptr, 0, session_key, session_key_len, recv_info, recv_prefix, sizeof(recv_prefix))) {
         return false;
     }
-    return aes_init_with_key(out, 32);
+    send_seq = 0;
+    recv_window.reset();
+    counter_nonces = true;
+    return true;
 }
 
-bool CryptoEcdhAes::aes_init_with_key(const uint8_t* key, size_t key_len) {
-    memcpy(aes_key, key, key_len);
-    int ret = mbedtls_gcm_setkey(&aes_ctx, MBEDTLS_CIPHER_ID_AES, aes_key, key_len * 8);
-    if (ret != 0) {
-        ESP_LOGE(TAG, "gcm_setkey failed: %d", ret);
+bool CryptoEcdhAes::seal(uint8_t* buf, size_t len, const uint8_t* aad, size_t aad_len) {
+    if (!key_ready) return false;
+    uint8_t iv[kIvLen];
+    uint8_t* text = buf + nonce_field_len();
+    if (counter_nonces) {
+        if (send_seq == UINT64_MAX) return false;
+        memcpy(iv, send_prefix, sizeof(send_prefix));
+        write_seq(iv + sizeof(send_prefix), send_seq);
+        memcpy(buf, iv + sizeof(send_prefix), kSeqLen);
+        send_seq++;
+    } else {
+        if (!randomService().fill(iv, kIvLen)) return false;
+        memcpy(buf, iv, kIvLen);
+    }
+    return seal_aead->seal(iv, aad, aad_len, text, len, text + len);
+}
+
+bool CryptoEcdhAes::open(uint8_t* buf, size_t len, uint8_t*& plain, size_t& plain_len,
+                         const uint8_t* aad, size_t aad_len) {
+    if (!key_ready || len < overhead()) {
         return false;
     }
-    aes_ready = true;
+    uint8_t iv[kIvLen];
+    uint64_t seq = 0;
+    if (counter_nonces) {
+        seq = read_seq(buf);
+        if (!recv_window.check(seq)) {
+            ESP_LOGW(TAG, "Replayed or stale frame, seq=%llu", (unsigned long long)seq);
+            return false;
+        }
+        memcpy(iv, recv_prefix, sizeof(recv_prefix));
+        memcpy(iv + sizeof(recv_prefix), buf, kSeqLen);
+    } else {
+        memcpy(iv, buf, kIvLen);
+    }
+    uint8_t* text = buf + nonce_field_len();
+    size_t text_len = len - overhead();
+    const uint8_t* tag = text + text_len;
+
+    if (!open_aead->open(iv, aad, aad_len, text, text_len, tag)) return false;
+    // Only authenticated frames move the window.
+    if (counter_nonces) recv_window.accept(seq);
+    plain = text;
+    plain_len = text_len;
     return true;
 }
 
+// PBKDF2 runs once per passphrase in PassphraseKeyCache, not per connection.
+bool CryptoEcdhAes::derive_key_from_passphrase(const std::string& passphrase) {
+    uint8_t out[PassphraseKeyCache::kKeyLen];
+    if (!passphraseKeyCache().get(passphrase, out)) return false;
+    bool ok = init_session_key(out, sizeof(out));
+    mbedtls_platform_zeroize(out, sizeof(out));
+    return ok;
+}
+
+bool CryptoEcdhAes::init_session_key(const uint8_t* key, size_t key_len) {
+    if (key_len > sizeof(session_key)) return false;
+    memcpy(session_key, key, key_len);
+    session_key_len = key_len;
+    key_ready = seal_aead->set_key(session_key, session_key_len) &&
+                open_aead->set_key(session_key, session_key_len);
+    return key_ready;
+}
+
+bool CryptoEcdhAes::select_aead(Aead::Kind kind) {
+    if (seal_aead && seal_aead->kind() == kind) return true;
+    std::unique_ptr<Aead> next_seal = Aead::create(kind);
+    std::unique_ptr<Aead> next_open = Aead::create(kind);
+    if (!next_seal || !next_open) {
+        ESP_LOGE(TAG, "AEAD backend %d not available", (int)kind);
+        return false;
+    }
+    if (key_ready && (!next_seal->set_key(session_key, session_key_len) ||
+                      !next_open->set_key(session_key, session_key_len))) {
+        return false;
+    }
+    seal_aead = std::move(next_seal);
+    open_aead = std::move(next_open);
+    return true;
+}
@@ -4,9 +4,9 @@
 #include "esp_log.h"
 #include "mbedtls/ecdh.h"
 #include "mbedtls/ecp.h"
-#include "mbedtls/entropy.h"
-#include "mbedtls/ctr_drbg.h"
-#include "mbedtls/gcm.h"
+#include <memory>
+#include "aead.hpp"
+#include "replay_window.hpp"
 #include "mbedtls/md.h"
 #include "mbedtls/pkcs5.h"
 
@@ -16,29 +16,108 @@ public:
         PASSPHRASE,
         EPHEMERAL
     };
+    // Key exchange curve of EPHEMERAL sessions. P-256 public keys are 65-byte
+    // uncompressed points; X25519 keys are 32 bytes and the shared secret is
+    // taken little-endian as in RFC 7748.
+    enum class Curve {
+        P256,
+        X25519
+    };
     explicit CryptoEcdhAes(Mode mode, const char* passPhrase = nullptr);
     ~CryptoEcdhAes();
 
+    // Call before the keypair is used (linkcaps::CurveX25519).
+    bool select_curve(Curve curve);
     bool generate_keypair();
+    // Uncompressed P-256 point or X25519 u-coordinate.
+    static constexpr size_t kMaxPublicKeyLen = 65;
+    // Returns the key length, 0 on failure.
+    size_t write_public_key(uint8_t* out, size_t out_len);
     std::vector<uint8_t> get_public_key_raw();
     void get_encoded_public_key(char* out, size_t out_len);
     bool apply_other_public(const std::vector<uint8_t>& other_pubkey_b64);
+    bool apply_other_public_raw(const uint8_t* other_pubkey, size_t len);
+
+    // Resumption secret of the last apply_other_public(), see SessionTickets.
+    bool export_resumption_secret(uint8_t* out, size_t out_len) const;
+    // Keys the session from a resumption secret instead of ECDH.
+    bool apply_resumed_key(const uint8_t* secret, size_t secret_len,
+                           const uint8_t* salt, size_t salt_len);
+    void random_bytes(uint8_t* out, size_t len);
+
+    // Mixes the caps offered on the guard line and the ones accepted into the
+    // session key, so a rewritten guard line fails the first sealed frame.
+    // Call once after the key is set and before enable_counter_nonces().
+    bool bind_caps(uint32_t offered, uint32_t accepted);
+
+    // RFC 5869 with SHA-256, built on HMAC so it does not need MBEDTLS_HKDF_C.
+    static bool hkdf_sha256(const uint8_t* salt, size_t salt_len,
+                            const uint8_t* ikm, size_t ikm_len,
+                            const char* info, uint8_t* out, size_t out_len);
     
-    bool derive_key_from_passphrase(const std::string& passphrase, const std::vector<uint8_t>& salt);
+    bool derive_key_from_passphrase(const std::string& passphrase);
+
+    // Switches the AEAD backend (linkcaps::ChaChaPoly). Call before the key
+    // is applied; an already set key is moved to the new backend if it fits.
+    bool select_aead(Aead::Kind kind);
 
-    std::vector<uint8_t> encrypt_data_whole(const std::vector<uint8_t>& data);
-    std::vector<uint8_t> decrypt_data_whole(const std::vector<uint8_t>& encrypted);
+    // Sealed frame layout: nonce field | ciphertext | tag. The nonce field is
+    // a random 12-byte IV, or with counter nonces an 8-byte sequence number.
+    static constexpr size_t kIvLen = Aead::kNonceLen;
+    static constexpr size_t kSeqLen = 8;
+    static constexpr size_t kTagLen = Aead::kTagLen;
+    static constexpr size_t kMaxOverhead = kIvLen + kTagLen;
+
+    // Which end of the link this object seals for; picks the nonce prefixes.
+    enum class Side {
+        Device,
+        Client
+    };
+
+    // Switches the session to counter nonces (linkcaps::CounterNonce). The IV
+    // becomes a 4-byte per-direction prefix derived from the key followed by
+    // the frame's sequence number, so sealing no longer draws from the DRBG.
+    // Frames from the peer must pass a 64-frame replay window. Only safe with
+    // a key that is fresh for every session.
+    bool enable_counter_nonces(Side side = Side::Device);
+    size_t nonce_field_len() const { return counter_nonces ? kSeqLen : kIvLen; }
+    size_t overhead() const { return nonce_field_len() + kTagLen; }
+
+    // seal() and open() may run on different threads at the same time, but
+    // neither may run on two at once.
+    // Encrypts in place without allocating: the len plaintext bytes sit at
+    // buf + nonce_field_len() and buf has room for len + overhead() bytes.
+    // aad (e.g. the frame header) is authenticated but not sent.
+    bool seal(uint8_t* buf, size_t len, const uint8_t* aad = nullptr, size_t aad_len = 0);
+    // Decrypts a sealed frame of len bytes in place; plain points into buf.
+    bool open(uint8_t* buf, size_t len, uint8_t*& plain, size_t& plain_len,
+              const uint8_t* aad = nullptr, size_t aad_len = 0);
 
 private:
     Mode mode;
+    Curve curve = Curve::P256;
     mbedtls_ecdh_context ecdh;
-    mbedtls_ctr_drbg_context ctr_drbg;
-    mbedtls_entropy_context entropy;
-    mbedtls_gcm_context aes_ctx;
-    uint8_t aes_key[32]; 
+    // One context per direction: the send task seals while the read task
+    // opens, and an mbedTLS context must not be used from two threads.
+    std::unique_ptr<Aead> seal_aead;
+    std::unique_ptr<Aead> open_aead;
+    uint8_t session_key[32];
+    size_t session_key_len = 0;
+
+    // Counter nonce state; this end sends with send_prefix, the peer with recv_prefix.
+    bool counter_nonces = false;
+    uint8_t send_prefix[4];
+    uint8_t recv_prefix[4];
+    uint64_t send_seq = 0;
+    ReplayWindow recv_window;
+
+    uint8_t resume_secret[32];
 
-    bool aes_ready = false;
+    bool key_ready = false;
     bool ecdh_ready = false;
+    bool resume_ready = false;
 
-    bool aes_init_with_key(const uint8_t* key, size_t key_len);
+    // The keypair is generated on first use, so resumed sessions never pay for it.
+    bool ensure_keypair();
+    bool init_session_key(const uint8_t* key, size_t key_len);
 };
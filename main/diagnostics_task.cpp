@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <vector>
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "esp_heap_caps.h"
+#include "esp_log.h"
+#include "sdkconfig.h"
+#include "parameter_store.cpp"
+#include "connection_manager.hpp"
+#include "app_command_pool.hpp"
+#include "job_scheduler.hpp"
+
+#ifndef CONFIG_DIAGNOSTICS_PERIOD_S
+#define CONFIG_DIAGNOSTICS_PERIOD_S 10
+#endif
+
+// Samples heap headroom, task stacks and CPU time, and the app and send queue
+// depths, into read-only parameters. Sampling is skipped while no client is
+// connected, so the job costs one readyCount() call then. The heap minimum
+// is a watermark kept by the allocator, so bursts between samples (e.g. a
+// full sendAllParametersInfo) still show up in it.
+//
+// Task stacks and CPU time need CONFIG_FREERTOS_USE_TRACE_FACILITY and
+// CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS respectively; without them the
+// parameters read "n/a". Type "diag" on the console for the full task table.
+class DiagnosticsTask {
+public:
+    DiagnosticsTask(paramstore::ParameterStore& store, ConnectionManager& connections, AppCommandPool& appCommands)
+        : store_(store), connections_(connections), appCommands_(appCommands) {}
+
+    void start(JobScheduler& jobs) {
+        jobs_ = &jobs;
+        job_ = jobs.every("diag", CONFIG_DIAGNOSTICS_PERIOD_S * 1000, kBudgetUs, [this]{
+            if (connections_.readyCount() > 0) sample(false);
+        });
+    }
+
+    void stop(JobScheduler& jobs) {
+        jobs.cancel(job_);
+        job_ = JobScheduler::kNoJob;
+        jobs_ = nullptr;
+    }
+
+    // Publishes a sample now and logs every task. The sample runs as a job,
+    // so the sampling state below is only ever touched by the jobs task.
+    void dump() {
+        if (!jobs_) {
+            ESP_LOGW(TAG, "Diagnostics not started");
+            return;
+        }
+        jobs_->once("diag dump", 0, [this]{ sample(true); });
+    }
+
+private:
+    static constexpr const char* TAG = "Diagnostics";
+    static constexpr uint32_t kBudgetUs = 20000;
+    static constexpr size_t kTaskName = 8;
+
+    struct TaskSample {
+        const char* name;
+        uint32_t stackFree;
+        uint32_t cpuPermille;
+    };
+
+    static int32_t clampCounter(size_t v) {
+        return static_cast<int32_t>(std::min<size_t>(v, paramstore::kMaxCounterValue));
+    }
+
+    void sample(bool log) {
+        store_.setInt(paramstore::ParameterId::HeapFree, clampCounter(heap_caps_get_free_size(MALLOC_CAP_INTERNAL)));
+        store_.setInt(paramstore::ParameterId::HeapMinFree, clampCounter(heap_caps_get_minimum_free_size(MALLOC_CAP_INTERNAL)));
+        store_.setInt(paramstore::ParameterId::HeapLargest, clampCounter(heap_caps_get_largest_free_block(MALLOC_CAP_INTERNAL)));
+
+        char text[paramstore::kMaxStrValueBytes];
+        formatHeapCaps(text, sizeof(text));
+        store_.setString(paramstore::ParameterId::HeapCaps, text);
+
+        store_.setInt(paramstore::ParameterId::AppQueueDepth, clampCounter(appCommands_.waiting()));
+        store_.setInt(paramstore::ParameterId::SendQueueDepth, clampCounter(connections_.sendQueueDepth()));
+
+        sampleTasks(log);
+    }
+
+    // "dma f/m/l psram f/m/l" in KiB: free, minimum free, largest block.
+    static void formatHeapCaps(char* out, size_t cap) {
+        int n = snprintf(out, cap, "dma %u/%u/%u",
+                         (unsigned)(heap_caps_get_free_size(MALLOC_CAP_DMA) / 1024),
+                         (unsigned)(heap_caps_get_minimum_free_size(MALLOC_CAP_DMA) / 1024),
+                         (unsigned)(heap_caps_get_largest_free_block(MALLOC_CAP_DMA) / 1024));
+        if (n > 0 && static_cast<size_t>(n) < cap && heap_caps_get_total_size(MALLOC_CAP_SPIRAM) > 0) {
+            snprintf(out + n, cap - n, " psram %u/%u/%u",
+                     (unsigned)(heap_caps_get_free_size(MALLOC_CAP_SPIRAM) / 1024),
+                     (unsigned)(heap_caps_get_minimum_free_size(MALLOC_CAP_SPIRAM) / 1024),
+                     (unsigned)(heap_caps_get_largest_free_block(MALLOC_CAP_SPIRAM) / 1024));
+        }
+    }
+
+#if CONFIG_FREERTOS_USE_TRACE_FACILITY
+    void sampleTasks(bool log) {
+        UBaseType_t count = uxTaskGetNumberOfTasks();
+        // A few spare entries for tasks created between the two calls.
+        if (status_.size() < count + 2) status_.resize(count + 2);
+        uint32_t totalRunTime = 0;
+        count = uxTaskGetSystemState(status_.data(), status_.size(), &totalRunTime);
+        uint32_t totalDelta = totalRunTime - lastTotalRunTime_;
+        lastTotalRunTime_ = totalRunTime;
+
+        samples_.clear();
+        for (UBaseType_t i = 0; i < count; i++) {
+            const TaskStatus_t& t = status_[i];
+            uint32_t cpu = 0;
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+            auto prev = std::find_if(lastRunTime_.begin(), lastRunTime_.end(),
+                                     [&](const auto& p){ return p.first == t.xHandle; });
+            uint32_t last = prev != lastRunTime_.end() ? prev->second : 0;
+            if (totalDelta) cpu = static_cast<uint32_t>(uint64_t(t.ulRunTimeCounter - last) * 1000 / totalDelta);
+#endif
+            samples_.push_back({t.pcTaskName, static_cast<uint32_t>(t.usStackHighWaterMark), cpu});
+        }
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        lastRunTime_.clear();
+        for (UBaseType_t i = 0; i < count; i++) lastRunTime_.emplace_back(status_[i].xHandle, status_[i].ulRunTimeCounter);
+#endif
+
+        char text[paramstore::kMaxStrValueBytes];
+        // Smallest headroom first: that is the stack to resize.
+        std::sort(samples_.begin(), samples_.end(), [](auto& a, auto& b){ return a.stackFree < b.stackFree; });
+        formatTasks(text, sizeof(text), [](const TaskSample& s){ return s.stackFree; });
+        store_.setString(paramstore::ParameterId::TaskStacks, text);
+#if CONFIG_FREERTOS_GENERATE_RUN_TIME_STATS
+        std::sort(samples_.begin(), samples_.end(), [](auto& a, auto& b){ return a.cpuPermille > b.cpuPermille; });
+        formatTasks(text, sizeof(text), [](const TaskSample& s){ return s.cpuPermille / 10; });
+        store_.setString(paramstore::ParameterId::TaskCpu, text);
+#endif
+
+        if (log) {
+            for (auto& s : samples_) {
+                ESP_LOGI(TAG, "%-16s stack free %5u B  cpu %3u.%u%%", s.name, (unsigned)s.stackFree,
+                         (unsigned)(s.cpuPermille / 10), (unsigned)(s.cpuPermille % 10));
+            }
+        }
+    }
+
+    // "name:value name:value ..." until the parameter is full.
+    template <typename Fn>
+    void formatTasks(char* out, size_t cap, Fn value) const {
+        size_t pos = 0;
+        out[0] = '\0';
+        for (auto& s : samples_) {
+            int n = snprintf(out + pos, cap - pos, "%s%.*s:%u", pos ? " " : "", (int)kTaskName, s.name, (unsigned)value(s));
+            if (n < 0 || pos + n >= cap) {
+                out[pos] = '\0';
+                break;
+            }
+            pos += n;
+        }
+    }
+
+    std::vector<TaskStatus_t> status_;
+    std::vector<TaskSample> samples_;
+    std::vector<std::pair<TaskHandle_t, uint32_t>> lastRunTime_;
+    uint32_t lastTotalRunTime_ = 0;
+#else
+    void sampleTasks(bool log) {
+        if (log) ESP_LOGI(TAG, "Task statistics need CONFIG_FREERTOS_USE_TRACE_FACILITY");
+    }
+#endif
+
+    paramstore::ParameterStore& store_;
+    ConnectionManager& connections_;
+    AppCommandPool& appCommands_;
+    JobScheduler* jobs_ = nullptr;
+    JobScheduler::JobId job_ = JobScheduler::kNoJob;
+};
@@ -1,17 +1,17 @@
 #include "fd_connection.hpp"
 
-#include <sys/_stdint.h>
+#include <cstdint>
 #include <vector>
 #include <cstring>
 #include <cerrno>
 #include <unistd.h>
-#include <sstream>
-#include <iomanip>
 #include "protocol/ecdh_aes_protocol.hpp"
 #include "protocol/passphrase_aes_protocol.hpp"
 #include "protocol/raw_protocol.hpp"
 #include "protocol/config_protocol.hpp"
 #include "esp_log.h"
+#include "link_metrics.hpp"
+#include "timeline.hpp"
 #include <memory>
 	
 namespace {
@@ -22,18 +22,20 @@ FdConnection::FdConnection(int fd,
 							   const char* passPhrase,
                                const char* taskName,
                                uint16_t stackSize,
-                               UBaseType_t priority,
-                               BaseType_t core)
-    : _fd(fd), _passPhrase(passPhrase), _taskName(taskName), _stack(stackSize), _prio(priority), _core(core) {
+                               osport::Priority priority,
+                               int core)
+    : _fd(fd), _passPhrase(passPhrase ? passPhrase : ""), _taskName(taskName), _stack(stackSize), _prio(priority), _core(core) {
 		ESP_LOGI(TAG, "Connection constructor");
 	}
 
 FdConnection::~FdConnection() { 
+    stop();
+    // The read task uses this until it clears _task; its fd is closed by now,
+    // so the next read fails and the loop sees _running cleared.
+    while (_task) osport::yield();
 	ESP_LOGI(TAG, "Connection destructor");
 }
 
-FdConnection::FdConnection(FdConnection&& other) noexcept { moveFrom(other); }
-
 bool FdConnection::isRunning() const { return _running.load(); }
 
 esp_err_t FdConnection::start() {
@@ -43,25 +45,28 @@ esp_err_t FdConnection::start() {
         return ESP_FAIL;
     }
     if (_running.load()) return ESP_OK;
+    TIMELINE_MARK(ConnectionStart, _fd.load());
     _running.store(true);
     _guarded.store(false);
-    protocol = /*std::make_unique<EcdhAesProtocol>(_passPhrase);*/createProtocol(_passPhrase);
-    ESP_LOGI(TAG, "protocol new=%p", protocol.get());
-    protocol.get() -> setReadyCallback([this](){if(_readyCallback) _readyCallback();});
-	sendQueue = xQueueCreate(16, sizeof(SendItem*));
+    _ready.store(false);
+    _caps.store(0);
+	sendQueue.create(SEND_QUEUE_LEN);
+    resetSendItems();
     startSendTask();
-    BaseType_t ok = xTaskCreatePinnedToCore(&FdConnection::taskTrampoline,
-                                            _taskName,
-                                            _stack,
-                                            this,
-                                            _prio,
-                                            &_task,
-                                            _core);
-    if (ok != pdPASS) {
-        _running.store(false);
-        _closeCB();
+    bool ok = osport::createTask(&FdConnection::taskTrampoline,
+                                 _taskName,
+                                 _stack,
+                                 this,
+                                 _prio,
+                                 &_task,
+                                 _core);
+    if (!ok) {
+        ESP_LOGE(TAG, "Failed to create read task");
         _task = nullptr;
-        ESP_LOGE(TAG, "Failed to create read task (err=%ld)", (long)ok);
+        _running.store(false);
+        // The fd stays with the caller, which still owns it on ESP_FAIL.
+        stopSendTask();
+        if (!_closeCbSent.exchange(true) && _closeCB) _closeCB();
         return ESP_FAIL;
     }
     ESP_LOGI(TAG, "Connection started");
@@ -71,25 +76,33 @@ esp_err_t FdConnection::start() {
 void FdConnection::stop() {
     if (!_running.exchange(false)) return; 
     ESP_LOGI(TAG, "Connection stop");
-    protocol.get() -> close();
+    _ready.store(false);
+    if (protocol) protocol.get() -> close();
     int fd = _fd.exchange(-1);
     if (fd >= 0) {
 		ESP_LOGW(TAG, "local stop: closing fd=%d", fd);
         ::close(fd);
     }
 
-     if (sendQueue) {
+    stopSendTask();
+    ESP_LOGI(TAG, "Connection stop end");
+    if (!_closeCbSent.exchange(true) && _closeCB) _closeCB();
+}
+
+// Runs with _running cleared: the send task exits on the poison pill.
+void FdConnection::stopSendTask() {
+    if (sendQueue.valid()) {
         SendItem* poison = nullptr;
-        xQueueSend(sendQueue, &poison, 0);
+        sendQueue.send(poison, 0);
         ESP_LOGI(TAG, "Connection send poison pill");
     }
-    
-   while(_sendTask) vTaskDelay(1);
-    
-   vQueueDelete(sendQueue);
-   sendQueue=nullptr;
-   ESP_LOGI(TAG, "Connection stop end");
-   if (!_closeCbSent.exchange(true) && _closeCB) _closeCB();
+    while (_sendTask) osport::yield();
+    // A producer blocked on a full queue gives up after SEND_QUEUE_TIMEOUT_MS.
+    while (_producers.load()) osport::yield();
+
+    sendQueue.destroy();
+    // Frames still queued when the send task exited are dropped here.
+    resetSendItems();
 }
 
 ssize_t FdConnection::writeAll(const uint8_t* data, size_t len) {
@@ -106,13 +119,18 @@ ssize_t FdConnection::writeAll(const uint8_t* data, size_t len) {
         }
         if (n < 0) {
             if (errno == EINTR) continue;
-            if (errno == EAGAIN || errno == EWOULDBLOCK) { vTaskDelay(1); continue; }
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                LinkMetrics::add(linkMetrics().writeRetries);
+                osport::yield();
+                continue;
+            }
             ESP_LOGE(TAG, "write() failed: errno=%d (%s)", errno, strerror(errno));
             return -1;
         }
         ESP_LOGW(TAG, "write() returned 0 (peer closed?)");
         return -1;
     }
+    LinkMetrics::add(linkMetrics().bytesOut, static_cast<uint32_t>(total));
     return static_cast<ssize_t>(total);
 }
 
@@ -137,18 +155,67 @@ ssize_t FdConnection::sendLine(const std::string& s) {
     return (b == 1) ? (a + 1) : -1;
 }
 
-void FdConnection::enqueueSend(const uint8_t* data, size_t len) {
-	if(_running.load()){
-    	auto* item = new SendItem{std::vector<uint8_t>(data, data + len)};
-    	xQueueSend(sendQueue, &item, portMAX_DELAY);
+bool FdConnection::enqueueSend(const uint8_t* data, size_t len) {
+    return enqueueSend(std::make_shared<const std::vector<uint8_t>>(data, data + len));
+}
+
+bool FdConnection::enqueueSend(std::shared_ptr<const std::vector<uint8_t>> data) {
+    // Counted before _running is read: stop() either sees this producer and
+    // waits for it, or the producer sees the connection stopped.
+    _producers.fetch_add(1);
+    bool ok = _running.load() && data && queueItem(std::move(data));
+    _producers.fetch_sub(1);
+    return ok;
+}
+
+bool FdConnection::queueItem(std::shared_ptr<const std::vector<uint8_t>> data) {
+    SendItem* item = acquireSendItem();
+    if (!item) {
+        ESP_LOGW(TAG, "send items exhausted, frame dropped (fd=%d)", _fd.load());
+        return false;
+    }
+    item->data = std::move(data);
+    item->enqueuedUs = osport::nowUs();
+    // Bounded wait: with several clients a stalled peer must not hold up the others.
+    if (!sendQueue.send(item, SEND_QUEUE_TIMEOUT_MS)) {
+        ESP_LOGW(TAG, "send queue full, frame dropped (fd=%d)", _fd.load());
+        releaseSendItem(item);
+        return false;
+    }
+    linkMetrics().noteSendQueueDepth(sendQueue.waiting());
+    return true;
+}
+
+SendItem* FdConnection::acquireSendItem() {
+    std::lock_guard<std::mutex> lock(_sendItemMtx);
+    return _sendItemFreeCount ? &_sendItems[_sendItemFree[--_sendItemFreeCount]] : nullptr;
+}
+
+void FdConnection::releaseSendItem(SendItem* item) {
+    item->data.reset();
+    std::lock_guard<std::mutex> lock(_sendItemMtx);
+    if (_sendItemFreeCount >= SEND_ITEM_SLOTS) {
+        ESP_LOGE(TAG, "send item released twice (slot %u)", (unsigned)(item - _sendItems.data()));
+        return;
+    }
+    _sendItemFree[_sendItemFreeCount++] = static_cast<uint8_t>(item - _sendItems.data());
+}
+
+// Only while no send task runs: every slot becomes free again.
+void FdConnection::resetSendItems() {
+    std::lock_guard<std::mutex> lock(_sendItemMtx);
+    for (size_t i = 0; i < SEND_ITEM_SLOTS; i++) {
+        _sendItems[i].data.reset();
+        _sendItemFree[i] = static_cast<uint8_t>(i);
     }
+    _sendItemFreeCount = SEND_ITEM_SLOTS;
 }
 
 void FdConnection::taskTrampoline(void* arg) {
     auto* self = static_cast<FdConnection*>(arg);
     self->taskLoop();
     self->_task = nullptr;
-    vTaskDelete(nullptr);
+    osport::exitTask();
 }
 
 void FdConnection::taskLoop() {
@@ -162,6 +229,7 @@ void FdConnection::taskLoop() {
 
         ssize_t n = ::read(fd, buf.data(), buf.size());
         if (n > 0) {
+            LinkMetrics::add(linkMetrics().bytesIn, static_cast<uint32_t>(n));
 			if(_guarded) {
 				protocol.get() -> appendReceived(buf.data(), n);
 				continue;
@@ -169,6 +237,7 @@ void FdConnection::taskLoop() {
             	accum.insert(accum.end(), buf.begin(), buf.begin() + n);
 
             	size_t start = 0;
+            	bool rejected = false;
            		for (size_t i = 0; i < accum.size(); i++) {
                	 if (accum[i] == '\n') {
                 	std::vector<uint8_t> lineBytes(accum.begin() + start, accum.begin() + i);
@@ -176,21 +245,17 @@ void FdConnection::taskLoop() {
                         lineBytes.pop_back();
                     }    
                     std::string line(reinterpret_cast<const char*>(lineBytes.data()), lineBytes.size());
-                    if(line.ends_with("guard")) {
-					  protocol.get()->init(
-    			[this](const uint8_t* data, size_t len) {
-       					 	FdConnection::sendBytes(data, len);
-    					 },
-    			 [this](std::vector<uint8_t> msg) {
-       					 	ESP_LOGI("FdConnection", "Got message size=%u, data=%s", msg.size(), toHex(msg).c_str());
-       					 	if(_dataCB) {
-								_dataCB(msg.data(), msg.size());	
-							}
-   						 }
-					  );
-					  _guarded.store(true); 
+                    uint32_t offeredCaps = 0;
+                    bool capsAnnounced = false;
+                    if(linkcaps::parseGuardLine(line, offeredCaps, capsAnnounced)) {
+					  if (!startProtocol(line)) {
+						  rejected = true;
+						  break;
+					  }
 					  accum.erase(accum.begin(), accum.begin() + i + 1);
 					  protocol.get() -> appendReceived(accum.data(), accum.size());
+					  accum.clear();
+					  start = 0;
 					  break;						
 					}
                     if (_onLine) {
@@ -199,6 +264,7 @@ void FdConnection::taskLoop() {
                     start = i + 1;
                 }
            	   }
+            if (rejected) break;
 
             if (start > 0) {
                 accum.erase(accum.begin(), accum.begin() + start);
@@ -212,12 +278,12 @@ void FdConnection::taskLoop() {
         }
         }
         if (n == 0) {
-            vTaskDelay(1);
+            osport::yield();
 			continue;
 		}
 
         if (errno == EINTR) continue;
-        if (errno == EAGAIN || errno == EWOULDBLOCK) { vTaskDelay(1); continue; }
+        if (errno == EAGAIN || errno == EWOULDBLOCK) { osport::yield(); continue; }
         ESP_LOGE(TAG, "read() failed: errno=%d (%s)", errno, strerror(errno));
         break;
     }
@@ -227,9 +293,49 @@ void FdConnection::taskLoop() {
     stop();
 }
 
+// Picks the protocol from the capabilities on the guard line and starts its
+// handshake. The send task only touches `protocol` for frames queued after the
+// handshake, so publishing it here before _guarded is sufficient.
+bool FdConnection::startProtocol(const std::string& guardLine) {
+    uint32_t offered = 0;
+    bool announced = false;
+    linkcaps::parseGuardLine(guardLine, offered, announced);
+    uint32_t accepted = acceptCaps(offered, announced);
+    TIMELINE_MARK(GuardLine, accepted);
+    ESP_LOGI(TAG, "guard: offered caps=0x%08x accepted=0x%08x", (unsigned)offered, (unsigned)accepted);
+
+    protocol = createProtocol(accepted, _passPhrase.c_str());
+    if (!protocol) {
+        ESP_LOGW(TAG, "No allowed cipher among offered caps 0x%08x", (unsigned)offered);
+        return false;
+    }
+    protocol.get() -> setReadyCallback([this](){
+        _ready.store(true);
+        if(_readyCallback) _readyCallback();
+    });
+    protocol.get() -> negotiate(offered, accepted, announced);
+    _caps.store(accepted);
+    protocol.get() -> init(
+        [this](const uint8_t* data, size_t len) {
+            FdConnection::sendBytes(data, len);
+        },
+        [this](std::span<const uint8_t> msg) {
+            ESP_LOGD(TAG, "Got message size=%u", (unsigned)msg.size());
+            ESP_LOG_BUFFER_HEX_LEVEL(TAG, msg.data(), msg.size(), ESP_LOG_DEBUG);
+            if(_dataCB) {
+                _dataCB(msg.data(), msg.size());	
+            }
+        }
+    );
+    // Parked by the protocol until the handshake completes, then written right after the reply.
+    if (_greeting && (accepted & _greetingCap)) protocol->send(_greeting->data(), _greeting->size());
+    _guarded.store(true);
+    return true;
+}
+
 void FdConnection::startSendTask() {
 	ESP_LOGI(TAG, "Connection startSendTask");
-    xTaskCreatePinnedToCore(&FdConnection::sendTask, "conn_send", 4096, this, _prio, &_sendTask, _core);
+    osport::createTask(&FdConnection::sendTask, "conn_send", 4096, this, _prio, &_sendTask, _core);
 }
 
 void FdConnection::sendTask(void* arg) {
@@ -237,55 +343,17 @@ void FdConnection::sendTask(void* arg) {
 	auto* self = static_cast<FdConnection*>(arg);
     SendItem* item;
     while (self->_running.load()) {
-        if (xQueueReceive(self->sendQueue, &item, portMAX_DELAY) == pdTRUE) {
+        if (self->sendQueue.receive(item, osport::kWaitForever)) {
 			if (!item) break;
-			if(self -> protocol.get() && self -> _running) self->protocol.get()->send(item->data.data(), item->data.size());
-            delete item;
+			if(self -> protocol.get() && self -> _running) {
+                if (self->protocol.get()->send(item->data->data(), item->data->size())) {
+                    linkMetrics().frameLatency.record(static_cast<uint32_t>(osport::nowUs() - item->enqueuedUs));
+                }
+            }
+            self->releaseSendItem(item);
         }
     }
     ESP_LOGI(TAG, "Connection sendTask exit");
     self->_sendTask = nullptr; 
-    vTaskDelete(nullptr); 
-}
-
-FdConnection& FdConnection::operator=(FdConnection&& other) noexcept {
-    if (this != &other) {
-        stop();                
-        moveFrom(other);
-    }
-    return *this;
-}
-
-void FdConnection::moveFrom(FdConnection& other) noexcept {
-    _fd.store(other._fd.exchange(-1));
-    _passPhrase = other._passPhrase;
-    _taskName   = other._taskName;
-    _stack      = other._stack;
-    _prio       = other._prio;
-    _core       = other._core;
-
-    _running.store(other._running.exchange(false));
-    _guarded.store(other._guarded.exchange(false));
-    _closeCbSent.store(other._closeCbSent.exchange(false));
-
-
-    _task     = other._task;     other._task = nullptr;
-    _sendTask = other._sendTask; other._sendTask = nullptr;
-    sendQueue = other.sendQueue; other.sendQueue = nullptr;
-
-    _dataCB       = std::move(other._dataCB);
-    _onLine       = std::move(other._onLine);
-    _readyCallback= std::move(other._readyCallback);
-    _closeCB      = std::move(other._closeCB);
-    protocol = std::move(other.protocol);
-}
-
-
-std::string FdConnection::toHex(const std::vector<uint8_t>& data) {
-    std::ostringstream oss;
-    oss << std::hex << std::setfill('0');
-    for (auto b : data) {
-        oss << std::setw(2) << static_cast<int>(b);
-    }
-    return oss.str();
+    osport::exitTask(); 
 }
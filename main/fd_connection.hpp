@@ -4,18 +4,16 @@
 #include <functional>
 #include <sys/types.h>
 #include <mutex>
+#include <array>
 #include <atomic>
 #include "esp_err.h"
+#include "os_port.hpp"
 #include "protocol/protocol.hpp"
 #include <memory>
 
-extern "C" {
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
-}
-
 struct SendItem {
-    std::vector<uint8_t> data;
+    std::shared_ptr<const std::vector<uint8_t>> data;
+    int64_t enqueuedUs;
 };
 
 
@@ -29,21 +27,32 @@ public:
     					    const char* passPhrase = nullptr,
                             const char* taskName = "conn_read",
                             uint16_t stackSize = 8192,
-                            UBaseType_t priority = tskIDLE_PRIORITY + 3,
-                            BaseType_t core = tskNO_AFFINITY);
+                            osport::Priority priority = osport::kIdlePriority + 3,
+                            int core = osport::kNoAffinity);
     ~FdConnection();
 
     FdConnection(const FdConnection&) = delete;
     FdConnection& operator=(const FdConnection&) = delete;
 
-    FdConnection(FdConnection&& other) noexcept;
-    FdConnection& operator=(FdConnection&& other) noexcept;
+    // The read and send tasks hold `this`, so a connection cannot be moved.
+    FdConnection(FdConnection&&) = delete;
+    FdConnection& operator=(FdConnection&&) = delete;
 
     void setDataCallback(DataCallback cb) { _dataCB = std::move(cb); }
     void setLineCallback(LineCallback cb) { _onLine = std::move(cb); }
     void setReadyCallback(ReadyCallback cb) { _readyCallback = std::move(cb); }
     void setCloseCallback(CloseCallback cb) { _closeCB = std::move(cb); }
+    void setGreeting(uint32_t cap, std::shared_ptr<const std::vector<uint8_t>> frame) {
+        _greetingCap = cap;
+        _greeting = std::move(frame);
+    }
     bool isRunning() const;
+    bool isReady() const { return _ready.load(); }
+    // Capabilities negotiated on the guard line; 0 until the client sends it.
+    uint32_t caps() const { return _caps.load(); }
+    // Largest message that fits one frame of the negotiated session; 0 before the handshake.
+    size_t maxPayload() const { return isReady() && protocol ? protocol->maxPayload() : 0; }
+    size_t sendQueueDepth() const { return sendQueue.waiting(); }
 
     esp_err_t start();
     void stop();
@@ -52,33 +61,56 @@ public:
     ssize_t sendBytes(const uint8_t* data, size_t len);
     ssize_t sendString(const std::string& s);
     ssize_t sendLine(const std::string& s); 
-    void enqueueSend(const uint8_t* data, size_t len);
+    bool enqueueSend(const uint8_t* data, size_t len);
+    // Shares one encoded payload between several connections without copying it.
+    bool enqueueSend(std::shared_ptr<const std::vector<uint8_t>> data);
 
 private:
     static constexpr size_t MAX_ACCUM = 8 * 1024;
+    static constexpr size_t SEND_QUEUE_LEN = 16;
+    static constexpr uint32_t SEND_QUEUE_TIMEOUT_MS = 100;
+    // Queued items, the one being written and a few producers waiting on a full queue.
+    static constexpr size_t SEND_ITEM_SLOTS = SEND_QUEUE_LEN + 4;
     static void taskTrampoline(void* arg);
     void taskLoop();
     void startSendTask();
+    void stopSendTask();
+    bool startProtocol(const std::string& guardLine);
     static void sendTask(void* arg);
-    void moveFrom(FdConnection& other) noexcept;
 
     ssize_t writeAll(const uint8_t* data, size_t len);
-    static std::string toHex(const std::vector<uint8_t>& data);
+    // SendItems come from a fixed pool instead of the heap; nullptr when it is empty.
+    SendItem* acquireSendItem();
+    void releaseSendItem(SendItem* item);
+    void resetSendItems();
+    bool queueItem(std::shared_ptr<const std::vector<uint8_t>> data);
 
     std::unique_ptr<Protocol> protocol;
-    QueueHandle_t sendQueue;
+    osport::Queue<SendItem*> sendQueue;
+    std::array<SendItem, SEND_ITEM_SLOTS> _sendItems;
+    std::array<uint8_t, SEND_ITEM_SLOTS> _sendItemFree;
+    size_t _sendItemFreeCount = 0;
+    std::mutex _sendItemMtx;
+    // enqueueSend() calls in progress; stop() waits for them before it
+    // destroys the queue and resets the pool.
+    std::atomic<int> _producers{0};
     std::atomic<int> _fd{-1};
-    const char* _passPhrase;
+    // Owned: the protocol is created later, when the guard line arrives.
+    std::string _passPhrase;
     const char* _taskName;
     uint16_t _stack;
-    UBaseType_t _prio;
-    BaseType_t _core;
+    osport::Priority _prio;
+    int _core;
 
     std::atomic<bool> _running{false};
     std::atomic<bool> _guarded{false};
+    std::atomic<bool> _ready{false};
+    std::atomic<uint32_t> _caps{0};
+    uint32_t _greetingCap = 0;
+    std::shared_ptr<const std::vector<uint8_t>> _greeting;
     std::atomic<bool> _closeCbSent{false};
-    TaskHandle_t _task{nullptr};
-    TaskHandle_t _sendTask{nullptr};
+    osport::TaskHandle _task{nullptr};
+    osport::TaskHandle _sendTask{nullptr};
 
     std::mutex _writeMtx;
     DataCallback _dataCB;
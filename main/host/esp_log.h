@@ -0,0 +1,48 @@
+#pragma once
+// Host stand-in for ESP-IDF logging, used when the connection stack is built
+// outside ESP-IDF. Output goes to stderr.
+#include <cstdio>
+#include <cstddef>
+#include <cstdint>
+
+typedef enum {
+    ESP_LOG_NONE,
+    ESP_LOG_ERROR,
+    ESP_LOG_WARN,
+    ESP_LOG_INFO,
+    ESP_LOG_DEBUG,
+    ESP_LOG_VERBOSE
+} esp_log_level_t;
+
+inline esp_log_level_t& esp_host_log_level() {
+    static esp_log_level_t level = ESP_LOG_INFO;
+    return level;
+}
+
+// As in ESP-IDF, but one level for every tag: benchmarks and fuzz targets
+// silence the per-frame logs with esp_log_level_set("*", ESP_LOG_NONE).
+inline void esp_log_level_set(const char* /*tag*/, esp_log_level_t level) {
+    esp_host_log_level() = level;
+}
+
+#define ESP_HOST_LOG_(level, letter, tag, fmt, ...)                                     \
+    do {                                                                                \
+        if (esp_host_log_level() >= level) fprintf(stderr, letter " (%s) " fmt "\n", tag, ##__VA_ARGS__); \
+    } while (0)
+
+#define ESP_LOGE(tag, fmt, ...) ESP_HOST_LOG_(ESP_LOG_ERROR, "E", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGW(tag, fmt, ...) ESP_HOST_LOG_(ESP_LOG_WARN, "W", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGI(tag, fmt, ...) ESP_HOST_LOG_(ESP_LOG_INFO, "I", tag, fmt, ##__VA_ARGS__)
+#define ESP_LOGD(tag, fmt, ...) do { } while (0)
+#define ESP_LOGV(tag, fmt, ...) do { } while (0)
+
+inline void esp_host_log_buffer_hex(const char* tag, const void* buffer, size_t len) {
+    if (esp_host_log_level() < ESP_LOG_INFO) return;
+    const uint8_t* p = static_cast<const uint8_t*>(buffer);
+    fprintf(stderr, "I (%s) ", tag);
+    for (size_t i = 0; i < len; i++) fprintf(stderr, "%02x ", p[i]);
+    fprintf(stderr, "\n");
+}
+
+#define ESP_LOG_BUFFER_HEX(tag, buffer, len) esp_host_log_buffer_hex(tag, buffer, len)
+#define ESP_LOG_BUFFER_HEX_LEVEL(tag, buffer, len, level) do { } while (0)
@@ -0,0 +1,128 @@
+#include "loopback_server.hpp"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <sys/socket.h>
+#include <termios.h>
+#include <unistd.h>
+#include "esp_log.h"
+
+static const char* TAG = "LoopbackServer";
+
+LoopbackServer::~LoopbackServer() {
+    stop();
+}
+
+int LoopbackServer::connect(Transport transport) {
+    switch (transport) {
+        case Transport::SocketPair: return connectSocketPair();
+        case Transport::Pty:        return connectPty();
+        case Transport::Tcp: {
+            ESP_LOGE(TAG, "connect(): use startTcp() and a TCP client for Transport::Tcp");
+            return -1;
+        }
+    }
+    return -1;
+}
+
+int LoopbackServer::connectSocketPair() {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        ESP_LOGE(TAG, "socketpair failed: errno=%d (%s)", errno, strerror(errno));
+        return -1;
+    }
+    handOver(fds[0]);
+    return fds[1];
+}
+
+int LoopbackServer::connectPty() {
+    int master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) != 0 || unlockpt(master) != 0) {
+        ESP_LOGE(TAG, "PTY setup failed: errno=%d (%s)", errno, strerror(errno));
+        if (master >= 0) ::close(master);
+        return -1;
+    }
+    int slave = ::open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0) {
+        ESP_LOGE(TAG, "open(pts) failed: errno=%d (%s)", errno, strerror(errno));
+        ::close(master);
+        return -1;
+    }
+    // Binary frames must pass through untouched: no echo, no line discipline.
+    termios tio{};
+    tcgetattr(slave, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(slave, TCSANOW, &tio);
+    tcgetattr(master, &tio);
+    cfmakeraw(&tio);
+    tcsetattr(master, TCSANOW, &tio);
+
+    handOver(master);
+    return slave;
+}
+
+esp_err_t LoopbackServer::startTcp(uint16_t port) {
+    int fd = ::socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0) {
+        ESP_LOGE(TAG, "socket failed: errno=%d (%s)", errno, strerror(errno));
+        return ESP_FAIL;
+    }
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0 || ::listen(fd, 4) != 0) {
+        ESP_LOGE(TAG, "bind/listen on %u failed: errno=%d (%s)", port, errno, strerror(errno));
+        ::close(fd);
+        return ESP_FAIL;
+    }
+    listen_fd_.store(fd);
+    accept_thread_ = std::thread(&LoopbackServer::acceptLoop, this);
+    ESP_LOGI(TAG, "Listening on 127.0.0.1:%u", port);
+    return ESP_OK;
+}
+
+void LoopbackServer::stop() {
+    int fd = listen_fd_.exchange(-1);
+    if (fd >= 0) {
+        ::shutdown(fd, SHUT_RDWR);
+        ::close(fd);
+    }
+    if (accept_thread_.joinable()) accept_thread_.join();
+}
+
+// SPP VFS reads never block, and FdConnection polls its fd the same way on
+// both targets: a read that waits for data would keep the read task from
+// seeing stop() until the peer sends or hangs up. Likewise a write to a peer
+// that hung up fails there instead of raising SIGPIPE.
+void LoopbackServer::handOver(int fd) {
+    std::signal(SIGPIPE, SIG_IGN);
+    int flags = fcntl(fd, F_GETFL);
+    if (flags >= 0) fcntl(fd, F_SETFL, flags | O_NONBLOCK);
+    if (!on_fd_ready_ || !on_fd_ready_(fd)) ::close(fd);
+}
+
+void LoopbackServer::acceptLoop() {
+    while (true) {
+        int lfd = listen_fd_.load();
+        if (lfd < 0) break;
+        int fd = ::accept(lfd, nullptr, nullptr);
+        if (fd < 0) {
+            if (errno == EINTR) continue;
+            break;
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        handOver(fd);
+    }
+    ESP_LOGI(TAG, "accept loop exit");
+}
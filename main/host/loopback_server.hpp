@@ -0,0 +1,48 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <thread>
+#include "esp_err.h"
+
+// Host stand-in for BtSppServer: produces connected fds over a socketpair,
+// PTY or TCP socket and hands the server side to the same OnFdReady callback
+// the device code uses.
+class LoopbackServer {
+public:
+    enum class Transport {
+        SocketPair,
+        Pty,
+        Tcp
+    };
+
+    // Returns false if the fd was not taken; the server then closes it.
+    using OnFdReady = std::function<bool(int fd)>;
+
+    LoopbackServer() = default;
+    ~LoopbackServer();
+
+    LoopbackServer(const LoopbackServer&) = delete;
+    LoopbackServer& operator=(const LoopbackServer&) = delete;
+
+    void setOnFdReady(OnFdReady cb) { on_fd_ready_ = std::move(cb); }
+
+    // SocketPair/Pty: creates one session and returns the client-side fd
+    // (owned by the caller), or -1 on failure.
+    int connect(Transport transport);
+
+    // Tcp: accepts clients on 127.0.0.1:port in a background thread.
+    esp_err_t startTcp(uint16_t port);
+    void stop();
+
+private:
+    int connectSocketPair();
+    int connectPty();
+    void acceptLoop();
+    // Server side of a session, non-blocking like an SPP fd, to on_fd_ready_.
+    void handOver(int fd);
+
+    OnFdReady on_fd_ready_;
+    std::atomic<int> listen_fd_{-1};
+    std::thread accept_thread_;
+};
@@ -0,0 +1,124 @@
+#pragma once
+// Host stand-in for ESP-IDF NVS: a process-wide in-memory key/value store
+// with the same calls and error codes as the subset used by ParameterStore
+// and PassphraseKeyCache. Nothing is persisted; commit is a no-op.
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include "esp_err.h"
+
+#define ESP_ERR_NVS_BASE            0x1100
+#define ESP_ERR_NVS_NOT_FOUND       (ESP_ERR_NVS_BASE + 0x02)
+#define ESP_ERR_NVS_TYPE_MISMATCH   (ESP_ERR_NVS_BASE + 0x03)
+#define ESP_ERR_NVS_INVALID_HANDLE  (ESP_ERR_NVS_BASE + 0x07)
+#define ESP_ERR_NVS_READ_ONLY       (ESP_ERR_NVS_BASE + 0x09)
+#define ESP_ERR_NVS_INVALID_LENGTH  (ESP_ERR_NVS_BASE + 0x0c)
+#define ESP_ERR_NVS_NO_FREE_PAGES   (ESP_ERR_NVS_BASE + 0x0d)
+#define ESP_ERR_NVS_NEW_VERSION_FOUND (ESP_ERR_NVS_BASE + 0x10)
+
+typedef uint32_t nvs_handle_t;
+typedef enum { NVS_READONLY, NVS_READWRITE } nvs_open_mode_t;
+
+namespace nvshost {
+
+enum class Kind : uint8_t { I32, U8, Str, Blob };
+
+struct Item {
+    Kind kind;
+    std::vector<uint8_t> bytes;
+};
+
+struct Handle {
+    std::string ns;
+    bool writable;
+};
+
+struct Store {
+    std::mutex mtx;
+    std::map<std::string, Item> items;  // "namespace/key"
+    std::map<nvs_handle_t, Handle> handles;
+    nvs_handle_t next = 1;
+};
+
+inline Store& store() {
+    static Store s;
+    return s;
+}
+
+inline esp_err_t set(nvs_handle_t h, const char* key, Kind kind, const void* data, size_t len) {
+    Store& s = store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    auto it = s.handles.find(h);
+    if (it == s.handles.end()) return ESP_ERR_NVS_INVALID_HANDLE;
+    if (!it->second.writable) return ESP_ERR_NVS_READ_ONLY;
+    auto p = static_cast<const uint8_t*>(data);
+    s.items[it->second.ns + "/" + key] = Item{kind, std::vector<uint8_t>(p, p + len)};
+    return ESP_OK;
+}
+
+// Copies the item out; *len is the capacity on input, the stored size on output.
+inline esp_err_t get(nvs_handle_t h, const char* key, Kind kind, void* out, size_t* len, bool exact) {
+    Store& s = store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    auto hit = s.handles.find(h);
+    if (hit == s.handles.end()) return ESP_ERR_NVS_INVALID_HANDLE;
+    auto it = s.items.find(hit->second.ns + "/" + key);
+    if (it == s.items.end()) return ESP_ERR_NVS_NOT_FOUND;
+    if (it->second.kind != kind) return ESP_ERR_NVS_TYPE_MISMATCH;
+    size_t size = it->second.bytes.size();
+    if (out) {
+        if (exact ? *len != size : *len < size) return ESP_ERR_NVS_INVALID_LENGTH;
+        memcpy(out, it->second.bytes.data(), size);
+    }
+    *len = size;
+    return ESP_OK;
+}
+
+} // namespace nvshost
+
+inline esp_err_t nvs_open(const char* ns, nvs_open_mode_t mode, nvs_handle_t* out) {
+    nvshost::Store& s = nvshost::store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    *out = s.next++;
+    s.handles[*out] = nvshost::Handle{ns, mode == NVS_READWRITE};
+    return ESP_OK;
+}
+
+inline void nvs_close(nvs_handle_t h) {
+    nvshost::Store& s = nvshost::store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    s.handles.erase(h);
+}
+
+inline esp_err_t nvs_commit(nvs_handle_t) { return ESP_OK; }
+
+inline esp_err_t nvs_set_i32(nvs_handle_t h, const char* key, int32_t v) {
+    return nvshost::set(h, key, nvshost::Kind::I32, &v, sizeof(v));
+}
+inline esp_err_t nvs_get_i32(nvs_handle_t h, const char* key, int32_t* out) {
+    size_t len = sizeof(*out);
+    return nvshost::get(h, key, nvshost::Kind::I32, out, &len, true);
+}
+inline esp_err_t nvs_set_u8(nvs_handle_t h, const char* key, uint8_t v) {
+    return nvshost::set(h, key, nvshost::Kind::U8, &v, sizeof(v));
+}
+inline esp_err_t nvs_get_u8(nvs_handle_t h, const char* key, uint8_t* out) {
+    size_t len = sizeof(*out);
+    return nvshost::get(h, key, nvshost::Kind::U8, out, &len, true);
+}
+// Like ESP-IDF, the stored length includes the terminating NUL.
+inline esp_err_t nvs_set_str(nvs_handle_t h, const char* key, const char* v) {
+    return nvshost::set(h, key, nvshost::Kind::Str, v, strlen(v) + 1);
+}
+inline esp_err_t nvs_get_str(nvs_handle_t h, const char* key, char* out, size_t* len) {
+    return nvshost::get(h, key, nvshost::Kind::Str, out, len, false);
+}
+inline esp_err_t nvs_set_blob(nvs_handle_t h, const char* key, const void* v, size_t len) {
+    return nvshost::set(h, key, nvshost::Kind::Blob, v, len);
+}
+inline esp_err_t nvs_get_blob(nvs_handle_t h, const char* key, void* out, size_t* len) {
+    return nvshost::get(h, key, nvshost::Kind::Blob, out, len, false);
+}
@@ -0,0 +1,13 @@
+#pragma once
+// Host stand-in for nvs_flash.h; the in-memory store needs no partition.
+#include <mutex>
+#include "nvs.h"
+
+inline esp_err_t nvs_flash_init() { return ESP_OK; }
+
+inline esp_err_t nvs_flash_erase() {
+    nvshost::Store& s = nvshost::store();
+    std::lock_guard<std::mutex> lock(s.mtx);
+    s.items.clear();
+    return ESP_OK;
+}
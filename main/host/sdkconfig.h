@@ -0,0 +1,14 @@
+#pragma once
+// Host build configuration; mirrors the defaults in Kconfig.projbuild.
+#define CONFIG_PASSPHRASE "PiroJOKE"
+#define CONFIG_BT_SERVER_NAME "Conf server"
+#define CONFIG_PROTOCOL_EPHEMERAL 1
+#define CONFIG_PROTOCOL_ALLOW_EPHEMERAL 1
+#define CONFIG_PROTOCOL_ALLOW_PASSPHRASE 1
+// Not a device default: host runs also offer Raw as the unencrypted baseline.
+#define CONFIG_PROTOCOL_ALLOW_RAW 1
+#define CONFIG_PROTOCOL_ALLOW_COMPRESSION 1
+#define CONFIG_PROTOCOL_ALLOW_CHACHAPOLY 1
+#define CONFIG_PROTOCOL_ALLOW_X25519 1
+#define CONFIG_PROTOCOL_ALLOW_RESUME 1
+#define CONFIG_MAX_CLIENT_CONNECTIONS 2
@@ -0,0 +1,3 @@
+#pragma once
+// Host stand-in for the newlib header some sources include directly.
+#include <stdint.h>
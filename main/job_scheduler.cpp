@@ -0,0 +1,140 @@
+#include "job_scheduler.hpp"
+#include <algorithm>
+#include "esp_log.h"
+
+static const char* TAG = "JobScheduler";
+
+bool JobScheduler::start(const char* name, uint32_t stackSize, osport::Priority priority) {
+    if (_task) return true;
+    if (!osport::createTask(&JobScheduler::taskEntry, name, stackSize, this, priority, &_task)) {
+        ESP_LOGE(TAG, "Failed to create task");
+        _task = nullptr;
+        return false;
+    }
+    return true;
+}
+
+JobScheduler::JobId JobScheduler::add(const char* name, uint32_t firstDelayMs, uint32_t budgetUs, JobFn fn) {
+    JobId id;
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        auto it = std::find_if(_jobs.begin(), _jobs.end(), [](const auto& j){ return !j->active && !j->running; });
+        if (it == _jobs.end()) {
+            _jobs.push_back(std::make_unique<Job>());
+            it = _jobs.end() - 1;
+        }
+        **it = Job{name, std::move(fn), budgetUs, osport::nowUs() + int64_t(firstDelayMs) * 1000, true, false, {}};
+        id = static_cast<JobId>(it - _jobs.begin());
+    }
+    wake();
+    return id;
+}
+
+JobScheduler::JobId JobScheduler::every(const char* name, uint32_t periodMs, uint32_t budgetUs, std::function<void()> fn) {
+    return add(name, periodMs, budgetUs, [periodMs, fn = std::move(fn)]{
+        fn();
+        return periodMs;
+    });
+}
+
+JobScheduler::JobId JobScheduler::once(const char* name, uint32_t delayMs, std::function<void()> fn) {
+    return add(name, delayMs, 0, [fn = std::move(fn)]{
+        fn();
+        return kDone;
+    });
+}
+
+void JobScheduler::cancel(JobId id) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (id >= 0 && static_cast<size_t>(id) < _jobs.size()) _jobs[id]->active = false;
+}
+
+JobScheduler::Stats JobScheduler::stats(JobId id) const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (id < 0 || static_cast<size_t>(id) >= _jobs.size()) return {};
+    return _jobs[id]->stats;
+}
+
+void JobScheduler::report() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (auto& job : _jobs) {
+        if (!job->active) continue;
+        const Stats& s = job->stats;
+        ESP_LOGI(TAG, "%-10s runs=%u jitter avg=%u max=%u us, run max=%u us, overruns=%u",
+                 job->name, (unsigned)s.runs,
+                 (unsigned)(s.runs ? s.jitterSumUs / s.runs : 0), (unsigned)s.jitterMaxUs,
+                 (unsigned)s.runMaxUs, (unsigned)s.overruns);
+    }
+}
+
+void JobScheduler::taskEntry(void* arg) {
+    static_cast<JobScheduler*>(arg)->run();
+    osport::exitTask();
+}
+
+JobScheduler::Job* JobScheduler::nextDue() const {
+    Job* next = nullptr;
+    for (auto& job : _jobs) {
+        if (job->active && (!next || job->dueUs < next->dueUs)) next = job.get();
+    }
+    return next;
+}
+
+void JobScheduler::wake() {
+    _events.set(kWakeBit);
+}
+
+void JobScheduler::run() {
+    ESP_LOGI(TAG, "started");
+    for (;;) {
+        // Cleared before the scan: a job added after it sets the bit again
+        // and cuts the wait short.
+        _events.clear(kWakeBit);
+        Job* job;
+        int64_t dueUs = 0;
+        uint32_t waitMs = osport::kWaitForever;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            job = nextDue();
+            if (job) {
+                dueUs = job->dueUs;
+                int64_t aheadUs = dueUs - osport::nowUs();
+                if (aheadUs > 0) {
+                    waitMs = static_cast<uint32_t>((aheadUs + 999) / 1000);
+                    job = nullptr;
+                } else {
+                    job->running = true;
+                }
+            }
+        }
+        if (!job) {
+            _events.wait(kWakeBit, waitMs);
+            continue;
+        }
+
+        // Runs without the lock so a job may add or cancel jobs itself.
+        int64_t startUs = osport::nowUs();
+        uint32_t nextMs = job->fn();
+        int64_t endUs = osport::nowUs();
+
+        std::lock_guard<std::mutex> lock(_mtx);
+        job->running = false;
+        Stats& s = job->stats;
+        uint32_t jitterUs = static_cast<uint32_t>(startUs - dueUs);
+        uint32_t runUs = static_cast<uint32_t>(endUs - startUs);
+        s.runs++;
+        s.jitterSumUs += jitterUs;
+        s.jitterMaxUs = std::max(s.jitterMaxUs, jitterUs);
+        s.runMaxUs = std::max(s.runMaxUs, runUs);
+        if (job->budgetUs && runUs > job->budgetUs) s.overruns++;
+        if (!job->active) continue;
+        if (nextMs == kDone) {
+            job->active = false;
+            continue;
+        }
+        int64_t periodUs = int64_t(nextMs) * 1000;
+        job->dueUs = dueUs + periodUs;
+        // More than a period behind: drop the missed runs.
+        if (job->dueUs + periodUs < endUs) job->dueUs = endUs;
+    }
+}
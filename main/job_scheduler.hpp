@@ -0,0 +1,83 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include "sdkconfig.h"
+#include "os_port.hpp"
+
+#ifndef CONFIG_JOB_SCHEDULER_STACK
+#define CONFIG_JOB_SCHEDULER_STACK 4096
+#endif
+
+// Runs periodic and one-shot jobs on a single task, so mostly idle pollers
+// share one stack instead of each owning a FreeRTOS task.
+//
+// A job function returns the delay in ms until its next run, or kDone. Runs
+// are scheduled against the previous due time, not the end of the run, so a
+// fixed period does not drift; a job that falls more than one period behind
+// skips the missed runs instead of bursting. Jobs run one after another and
+// must not block: every run is timed against the job's budget, and the start
+// delay (jitter) and overruns are kept per job for report().
+class JobScheduler {
+public:
+    using JobFn = std::function<uint32_t()>;
+    using JobId = int;
+
+    static constexpr uint32_t kDone = UINT32_MAX;
+    static constexpr JobId kNoJob = -1;
+
+    struct Stats {
+        uint32_t runs = 0;
+        uint32_t overruns = 0;
+        uint32_t jitterMaxUs = 0;
+        uint64_t jitterSumUs = 0;
+        uint32_t runMaxUs = 0;
+    };
+
+    JobScheduler() = default;
+    JobScheduler(const JobScheduler&) = delete;
+    JobScheduler& operator=(const JobScheduler&) = delete;
+
+    bool start(const char* name = "jobs", uint32_t stackSize = CONFIG_JOB_SCHEDULER_STACK,
+               osport::Priority priority = osport::kIdlePriority + 5);
+
+    // First run after firstDelayMs; a budget of 0 disables the overrun check.
+    JobId add(const char* name, uint32_t firstDelayMs, uint32_t budgetUs, JobFn fn);
+    JobId every(const char* name, uint32_t periodMs, uint32_t budgetUs, std::function<void()> fn);
+    JobId once(const char* name, uint32_t delayMs, std::function<void()> fn);
+    // A running job finishes its current run.
+    void cancel(JobId id);
+
+    Stats stats(JobId id) const;
+    // Logs runs, average and maximum jitter, longest run and overruns per job.
+    void report() const;
+
+private:
+    struct Job {
+        const char* name;
+        JobFn fn;
+        uint32_t budgetUs;
+        int64_t dueUs;
+        bool active;
+        bool running;
+        Stats stats;
+    };
+
+    static constexpr uint32_t kWakeBit = 1u << 0;
+
+    static void taskEntry(void* arg);
+    void run();
+    // Called with _mtx held: the active job due first, or nullptr.
+    Job* nextDue() const;
+    void wake();
+
+    // Jobs stay at a fixed address while they run; slots of finished and
+    // cancelled jobs are reused.
+    std::vector<std::unique_ptr<Job>> _jobs;
+    mutable std::mutex _mtx;
+    osport::EventFlags _events;
+    osport::TaskHandle _task = nullptr;
+};
@@ -1,9 +1,8 @@
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
 #include "driver/gpio.h"
 #include "parameter_store.cpp"
+#include "job_scheduler.hpp"
 #include "esp_adc/adc_oneshot.h"
-#include "protocol/config_protocol.hpp"
+#include <functional>
 
 #define JOY_X_PIN    34
 #define JOY_Y_PIN    35
@@ -11,67 +10,57 @@
 
 class JoystickTask {
 public:
-    JoystickTask(paramstore::ParameterStore& params) : store_(params) {}
+    using FastLinkFn = std::function<bool()>;
 
-    void start(const char* name = "JoystickTask", uint32_t stackSize = 4096, UBaseType_t priority = 5) {
-        xTaskCreatePinnedToCore(
-            &JoystickTask::taskEntry,
-            name,
-            stackSize,
-            this,
-            priority,
-            &taskHandle_,
-            tskNO_AFFINITY
-        );
-    }
-
-    void stop() {
-        if (taskHandle_) {
-            vTaskDelete(taskHandle_);
-            taskHandle_ = nullptr;
-        }
-    }
-
-private:
-    static void taskEntry(void* arg) {
-        auto* self = static_cast<JoystickTask*>(arg);
-        self->run();
-    }
+    // fastLink is polled every sample: the rate follows the slowest connected client.
+    JoystickTask(paramstore::ParameterStore& params, FastLinkFn fastLink)
+        : store_(params), fastLink_(std::move(fastLink)) {}
 
-    void run() {
-        adc_oneshot_unit_handle_t adc1_handle;
+    void start(JobScheduler& jobs) {
         adc_oneshot_unit_init_cfg_t init_config = {
             .unit_id = ADC_UNIT_1,
             .clk_src = ADC_RTC_CLK_SRC_DEFAULT,
     		.ulp_mode = ADC_ULP_MODE_DISABLE
         };
-        ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config, &adc1_handle));
+        ESP_ERROR_CHECK(adc_oneshot_new_unit(&init_config, &adc1_handle_));
 
         adc_oneshot_chan_cfg_t chan_cfg = {
             .atten = ADC_ATTEN_DB_12,
             .bitwidth = ADC_BITWIDTH_12
         };
-        ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, ADC_CHANNEL_6, &chan_cfg));
-        ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle, ADC_CHANNEL_7, &chan_cfg));
+        ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle_, ADC_CHANNEL_6, &chan_cfg));
+        ESP_ERROR_CHECK(adc_oneshot_config_channel(adc1_handle_, ADC_CHANNEL_7, &chan_cfg));
 
         gpio_set_direction((gpio_num_t)JOY_SW_PIN, GPIO_MODE_INPUT);
         gpio_pullup_en((gpio_num_t)JOY_SW_PIN);
 
-        int delay = 200;
-        if(isFast()) delay = 20;
-        while (true) {
-            int rawX = 0, rawY = 0;
-            ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, ADC_CHANNEL_6, &rawX));
-            ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle, ADC_CHANNEL_7, &rawY));
-            rawX = std::clamp(rawX, 0, 4095);
-            rawY = std::clamp(rawY, 0, 4095);
-            //int sw   = gpio_get_level((gpio_num_t)JOY_SW_PIN);
-            store_.setInt(paramstore::ParameterId::JoystickX, rawX);
-            store_.setInt(paramstore::ParameterId::JoystickY, rawY);
-            vTaskDelay(pdMS_TO_TICKS(delay));
-        }
+        job_ = jobs.add("joystick", 0, kBudgetUs, [this]{ return sample(); });
+    }
+
+    void stop(JobScheduler& jobs) {
+        jobs.cancel(job_);
+        job_ = JobScheduler::kNoJob;
+    }
+
+private:
+    static constexpr uint32_t kBudgetUs = 10000;
+
+    // Returns the delay to the next sample.
+    uint32_t sample() {
+        uint32_t delay = (fastLink_ && fastLink_()) ? 20 : 200;
+        int rawX = 0, rawY = 0;
+        ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle_, ADC_CHANNEL_6, &rawX));
+        ESP_ERROR_CHECK(adc_oneshot_read(adc1_handle_, ADC_CHANNEL_7, &rawY));
+        rawX = std::clamp(rawX, 0, 4095);
+        rawY = std::clamp(rawY, 0, 4095);
+        //int sw   = gpio_get_level((gpio_num_t)JOY_SW_PIN);
+        store_.setInt(paramstore::ParameterId::JoystickX, rawX);
+        store_.setInt(paramstore::ParameterId::JoystickY, rawY);
+        return delay;
     }
 
     paramstore::ParameterStore& store_;
-    TaskHandle_t taskHandle_ = nullptr;
+    FastLinkFn fastLink_;
+    adc_oneshot_unit_handle_t adc1_handle_ = nullptr;
+    JobScheduler::JobId job_ = JobScheduler::kNoJob;
 };
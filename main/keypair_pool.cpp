@@ -0,0 +1,118 @@
+#include "keypair_pool.hpp"
+
+#include <cstring>
+#include "esp_log.h"
+#include "mbedtls/ecdh.h"
+#include "random_service.hpp"
+
+namespace {
+    static const char* TAG = "KeypairPool";
+}
+
+KeypairPool::KeypairPool() {
+    for (auto& slot : _slots) {
+        mbedtls_mpi_init(&slot.d);
+        mbedtls_ecp_point_init(&slot.Q);
+    }
+    mbedtls_ecp_group_init(&_grp);
+}
+
+KeypairPool::~KeypairPool() {
+    stop();
+    for (auto& slot : _slots) {
+        mbedtls_mpi_free(&slot.d);
+        mbedtls_ecp_point_free(&slot.Q);
+    }
+    mbedtls_ecp_group_free(&_grp);
+}
+
+void KeypairPool::start(osport::Priority priority) {
+    if (kCapacity == 0 || _task) return;
+    _events.clear(kStopBit | kStoppedBit);
+    if (!osport::createTask(&KeypairPool::taskEntry, "keypair_pool", 4096, this, priority, &_task)) {
+        ESP_LOGE(TAG, "Failed to create pool task");
+        _task = nullptr;
+    }
+}
+
+void KeypairPool::stop() {
+    if (!_task) return;
+    _events.set(kStopBit);
+    _events.wait(kStoppedBit, osport::kWaitForever);
+    _task = nullptr;
+}
+
+bool KeypairPool::take(mbedtls_mpi& d, mbedtls_ecp_point& Q) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (auto& slot : _slots) {
+        if (!slot.ready) continue;
+        bool ok = mbedtls_mpi_copy(&d, &slot.d) == 0 && mbedtls_ecp_copy(&Q, &slot.Q) == 0;
+        // A key is handed out at most once, even if copying it failed.
+        mbedtls_mpi_free(&slot.d);
+        mbedtls_mpi_init(&slot.d);
+        slot.ready = false;
+        _events.set(kRefillBit);
+        return ok;
+    }
+    _events.set(kRefillBit);
+    return false;
+}
+
+size_t KeypairPool::available() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    size_t n = 0;
+    for (auto& slot : _slots) if (slot.ready) n++;
+    return n;
+}
+
+void KeypairPool::taskEntry(void* arg) {
+    static_cast<KeypairPool*>(arg)->run();
+    osport::exitTask();
+}
+
+void KeypairPool::run() {
+    int ret = mbedtls_ecp_group_load(&_grp, MBEDTLS_ECP_DP_SECP256R1);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Pool disabled, init failed: %d", ret);
+        _events.set(kStoppedBit);
+        return;
+    }
+    ESP_LOGI(TAG, "started, %u slots", (unsigned)kCapacity);
+    while (!(_events.get() & kStopBit)) {
+        _events.clear(kRefillBit);
+        for (size_t i = 0; i < kCapacity; i++) {
+            {
+                std::lock_guard<std::mutex> lock(_mtx);
+                if (_slots[i].ready) continue;
+            }
+            // Generated outside the lock into a scratch slot, so take() never waits for it.
+            Slot fresh;
+            mbedtls_mpi_init(&fresh.d);
+            mbedtls_ecp_point_init(&fresh.Q);
+            if (generate(fresh)) {
+                std::lock_guard<std::mutex> lock(_mtx);
+                std::swap(_slots[i].d, fresh.d);
+                std::swap(_slots[i].Q, fresh.Q);
+                _slots[i].ready = true;
+            }
+            mbedtls_mpi_free(&fresh.d);
+            mbedtls_ecp_point_free(&fresh.Q);
+        }
+        _events.wait(kRefillBit | kStopBit, osport::kWaitForever);
+    }
+    _events.set(kStoppedBit);
+}
+
+bool KeypairPool::generate(Slot& slot) {
+    int ret = mbedtls_ecdh_gen_public(&_grp, &slot.d, &slot.Q, RandomService::rng, &randomService());
+    if (ret != 0) {
+        ESP_LOGE(TAG, "mbedtls_ecdh_gen_public failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+KeypairPool& keypairPool() {
+    static KeypairPool pool;
+    return pool;
+}
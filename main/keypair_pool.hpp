@@ -0,0 +1,61 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <mutex>
+#include "sdkconfig.h"
+#include "mbedtls/ecp.h"
+#include "os_port.hpp"
+
+#ifndef CONFIG_ECDH_KEYPAIR_POOL_SIZE
+#define CONFIG_ECDH_KEYPAIR_POOL_SIZE 2
+#endif
+
+// Pre-generated P-256 keypairs for ephemeral sessions. A low priority task
+// fills the pool while the device is idle and refills a slot after every
+// take(), so the handshake only copies a ready key instead of running the
+// scalar multiplication on the connecting path.
+class KeypairPool {
+public:
+    static constexpr size_t kCapacity = CONFIG_ECDH_KEYPAIR_POOL_SIZE;
+
+    KeypairPool();
+    ~KeypairPool();
+
+    KeypairPool(const KeypairPool&) = delete;
+    KeypairPool& operator=(const KeypairPool&) = delete;
+
+    void start(osport::Priority priority = osport::kIdlePriority + 1);
+    // Ends the refill task and waits for it; keys already made stay usable.
+    void stop();
+
+    // Moves a ready keypair of the SECP256R1 group into d/Q. Returns false if
+    // the pool is empty; the caller then generates the key itself.
+    bool take(mbedtls_mpi& d, mbedtls_ecp_point& Q);
+
+    size_t available() const;
+
+private:
+    struct Slot {
+        mbedtls_mpi d;
+        mbedtls_ecp_point Q;
+        bool ready = false;
+    };
+
+    static void taskEntry(void* arg);
+    void run();
+    bool generate(Slot& slot);
+
+    static constexpr uint32_t kRefillBit = 1u << 0;
+    static constexpr uint32_t kStopBit = 1u << 1;
+    static constexpr uint32_t kStoppedBit = 1u << 2;
+
+    mutable std::mutex _mtx;
+    std::array<Slot, kCapacity> _slots;
+    osport::EventFlags _events;
+    osport::TaskHandle _task = nullptr;
+
+    // Used by the pool task only.
+    mbedtls_ecp_group _grp;
+};
+
+KeypairPool& keypairPool();
@@ -1,17 +1,18 @@
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
 #include "driver/gpio.h"
 #include <inttypes.h>
 #include "esp_log.h"
 #include "parameter_store.cpp"
+#include "job_scheduler.hpp"
 #include <sys/_stdint.h>
 
+// Blinks BlinkCount short pulses, then pauses; a step of the sequence runs as
+// a job on the shared scheduler and returns the delay to the next step.
 class LedBlinkTask {
 public:
     LedBlinkTask(paramstore::ParameterStore& store, gpio_num_t pin)
         : store_(store), pin_(pin) {}
 
-    void start(const char* name = "LedBlinkTask", uint32_t stackSize = 4096, UBaseType_t priority = 5) {
+    void start(JobScheduler& jobs) {
         gpio_config_t io_conf = {};
         io_conf.intr_type = GPIO_INTR_DISABLE;
         io_conf.mode = GPIO_MODE_OUTPUT;
@@ -29,53 +30,36 @@ public:
             ESP_LOGI(TAG, "BlinkCount changed: %" PRId32, blinkCount_);
         });
 
-        xTaskCreatePinnedToCore(
-            &LedBlinkTask::taskEntry,
-            name,
-            stackSize,
-            this,
-            priority,
-            &taskHandle_,
-            tskNO_AFFINITY
-        );
+        job_ = jobs.add("blink", 0, kBudgetUs, [this]{ return step(); });
     }
 
-    void stop() {
-        if (taskHandle_) {
-            vTaskDelete(taskHandle_);
-            taskHandle_ = nullptr;
-        }
+    void stop(JobScheduler& jobs) {
+        jobs.cancel(job_);
+        job_ = JobScheduler::kNoJob;
     }
 
 private:
     static constexpr const char* TAG = "LedBlinkTask";
+    static constexpr uint32_t kBudgetUs = 1000;
 
-    static void taskEntry(void* arg) {
-        auto* self = static_cast<LedBlinkTask*>(arg);
-        self -> run();
-    }
-
-    void run() {
-        ESP_LOGI(TAG, "started");
-        while (true) {
-            if (ledEnabled_) {
-                for (int i = 0; i < blinkCount_; i++) {
-                    gpio_set_level(pin_, 0);
-                    vTaskDelay(pdMS_TO_TICKS(100));
-                    gpio_set_level(pin_, 1);
-                    vTaskDelay(pdMS_TO_TICKS(100));
-                }
-                vTaskDelay(pdMS_TO_TICKS(500));
-            } else {
-                gpio_set_level(pin_, 1); 
-                vTaskDelay(pdMS_TO_TICKS(200));
-            }
+    // Pulse phases alternate LED on (level 0) and off for 100 ms each; the
+    // last one adds the 500 ms pause.
+    uint32_t step() {
+        if (!ledEnabled_) {
+            gpio_set_level(pin_, 1); 
+            phase_ = 0;
+            return 200;
         }
+        gpio_set_level(pin_, phase_ % 2 == 0 ? 0 : 1);
+        if (++phase_ < 2 * blinkCount_) return 100;
+        phase_ = 0;
+        return 100 + 500;
     }
 
     paramstore::ParameterStore& store_;
     gpio_num_t pin_;
-    TaskHandle_t taskHandle_ = nullptr;
+    JobScheduler::JobId job_ = JobScheduler::kNoJob;
+    int32_t phase_ = 0;
 
     bool ledEnabled_ = true;
     int32_t blinkCount_ = 3;
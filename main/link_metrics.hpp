@@ -0,0 +1,69 @@
+#pragma once
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+
+// Process-wide link health counters. All updates are relaxed atomics so they
+// are cheap enough to sit on the per-frame path of every connection.
+
+class LatencyHistogram {
+public:
+    // Upper bounds of the buckets in microseconds; the last bucket is open.
+    static constexpr std::array<uint32_t, 5> kBoundsUs = {1000, 5000, 20000, 100000, 500000};
+    static constexpr size_t kBuckets = kBoundsUs.size() + 1;
+
+    void record(uint32_t us) {
+        size_t i = 0;
+        while (i < kBoundsUs.size() && us > kBoundsUs[i]) i++;
+        buckets_[i].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    uint32_t count(size_t bucket) const { return buckets_[bucket].load(std::memory_order_relaxed); }
+
+    // "a/b/c/d/e/f" with one count per bucket.
+    size_t format(char* out, size_t outLen) const {
+        int n = snprintf(out, outLen, "%u/%u/%u/%u/%u/%u",
+                         (unsigned)count(0), (unsigned)count(1), (unsigned)count(2),
+                         (unsigned)count(3), (unsigned)count(4), (unsigned)count(5));
+        return n > 0 ? static_cast<size_t>(n) : 0;
+    }
+
+private:
+    std::array<std::atomic<uint32_t>, kBuckets> buckets_{};
+};
+
+struct LinkMetrics {
+    std::atomic<uint32_t> bytesIn{0};
+    std::atomic<uint32_t> bytesOut{0};
+    std::atomic<uint32_t> framesIn{0};
+    std::atomic<uint32_t> framesOut{0};
+    std::atomic<uint32_t> decryptFailures{0};
+    std::atomic<uint32_t> handshakeMs{0};
+    std::atomic<uint32_t> sendQueuePeak{0};
+    std::atomic<uint32_t> writeRetries{0};
+    // AppCommand pipeline: frames handed to appTask and the ones dropped
+    // because the slot pool was empty, the queue was full or the frame did not
+    // fit a slot.
+    std::atomic<uint32_t> appFrames{0};
+    std::atomic<uint32_t> appPoolExhausted{0};
+    std::atomic<uint32_t> appQueueFull{0};
+    std::atomic<uint32_t> appOversize{0};
+    // Time from enqueueSend to the frame being written to the fd.
+    LatencyHistogram frameLatency;
+
+    static void add(std::atomic<uint32_t>& counter, uint32_t v = 1) {
+        counter.fetch_add(v, std::memory_order_relaxed);
+    }
+
+    void noteSendQueueDepth(uint32_t depth) {
+        uint32_t peak = sendQueuePeak.load(std::memory_order_relaxed);
+        while (depth > peak && !sendQueuePeak.compare_exchange_weak(peak, depth, std::memory_order_relaxed)) {}
+    }
+};
+
+inline LinkMetrics& linkMetrics() {
+    static LinkMetrics metrics;
+    return metrics;
+}
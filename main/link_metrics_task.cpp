@@ -0,0 +1,64 @@
+#include "esp_log.h"
+#include "parameter_store.cpp"
+#include "link_metrics.hpp"
+#include "job_scheduler.hpp"
+
+// Copies the link counters into read-only parameters at a low rate, so they
+// reach clients through the regular parameter sync path only when they change.
+class LinkMetricsTask {
+public:
+    LinkMetricsTask(paramstore::ParameterStore& store) : store_(store) {}
+
+    void start(JobScheduler& jobs) {
+        job_ = jobs.every("metrics", kPublishPeriodMs, kBudgetUs, [this]{ publishAll(); });
+    }
+
+    void stop(JobScheduler& jobs) {
+        jobs.cancel(job_);
+        job_ = JobScheduler::kNoJob;
+    }
+
+private:
+    static constexpr uint32_t kPublishPeriodMs = 5000;
+    static constexpr uint32_t kBudgetUs = 50000;
+
+    void publish(paramstore::ParameterId id, const std::atomic<uint32_t>& counter) {
+        uint32_t v = std::min<uint32_t>(counter.load(std::memory_order_relaxed), paramstore::kMaxCounterValue);
+        store_.setInt(id, static_cast<int32_t>(v));
+    }
+
+    // Logs the AppCommand pipeline counters when a frame was dropped since the
+    // last report.
+    void reportAppCommands(const LinkMetrics& m) {
+        uint32_t dropped = m.appPoolExhausted.load(std::memory_order_relaxed) +
+                           m.appQueueFull.load(std::memory_order_relaxed) +
+                           m.appOversize.load(std::memory_order_relaxed);
+        if (dropped == lastAppDropped_) return;
+        lastAppDropped_ = dropped;
+        ESP_LOGW("LinkMetricsTask", "AppCommand: frames=%u pool empty=%u queue full=%u oversize=%u",
+                 (unsigned)m.appFrames.load(std::memory_order_relaxed),
+                 (unsigned)m.appPoolExhausted.load(std::memory_order_relaxed),
+                 (unsigned)m.appQueueFull.load(std::memory_order_relaxed),
+                 (unsigned)m.appOversize.load(std::memory_order_relaxed));
+    }
+
+    void publishAll() {
+        LinkMetrics& m = linkMetrics();
+        char latency[paramstore::kMaxStrValueBytes];
+        publish(paramstore::ParameterId::LinkBytesIn, m.bytesIn);
+        publish(paramstore::ParameterId::LinkBytesOut, m.bytesOut);
+        publish(paramstore::ParameterId::LinkFramesIn, m.framesIn);
+        publish(paramstore::ParameterId::LinkFramesOut, m.framesOut);
+        publish(paramstore::ParameterId::LinkDecryptFails, m.decryptFailures);
+        publish(paramstore::ParameterId::LinkHandshakeMs, m.handshakeMs);
+        publish(paramstore::ParameterId::LinkSendQueuePeak, m.sendQueuePeak);
+        publish(paramstore::ParameterId::LinkWriteRetries, m.writeRetries);
+        m.frameLatency.format(latency, sizeof(latency));
+        store_.setString(paramstore::ParameterId::LinkLatency, latency);
+        reportAppCommands(m);
+    }
+
+    paramstore::ParameterStore& store_;
+    JobScheduler::JobId job_ = JobScheduler::kNoJob;
+    uint32_t lastAppDropped_ = 0;
+};
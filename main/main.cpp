@@ -8,109 +8,128 @@
 #include "sdkconfig.h"
 #include "esp_log.h"
 #include "esp_system.h"
+#include "esp_timer.h"
 #include "nvs_flash.h"
 
 #include "serial_line_reader.hpp"
 #include "bt_spp_server.hpp"
-#include "fd_connection.hpp"
+#include "connection_manager.hpp"
+#include "keypair_pool.hpp"
+#include "random_service.hpp"
+#include "passphrase_key_cache.hpp"
+#include "startup_orchestrator.hpp"
+#include "job_scheduler.hpp"
+#include "timeline.hpp"
+#include "app_command_pool.hpp"
+#include "message_dispatcher.hpp"
 #include "parameter_store.cpp"
 #include "parameter_sync.cpp"
 #include "message_type.cpp"
 #include "joystick_task.cpp"
 #include "led_blink_task.cpp"
 #include "uptime_task.cpp"
+#include "link_metrics_task.cpp"
+#include "diagnostics_task.cpp"
 #include "send_delayed.cpp"
 
 using namespace paramstore;
 
-enum class AppCommandType : uint8_t {
-	CleanupConnection,
-	DataReceived,
-	RestartConnection,
-	RestartServer,
-    SendAllParameters,
-};
-
-struct Data {
-    std::vector<uint8_t> bytes;
-};
-
-struct AppCommand {
-    AppCommandType type;
-    std::variant<std::monostate, Data> data;
-};
-
-QueueHandle_t appQueue = nullptr;
+AppCommandPool appCommands;
+JobScheduler jobs;
 SerialLineReader reader;
 BtSppServer bt;
-FdConnection* g_conn = nullptr;
+ConnectionManager connections;
 ParameterStore store;
-ParameterSync parameterSync(store);
-JoystickTask joystickTask(store);
+ParameterSync parameterSync(store, connections);
+MessageDispatcher dispatcher;
+JoystickTask joystickTask(store, []{ return connections.allLinksFast(); });
 LedBlinkTask blinkTask(store, GPIO_NUM_2);
 UptimeTask uptime(store);
+LinkMetricsTask linkMetricsTask(store);
+DiagnosticsTask diagnostics(store, connections, appCommands);
 
-static void setupConnection(int fd) {
-	if (g_conn) {
-		delete g_conn;
-		g_conn = nullptr;
-	}
-    std::string passPhrase = store.getString(ParameterId::PassPhrase);
-    g_conn = new FdConnection(fd, passPhrase.c_str());
-    g_conn->setReadyCallback([](){
-		parameterSync.setConnection(g_conn);
-        AppCommand* cmd = new AppCommand{AppCommandType::SendAllParameters, {}};
-        xQueueSend(appQueue, &cmd, 0);
+static void setupConnections() {
+    connections.setGreeting(linkcaps::BinaryHandshake, parameterSync.schemaHashMessage());
+    connections.setReadyCallback([](ConnectionManager::ConnectionId id){
+        appCommands.post(AppCommandType::SendAllParameters, id);
 	});
-    g_conn->setCloseCallback([](){
-		ESP_LOGI("APP", "Close Connection callback");
-		parameterSync.removeConnection();
-		AppCommand* cmd = new AppCommand{AppCommandType::CleanupConnection, {}};
-        xQueueSend(appQueue, &cmd, 0);
+    connections.setCloseCallback([](ConnectionManager::ConnectionId id){
+		ESP_LOGI("APP", "Close Connection callback id=%u", (unsigned)id);
+		if (!appCommands.post(AppCommandType::CleanupConnection, id)) {
+			ESP_LOGE("APP", "Cleanup of connection %u not queued", (unsigned)id);
+		}
 	});
-	g_conn->setDataCallback([](const uint8_t* data, size_t len){
-		 ESP_LOGI("APP", "Data received:");
-		 ESP_LOG_BUFFER_HEX("APP", data, len);
-		 Data d;
-         d.bytes.assign(data, data + len);
-         AppCommand* cmd = new AppCommand{AppCommandType::DataReceived, d};
-         xQueueSend(appQueue, &cmd, 0);
-    });
-        
-    g_conn->setLineCallback([](const std::string& line){
-        ESP_LOGI("APP", "RX line: %s", line.c_str());
-        g_conn->sendLine("OK");
+	connections.setDataCallback([](ConnectionManager::ConnectionId id, const uint8_t* data, size_t len){
+		 // Per frame: debug only, so the hex dump is compiled out by default.
+		 ESP_LOGD("APP", "Data received from %u:", (unsigned)id);
+		 ESP_LOG_BUFFER_HEX_LEVEL("APP", data, len, ESP_LOG_DEBUG);
+         LinkMetrics::add(linkMetrics().appFrames);
+         appCommands.post(appCommands.acquire(AppCommandType::DataReceived, id, data, len));
     });
-    
-    if (g_conn->start() != ESP_OK) { 
-		ESP_LOGE("APP", "start failed"); 
-		delete g_conn; g_conn = nullptr;
-	}
 }
 
-static void setupStore() {
+static bool setupConnection(int fd) {
+    std::string passPhrase = store.getString(ParameterId::PassPhrase);
+    return connections.add(fd, passPhrase) != ConnectionManager::kNoConnection;
+}
+
+static void openStore() {
 	ESP_ERROR_CHECK(store.begin());
+}
+
+static void loadStore() {
     store.setupDefaults();
     store.loadFromNvs();
 }
 
-static void start_bt() {
+// Derives the passphrase key at boot and on every PassPhrase change, off the
+// connection path.
+static void setupPassphraseKey() {
+#if defined(CONFIG_PROTOCOL_PASSPHRASE) || defined(CONFIG_PROTOCOL_ALLOW_PASSPHRASE)
+    store.onChange(ParameterId::PassPhrase, [](uint32_t id, const paramstore::Value& newValue) {
+        passphraseKeyCache().prime(std::get<std::string>(newValue));
+    });
+#endif
+}
+
+static void setupBtCallbacks() {
 	bt.setOnEvent([](BtSppServer::Event e, int err){
         ESP_LOGI("APP", "Event=%d err=0x%x", (int)e, err);
+        if (e == BtSppServer::Event::Discoverable) {
+            ESP_LOGI("APP", "Time to discoverable: %u ms", (unsigned)(esp_timer_get_time() / 1000));
+        }
     });
 
     bt.setOnFdReady([](int fd){
         ESP_LOGI("APP", "FD ready: %d", fd);
-        setupConnection(fd);
+        return setupConnection(fd);
     });
+}
+
+// The callbacks are set once in bt_up and outlive bt.stop().
+static bool start_bt() {
     std::string name = store.getString(paramstore::ParameterId::DeviceName);
-    bt.start(name.c_str());
+    return bt.start(name.c_str()) == ESP_OK;
 }
 
 static void startReader() {
 	reader.start([](const std::string& line) {
         ESP_LOGI("MAIN", "Got line: %s", line.c_str());
-        if(g_conn != nullptr) g_conn->sendLine(line);
+#if defined(CONFIG_TIMELINE_ENABLED)
+        if (line == "timeline") {
+            timeline::dump();
+            return;
+        }
+#endif
+        if (line == "jobs") {
+            jobs.report();
+            return;
+        }
+        if (line == "diag") {
+            diagnostics.dump();
+            return;
+        }
+        connections.broadcastLine(line);
     });
 }
 
@@ -125,93 +144,90 @@ static void sendMessageToConnection(const char* text) {
     pb_ostream_t ostream = pb_ostream_from_buffer(buffer + 1, sizeof(buffer) - 1);
 	buffer[0] = static_cast<uint8_t>(MessageType::Message);
 	pb_encode(&ostream, pModel_Message_fields, &msg);	
-	if(g_conn) {
-        g_conn -> enqueueSend(buffer, ostream.bytes_written + 1);
-    }
+	connections.broadcast(buffer, ostream.bytes_written + 1);
 }
 
-static void handleDataReceivedCommand(std::vector<uint8_t> data) {
-	if (!data.empty()) {
-		auto type = static_cast<MessageType>(data[0]);                       	        	
-		const uint8_t* payload = data.data() + 1;
-    	size_t payloadLen = data.size() - 1;
-    	if(type == MessageType::SetInt || type == MessageType::SetInt ||
-    		type == MessageType::SetString || type == MessageType::SetBoolean) {
-			auto paramSetType = static_cast<ParamSetType>(data[0]);
-			bool ok = parameterSync.handleSetParameter(paramSetType, payload, payloadLen, 	[](SetParam setParam){
-					if(setParam == SetParam::Passphrase) {
-						sendMessageToConnection("З'єднання буде закрито. Підключись з новою Pass-фразою. Не забудь її змінити на Android-стороні.");
-					    AppCommand* cmd = new AppCommand{ AppCommandType::RestartConnection, {} };
-                        sendDelayed(appQueue, cmd, 1000);
-					}
-					if(setParam == SetParam::ServerName) {
-						sendMessageToConnection("Сервер буде перезапущено з новою назвою. Перепідключись."); 
-						AppCommand* cmd = new AppCommand{ AppCommandType::RestartServer, {} };
-                        sendDelayed(appQueue, cmd, 1000);
-					}
-				});
-    		if (!ok) {
-        		ESP_LOGW("APP", "handleSetParameter failed for type=%d", (int)paramSetType);
-    		}
-		} else {
-			ESP_LOGW("APP", "Unsupported DataReceived type=%d", (int)type); 
-		}
-	} else {
-	 	ESP_LOGW("APP", "DataReceived without data");
-	}
-}       		
+// Client messages are routed by MessageDispatcher; modules register their
+// own handlers, ParameterSync the set and get messages.
+static void setupDispatcher() {
+    dispatcher.setWriter([](void*, MessageDispatcher::ConnectionId to, const uint8_t* data, size_t len) {
+        return connections.sendTo(to, data, len);
+    }, nullptr);
+    parameterSync.setOnSetParameter([](SetParam setParam){
+        if(setParam == SetParam::Passphrase) {
+            sendMessageToConnection("З'єднання буде закрито. Підключись з новою Pass-фразою. Не забудь її змінити на Android-стороні.");
+            runDelayed(1000, []{ appCommands.post(AppCommandType::RestartConnection); });
+        }
+        if(setParam == SetParam::ServerName) {
+            sendMessageToConnection("Сервер буде перезапущено з новою назвою. Перепідключись."); 
+            runDelayed(1000, []{ appCommands.post(AppCommandType::RestartServer); });
+        }
+    });
+    parameterSync.registerHandlers(dispatcher);
+}
 
 void appTask(void* arg) {
-    AppCommand* cmd;
     for (;;) {
-        if (xQueueReceive(appQueue, &cmd, portMAX_DELAY) == pdTRUE) {
+        // The slot returns to the pool when cmd goes out of scope.
+        if (AppCommandPool::Ptr cmd = appCommands.receive()) {
             switch (cmd -> type) {
 				case AppCommandType::CleanupConnection:
-    				if (g_conn) {
-						g_conn -> stop();
-						delete g_conn;
-						g_conn = nullptr;
-					}
+    				connections.remove(cmd -> connId);
     				break;
     
 				case AppCommandType::DataReceived:
-                	if (std::holds_alternative<Data>(cmd -> data)) {
-                    	handleDataReceivedCommand(std::get<Data>(cmd -> data).bytes);
-   					} else {
-						ESP_LOGW("APP", "Wrong  AppCommandType::DataReceived");
-				    }
+                   	dispatcher.dispatch(cmd -> bytes(), dispatcher.replyTo(cmd -> connId));
                 	break;
                               	
                 case AppCommandType::RestartConnection:
-                    g_conn -> stop();
+                    connections.stopAll();
                 	break;
                 	
                 case AppCommandType::RestartServer:
-                    g_conn -> stop();
+                    connections.stopAll();
 					bt.stop();
 					start_bt();
                 	break;
                 	
                 case AppCommandType::SendAllParameters:
-                    parameterSync.sendAllParametersInfo();
-                    parameterSync.sendAllParameters();
+                    parameterSync.sendAllParametersInfo(cmd -> connId);
+                    parameterSync.sendAllParameters(cmd -> connId);
                     break;
 
                 default:
                     break;
             }
-            delete cmd;
         }
     }
 }
 
 extern "C" void app_main(void) {
-	appQueue = xQueueCreate(16, sizeof(AppCommand*));
+    TIMELINE_MARK(BootBegin, 0);
+	appCommands.start();
     xTaskCreatePinnedToCore(appTask, "appTask", 4096, nullptr, 5, nullptr, tskNO_AFFINITY);
-    setupStore();
-    start_bt();
-    startReader();
-    blinkTask.start();
-    joystickTask.start();
-    uptime.start();
-}	
+
+    // Independent stages run concurrently, one worker per core. The Bluetooth
+    // controller only needs NVS initialised (PHY calibration), not the
+    // parameters, so it comes up while they load.
+    StartupOrchestrator startup;
+    startup.add("nvs", {}, []{ openStore(); return true; });
+    startup.add("params", {"nvs"}, []{ loadStore(); return true; });
+    startup.add("bt_up", {"nvs"}, []{ setupBtCallbacks(); return bt.bringUp() == ESP_OK; });
+    startup.add("crypto", {}, []{ randomService().start(); keypairPool().start(); return true; });
+    startup.add("pp_key", {"params", "crypto"}, []{ setupPassphraseKey(); return true; });
+    startup.add("dispatcher", {}, []{ setupDispatcher(); return true; });
+    startup.add("connections", {"params", "dispatcher"}, []{ setupConnections(); return true; });
+    startup.add("bt_spp", {"bt_up", "params", "connections"}, []{ return start_bt(); });
+    startup.add("reader", {"connections"}, []{ startReader(); return true; });
+    startup.add("jobs", {"params"}, []{
+        blinkTask.start(jobs);
+        joystickTask.start(jobs);
+        uptime.start(jobs);
+        linkMetricsTask.start(jobs);
+        diagnostics.start(jobs);
+        return jobs.start();
+    });
+    if (!startup.run()) ESP_LOGE("APP", "Startup incomplete");
+    startup.report();
+    TIMELINE_MARK(BootEnd, 0);
+}
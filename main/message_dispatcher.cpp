@@ -0,0 +1,76 @@
+#include "message_dispatcher.hpp"
+#include "esp_log.h"
+
+static const char* TAG = "MessageDispatcher";
+
+MessageDispatcher::MessageDispatcher() {
+    on(MessageType::Batch, &MessageDispatcher::onBatch, this);
+}
+
+bool MessageDispatcher::on(MessageType type, Handler handler, void* ctx) {
+    size_t i = static_cast<size_t>(type);
+    if (i >= kMaxTypes || !handler) {
+        ESP_LOGE(TAG, "Cannot register handler for type 0x%02x", (unsigned)i);
+        return false;
+    }
+    if (_table[i].handler) {
+        ESP_LOGE(TAG, "Type 0x%02x already has a handler", (unsigned)i);
+        return false;
+    }
+    _table[i] = Entry{handler, ctx};
+    return true;
+}
+
+void MessageDispatcher::setWriter(WriteFn write, void* ctx) {
+    _write = write;
+    _writeCtx = ctx;
+}
+
+bool MessageDispatcher::dispatch(std::span<const uint8_t> message, const Reply& reply) const {
+    if (message.empty()) {
+        ESP_LOGW(TAG, "Empty message from %u", (unsigned)reply.to());
+        return false;
+    }
+    uint8_t type = message[0];
+    const Entry* entry = type < kMaxTypes ? &_table[type] : nullptr;
+    if (!entry || !entry->handler) {
+        _unhandled++;
+        ESP_LOGW(TAG, "Unsupported message type=0x%02x", (unsigned)type);
+        return false;
+    }
+    return entry->handler(entry->ctx, message.subspan(1), reply);
+}
+
+// [varint len][message]... as written by ParameterSync's outgoing batches.
+bool MessageDispatcher::onBatch(void* ctx, std::span<const uint8_t> payload, const Reply& reply) {
+    auto* self = static_cast<MessageDispatcher*>(ctx);
+    bool ok = true;
+    size_t pos = 0;
+    while (pos < payload.size()) {
+        size_t len = 0;
+        unsigned shift = 0;
+        uint8_t b;
+        do {
+            if (pos >= payload.size() || shift > 14) {
+                ESP_LOGW(TAG, "Malformed batch length");
+                return false;
+            }
+            b = payload[pos++];
+            len |= size_t(b & 0x7F) << shift;
+            shift += 7;
+        } while (b & 0x80);
+        if (len == 0 || len > payload.size() - pos) {
+            ESP_LOGW(TAG, "Batch entry of %u bytes does not fit", (unsigned)len);
+            return false;
+        }
+        auto inner = payload.subspan(pos, len);
+        pos += len;
+        if (inner[0] == static_cast<uint8_t>(MessageType::Batch)) {
+            ESP_LOGW(TAG, "Nested batch refused");
+            ok = false;
+            continue;
+        }
+        ok = self->dispatch(inner, reply) && ok;
+    }
+    return ok;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include "message_type.cpp"
+
+// Routes every decoded client message to the handler registered for its
+// MessageType. The table is indexed by the type byte, so dispatch costs one
+// load and one indirect call whatever the number of handlers.
+//
+// Handlers are plain function pointers with a context pointer: registering
+// and dispatching never allocate. A handler gets the message without its type
+// byte and a Reply that answers the connection the message came from.
+//
+// MessageType::Batch is handled here: each inner message is dispatched in
+// turn with the same Reply. Nested batches are refused.
+class MessageDispatcher {
+public:
+    using ConnectionId = uint32_t;
+    using WriteFn = bool (*)(void* ctx, ConnectionId to, const uint8_t* data, size_t len);
+
+    // Answers one incoming message.
+    class Reply {
+    public:
+        Reply(ConnectionId to, WriteFn write, void* ctx) : _to(to), _write(write), _ctx(ctx) {}
+
+        ConnectionId to() const { return _to; }
+        bool send(const uint8_t* data, size_t len) const { return _write && _write(_ctx, _to, data, len); }
+
+    private:
+        ConnectionId _to;
+        WriteFn _write;
+        void* _ctx;
+    };
+
+    using Handler = bool (*)(void* ctx, std::span<const uint8_t> payload, const Reply& reply);
+
+    // Type bytes at or above this are refused; keeps the table small.
+    static constexpr size_t kMaxTypes = 0x40;
+
+    MessageDispatcher();
+
+    MessageDispatcher(const MessageDispatcher&) = delete;
+    MessageDispatcher& operator=(const MessageDispatcher&) = delete;
+
+    // False if the type is out of range or already has a handler.
+    bool on(MessageType type, Handler handler, void* ctx);
+    // Where Reply::send writes; usually ConnectionManager::sendTo.
+    void setWriter(WriteFn write, void* ctx);
+
+    Reply replyTo(ConnectionId to) const { return Reply(to, _write, _writeCtx); }
+
+    // message = [type][payload]. Returns the handler's result; false for an
+    // empty message or a type nobody handles.
+    bool dispatch(std::span<const uint8_t> message, const Reply& reply) const;
+
+    uint32_t unhandled() const { return _unhandled; }
+
+private:
+    struct Entry {
+        Handler handler = nullptr;
+        void* ctx = nullptr;
+    };
+
+    static bool onBatch(void* ctx, std::span<const uint8_t> payload, const Reply& reply);
+
+    std::array<Entry, kMaxTypes> _table{};
+    WriteFn _write = nullptr;
+    void* _writeCtx = nullptr;
+    mutable uint32_t _unhandled = 0;
+};
@@ -14,5 +14,9 @@ enum class MessageType : uint8_t {
     Float             = 0x09,
     String            = 0x10,
     Boolean           = 0x11,
-    Message           = 0x12
+    Message           = 0x12,
+    Batch             = 0x13, // [Batch][varint len][message]... , only with linkcaps::Batching
+    Compressed        = 0x14, // [Compressed][dict id LE16][varint len][LZ stream], only with linkcaps::Compression
+    SchemaHash        = 0x15, // [SchemaHash][8 bytes], first frame after a linkcaps::BinaryHandshake reply
+    Get               = 0x16  // [Get][varint id]..., client asks for values; no ids means all
 };
@@ -0,0 +1,237 @@
+#pragma once
+// Thin OS layer used by the connection stack (FdConnection and the protocols).
+// On the device it maps 1:1 onto FreeRTOS; everywhere else it is backed by
+// std::thread and condition variables so the same code runs over a socketpair,
+// TCP socket or PTY on Linux.
+
+#include <cstdint>
+#include <cstddef>
+
+#if defined(ESP_PLATFORM)
+
+#include "freertos/FreeRTOS.h"
+#include "freertos/task.h"
+#include "freertos/queue.h"
+#include "freertos/semphr.h"
+#include "freertos/event_groups.h"
+#include "esp_timer.h"
+
+namespace osport {
+
+using TaskHandle = TaskHandle_t;
+using TaskFn = void (*)(void*);
+using Priority = UBaseType_t;
+
+static constexpr uint32_t kWaitForever = UINT32_MAX;
+static constexpr Priority kIdlePriority = tskIDLE_PRIORITY;
+static constexpr int kNoAffinity = tskNO_AFFINITY;
+static constexpr size_t kNumCores = portNUM_PROCESSORS;
+
+inline TickType_t toTicks(uint32_t ms) {
+    return ms == kWaitForever ? portMAX_DELAY : pdMS_TO_TICKS(ms);
+}
+
+inline bool createTask(TaskFn fn, const char* name, uint32_t stackSize, void* arg,
+                       Priority priority, TaskHandle* out, int core = kNoAffinity) {
+    return xTaskCreatePinnedToCore(fn, name, stackSize, arg, priority, out, core) == pdPASS;
+}
+
+// Must be the last call of a task function.
+inline void exitTask() { vTaskDelete(nullptr); }
+
+inline void delayMs(uint32_t ms) { vTaskDelay(pdMS_TO_TICKS(ms)); }
+
+// Shortest possible sleep: lets lower priority tasks run.
+inline void yield() { vTaskDelay(1); }
+
+inline int64_t nowUs() { return esp_timer_get_time(); }
+
+// May change right after the call unless the task is pinned; use as a hint.
+inline size_t currentCore() { return xPortGetCoreID(); }
+
+template <typename T>
+class Queue {
+public:
+    Queue() = default;
+    ~Queue() { destroy(); }
+    Queue(const Queue&) = delete;
+    Queue& operator=(const Queue&) = delete;
+
+    bool create(size_t length) {
+        destroy();
+        handle_ = xQueueCreate(length, sizeof(T));
+        return handle_ != nullptr;
+    }
+    void destroy() {
+        if (handle_) {
+            vQueueDelete(handle_);
+            handle_ = nullptr;
+        }
+    }
+    bool valid() const { return handle_ != nullptr; }
+    bool send(const T& item, uint32_t timeoutMs) { return xQueueSend(handle_, &item, toTicks(timeoutMs)) == pdTRUE; }
+    bool receive(T& item, uint32_t timeoutMs) { return xQueueReceive(handle_, &item, toTicks(timeoutMs)) == pdTRUE; }
+    size_t waiting() const { return handle_ ? uxQueueMessagesWaiting(handle_) : 0; }
+
+private:
+    QueueHandle_t handle_ = nullptr;
+};
+
+// Up to 24 flag bits; wait() returns as soon as any of the requested bits is set.
+class EventFlags {
+public:
+    EventFlags() { handle_ = xEventGroupCreateStatic(&storage_); }
+    ~EventFlags() { vEventGroupDelete(handle_); }
+    EventFlags(const EventFlags&) = delete;
+    EventFlags& operator=(const EventFlags&) = delete;
+
+    void set(uint32_t bits) { xEventGroupSetBits(handle_, bits); }
+    void clear(uint32_t bits) { xEventGroupClearBits(handle_, bits); }
+    uint32_t get() const { return xEventGroupGetBits(handle_); }
+    uint32_t wait(uint32_t bits, uint32_t timeoutMs) {
+        return xEventGroupWaitBits(handle_, bits, pdFALSE, pdFALSE, toTicks(timeoutMs)) & bits;
+    }
+
+private:
+    StaticEventGroup_t storage_;
+    EventGroupHandle_t handle_ = nullptr;
+};
+
+} // namespace osport
+
+#else // host
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+
+namespace osport {
+
+struct HostTask;
+using TaskHandle = HostTask*;
+using TaskFn = void (*)(void*);
+using Priority = unsigned;
+
+static constexpr uint32_t kWaitForever = UINT32_MAX;
+static constexpr Priority kIdlePriority = 0;
+static constexpr int kNoAffinity = -1;
+static constexpr size_t kNumCores = 1;
+
+// Priority, stack size and core are accepted for signature compatibility only.
+inline bool createTask(TaskFn fn, const char* /*name*/, uint32_t /*stackSize*/, void* arg,
+                       Priority /*priority*/, TaskHandle* out, int /*core*/ = kNoAffinity) {
+    static char token;
+    // Non-null so callers that poll the handle see a running task. Written
+    // before the thread starts, as FreeRTOS does, so a task that clears its
+    // handle on exit cannot be overwritten by it afterwards.
+    if (out) *out = reinterpret_cast<TaskHandle>(&token);
+    std::thread(fn, arg).detach();
+    return true;
+}
+
+inline void exitTask() {}
+
+inline size_t currentCore() { return 0; }
+
+inline void delayMs(uint32_t ms) { std::this_thread::sleep_for(std::chrono::milliseconds(ms)); }
+
+inline void yield() { std::this_thread::sleep_for(std::chrono::milliseconds(1)); }
+
+inline int64_t nowUs() {
+    return std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+template <typename Lock, typename Pred>
+inline bool waitFor(std::condition_variable& cv, Lock& lock, uint32_t timeoutMs, Pred pred) {
+    if (timeoutMs == kWaitForever) {
+        cv.wait(lock, pred);
+        return true;
+    }
+    return cv.wait_for(lock, std::chrono::milliseconds(timeoutMs), pred);
+}
+
+template <typename T>
+class Queue {
+public:
+    Queue() = default;
+    ~Queue() { destroy(); }
+    Queue(const Queue&) = delete;
+    Queue& operator=(const Queue&) = delete;
+
+    bool create(size_t length) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        items_.clear();
+        capacity_ = length;
+        return true;
+    }
+    void destroy() {
+        std::lock_guard<std::mutex> lock(mtx_);
+        items_.clear();
+        capacity_ = 0;
+    }
+    bool valid() const { return capacity_ != 0; }
+    bool send(const T& item, uint32_t timeoutMs) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (!waitFor(notFull_, lock, timeoutMs, [this]{ return items_.size() < capacity_; })) return false;
+        items_.push_back(item);
+        notEmpty_.notify_one();
+        return true;
+    }
+    bool receive(T& item, uint32_t timeoutMs) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        if (!waitFor(notEmpty_, lock, timeoutMs, [this]{ return !items_.empty(); })) return false;
+        item = items_.front();
+        items_.pop_front();
+        notFull_.notify_one();
+        return true;
+    }
+    size_t waiting() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return items_.size();
+    }
+
+private:
+    mutable std::mutex mtx_;
+    std::condition_variable notEmpty_;
+    std::condition_variable notFull_;
+    std::deque<T> items_;
+    size_t capacity_ = 0;
+};
+
+class EventFlags {
+public:
+    EventFlags() = default;
+    EventFlags(const EventFlags&) = delete;
+    EventFlags& operator=(const EventFlags&) = delete;
+
+    void set(uint32_t bits) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        bits_ |= bits;
+        cv_.notify_all();
+    }
+    void clear(uint32_t bits) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        bits_ &= ~bits;
+    }
+    uint32_t get() const {
+        std::lock_guard<std::mutex> lock(mtx_);
+        return bits_;
+    }
+    uint32_t wait(uint32_t bits, uint32_t timeoutMs) {
+        std::unique_lock<std::mutex> lock(mtx_);
+        waitFor(cv_, lock, timeoutMs, [&]{ return (bits_ & bits) != 0; });
+        return bits_ & bits;
+    }
+
+private:
+    mutable std::mutex mtx_;
+    std::condition_variable cv_;
+    uint32_t bits_ = 0;
+};
+
+} // namespace osport
+
+#endif
@@ -23,6 +23,7 @@ static constexpr const char* TAG = "ParameterStore";
 static constexpr const char* NVS_NAMESPACE = "params";
 
 static constexpr size_t kMaxStrValueBytes   = 64;   // StringParameter.value
+static constexpr int32_t kMaxCounterValue   = 1000000000; // exactly representable in Meta's float bounds
 
 enum class ParamType : uint32_t { Int = 0, Float = 1, String = 2, Bool = 3 };
 
@@ -38,7 +39,24 @@ enum class ParameterId : uint32_t {
     JoystickX        = 5,
     JoystickY        = 6,
     ExampleText      = 7,
-    ExampleBool      = 8
+    ExampleBool      = 8,
+    LinkBytesIn      = 9,
+    LinkBytesOut     = 10,
+    LinkFramesIn     = 11,
+    LinkFramesOut    = 12,
+    LinkDecryptFails = 13,
+    LinkHandshakeMs  = 14,
+    LinkSendQueuePeak= 15,
+    LinkWriteRetries = 16,
+    LinkLatency      = 17,
+    HeapFree         = 18,
+    HeapMinFree      = 19,
+    HeapLargest      = 20,
+    HeapCaps         = 21,
+    AppQueueDepth    = 22,
+    SendQueueDepth   = 23,
+    TaskStacks       = 24,
+    TaskCpu          = 25
 };
 
 struct Meta {
@@ -199,6 +217,10 @@ public:
     bool        getBool(ParameterId id)  { return std::get<bool>(at_(static_cast<uint32_t>(id)).value); }
     Value       getValue(ParameterId id)  { return at_(static_cast<uint32_t>(id)).value; }
     Entry       get(uint32_t id)  { return at_(id); }
+    // The set of parameters is fixed after setupDefaults(), so no lock is needed.
+    bool        has(uint32_t id) const { return params_.count(id) != 0; }
+    // Meta is fixed then too; no copy of the entry's strings.
+    bool        editable(uint32_t id) const { return at_(id).meta.editable; }
 
     std::vector<Meta> listMeta() const {
         std::vector<Meta> v;
@@ -220,13 +242,38 @@ public:
         addIntParam   (ParameterId::JoystickY, 2048, "Джойстик Y", "Положення джойстика по осі Y", 0, 4095, false);
         addStringParam(ParameterId::ExampleText, "Значення", "Приклад Текст", "Приклад відображення текстового параметру", false);
         addBoolParam  (ParameterId::ExampleBool, true, "Приклад Буль", "Приклад відображення булевого параметру", false);
+
+        addIntParam   (ParameterId::LinkBytesIn, 0, "Байтів отримано", "Сума по всіх з'єднаннях від запуску", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::LinkBytesOut, 0, "Байтів надіслано", "Сума по всіх з'єднаннях від запуску", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::LinkFramesIn, 0, "Кадрів отримано", "Кадри протоколу від клієнтів", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::LinkFramesOut, 0, "Кадрів надіслано", "Кадри протоколу до клієнтів", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::LinkDecryptFails, 0, "Помилки дешифрування", "Кадри, які не пройшли перевірку AES-GCM", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::LinkHandshakeMs, 0, "Тривалість рукостискання, мс", "Останнє рукостискання", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::LinkSendQueuePeak, 0, "Пік черги відправки", "Найбільша глибина черги відправки", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::LinkWriteRetries, 0, "Повтори запису", "Скільки разів write() повернув EAGAIN", 0, kMaxCounterValue, false);
+        addStringParam(ParameterId::LinkLatency, "0/0/0/0/0/0", "Затримка кадрів", "Кількість кадрів до 1/5/20/100/500 мс і більше", false);
+
+        addIntParam   (ParameterId::HeapFree, 0, "Вільна пам'ять, Б", "Внутрішня RAM", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::HeapMinFree, 0, "Мінімум вільної пам'яті, Б", "Найменше значення від запуску", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::HeapLargest, 0, "Найбільший вільний блок, Б", "Найбільше можливе виділення у внутрішній RAM", 0, kMaxCounterValue, false);
+        addStringParam(ParameterId::HeapCaps, "n/a", "Пам'ять DMA/PSRAM, КіБ", "Вільно/мінімум/найбільший блок", false);
+        addIntParam   (ParameterId::AppQueueDepth, 0, "Черга застосунку", "Команди, що чекають на appTask", 0, kMaxCounterValue, false);
+        addIntParam   (ParameterId::SendQueueDepth, 0, "Черга відправки", "Найглибша черга відправки серед з'єднань", 0, kMaxCounterValue, false);
+        addStringParam(ParameterId::TaskStacks, "n/a", "Запас стеку задач, Б", "Задачі з найменшим запасом стеку", false);
+        addStringParam(ParameterId::TaskCpu, "n/a", "Завантаження CPU, %", "Задачі з найбільшою часткою часу одного ядра", false);
     }
 
 private:
-    static std::string key_(uint32_t id, char prefix) {
-        char buf[16];
-        snprintf(buf, sizeof(buf), "%c%u", prefix, static_cast<unsigned>(id));
-        return std::string(buf);
+    // NVS key of one parameter, e.g. "i4"; kept on the stack.
+    struct NvsKey {
+        char text[16];
+        const char* c_str() const { return text; }
+    };
+
+    static NvsKey key_(uint32_t id, char prefix) {
+        NvsKey key;
+        snprintf(key.text, sizeof(key.text), "%c%u", prefix, static_cast<unsigned>(id));
+        return key;
     }
 
     esp_err_t nvs_set_i32_(uint32_t id, int32_t v) {
@@ -249,7 +296,7 @@ private:
     }
 
     esp_err_t nvs_set_bool_(uint32_t id, bool v) {
-        std::string k = key_(id, 'c');
+        auto k = key_(id, 'c');
         return nvs_set_u8(nvs_, k.c_str(), v ? 1 : 0);
     }
     esp_err_t nvs_get_bool_(uint32_t id, bool &out) {
@@ -1,16 +1,16 @@
 #include "parameter_store.cpp"
-#include "fd_connection.hpp"
+#include "connection_manager.hpp"
+#include "protocol/link_caps.hpp"
+#include "protocol/lz_codec.hpp"
+#include "protocol/compression_dict.hpp"
+#include "protocol/frame_codec.hpp"
+#include "mbedtls/md.h"
 #include "pb.h"
 #include "pb_encode.h"
 #include "pb_decode.h"
 #include "message_type.cpp"
-
-enum class ParamSetType : uint8_t {
-    SetInt     = 0x04,
-    SetFloat   = 0x05,
-    SetString  = 0x06,
-    SetBoolean = 0x07
-};
+#include "message_dispatcher.hpp"
+#include "timeline.hpp"
 
 enum class SetParam : uint8_t {
     Passphrase     = 0x01,
@@ -21,108 +21,307 @@ using SetParameterCallback = std::function<void(const SetParam& setParam)>;;
 
 class ParameterSync {
 public:
-    ParameterSync(paramstore::ParameterStore& store) : store_(store)
+    using ConnectionId = ConnectionManager::ConnectionId;
+
+    ParameterSync(paramstore::ParameterStore& store, ConnectionManager& connections)
+        : store_(store), connections_(connections)
     {
         store_.onAnyChange([this](uint32_t id, const paramstore::Value& val){
             sendParameterValue(id, val);
         });
     }
     
-    bool handleSetParameter(ParamSetType type, const uint8_t* data, size_t datalen, SetParameterCallback cb) {
-    switch (type) {
-        case ParamSetType::SetInt: {
-            pModel_IntParameter msg = pModel_IntParameter_init_zero;
-            pb_istream_t stream = pb_istream_from_buffer(data, datalen);
-            if (!pb_decode(&stream, pModel_IntParameter_fields, &msg)) {
-                ESP_LOGE(TAG, "Failed to decode IntParameter: %s", PB_GET_ERROR(&stream));
-                return false;
-            }
-            store_.setInt(static_cast<paramstore::ParameterId>(msg.id), static_cast<int32_t>(msg.value));
-            return true;
+    // Called before a client's set of DeviceName or PassPhrase is applied.
+    void setOnSetParameter(SetParameterCallback cb) { onSetParam_ = std::move(cb); }
+
+    // Registers the set and get handlers of the client protocol.
+    void registerHandlers(MessageDispatcher& dispatcher) {
+        dispatcher.on(MessageType::SetInt, &ParameterSync::onSetInt, this);
+        dispatcher.on(MessageType::SetFloat, &ParameterSync::onSetFloat, this);
+        dispatcher.on(MessageType::SetString, &ParameterSync::onSetString, this);
+        dispatcher.on(MessageType::SetBoolean, &ParameterSync::onSetBoolean, this);
+        dispatcher.on(MessageType::Get, &ParameterSync::onGet, this);
+    }
+
+    // target == kNoConnection fans the encoded frame out to every ready session.
+    void sendParameterValue(uint32_t id, const paramstore::Value& val,
+                            ConnectionId target = ConnectionManager::kNoConnection) {
+        uint8_t buffer[128];
+        size_t n = encodeParameterValue(id, val, buffer, sizeof(buffer));
+        if (n) dispatch(target, buffer, n);
+    }
+ 
+    void sendParameterInfo(uint32_t id, const paramstore::Meta& meta,
+                           ConnectionId target = ConnectionManager::kNoConnection) {
+        uint8_t buffer[512];
+        size_t n = encodeParameterInfo(meta, buffer, sizeof(buffer));
+        if (n) dispatch(target, buffer, n);
+    }
+
+    void sendAllParameters(ConnectionId target = ConnectionManager::kNoConnection) {
+        TIMELINE_MARK(SendValuesBegin, target);
+        Batch batch(*this, target);
+        addAllValues(batch);
+        batch.flush();
+        TIMELINE_MARK(SendValuesEnd, target);
+    }
+    
+    void sendAllParametersInfo(ConnectionId target = ConnectionManager::kNoConnection) {
+        TIMELINE_MARK(SendInfoBegin, target);
+        Batch batch(*this, target);
+        for (auto& meta : store_.listMeta()) {
+            uint8_t buffer[512];
+            size_t n = encodeParameterInfo(meta, buffer, sizeof(buffer));
+            if (n) batch.add(buffer, n);
         }
+        batch.flush();
+        TIMELINE_MARK(SendInfoEnd, target);
+    }
 
-        case ParamSetType::SetFloat: {
-            pModel_FloatParameter msg = pModel_FloatParameter_init_zero;
-            pb_istream_t stream = pb_istream_from_buffer(data, datalen);
-            if (!pb_decode(&stream, pModel_FloatParameter_fields, &msg)) {
-                ESP_LOGE(TAG, "Failed to decode FloatParameter: %s", PB_GET_ERROR(&stream));
-                return false;
-            }
-            store_.setFloat(static_cast<paramstore::ParameterId>(msg.id), static_cast<float>(msg.value));
+    // MessageType::SchemaHash frame: the first 8 bytes of SHA-256 over every
+    // parameter's id, type, limits, flags, name and description. A client
+    // that has the schema cached under this hash can use it before the
+    // ParameterInfo messages arrive.
+    std::vector<uint8_t> schemaHashMessage() const {
+        uint8_t hash[32];
+        mbedtls_md_context_t ctx;
+        mbedtls_md_init(&ctx);
+        mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 0);
+        mbedtls_md_starts(&ctx);
+        for (auto& meta : store_.listMeta()) {
+            uint8_t fixed[18];
+            uint32_t type = static_cast<uint32_t>(meta.type);
+            memcpy(fixed, &meta.id, 4);
+            memcpy(fixed + 4, &type, 4);
+            memcpy(fixed + 8, &meta.minValue, 4);
+            memcpy(fixed + 12, &meta.maxValue, 4);
+            fixed[16] = meta.editable;
+            fixed[17] = static_cast<uint8_t>(meta.name.size());
+            mbedtls_md_update(&ctx, fixed, sizeof(fixed));
+            mbedtls_md_update(&ctx, reinterpret_cast<const uint8_t*>(meta.name.data()), meta.name.size());
+            // NUL-terminated: the next parameter's fields cannot shift into it.
+            mbedtls_md_update(&ctx, reinterpret_cast<const uint8_t*>(meta.description.c_str()),
+                              meta.description.size() + 1);
+        }
+        mbedtls_md_finish(&ctx, hash);
+        mbedtls_md_free(&ctx);
+        std::vector<uint8_t> msg(1 + 8);
+        msg[0] = static_cast<uint8_t>(MessageType::SchemaHash);
+        memcpy(msg.data() + 1, hash, 8);
+        return msg;
+    }
+
+private:
+    static constexpr const char* TAG = "ParameterSync";
+
+    using Reply = MessageDispatcher::Reply;
+
+    template <typename Msg>
+    static bool decode(std::span<const uint8_t> payload, const pb_msgdesc_t* fields, Msg& msg, const char* name) {
+        pb_istream_t stream = pb_istream_from_buffer(payload.data(), payload.size());
+        if (!pb_decode(&stream, fields, &msg)) {
+            ESP_LOGE(TAG, "Failed to decode %s: %s", name, PB_GET_ERROR(&stream));
+            return false;
+        }
+        return true;
+    }
+
+    // The store aborts on an unknown id, so client ids are checked first.
+    bool known(uint32_t id) const {
+        if (store_.has(id)) return true;
+        ESP_LOGW(TAG, "Unknown parameter id=%u from client", (unsigned)id);
+        return false;
+    }
+
+    // Read-only parameters (uptime, link and heap statistics) belong to the
+    // device; a client may only set editable ones.
+    bool settable(uint32_t id) const {
+        if (!known(id)) return false;
+        if (store_.editable(id)) return true;
+        ESP_LOGW(TAG, "Set of read-only parameter id=%u from client refused", (unsigned)id);
+        return false;
+    }
+
+    static bool onSetInt(void* ctx, std::span<const uint8_t> payload, const Reply&) {
+        auto* self = static_cast<ParameterSync*>(ctx);
+        pModel_IntParameter msg = pModel_IntParameter_init_zero;
+        if (!decode(payload, pModel_IntParameter_fields, msg, "IntParameter") || !self->settable(msg.id)) return false;
+        self->store_.setInt(static_cast<paramstore::ParameterId>(msg.id), static_cast<int32_t>(msg.value));
+        return true;
+    }
+
+    static bool onSetFloat(void* ctx, std::span<const uint8_t> payload, const Reply&) {
+        auto* self = static_cast<ParameterSync*>(ctx);
+        pModel_FloatParameter msg = pModel_FloatParameter_init_zero;
+        if (!decode(payload, pModel_FloatParameter_fields, msg, "FloatParameter") || !self->settable(msg.id)) return false;
+        self->store_.setFloat(static_cast<paramstore::ParameterId>(msg.id), static_cast<float>(msg.value));
+        return true;
+    }
+
+    static bool onSetString(void* ctx, std::span<const uint8_t> payload, const Reply&) {
+        auto* self = static_cast<ParameterSync*>(ctx);
+        pModel_StringParameter msg = pModel_StringParameter_init_zero;
+        if (!decode(payload, pModel_StringParameter_fields, msg, "StringParameter") || !self->settable(msg.id)) return false;
+        auto id = static_cast<paramstore::ParameterId>(msg.id);
+        std::string value(reinterpret_cast<char*>(msg.value.bytes), msg.value.size);
+        if (self->onSetParam_) {
+            if (id == paramstore::ParameterId::DeviceName) self->onSetParam_(SetParam::ServerName);
+            if (id == paramstore::ParameterId::PassPhrase) self->onSetParam_(SetParam::Passphrase);
+        }
+        self->store_.setString(id, value);
+        return true;
+    }
+
+    static bool onSetBoolean(void* ctx, std::span<const uint8_t> payload, const Reply&) {
+        auto* self = static_cast<ParameterSync*>(ctx);
+        pModel_BooleanParameter msg = pModel_BooleanParameter_init_zero;
+        if (!decode(payload, pModel_BooleanParameter_fields, msg, "BooleanParameter") || !self->settable(msg.id)) return false;
+        self->store_.setBool(static_cast<paramstore::ParameterId>(msg.id), static_cast<bool>(msg.value));
+        return true;
+    }
+
+    // Values go back through the Reply only, batched like the initial dump.
+    static bool onGet(void* ctx, std::span<const uint8_t> payload, const Reply& reply) {
+        auto* self = static_cast<ParameterSync*>(ctx);
+        Batch batch(*self, reply.to(), &reply);
+        if (payload.empty()) {
+            self->addAllValues(batch);
+            batch.flush();
             return true;
         }
+        size_t pos = 0;
+        while (pos < payload.size()) {
+            uint32_t id = 0;
+            unsigned shift = 0;
+            uint8_t b;
+            do {
+                if (pos >= payload.size() || shift > 28) {
+                    ESP_LOGW(TAG, "Malformed Get request");
+                    batch.flush();
+                    return false;
+                }
+                b = payload[pos++];
+                id |= uint32_t(b & 0x7F) << shift;
+                shift += 7;
+            } while (b & 0x80);
+            if (!self->known(id)) continue;
+            uint8_t buffer[128];
+            size_t n = self->encodeParameterValue(id, self->store_.get(id).value, buffer, sizeof(buffer));
+            if (n) batch.add(buffer, n);
+        }
+        batch.flush();
+        return true;
+    }
 
-        case ParamSetType::SetString: {
-            pModel_StringParameter msg = pModel_StringParameter_init_zero;
-            pb_istream_t stream = pb_istream_from_buffer(data, datalen);
-            if (!pb_decode(&stream, pModel_StringParameter_fields, &msg)) {
-                ESP_LOGE(TAG, "Failed to decode StringParameter: %s", PB_GET_ERROR(&stream));
-                return false;
+    paramstore::ParameterStore& store_;
+    ConnectionManager& connections_;
+    SetParameterCallback onSetParam_;
+    // The encoder is shared by every sending task. The frame buffer is
+    // allocated on first use; a second sender meanwhile gets one of its own.
+    std::mutex compressMtx_;
+    lz::Encoder encoder_;
+    std::unique_ptr<uint8_t[]> compressBuf_;
+
+    // Packs messages for one connection into MessageType::Batch frames
+    // ([type][varint len][message]...) when the session negotiated batching;
+    // otherwise every message goes out as its own frame. With a reply the
+    // frames go through it instead of straight to the connection.
+    class Batch {
+    public:
+        Batch(ParameterSync& sync, ConnectionId target, const Reply* reply = nullptr)
+            : sync_(sync), target_(target), reply_(reply) {
+            if (target != ConnectionManager::kNoConnection &&
+                (sync.connections_.caps(target) & linkcaps::Batching)) {
+                limit_ = sync.connections_.maxPayload(target);
+                buf_.reserve(limit_);
             }
-            std::string value(reinterpret_cast<char*>(msg.value.bytes), msg.value.size);
-            if(static_cast<paramstore::ParameterId>(msg.id) == paramstore::ParameterId::DeviceName) {
-				cb(SetParam::ServerName);
-			}
-			if(static_cast<paramstore::ParameterId>(msg.id) == paramstore::ParameterId::PassPhrase) {
-				cb(SetParam::Passphrase);
-			}
-            store_.setString(static_cast<paramstore::ParameterId>(msg.id), value);
-            return true;
         }
 
-        case ParamSetType::SetBoolean: {
-            pModel_BooleanParameter msg = pModel_BooleanParameter_init_zero;
-            pb_istream_t stream = pb_istream_from_buffer(data, datalen);
-            if (!pb_decode(&stream, pModel_BooleanParameter_fields, &msg)) {
-                ESP_LOGE(TAG, "Failed to decode BooleanParameter: %s", PB_GET_ERROR(&stream));
-                return false;
+        void add(const uint8_t* msg, size_t len) {
+            uint8_t prefix[5];
+            size_t prefixLen = varint(len, prefix);
+            if (limit_ == 0 || 1 + prefixLen + len > limit_) {
+                // Too big to batch: what is already packed goes first, so the
+                // client still sees the messages in the order they were added.
+                flush();
+                sync_.dispatch(target_, msg, len, reply_);
+                return;
             }
-            store_.setBool(static_cast<paramstore::ParameterId>(msg.id), static_cast<bool>(msg.value));
-            return true;
+            if (buf_.size() + prefixLen + len > limit_) flush();
+            if (buf_.empty()) buf_.push_back(static_cast<uint8_t>(MessageType::Batch));
+            buf_.insert(buf_.end(), prefix, prefix + prefixLen);
+            buf_.insert(buf_.end(), msg, msg + len);
         }
 
-        default:
-            ESP_LOGW(TAG, "Unknown parameter set type: %d", static_cast<int>(type));
-            return false;
+        void flush() {
+            if (buf_.empty()) return;
+            sync_.dispatch(target_, buf_.data(), buf_.size(), reply_);
+            buf_.clear();
+        }
+
+    private:
+        static size_t varint(size_t v, uint8_t* out) {
+            size_t n = 0;
+            do {
+                uint8_t b = v & 0x7F;
+                v >>= 7;
+                out[n++] = v ? (b | 0x80) : b;
+            } while (v);
+            return n;
+        }
+
+        ParameterSync& sync_;
+        ConnectionId target_;
+        const Reply* reply_;
+        size_t limit_ = 0;
+        std::vector<uint8_t> buf_;
+    };
+
+    void addAllValues(Batch& batch) {
+        for (auto& meta : store_.listMeta()) {
+            uint8_t buffer[128];
+            size_t n = encodeParameterValue(meta.id, store_.get(meta.id).value, buffer, sizeof(buffer));
+            if (n) batch.add(buffer, n);
+        }
     }
-}
 
-    void sendParameterValue(uint32_t id, const paramstore::Value& val) {
-        uint8_t buffer[128];
-        pb_ostream_t ostream = pb_ostream_from_buffer(buffer + 1, sizeof(buffer) - 1);
+    size_t encodeParameterValue(uint32_t id, const paramstore::Value& val, uint8_t* buffer, size_t cap) {
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer + 1, cap - 1);
+        bool ok = false;
 
         if (std::holds_alternative<int32_t>(val)) {
 			buffer[0] = static_cast<uint8_t>(MessageType::Int);
             pModel_IntParameter msg;
-            if (!toValueMessage(id, msg)) return;
-            pb_encode(&ostream, pModel_IntParameter_fields, &msg);
+            if (!toValueMessage(id, msg)) return 0;
+            ok = pb_encode(&ostream, pModel_IntParameter_fields, &msg);
         }
         else if (std::holds_alternative<float>(val)) {
 			buffer[0] = static_cast<uint8_t>(MessageType::Float);
             pModel_FloatParameter msg;
-            if (!toValueMessage(id, msg)) return;
-            pb_encode(&ostream, pModel_FloatParameter_fields, &msg);
+            if (!toValueMessage(id, msg)) return 0;
+            ok = pb_encode(&ostream, pModel_FloatParameter_fields, &msg);
         }
         else if (std::holds_alternative<std::string>(val)) {
 			buffer[0] = static_cast<uint8_t>(MessageType::String);
             pModel_StringParameter msg;
-            if (!toValueMessage(id, msg)) return;
-            pb_encode(&ostream, pModel_StringParameter_fields, &msg);
+            if (!toValueMessage(id, msg)) return 0;
+            ok = pb_encode(&ostream, pModel_StringParameter_fields, &msg);
         }
         else if (std::holds_alternative<bool>(val)) {
 			buffer[0] = static_cast<uint8_t>(MessageType::Boolean);
             pModel_BooleanParameter msg;
-            if (!toValueMessage(id, msg)) return;
-            pb_encode(&ostream, pModel_BooleanParameter_fields, &msg);
+            if (!toValueMessage(id, msg)) return 0;
+            ok = pb_encode(&ostream, pModel_BooleanParameter_fields, &msg);
         }
-        if(connection_) {
-          	connection_ -> enqueueSend(buffer, ostream.bytes_written + 1);
+        if (!ok) {
+            ESP_LOGE(TAG, "Failed to encode value of parameter %u", (unsigned)id);
+            return 0;
         }
+        return ostream.bytes_written + 1;
     }
- 
-    void sendParameterInfo(uint32_t id, const paramstore::Meta& meta) {
-        uint8_t buffer[512];
-        pb_ostream_t ostream = pb_ostream_from_buffer(buffer + 1, sizeof(buffer) - 1);
+
+    size_t encodeParameterInfo(const paramstore::Meta& meta, uint8_t* buffer, size_t cap) {
+        pb_ostream_t ostream = pb_ostream_from_buffer(buffer + 1, cap - 1);
 		buffer[0] = static_cast<uint8_t>(MessageType::ParameterInfo);
         pModel_ParameterInfo out = pModel_ParameterInfo_init_zero;
         out.id = meta.id;
@@ -139,38 +338,86 @@ public:
         out.description.size = n;
         memcpy(out.description.bytes, meta.description.data(), n);
 
-		pb_encode(&ostream, pModel_ParameterInfo_fields, &out);
-		if(connection_) {
-        	connection_ -> enqueueSend(buffer, ostream.bytes_written + 1);
+		if (!pb_encode(&ostream, pModel_ParameterInfo_fields, &out)) {
+            ESP_LOGE(TAG, "Failed to encode info of parameter %u", (unsigned)meta.id);
+            return 0;
         }
+        return ostream.bytes_written + 1;
     }
 
-    void sendAllParameters() {
-        for (auto& meta : store_.listMeta()) {
-            const auto& e = store_.get(meta.id);
-            sendParameterValue(meta.id, e.value);
+    // With a reply, target is reply->to() and the frame goes through the reply.
+    void dispatch(ConnectionId target, const uint8_t* data, size_t len, const Reply* reply = nullptr) {
+        if (isCompressible(data[0])) {
+            dispatchCompressed(target, data, len, reply);
+        } else if (target == ConnectionManager::kNoConnection) {
+            connections_.broadcast(data, len);
+        } else {
+            sendTo(target, data, len, reply);
         }
     }
-    
-    void sendAllParametersInfo() {
-        for (auto& meta : store_.listMeta()) {
-            sendParameterInfo(meta.id, meta);
+
+    void sendTo(ConnectionId target, const uint8_t* data, size_t len, const Reply* reply) {
+        if (reply) {
+            reply->send(data, len);
+        } else {
+            connections_.sendTo(target, data, len);
         }
     }
-    
-    void setConnection(FdConnection* connection) {
-		connection_ = connection;
-	}
-	
-	void removeConnection() {
-		connection_ = nullptr;
-	}
 
-private:
-    static constexpr const char* TAG = "ParameterSync";
+    static bool isCompressible(uint8_t type) {
+        return type == static_cast<uint8_t>(MessageType::ParameterInfo) ||
+               type == static_cast<uint8_t>(MessageType::String) ||
+               type == static_cast<uint8_t>(MessageType::Batch);
+    }
 
-    paramstore::ParameterStore& store_;
-    FdConnection* connection_;
+    // Sessions that negotiated compression get a MessageType::Compressed frame
+    // when it is smaller than the message; everyone else gets the message as is.
+    // Only the encoder runs under compressMtx_: the frame goes to a buffer taken
+    // from compressBuf_, which is handed back once the frame has been sent.
+    void dispatchCompressed(ConnectionId target, const uint8_t* data, size_t len, const Reply* reply) {
+        const bool broadcast = target == ConnectionManager::kNoConnection;
+        const bool wanted = broadcast ? connections_.anyReadyWith(linkcaps::Compression)
+                                      : (connections_.caps(target) & linkcaps::Compression) != 0;
+        std::unique_ptr<uint8_t[]> buf;
+        size_t n = 0;
+        if (wanted) {
+            std::lock_guard<std::mutex> lock(compressMtx_);
+            buf = compressBuf_ ? std::move(compressBuf_)
+                                 : std::unique_ptr<uint8_t[]>(new uint8_t[FrameCodec::kMaxVarintFrame]);
+            n = compress(data, len, buf.get());
+        }
+        if (broadcast) {
+            connections_.broadcast(data, len, linkcaps::Compression, buf.get(), n);
+        } else if (n) {
+            sendTo(target, buf.get(), n, reply);
+        } else {
+            sendTo(target, data, len, reply);
+        }
+        if (buf) {
+            std::lock_guard<std::mutex> lock(compressMtx_);
+            if (!compressBuf_) compressBuf_ = std::move(buf);
+        }
+    }
+
+    // Writes the Compressed frame to out and returns its size, or 0 if it
+    // would not be smaller than the message. Call with compressMtx_ held.
+    size_t compress(const uint8_t* data, size_t len, uint8_t* out) {
+        size_t o = 0;
+        out[o++] = static_cast<uint8_t>(MessageType::Compressed);
+        out[o++] = static_cast<uint8_t>(lz::kDictionaryId);
+        out[o++] = static_cast<uint8_t>(lz::kDictionaryId >> 8);
+        size_t v = len;
+        do {
+            uint8_t b = v & 0x7F;
+            v >>= 7;
+            out[o++] = v ? (b | 0x80) : b;
+        } while (v);
+        if (o >= len) return 0;
+        size_t cap = std::min(len - o, FrameCodec::kMaxVarintFrame - o);
+        size_t n = encoder_.compress(lz::dictionary(), data, len, out + o, cap);
+        if (n == 0 || o + n >= len) return 0;
+        return o + n;
+    }
     
     bool toValueMessage(uint32_t id, pModel_IntParameter &msg) const {
         const paramstore::Entry &e = store_.get(id);
@@ -0,0 +1,253 @@
+#include "passphrase_key_cache.hpp"
+
+#include <cstring>
+#include "esp_log.h"
+#include "mbedtls/md.h"
+#include "mbedtls/pkcs5.h"
+#include "mbedtls/gcm.h"
+#include "mbedtls/platform_util.h"
+#include "crypto_ecdh_aes.hpp"
+#include "os_port.hpp"
+#include "random_service.hpp"
+#if defined(CONFIG_PASSPHRASE_KEY_NVS)
+#include "nvs.h"
+#include "esp_mac.h"
+#include "mbedtls/constant_time.h"
+#endif
+
+namespace {
+    static const char* TAG = "PassphraseKeyCache";
+    static constexpr const char* NVS_NAMESPACE = "kdf";
+    static constexpr const char* NVS_KEY = "pp_key";
+    static constexpr const char* NVS_SECRET = "pp_secret";
+
+    // version | IV | wrapped fingerprint and key | tag. The fingerprint is
+    // only compared once unwrapped, so nothing derived from the passphrase
+    // is stored in the clear.
+    struct WrappedKey {
+        uint8_t version;
+        uint8_t iv[12];
+        uint8_t sealed[16 + PassphraseKeyCache::kKeyLen];
+        uint8_t tag[16];
+    };
+
+    int hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return -1;
+    }
+}
+
+PassphraseKeyCache::PassphraseKeyCache() {
+    const char* hex = CONFIG_PASSPHRASE_KDF_SALT;
+    size_t len = strlen(hex);
+    for (size_t i = 0; i + 1 < len && _saltLen < sizeof(_salt); i += 2) {
+        int hi = hexValue(hex[i]);
+        int lo = hexValue(hex[i + 1]);
+        if (hi < 0 || lo < 0) {
+            ESP_LOGE(TAG, "PASSPHRASE_KDF_SALT is not a hex string");
+            break;
+        }
+        _salt[_saltLen++] = static_cast<uint8_t>((hi << 4) | lo);
+    }
+}
+
+PassphraseKeyCache::~PassphraseKeyCache() {
+    wipe();
+    mbedtls_platform_zeroize(_secret, sizeof(_secret));
+}
+
+void PassphraseKeyCache::prime(const std::string& passphrase) {
+    {
+        std::lock_guard<std::mutex> lock(_mtx);
+        _pending = passphrase;
+    }
+    if (!osport::createTask(&PassphraseKeyCache::primeTask, "kdf_prime", 4096, this, osport::kIdlePriority + 1, nullptr)) {
+        ESP_LOGW(TAG, "No prime task, key will be derived on first connection");
+    }
+}
+
+void PassphraseKeyCache::primeTask(void* arg) {
+    auto* self = static_cast<PassphraseKeyCache*>(arg);
+    {
+        std::lock_guard<std::mutex> lock(self->_mtx);
+        // A newer prime() may have replaced the passphrase; deriving that one is what we want.
+        self->ensure(self->_pending);
+    }
+    osport::exitTask();
+}
+
+bool PassphraseKeyCache::get(const std::string& passphrase, uint8_t* keyOut) {
+    std::lock_guard<std::mutex> lock(_mtx);
+    if (!ensure(passphrase)) return false;
+    memcpy(keyOut, _key, kKeyLen);
+    return true;
+}
+
+bool PassphraseKeyCache::ensure(const std::string& passphrase) {
+    uint8_t fp[kFingerprintLen];
+    if (!ensureSecret() || !fingerprint(passphrase, fp)) return false;
+    if (_valid && memcmp(fp, _fingerprint, sizeof(fp)) == 0) return true;
+    wipe();
+    int64_t startUs = osport::nowUs();
+    if (!loadWrapped(fp)) {
+        if (!derive(passphrase)) return false;
+        storeWrapped(fp);
+    }
+    memcpy(_fingerprint, fp, sizeof(fp));
+    _valid = true;
+    ESP_LOGI(TAG, "Key ready in %u ms", (unsigned)((osport::nowUs() - startUs) / 1000));
+    return true;
+}
+
+// The stored secret, or a random one for this boot.
+bool PassphraseKeyCache::ensureSecret() {
+    if (_secretReady) return true;
+    _secretReady = loadSecret() || randomService().fill(_secret, sizeof(_secret));
+    if (!_secretReady) ESP_LOGE(TAG, "No device secret");
+    return _secretReady;
+}
+
+// Truncated HMAC-SHA256, keyed with the device secret, over the KDF
+// parameters and the passphrase.
+bool PassphraseKeyCache::fingerprint(const std::string& passphrase, uint8_t* out) const {
+    const uint32_t version = CONFIG_PASSPHRASE_KDF_VERSION;
+    const uint32_t iterations = CONFIG_PASSPHRASE_KDF_ITERATIONS;
+    uint8_t mac[32];
+    mbedtls_md_context_t ctx;
+    mbedtls_md_init(&ctx);
+    bool ok = mbedtls_md_setup(&ctx, mbedtls_md_info_from_type(MBEDTLS_MD_SHA256), 1) == 0 &&
+              mbedtls_md_hmac_starts(&ctx, _secret, sizeof(_secret)) == 0 &&
+              mbedtls_md_hmac_update(&ctx, reinterpret_cast<const uint8_t*>(&version), sizeof(version)) == 0 &&
+              mbedtls_md_hmac_update(&ctx, reinterpret_cast<const uint8_t*>(&iterations), sizeof(iterations)) == 0 &&
+              mbedtls_md_hmac_update(&ctx, _salt, _saltLen) == 0 &&
+              mbedtls_md_hmac_update(&ctx, reinterpret_cast<const uint8_t*>(passphrase.data()), passphrase.size()) == 0 &&
+              mbedtls_md_hmac_finish(&ctx, mac) == 0;
+    mbedtls_md_free(&ctx);
+    if (ok) memcpy(out, mac, kFingerprintLen);
+    mbedtls_platform_zeroize(mac, sizeof(mac));
+    return ok;
+}
+
+bool PassphraseKeyCache::derive(const std::string& passphrase) {
+    int ret = mbedtls_pkcs5_pbkdf2_hmac_ext(MBEDTLS_MD_SHA256,
+                                            reinterpret_cast<const unsigned char*>(passphrase.data()),
+                                            passphrase.size(),
+                                            _salt, _saltLen,
+                                            CONFIG_PASSPHRASE_KDF_ITERATIONS,
+                                            kKeyLen, _key);
+    if (ret != 0) {
+        ESP_LOGE(TAG, "pbkdf2 failed: %d", ret);
+        return false;
+    }
+    return true;
+}
+
+void PassphraseKeyCache::wipe() {
+    mbedtls_platform_zeroize(_key, sizeof(_key));
+    _valid = false;
+}
+
+#if defined(CONFIG_PASSPHRASE_KEY_NVS)
+
+// Created on first use; survives a passphrase change.
+bool PassphraseKeyCache::loadSecret() {
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) return false;
+    size_t len = sizeof(_secret);
+    esp_err_t err = nvs_get_blob(nvs, NVS_SECRET, _secret, &len);
+    bool ok = err == ESP_OK && len == sizeof(_secret);
+    if (!ok && randomService().fill(_secret, sizeof(_secret))) {
+        ok = nvs_set_blob(nvs, NVS_SECRET, _secret, sizeof(_secret)) == ESP_OK && nvs_commit(nvs) == ESP_OK;
+        // Keys wrapped under an older secret no longer unwrap.
+        if (ok) nvs_erase_key(nvs, NVS_KEY);
+    }
+    nvs_close(nvs);
+    if (!ok) mbedtls_platform_zeroize(_secret, sizeof(_secret));
+    return ok;
+}
+
+bool PassphraseKeyCache::wrappingKey(uint8_t* out) const {
+    uint8_t ikm[6 + kSecretLen];
+    if (esp_efuse_mac_get_default(ikm) != ESP_OK) return false;
+    memcpy(ikm + 6, _secret, kSecretLen);
+    bool ok = CryptoEcdhAes::hkdf_sha256(nullptr, 0, ikm, sizeof(ikm), "esp-conf key wrap", out, 32);
+    mbedtls_platform_zeroize(ikm, sizeof(ikm));
+    return ok;
+}
+
+bool PassphraseKeyCache::loadWrapped(const uint8_t* fp) {
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READONLY, &nvs) != ESP_OK) return false;
+    WrappedKey blob;
+    size_t len = sizeof(blob);
+    esp_err_t err = nvs_get_blob(nvs, NVS_KEY, &blob, &len);
+    nvs_close(nvs);
+    if (err != ESP_OK || len != sizeof(blob) || blob.version != CONFIG_PASSPHRASE_KDF_VERSION) return false;
+
+    uint8_t kek[32];
+    if (!wrappingKey(kek)) return false;
+    uint8_t plain[sizeof(blob.sealed)];
+    mbedtls_gcm_context gcm;
+    mbedtls_gcm_init(&gcm);
+    int ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, kek, 256);
+    if (ret == 0) {
+        ret = mbedtls_gcm_auth_decrypt(&gcm, sizeof(plain), blob.iv, sizeof(blob.iv),
+                                       &blob.version, 1, blob.tag, sizeof(blob.tag), blob.sealed, plain);
+    }
+    mbedtls_gcm_free(&gcm);
+    mbedtls_platform_zeroize(kek, sizeof(kek));
+    // A stored key of another passphrase is normal after a change; only a
+    // blob that does not unwrap is worth a warning.
+    bool ok = ret == 0 && mbedtls_ct_memcmp(plain, fp, kFingerprintLen) == 0;
+    if (ok) memcpy(_key, plain + kFingerprintLen, kKeyLen);
+    mbedtls_platform_zeroize(plain, sizeof(plain));
+    if (ret != 0) ESP_LOGW(TAG, "Stored key does not unwrap (%d), deriving", ret);
+    return ok;
+}
+
+void PassphraseKeyCache::storeWrapped(const uint8_t* fp) {
+    WrappedKey blob;
+    blob.version = CONFIG_PASSPHRASE_KDF_VERSION;
+    if (!randomService().fill(blob.iv, sizeof(blob.iv))) return;
+
+    uint8_t kek[32];
+    if (!wrappingKey(kek)) return;
+    uint8_t plain[sizeof(blob.sealed)];
+    memcpy(plain, fp, kFingerprintLen);
+    memcpy(plain + kFingerprintLen, _key, kKeyLen);
+    mbedtls_gcm_context gcm;
+    mbedtls_gcm_init(&gcm);
+    int ret = mbedtls_gcm_setkey(&gcm, MBEDTLS_CIPHER_ID_AES, kek, 256);
+    if (ret == 0) {
+        ret = mbedtls_gcm_crypt_and_tag(&gcm, MBEDTLS_GCM_ENCRYPT, sizeof(plain), blob.iv, sizeof(blob.iv),
+                                        &blob.version, 1, plain, blob.sealed, sizeof(blob.tag), blob.tag);
+    }
+    mbedtls_gcm_free(&gcm);
+    mbedtls_platform_zeroize(kek, sizeof(kek));
+    mbedtls_platform_zeroize(plain, sizeof(plain));
+    if (ret != 0) {
+        ESP_LOGE(TAG, "Key wrap failed: %d", ret);
+        return;
+    }
+
+    nvs_handle_t nvs;
+    if (nvs_open(NVS_NAMESPACE, NVS_READWRITE, &nvs) != ESP_OK) return;
+    if (nvs_set_blob(nvs, NVS_KEY, &blob, sizeof(blob)) == ESP_OK) nvs_commit(nvs);
+    nvs_close(nvs);
+}
+
+#else
+
+bool PassphraseKeyCache::loadSecret() { return false; }
+bool PassphraseKeyCache::wrappingKey(uint8_t*) const { return false; }
+bool PassphraseKeyCache::loadWrapped(const uint8_t*) { return false; }
+void PassphraseKeyCache::storeWrapped(const uint8_t*) {}
+
+#endif
+
+PassphraseKeyCache& passphraseKeyCache() {
+    static PassphraseKeyCache cache;
+    return cache;
+}
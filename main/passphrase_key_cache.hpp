@@ -0,0 +1,76 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include "sdkconfig.h"
+
+#ifndef CONFIG_PASSPHRASE_KDF_SALT
+#define CONFIG_PASSPHRASE_KDF_SALT "0001020304050607"
+#endif
+#ifndef CONFIG_PASSPHRASE_KDF_ITERATIONS
+#define CONFIG_PASSPHRASE_KDF_ITERATIONS 10000
+#endif
+#ifndef CONFIG_PASSPHRASE_KDF_VERSION
+#define CONFIG_PASSPHRASE_KDF_VERSION 1
+#endif
+
+// AES key of the passphrase protocols, PBKDF2-HMAC-SHA256 of the PassPhrase
+// parameter. It is derived once per passphrase instead of once per
+// connection: prime() is called when the parameter changes and derives in a
+// low priority task, get() returns the cached key (or derives it if the
+// background run has not finished).
+//
+// The key only lives in this object in internal RAM and is wiped when the
+// passphrase changes. It is matched to a passphrase by an HMAC fingerprint
+// keyed with a device secret, so the fingerprint is no shortcut around PBKDF2
+// for guessing the passphrase. The secret is random per boot, or with
+// CONFIG_PASSPHRASE_KEY_NVS kept in NVS. The key is then stored there too,
+// AES-GCM wrapped together with its fingerprint under a key derived from the
+// factory MAC and the secret, so a reboot does not pay for PBKDF2 either;
+// this only adds secrecy on top of NVS encryption.
+//
+// Salt, iteration count and a version number come from Kconfig; changing any
+// of them invalidates the cached and stored key.
+class PassphraseKeyCache {
+public:
+    static constexpr size_t kKeyLen = 32;
+
+    PassphraseKeyCache();
+    ~PassphraseKeyCache();
+
+    PassphraseKeyCache(const PassphraseKeyCache&) = delete;
+    PassphraseKeyCache& operator=(const PassphraseKeyCache&) = delete;
+
+    // Starts deriving the key for passphrase in the background.
+    void prime(const std::string& passphrase);
+    bool get(const std::string& passphrase, uint8_t* keyOut);
+
+private:
+    static constexpr size_t kFingerprintLen = 16;
+    static constexpr size_t kSecretLen = 32;
+
+    static void primeTask(void* arg);
+    // Both called with _mtx held.
+    bool ensure(const std::string& passphrase);
+    bool ensureSecret();
+    bool fingerprint(const std::string& passphrase, uint8_t* out) const;
+    bool derive(const std::string& passphrase);
+    bool loadWrapped(const uint8_t* fp);
+    void storeWrapped(const uint8_t* fp);
+    bool loadSecret();
+    bool wrappingKey(uint8_t* out) const;
+    void wipe();
+
+    std::mutex _mtx;
+    std::string _pending;
+    uint8_t _salt[32];
+    size_t _saltLen = 0;
+    uint8_t _secret[kSecretLen];
+    bool _secretReady = false;
+    uint8_t _fingerprint[kFingerprintLen];
+    uint8_t _key[kKeyLen];
+    bool _valid = false;
+};
+
+PassphraseKeyCache& passphraseKeyCache();
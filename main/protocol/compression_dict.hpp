@@ -0,0 +1,73 @@
+// Generated by tools/gen_compression_dict.py from parameter_store.cpp - do not edit.
+#pragma once
+#include <cstdint>
+#include <span>
+
+namespace lz {
+
+// Preset dictionary: parameter names, descriptions and default strings.
+static constexpr char kDictionaryText[] =
+    "Pass-фраза"
+    "На її основі генерується симетричний ключ для обміну повідомлень"
+    "Назва Bluetooth пристрою"
+    "Відображається у результатах сканування пристроїв"
+    "LED увімкнено"
+    "Увімкни діод"
+    "Кількість мигань"
+    "Кількість послідовних коротких мигань розділених паузою"
+    "Час від запуску"
+    "Демонстрація динамічного оновлення параметру"
+    "Джойстик X"
+    "Положення джойстика по осі X"
+    "Джойстик Y"
+    "Положення джойстика по осі Y"
+    "Значення"
+    "Приклад Текст"
+    "Приклад відображення текстового параметру"
+    "Приклад Буль"
+    "Приклад відображення булевого параметру"
+    "Байтів отримано"
+    "Сума по всіх з'єднаннях від запуску"
+    "Байтів надіслано"
+    "Кадрів отримано"
+    "Кадри протоколу від клієнтів"
+    "Кадрів надіслано"
+    "Кадри протоколу до клієнтів"
+    "Помилки дешифрування"
+    "Кадри, які не пройшли перевірку AES-GCM"
+    "Тривалість рукостискання, мс"
+    "Останнє рукостискання"
+    "Пік черги відправки"
+    "Найбільша глибина черги відправки"
+    "Повтори запису"
+    "Скільки разів write() повернув EAGAIN"
+    "0/0/0/0/0/0"
+    "Затримка кадрів"
+    "Кількість кадрів до 1/5/20/100/500 мс і більше"
+    "Вільна пам'ять, Б"
+    "Внутрішня RAM"
+    "Мінімум вільної пам'яті, Б"
+    "Найменше значення від запуску"
+    "Найбільший вільний блок, Б"
+    "Найбільше можливе виділення у внутрішній RAM"
+    "n/a"
+    "Пам'ять DMA/PSRAM, КіБ"
+    "Вільно/мінімум/найбільший блок"
+    "Черга застосунку"
+    "Команди, що чекають на appTask"
+    "Черга відправки"
+    "Найглибша черга відправки серед з'єднань"
+    "Запас стеку задач, Б"
+    "Задачі з найменшим запасом стеку"
+    "Завантаження CPU, %"
+    "Задачі з найбільшою часткою часу одного ядра";
+
+// Sent with every compressed message so a client with another dictionary
+// rejects it instead of decoding garbage.
+static constexpr uint16_t kDictionaryId = 0x1658;
+
+inline std::span<const uint8_t> dictionary() {
+    return {reinterpret_cast<const uint8_t*>(kDictionaryText), sizeof(kDictionaryText) - 1};
+}
+
+} // namespace lz
@@ -4,22 +4,81 @@
 #include "raw_protocol.hpp"
 #include "sdkconfig.h"
 
-std::unique_ptr<Protocol> createProtocol(const char* passPhrase) {
-#if defined(CONFIG_PROTOCOL_EPHEMERAL)
-    return std::make_unique<EcdhAesProtocol>(passPhrase);
-#elif defined(CONFIG_PROTOCOL_PASSPHRASE)
-    return std::make_unique<PassphraseAesProtocol>(passPhrase);
+namespace {
+
+// Used when the client does not name a cipher (plain "guard" line).
+constexpr uint32_t kDefaultCipher =
+#if defined(CONFIG_PROTOCOL_PASSPHRASE)
+    linkcaps::CipherPassphrase;
 #elif defined(CONFIG_PROTOCOL_RAW)
-    return std::make_unique<RawProtocol>(passPhrase);
+    linkcaps::CipherRaw;
 #else
-    return std::make_unique<EcdhAesProtocol>(passPhrase);
+    linkcaps::CipherEphemeral;
 #endif
-}
 
-bool isFast() {
-#if defined(CONFIG_PROTOCOL_EPHEMERAL) || defined(CONFIG_PROTOCOL_PASSPHRASE)
-    return false;
-#else
-    return true;
+// Ciphers a client may pick at runtime. The default one is always allowed.
+constexpr uint32_t kAllowedCiphers = kDefaultCipher
+#if defined(CONFIG_PROTOCOL_ALLOW_EPHEMERAL)
+    | linkcaps::CipherEphemeral
+#endif
+#if defined(CONFIG_PROTOCOL_ALLOW_PASSPHRASE)
+    | linkcaps::CipherPassphrase
+#endif
+#if defined(CONFIG_PROTOCOL_ALLOW_RAW)
+    | linkcaps::CipherRaw
+#endif
+    ;
+
+constexpr uint32_t kDisabledCaps = 0
+#if !defined(CONFIG_PROTOCOL_ALLOW_COMPRESSION)
+    | linkcaps::Compression
+#endif
+#if !defined(CONFIG_PROTOCOL_ALLOW_RESUME)
+    | linkcaps::Resume
+#endif
+#if !defined(CONFIG_PROTOCOL_ALLOW_CHACHAPOLY)
+    | linkcaps::ChaChaPoly
 #endif
+#if !defined(CONFIG_PROTOCOL_ALLOW_X25519)
+    | linkcaps::CurveX25519
+#endif
+    ;
+
+}
+
+uint32_t acceptCaps(uint32_t offered, bool announced) {
+    if (!announced) return kDefaultCipher;
+    uint32_t caps = offered & linkcaps::kSupported & ~linkcaps::kCipherMask & ~kDisabledCaps;
+    uint32_t ciphers = offered & linkcaps::kCipherMask;
+    uint32_t cipher = 0;
+    if (ciphers == 0) {
+        cipher = kDefaultCipher;
+    } else {
+        ciphers &= kAllowedCiphers;
+        // Strongest offered cipher wins.
+        for (uint32_t c : {linkcaps::CipherEphemeral, linkcaps::CipherPassphrase, linkcaps::CipherRaw}) {
+            if (ciphers & c) {
+                cipher = c;
+                break;
+            }
+        }
+    }
+    // Only ephemeral sessions have a key that is new every time; with the
+    // passphrase key, counters restarting at zero would repeat nonces.
+    if (cipher != linkcaps::CipherEphemeral) caps &= ~(linkcaps::CounterNonce | linkcaps::CurveX25519 | linkcaps::BinaryHandshake);
+    if (cipher == linkcaps::CipherRaw) caps &= ~linkcaps::ChaChaPoly;
+    return caps | cipher;
+}
+
+std::unique_ptr<Protocol> createProtocol(uint32_t cipher, const char* passPhrase) {
+    switch (cipher & linkcaps::kCipherMask) {
+        case linkcaps::CipherEphemeral:  return std::make_unique<EcdhAesProtocol>(passPhrase);
+        case linkcaps::CipherPassphrase: return std::make_unique<PassphraseAesProtocol>(passPhrase);
+        case linkcaps::CipherRaw:        return std::make_unique<RawProtocol>(passPhrase);
+        default:                         return nullptr;
+    }
+}
+
+bool isFast(uint32_t caps) {
+    return (caps & linkcaps::CipherRaw) != 0;
 }
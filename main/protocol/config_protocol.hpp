@@ -2,5 +2,9 @@
 #include "protocol.hpp"
 #include <memory>
 
-std::unique_ptr<Protocol> createProtocol(const char* passPhrase);
-bool isFast();
+// Capabilities the device accepts for a client offer. The result carries
+// exactly one cipher bit, or none if no offered cipher is allowed.
+uint32_t acceptCaps(uint32_t offered, bool announced);
+std::unique_ptr<Protocol> createProtocol(uint32_t cipher, const char* passPhrase);
+// Links cheap enough for high-rate telemetry.
+bool isFast(uint32_t caps);
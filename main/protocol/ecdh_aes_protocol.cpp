@@ -3,66 +3,80 @@
 #include <cstring>
 #include <stdint.h>
 #include <string>
+#include <string_view>
 #include "esp_log.h"
+#include "mbedtls/base64.h"
+#include "mbedtls/platform_util.h"
 #include "pb_decode.h"
 #include "pb_encode.h"
 #include "proto-model/Handshake.pb.h"
 
 static const char* TAG = "EcdhAesProtocol";
 
-EcdhAesProtocol::EcdhAesProtocol(std::string passPhrase): crypto(CryptoEcdhAes::Mode::EPHEMERAL), _passPhrase(passPhrase) {}
+// text2 of a resuming client: "resume:<base64 ticket id>:<base64 16-byte nonce>".
+// The device answers with "resume:<base64 16-byte nonce>" and no public key.
+static constexpr const char* kResumePrefix = "resume:";
+// Sent instead of 0x11 when only the ticket was refused: the client should
+// follow up with a full handshake on the same connection.
+static constexpr uint8_t kCodeResumeRejected = 0x12;
+
+// Binary handshake (linkcaps::BinaryHandshake), raw keys instead of base64 in protobuf:
+//   client: [version][flags][bind len][bind phrase][public key | ticket id (16) + nonce (16)]
+//   device: [version][flags][ticket id (16), if kFlagTicket][public key | nonce (16)]
+// kFlagResume marks a ticket offer from the client and an accepted one in the reply.
+static constexpr uint8_t kBinaryVersion = 1;
+static constexpr uint8_t kFlagResume = 1u << 0;
+static constexpr uint8_t kFlagTicket = 1u << 1;
+static constexpr size_t kNonceLen = 16;
+
+static bool decodeBase64(const char* in, size_t inLen, uint8_t* out, size_t outLen) {
+    size_t olen = 0;
+    return mbedtls_base64_decode(out, outLen, &olen, reinterpret_cast<const unsigned char*>(in), inLen) == 0 &&
+           olen == outLen;
+}
+
+static void encodeBase64(const uint8_t* in, size_t inLen, char* out, size_t outLen) {
+    size_t olen = 0;
+    if (mbedtls_base64_encode(reinterpret_cast<unsigned char*>(out), outLen, &olen, in, inLen) != 0) out[0] = '\0';
+}
+
+EcdhAesProtocol::EcdhAesProtocol(std::string passPhrase)
+    : crypto(CryptoEcdhAes::Mode::EPHEMERAL), _passPhrase(passPhrase), sealBuf(new uint8_t[FrameCodec::kMaxVarintFrame]) {}
 
 EcdhAesProtocol::~EcdhAesProtocol() {}
 
 void EcdhAesProtocol::init(WriteCallback writeCb, QueueCallback recvCb) {
     this->writeCb = writeCb;
     this->recvCb = recvCb;
-    buffer.clear();
+    beginSession();
     handshakeReceived = false;
-    xSemaphoreTake(sendReady, 0); 
-    //no header
-	uint8_t headerLen = 0;
-	writeCb(&headerLen, 1);
-}
-
-void EcdhAesProtocol::appendReceived(const uint8_t* data, size_t len) {
-    buffer.insert(buffer.end(), data, data + len);
-    while (true) {
-        if (buffer.empty()) return;
-        uint8_t frameLen = buffer[0];
-        if (buffer.size() < frameLen + 1) {
-            return; 
-        }
-        std::vector<uint8_t> frame(buffer.begin() + 1, buffer.begin() + 1 + frameLen);
-        buffer.erase(buffer.begin(), buffer.begin() + 1 + frameLen);
-        std::vector<uint8_t> decrypted;
-        if(handshakeReceived) decrypted = decryptFrame(frame); else decrypted = frame;
-        if (!handshakeReceived) {
-            if (parseHandshake(decrypted)) {
-                handshakeReceived = true;
-                ESP_LOGI(TAG, "Handshake complete");
-                if(readyCallback) readyCallback();
-                sendHandshake();
-                xSemaphoreGive(sendReady);
-            } else {
-				sendCode(0x11);
-			}
-        } else {          
-            if (recvCb) recvCb(decrypted);
-        }
-    }
+    resumed = false;
+    crypto.select_aead((acceptedCaps & linkcaps::ChaChaPoly) ? Aead::Kind::ChaChaPoly : Aead::Kind::AesGcm);
+    crypto.select_curve((acceptedCaps & linkcaps::CurveX25519) ? CryptoEcdhAes::Curve::X25519
+                                                               : CryptoEcdhAes::Curve::P256);
+    writeSessionHeader();
 }
 
-bool EcdhAesProtocol::send(const uint8_t* data, size_t len) {
-    if (xSemaphoreTake(sendReady, pdMS_TO_TICKS(5000)) == pdFALSE) {
-        ESP_LOGW(TAG, "Send blocked: handshake not complete");
-        return false;
+void EcdhAesProtocol::onFrame(std::span<uint8_t> frame) {
+    if (!handshakeReceived) {
+        const bool binary = acceptedCaps & linkcaps::BinaryHandshake;
+        if ((binary ? parseBinaryHello(frame) : parseHandshake(frame)) && bindCaps() && applyNonceMode()) {
+            handshakeReceived = true;
+            ESP_LOGI(TAG, "Handshake complete");
+            noteHandshakeDone();
+            if (binary ? sendBinaryReply() : sendHandshake()) markReady();
+        } else {
+			sendCode(resumeRejected ? kCodeResumeRejected : 0x11);
+		}
+    } else {
+        std::span<const uint8_t> plain;
+        if (decryptFrame(frame, plain) && recvCb) recvCb(plain);
     }
-    xSemaphoreGive(sendReady);
-    auto encrypted = encryptFrame({data, data + len});
-    uint8_t hdr = encrypted.size();
-    writeCb(&hdr, 1);
-    writeCb(encrypted.data(), encrypted.size());
+}
+
+bool EcdhAesProtocol::sendFrame(const uint8_t* data, size_t len) {
+    if (!sealAndWrite(data, len)) return false;
+    LinkMetrics::add(linkMetrics().framesOut);
     return true;
 }
 
@@ -70,26 +84,37 @@ void EcdhAesProtocol::sendCode(uint8_t code) {
     writeCb(&code, 1);
 }
 
-void EcdhAesProtocol::sendHandshake() {
+bool EcdhAesProtocol::sendHandshake() {
 	ESP_LOGI(TAG, "Sending HANDSHAKE");
      
     pModel_HandshakeRequest req = pModel_HandshakeRequest_init_zero;
-    char pk_base64[256];  
-    crypto.get_encoded_public_key(pk_base64, sizeof(pk_base64));
-    strncpy(req.text2, pk_base64, sizeof(req.text2) - 1);
-    req.text2[sizeof(req.text2) - 1] = '\0'; 
-    uint8_t buffer[256];
+    if (resumed) {
+        char nonce_base64[32];
+        encodeBase64(deviceNonce, sizeof(deviceNonce), nonce_base64, sizeof(nonce_base64));
+        snprintf(req.text2, sizeof(req.text2), "%s%s", kResumePrefix, nonce_base64);
+    } else {
+        char pk_base64[256];  
+        crypto.get_encoded_public_key(pk_base64, sizeof(pk_base64));
+        if (pk_base64[0] == '\0') {
+            sendCode(5);
+            return false;
+        }
+        strncpy(req.text2, pk_base64, sizeof(req.text2) - 1);
+        req.text2[sizeof(req.text2) - 1] = '\0'; 
+    }
+    if (ticketIssued) encodeBase64(ticketId.data(), ticketId.size(), req.text, sizeof(req.text));
+    uint8_t buffer[pModel_HandshakeRequest_size];
     pb_ostream_t stream = pb_ostream_from_buffer(buffer, sizeof(buffer));
     if (!pb_encode(&stream, pModel_HandshakeRequest_fields, &req)) {
         ESP_LOGE(TAG, "Handshake encode failed: %s", PB_GET_ERROR(&stream));
         sendCode(5);
+        return false;
     }  
-    uint8_t len = stream.bytes_written;
-    writeCb(&len, 1);
-    writeCb(buffer, len);
+    return writeFrame(buffer, stream.bytes_written);
 }
 
-bool EcdhAesProtocol::parseHandshake(const std::vector<uint8_t>& frame) {
+bool EcdhAesProtocol::parseHandshake(std::span<const uint8_t> frame) {
+    resumeRejected = false;
     pModel_HandshakeRequest resp = pModel_HandshakeRequest_init_zero;
     pb_istream_t istream = pb_istream_from_buffer(frame.data(), frame.size());
     if (!pb_decode(&istream, pModel_HandshakeRequest_fields, &resp)) {
@@ -101,19 +126,154 @@ bool EcdhAesProtocol::parseHandshake(const std::vector<uint8_t>& frame) {
 		ESP_LOGW(TAG, "Bound phrase is wrong");
 		return false;
 	}
+    if ((acceptedCaps & linkcaps::Resume) && strncmp(resp.text2, kResumePrefix, strlen(kResumePrefix)) == 0) {
+        return resumeSession(resp.text2 + strlen(kResumePrefix));
+    }
     std::vector<uint8_t> b64(resp.text2, resp.text2 + strlen(resp.text2));
     bool res = crypto.apply_other_public(b64);
+    if (res && (acceptedCaps & linkcaps::Resume)) issueTicket();
+    return res;
+}
+
+bool EcdhAesProtocol::resumeSession(const char* offer) {
+    resumeRejected = true;
+    const char* sep = strchr(offer, ':');
+    SessionTickets::Id id;
+    uint8_t clientNonce[kNonceLen];
+    if (!sep || !decodeBase64(offer, sep - offer, id.data(), id.size()) ||
+        !decodeBase64(sep + 1, strlen(sep + 1), clientNonce, sizeof(clientNonce))) {
+        ESP_LOGW(TAG, "Malformed resume offer");
+        return false;
+    }
+    return resumeSession(id, clientNonce);
+}
+
+bool EcdhAesProtocol::resumeSession(const SessionTickets::Id& id, const uint8_t* clientNonce) {
+    resumeRejected = true;
+    uint8_t salt[2 * kNonceLen];
+    uint8_t secret[SessionTickets::kSecretLen];
+    if (!sessionTickets().redeem(id, secret)) {
+        ESP_LOGI(TAG, "Ticket unknown or expired, full handshake required");
+        return false;
+    }
+    crypto.random_bytes(deviceNonce, sizeof(deviceNonce));
+    memcpy(salt, clientNonce, kNonceLen);
+    memcpy(salt + kNonceLen, deviceNonce, sizeof(deviceNonce));
+    bool ok = crypto.apply_resumed_key(secret, sizeof(secret), salt, sizeof(salt));
+    mbedtls_platform_zeroize(secret, sizeof(secret));
+    if (!ok) return false;
+    resumeRejected = false;
+    resumed = true;
+    ESP_LOGI(TAG, "Session resumed from ticket");
+    return true;
+}
+
+bool EcdhAesProtocol::parseBinaryHello(std::span<const uint8_t> frame) {
+    resumeRejected = false;
+    if (frame.size() < 3 || frame[0] != kBinaryVersion) {
+        ESP_LOGE(TAG, "Malformed binary hello");
+        return false;
+    }
+    const uint8_t flags = frame[1];
+    const size_t bindLen = frame[2];
+    if (frame.size() < 3 + bindLen) return false;
+    std::string_view bind(reinterpret_cast<const char*>(frame.data() + 3), bindLen);
+    if (bind != _passPhrase) {
+        ESP_LOGW(TAG, "Bound phrase is wrong");
+        return false;
+    }
+    std::span<const uint8_t> payload = frame.subspan(3 + bindLen);
+    if (flags & kFlagResume) {
+        if (!(acceptedCaps & linkcaps::Resume) || payload.size() != SessionTickets::kIdLen + kNonceLen) {
+            ESP_LOGW(TAG, "Malformed resume offer");
+            resumeRejected = true;
+            return false;
+        }
+        SessionTickets::Id id;
+        memcpy(id.data(), payload.data(), id.size());
+        return resumeSession(id, payload.data() + id.size());
+    }
+    bool res = crypto.apply_other_public_raw(payload.data(), payload.size());
+    if (res && (acceptedCaps & linkcaps::Resume)) issueTicket();
     return res;
 }
 
-std::vector<uint8_t> EcdhAesProtocol::encryptFrame(const std::vector<uint8_t>& plain) {
-	std::vector<uint8_t> enc = crypto.encrypt_data_whole(plain);
-    if(enc.empty()) sendCode(2);
-    return enc; 
+bool EcdhAesProtocol::sendBinaryReply() {
+    uint8_t reply[2 + SessionTickets::kIdLen + CryptoEcdhAes::kMaxPublicKeyLen];
+    size_t n = 0;
+    reply[n++] = kBinaryVersion;
+    reply[n++] = (resumed ? kFlagResume : 0) | (ticketIssued ? kFlagTicket : 0);
+    if (ticketIssued) {
+        memcpy(reply + n, ticketId.data(), ticketId.size());
+        n += ticketId.size();
+    }
+    if (resumed) {
+        memcpy(reply + n, deviceNonce, sizeof(deviceNonce));
+        n += sizeof(deviceNonce);
+    } else {
+        size_t keyLen = crypto.write_public_key(reply + n, sizeof(reply) - n);
+        if (keyLen == 0) {
+            sendCode(5);
+            return false;
+        }
+        n += keyLen;
+    }
+    return writeFrame(reply, n);
+}
+
+void EcdhAesProtocol::issueTicket() {
+    uint8_t secret[SessionTickets::kSecretLen];
+    if (!crypto.export_resumption_secret(secret, sizeof(secret))) return;
+    crypto.random_bytes(ticketId.data(), ticketId.size());
+    sessionTickets().issue(ticketId, secret);
+    mbedtls_platform_zeroize(secret, sizeof(secret));
+    ticketIssued = true;
 }
 
-std::vector<uint8_t> EcdhAesProtocol::decryptFrame(const std::vector<uint8_t>& enc) {
-    std::vector<uint8_t> dec = crypto.decrypt_data_whole(enc);
-    if(dec.empty()) sendCode(2);
-    return dec; 
+bool EcdhAesProtocol::sealAndWrite(const uint8_t* data, size_t len) {
+    const size_t sealedLen = len + crypto.overhead();
+    if (sealedLen > FrameCodec::kMaxVarintFrame) return false;
+    uint8_t header[FrameCodec::kMaxHeaderLen];
+    size_t headerLen = frameAad(sealedLen, header);
+    std::lock_guard<std::mutex> lock(sealMtx);
+    memcpy(sealBuf.get() + crypto.nonce_field_len(), data, len);
+    if (!crypto.seal(sealBuf.get(), len, header, headerLen)) {
+        sendCode(2);
+        return false;
+    }
+    return writeFrame(sealBuf.get(), sealedLen);
+}
+
+// A plain "guard" line has no caps to bind.
+bool EcdhAesProtocol::bindCaps() {
+    return !capsAnnounced || crypto.bind_caps(offeredCaps, acceptedCaps);
+}
+
+// The session key is fresh (new ECDH secret, or a resumed secret mixed with
+// new nonces), so counters may start at zero.
+bool EcdhAesProtocol::applyNonceMode() {
+    if (!(acceptedCaps & linkcaps::CounterNonce)) return true;
+    return crypto.enable_counter_nonces();
+}
+
+// With counter nonces the frame's length prefix is authenticated as AAD. The
+// decoder rejects non-canonical prefixes, so re-encoding the received length
+// reproduces the bytes that were on the wire.
+size_t EcdhAesProtocol::frameAad(size_t sealedLen, uint8_t* out) const {
+    if (!(acceptedCaps & linkcaps::CounterNonce)) return 0;
+    return codec.encodeHeader(sealedLen, out);
+}
+
+bool EcdhAesProtocol::decryptFrame(std::span<uint8_t> enc, std::span<const uint8_t>& plain) {
+    uint8_t* plainPtr = nullptr;
+    size_t plainLen = 0;
+    uint8_t header[FrameCodec::kMaxHeaderLen];
+    size_t headerLen = frameAad(enc.size(), header);
+    if (!crypto.open(enc.data(), enc.size(), plainPtr, plainLen, header, headerLen)) {
+        LinkMetrics::add(linkMetrics().decryptFailures);
+        sendCode(2);
+        return false;
+    }
+    plain = std::span<const uint8_t>(plainPtr, plainLen);
+    return true;
 }
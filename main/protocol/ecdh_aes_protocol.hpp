@@ -1,11 +1,10 @@
 #pragma once
 #include "protocol.hpp"
-#include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "crypto_ecdh_aes.hpp"
+#include "session_tickets.hpp"
 #include <stdint.h>
-#include <sys/_intsup.h>
+#include <memory>
 
 class EcdhAesProtocol : public Protocol {
 public:
@@ -13,17 +12,38 @@ public:
     ~EcdhAesProtocol() override;
 
     void init(WriteCallback writeCb, QueueCallback recvCb) override;
-    void appendReceived(const uint8_t* data, size_t len) override;
-    bool send(const uint8_t* data, size_t len) override;
+    size_t frameOverhead() const override { return crypto.overhead(); }
+
+protected:
+    void onFrame(std::span<uint8_t> frame) override;
+    bool sendFrame(const uint8_t* data, size_t len) override;
 
 private:
     bool handshakeReceived = false;
+    // Set when the client's handshake redeemed a ticket (linkcaps::Resume).
+    bool resumed = false;
+    bool resumeRejected = false;
+    uint8_t deviceNonce[16];
+    SessionTickets::Id ticketId{};
+    bool ticketIssued = false;
     CryptoEcdhAes crypto;
     std::string _passPhrase;
+    // Outgoing frames are sealed here in place; allocated once per session.
+    // Frames are decrypted in place in the receive buffer.
+    std::unique_ptr<uint8_t[]> sealBuf;
+    std::mutex sealMtx;
 
     void sendCode(uint8_t code);
-    void sendHandshake();
-    bool parseHandshake(const std::vector<uint8_t>& frame);
-    std::vector<uint8_t> encryptFrame(const std::vector<uint8_t>& plain);
-    std::vector<uint8_t> decryptFrame(const std::vector<uint8_t>& enc);
+    bool sendHandshake();
+    bool parseHandshake(std::span<const uint8_t> frame);
+    bool resumeSession(const char* offer);
+    bool resumeSession(const SessionTickets::Id& id, const uint8_t* clientNonce);
+    bool parseBinaryHello(std::span<const uint8_t> frame);
+    bool sendBinaryReply();
+    void issueTicket();
+    bool sealAndWrite(const uint8_t* data, size_t len);
+    size_t frameAad(size_t sealedLen, uint8_t* out) const;
+    bool bindCaps();
+    bool applyNonceMode();
+    bool decryptFrame(std::span<uint8_t> enc, std::span<const uint8_t>& plain);
 };
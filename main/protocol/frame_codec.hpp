@@ -0,0 +1,65 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+
+// Length prefix of a protocol frame.
+//   Byte   - one length byte, frames up to 255 bytes (original framing)
+//   Varint - LEB128 length, frames up to kMaxVarintFrame bytes
+class FrameCodec {
+public:
+    enum class Framing : uint8_t { Byte, Varint };
+    enum class Result { Ok, NeedMore, Error };
+
+    static constexpr size_t kMaxByteFrame = 0xFF;
+    static constexpr size_t kMaxVarintFrame = 4096;
+    static constexpr size_t kMaxHeaderLen = 3;
+
+    void setFraming(Framing f) { framing_ = f; }
+    Framing framing() const { return framing_; }
+
+    size_t maxFrame() const { return framing_ == Framing::Varint ? kMaxVarintFrame : kMaxByteFrame; }
+
+    // Writes the length prefix to out (kMaxHeaderLen bytes). Returns the
+    // prefix length, or 0 if len does not fit the current framing.
+    size_t encodeHeader(size_t len, uint8_t* out) const {
+        if (len > maxFrame()) return 0;
+        if (framing_ == Framing::Byte) {
+            out[0] = static_cast<uint8_t>(len);
+            return 1;
+        }
+        size_t n = 0;
+        do {
+            uint8_t b = len & 0x7F;
+            len >>= 7;
+            out[n++] = len ? (b | 0x80) : b;
+        } while (len);
+        return n;
+    }
+
+    // Parses a length prefix from the first avail bytes of data.
+    Result decodeHeader(const uint8_t* data, size_t avail, size_t& frameLen, size_t& headerLen) const {
+        if (avail == 0) return Result::NeedMore;
+        if (framing_ == Framing::Byte) {
+            frameLen = data[0];
+            headerLen = 1;
+            return Result::Ok;
+        }
+        size_t len = 0;
+        for (size_t i = 0; i < kMaxHeaderLen; i++) {
+            if (i >= avail) return Result::NeedMore;
+            len |= static_cast<size_t>(data[i] & 0x7F) << (7 * i);
+            if (!(data[i] & 0x80)) {
+                // Reject over-long encodings so every length has one representation.
+                if (i > 0 && data[i] == 0) return Result::Error;
+                if (len > kMaxVarintFrame) return Result::Error;
+                frameLen = len;
+                headerLen = i + 1;
+                return Result::Ok;
+            }
+        }
+        return Result::Error;
+    }
+
+private:
+    Framing framing_ = Framing::Byte;
+};
@@ -0,0 +1,92 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include "frame_codec.hpp"
+
+// Reassembles length-prefixed frames from a byte stream in a fixed ring
+// buffer. Complete frames are handed out as spans into the ring; only a frame
+// that wraps around the end of the ring is linearised into a scratch buffer.
+// Both buffers are allocated once, so steady-state decoding never allocates.
+class FrameDecoder {
+public:
+    static constexpr size_t kCapacity = FrameCodec::kMaxVarintFrame + FrameCodec::kMaxHeaderLen;
+
+    FrameDecoder() : ring_(new uint8_t[kCapacity]) {}
+
+    FrameDecoder(const FrameDecoder&) = delete;
+    FrameDecoder& operator=(const FrameDecoder&) = delete;
+
+    void reset() {
+        head_ = 0;
+        size_ = 0;
+    }
+
+    size_t size() const { return size_; }
+
+    // Copies as much of data as fits; returns the number of bytes taken.
+    size_t push(const uint8_t* data, size_t len) {
+        size_t n = std::min(len, kCapacity - size_);
+        size_t tail = (head_ + size_) % kCapacity;
+        size_t first = std::min(n, kCapacity - tail);
+        memcpy(ring_.get() + tail, data, first);
+        memcpy(ring_.get(), data + first, n - first);
+        size_ += n;
+        return n;
+    }
+
+    // Calls onFrame(std::span<uint8_t>) for every complete frame. The span is
+    // valid only during the call and may be modified in place. Returns false
+    // on a malformed length prefix; the buffer is then cleared.
+    template <typename OnFrame>
+    bool drain(const FrameCodec& codec, OnFrame&& onFrame) {
+        while (size_ > 0) {
+            uint8_t header[FrameCodec::kMaxHeaderLen];
+            size_t peek = std::min(size_, sizeof(header));
+            copyOut(0, header, peek);
+
+            size_t frameLen = 0;
+            size_t headerLen = 0;
+            auto res = codec.decodeHeader(header, peek, frameLen, headerLen);
+            if (res == FrameCodec::Result::NeedMore) return true;
+            if (res == FrameCodec::Result::Error) {
+                reset();
+                return false;
+            }
+            if (size_ < headerLen + frameLen) return true;
+
+            size_t start = (head_ + headerLen) % kCapacity;
+            uint8_t* frame = ring_.get() + start;
+            if (start + frameLen > kCapacity) {
+                if (!scratch_) scratch_.reset(new uint8_t[FrameCodec::kMaxVarintFrame]);
+                copyOut(headerLen, scratch_.get(), frameLen);
+                frame = scratch_.get();
+            }
+            onFrame(std::span<uint8_t>(frame, frameLen));
+            consume(headerLen + frameLen);
+        }
+        return true;
+    }
+
+private:
+    void copyOut(size_t offset, uint8_t* out, size_t len) const {
+        size_t pos = (head_ + offset) % kCapacity;
+        size_t first = std::min(len, kCapacity - pos);
+        memcpy(out, ring_.get() + pos, first);
+        memcpy(out + first, ring_.get(), len - first);
+    }
+
+    void consume(size_t len) {
+        head_ = (head_ + len) % kCapacity;
+        size_ -= len;
+        if (size_ == 0) head_ = 0;
+    }
+
+    std::unique_ptr<uint8_t[]> ring_;
+    std::unique_ptr<uint8_t[]> scratch_;
+    size_t head_ = 0;
+    size_t size_ = 0;
+};
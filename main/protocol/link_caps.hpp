@@ -0,0 +1,63 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+
+// Link capabilities offered by the client on its "guard" line and confirmed
+// by the device in the session header that precedes the handshake.
+//
+//   client:  "guard\n"              legacy session, device answers header length 0
+//   client:  "guard:<hex caps>\n"   device answers header length 4 + accepted caps (LE)
+//
+// Encrypted sessions with announced caps mix the offered and accepted caps
+// into the session key (CryptoEcdhAes::bind_caps). Raw sessions have no key.
+namespace linkcaps {
+
+enum : uint32_t {
+    // Frame lengths are LEB128 varints instead of a single byte.
+    FramingVarint    = 1u << 0,
+    // Session cipher; the device accepts exactly one of the offered ones.
+    CipherRaw        = 1u << 1,
+    CipherPassphrase = 1u << 2,
+    CipherEphemeral  = 1u << 3,
+    // Device may pack several messages into one MessageType::Batch frame.
+    Batching         = 1u << 4,
+    // Device may send MessageType::Compressed frames (preset-dictionary LZ).
+    Compression      = 1u << 5,
+    // Ephemeral sessions may resume from a ticket instead of a new ECDH exchange.
+    Resume           = 1u << 6,
+    // AES frames carry a sequence number and use counter nonces, the length
+    // prefix is authenticated and replays are rejected. Ephemeral cipher only.
+    CounterNonce     = 1u << 7,
+    // ChaCha20-Poly1305 instead of AES-GCM for the AES ciphers; same frame layout.
+    ChaChaPoly       = 1u << 8,
+    // X25519 instead of P-256 for the ephemeral key exchange (32-byte keys).
+    CurveX25519      = 1u << 9,
+    // Ephemeral handshake with raw keys in a binary frame instead of base64 in
+    // protobuf; the reply is followed by a MessageType::SchemaHash frame.
+    BinaryHandshake  = 1u << 10,
+};
+
+static constexpr uint32_t kCipherMask = CipherRaw | CipherPassphrase | CipherEphemeral;
+static constexpr uint32_t kSupported = FramingVarint | kCipherMask | Batching | Compression | Resume | CounterNonce |
+                                       ChaChaPoly | CurveX25519 | BinaryHandshake;
+
+// Returns false if the line is not a guard line. `negotiated` tells whether
+// the client sent a capability bitmap (and therefore expects one back).
+inline bool parseGuardLine(const std::string& line, uint32_t& caps, bool& negotiated) {
+    static constexpr const char* kGuard = "guard";
+    caps = 0;
+    negotiated = false;
+    if (line.ends_with(kGuard)) return true;
+    size_t pos = line.rfind(std::string(kGuard) + ":");
+    if (pos == std::string::npos) return false;
+    const char* hex = line.c_str() + pos + 6;
+    char* end = nullptr;
+    unsigned long v = strtoul(hex, &end, 16);
+    if (end == hex || *end != '\0') return false;
+    caps = static_cast<uint32_t>(v);
+    negotiated = true;
+    return true;
+}
+
+} // namespace linkcaps
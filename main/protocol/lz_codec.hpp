@@ -0,0 +1,134 @@
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <span>
+
+// Byte-oriented LZ77 with a preset dictionary. Matches may reach back into
+// the dictionary, so even a single short message compresses well when its
+// text is already known to both ends.
+//
+// Token stream:
+//   0x00..0x7F  literal run of (c + 1) bytes that follow
+//   0x80..0xFF  match of ((c & 0x7F) + 3) bytes, then a 16-bit LE distance
+//               back into dictionary + output produced so far
+namespace lz {
+
+static constexpr size_t kMinMatch = 3;
+static constexpr size_t kMaxMatch = 0x7F + kMinMatch;
+static constexpr size_t kMaxLiteralRun = 0x80;
+static constexpr size_t kMaxWindow = 0xFFFF;
+
+// The hash table lives in the encoder object (2 KiB), not on the caller's
+// stack, so encoding is safe from small parameter-producing tasks.
+class Encoder {
+public:
+    // Returns the compressed size, or 0 if the output would exceed cap.
+    // Pass cap < len to give up as soon as compression stops paying off.
+    size_t compress(std::span<const uint8_t> dict, const uint8_t* in, size_t len, uint8_t* out, size_t cap) {
+        const size_t base = dict.size();
+        const size_t total = base + len;
+        if (len == 0 || total > kMaxWindow) return 0;
+        std::fill(std::begin(head_), std::end(head_), kEmpty);
+
+        auto at = [&](size_t pos) -> uint8_t { return pos < base ? dict[pos] : in[pos - base]; };
+        auto hashAt = [&](size_t pos) -> uint32_t {
+            uint32_t v = at(pos) | (at(pos + 1) << 8) | (at(pos + 2) << 16) | (uint32_t(at(pos + 3)) << 24);
+            return (v * 2654435761u) >> (32 - kHashBits);
+        };
+        auto insert = [&](size_t pos) {
+            if (pos + kHashLen <= total) head_[hashAt(pos)] = static_cast<uint16_t>(pos);
+        };
+
+        for (size_t p = 0; p < base; p++) insert(p);
+
+        size_t o = 0;
+        auto flushLiterals = [&](size_t from, size_t to) -> bool {
+            while (from < to) {
+                size_t n = std::min(to - from, kMaxLiteralRun);
+                if (o + 1 + n > cap) return false;
+                out[o++] = static_cast<uint8_t>(n - 1);
+                memcpy(out + o, in + (from - base), n);
+                o += n;
+                from += n;
+            }
+            return true;
+        };
+
+        size_t p = base;
+        size_t literalStart = base;
+        while (p < total) {
+            size_t best = 0;
+            size_t dist = 0;
+            if (p + kHashLen <= total) {
+                uint32_t h = hashAt(p);
+                uint16_t cand = head_[h];
+                head_[h] = static_cast<uint16_t>(p);
+                if (cand != kEmpty) {
+                    size_t l = 0;
+                    while (l < kMaxMatch && p + l < total && at(cand + l) == at(p + l)) l++;
+                    if (l >= kMinMatch) {
+                        best = l;
+                        dist = p - cand;
+                    }
+                }
+            }
+            if (best == 0) {
+                p++;
+                continue;
+            }
+            if (!flushLiterals(literalStart, p) || o + 3 > cap) return 0;
+            out[o++] = static_cast<uint8_t>(0x80 | (best - kMinMatch));
+            out[o++] = static_cast<uint8_t>(dist);
+            out[o++] = static_cast<uint8_t>(dist >> 8);
+            for (size_t q = p + 1; q < p + best; q++) insert(q);
+            p += best;
+            literalStart = p;
+        }
+        if (!flushLiterals(literalStart, total)) return 0;
+        return o;
+    }
+
+private:
+    // Four bytes: two Cyrillic letters in UTF-8, whose lead bytes carry little entropy.
+    static constexpr size_t kHashLen = 4;
+    static constexpr int kHashBits = 10;
+    static constexpr uint16_t kEmpty = 0xFFFF;
+    uint16_t head_[1u << kHashBits];
+};
+
+// Needs no state beyond the output buffer. Returns false on a malformed
+// stream or if the output would exceed cap.
+inline bool decompress(std::span<const uint8_t> dict, const uint8_t* in, size_t len,
+                       uint8_t* out, size_t cap, size_t& outLen) {
+    const size_t base = dict.size();
+    size_t i = 0;
+    size_t o = 0;
+    while (i < len) {
+        uint8_t c = in[i++];
+        if (c < 0x80) {
+            size_t n = c + 1u;
+            if (i + n > len || o + n > cap) return false;
+            memcpy(out + o, in + i, n);
+            i += n;
+            o += n;
+            continue;
+        }
+        size_t n = (c & 0x7F) + kMinMatch;
+        if (i + 2 > len || o + n > cap) return false;
+        size_t dist = in[i] | (in[i + 1] << 8);
+        i += 2;
+        size_t pos = base + o;
+        if (dist == 0 || dist > pos) return false;
+        // Byte by byte: a match may overlap the bytes it produces.
+        for (size_t k = 0, src = pos - dist; k < n; k++, src++) {
+            out[o + k] = src < base ? dict[src] : out[src - base];
+        }
+        o += n;
+    }
+    outLen = o;
+    return true;
+}
+
+} // namespace lz
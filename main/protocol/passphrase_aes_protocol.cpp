@@ -12,7 +12,8 @@ static const char* TAG = "PassphraseAesProtocol";
 
 PassphraseAesProtocol::PassphraseAesProtocol(std::string passPhrase)
     : _passPhrase(std::move(passPhrase)),
-      crypto(CryptoEcdhAes::Mode::PASSPHRASE, _passPhrase.c_str()){
+      crypto(CryptoEcdhAes::Mode::PASSPHRASE, _passPhrase.c_str()),
+      sealBuf(new uint8_t[FrameCodec::kMaxVarintFrame]) {
 	ESP_LOGI(TAG, "PassphraseAesProtocol constructor");
 }
 
@@ -24,74 +25,50 @@ void PassphraseAesProtocol::init(WriteCallback writeCb, QueueCallback recvCb) {
 	ESP_LOGI(TAG, "PassphraseAesProtocol init");
     this->writeCb = writeCb;
     this->recvCb = recvCb;
-    buffer.clear();
+    beginSession();
     handshakeReceived = false;
-    xSemaphoreTake(sendReady, 0); 
-    //no header
-	uint8_t headerLen = 0;
-	writeCb(&headerLen, 1);
+    crypto.select_aead((acceptedCaps & linkcaps::ChaChaPoly) ? Aead::Kind::ChaChaPoly : Aead::Kind::AesGcm);
+    // A plain "guard" line has no caps to bind.
+    if (capsAnnounced && !crypto.bind_caps(offeredCaps, acceptedCaps)) ESP_LOGE(TAG, "Binding caps failed");
+    writeSessionHeader();
 }
 
-void PassphraseAesProtocol::appendReceived(const uint8_t* data, size_t len) {
-	if(isClosed.load()) {
-		ESP_LOGI(TAG, "PassphraseAesProtocol append received after close");
-		return;
-	}
-	ESP_LOGI(TAG, "PassphraseAesProtocol append received");
-    buffer.insert(buffer.end(), data, data + len);
-    while (true) {
-        if (buffer.empty()) return;
-        uint8_t frameLen = buffer[0];
-        if (buffer.size() < frameLen + 1) {
-            return; 
-        }
-        std::vector<uint8_t> frame(buffer.begin() + 1, buffer.begin() + 1 + frameLen);
-        buffer.erase(buffer.begin(), buffer.begin() + 1 + frameLen);
-        auto decrypted = decryptFrame(frame);
-        if (!handshakeReceived) {
-            if (parseHandshake(decrypted)) {
-                handshakeReceived = true;
-                ESP_LOGI(TAG, "Handshake complete");
-                if(readyCallback) readyCallback();
-                sendHandshake();
-                xSemaphoreGive(sendReady);
-            }
-        } else {          
-            if (recvCb && !isClosed.load()) recvCb(decrypted);
+void PassphraseAesProtocol::onFrame(std::span<uint8_t> frame) {
+    std::span<const uint8_t> plain;
+    if (!decryptFrame(frame, plain)) return;
+    if (!handshakeReceived) {
+        if (parseHandshake(plain)) {
+            handshakeReceived = true;
+            ESP_LOGI(TAG, "Handshake complete");
+            noteHandshakeDone();
+            if (sendHandshake()) markReady();
         }
+    } else {          
+        if (recvCb && !isClosed()) recvCb(plain);
     }
 }
 
-bool PassphraseAesProtocol::send(const uint8_t* data, size_t len) {
-	if(isClosed.load()) {
+bool PassphraseAesProtocol::sendFrame(const uint8_t* data, size_t len) {
+	if(isClosed()) {
 		ESP_LOGI(TAG, "PassphraseAesProtocol send after close");
 		return false;
 	}
-    if (xSemaphoreTake(sendReady, pdMS_TO_TICKS(5000)) == pdFALSE) {
-        ESP_LOGW(TAG, "Send blocked: handshake not complete");
-        return false;
-    }
-    xSemaphoreGive(sendReady);
-    auto encrypted = encryptFrame({data, data + len});
-    uint8_t hdr = encrypted.size();
-    if(!isClosed.load()) {
-	    writeCb(&hdr, 1);
-	    writeCb(encrypted.data(), encrypted.size());
-    }
+    if (!sealAndWrite(data, len)) return false;
+    LinkMetrics::add(linkMetrics().framesOut);
     return true;
 }
 
 void PassphraseAesProtocol::sendCode(uint8_t code) {
-	if(isClosed.load()) {
+	if(isClosed()) {
 		ESP_LOGI(TAG, "PassphraseAesProtocol sendCode after close");
 		return;
 	}
-	if(!isClosed.load()){
+	if(!isClosed()){
     	writeCb(&code, 1);
     }
 }
 
-void PassphraseAesProtocol::sendHandshake() {	
+bool PassphraseAesProtocol::sendHandshake() {	
 	ESP_LOGI(TAG, "Sending HANDSHAKE");
      
     pModel_HandshakeRequest req = pModel_HandshakeRequest_init_zero;
@@ -102,17 +79,13 @@ void PassphraseAesProtocol::sendHandshake() {
     if (!pb_encode(&stream, pModel_HandshakeRequest_fields, &req)) {
         ESP_LOGE(TAG, "Handshake encode failed: %s", PB_GET_ERROR(&stream));
         sendCode(5);
+        return false;
     }  
      
-    size_t total_len = stream.bytes_written;
-    std::vector<uint8_t> msg_vec(buffer, buffer + total_len);
-    std::vector<uint8_t> enc = crypto.encrypt_data_whole(msg_vec);
-    uint8_t len = enc.size();
-    writeCb(&len, 1);
-    writeCb(enc.data(), len);
+    return sealAndWrite(buffer, stream.bytes_written);
 }
 
-bool PassphraseAesProtocol::parseHandshake(const std::vector<uint8_t>& frame) {
+bool PassphraseAesProtocol::parseHandshake(std::span<const uint8_t> frame) {
     pModel_HandshakeResponse resp = pModel_HandshakeResponse_init_zero;
     pb_istream_t istream = pb_istream_from_buffer(frame.data(), frame.size());
     if (!pb_decode(&istream, pModel_HandshakeResponse_fields, &resp)) {
@@ -124,14 +97,25 @@ bool PassphraseAesProtocol::parseHandshake(const std::vector<uint8_t>& frame) {
     return strcmp(resp.text, "HANDSHAKE") == 0;
 }
 
-std::vector<uint8_t> PassphraseAesProtocol::encryptFrame(const std::vector<uint8_t>& plain) {
-	std::vector<uint8_t> enc = crypto.encrypt_data_whole(plain);
-    if(enc.empty()) sendCode(2);
-    return enc; 
+bool PassphraseAesProtocol::sealAndWrite(const uint8_t* data, size_t len) {
+    if (len + crypto.overhead() > FrameCodec::kMaxVarintFrame) return false;
+    std::lock_guard<std::mutex> lock(sealMtx);
+    memcpy(sealBuf.get() + crypto.nonce_field_len(), data, len);
+    if (!crypto.seal(sealBuf.get(), len)) {
+        sendCode(2);
+        return false;
+    }
+    return writeFrame(sealBuf.get(), len + crypto.overhead());
 }
 
-std::vector<uint8_t> PassphraseAesProtocol::decryptFrame(const std::vector<uint8_t>& enc) {
-    std::vector<uint8_t> dec = crypto.decrypt_data_whole(enc);
-    if(dec.empty()) sendCode(2);
-    return dec; 
+bool PassphraseAesProtocol::decryptFrame(std::span<uint8_t> enc, std::span<const uint8_t>& plain) {
+    uint8_t* plainPtr = nullptr;
+    size_t plainLen = 0;
+    if (!crypto.open(enc.data(), enc.size(), plainPtr, plainLen)) {
+        LinkMetrics::add(linkMetrics().decryptFailures);
+        sendCode(2);
+        return false;
+    }
+    plain = std::span<const uint8_t>(plainPtr, plainLen);
+    return true;
 }
@@ -1,11 +1,9 @@
 #pragma once
 #include "protocol.hpp"
-#include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
 #include "esp_log.h"
 #include "crypto_ecdh_aes.hpp"
 #include <stdint.h>
-#include <sys/_intsup.h>
+#include <memory>
 
 class PassphraseAesProtocol : public Protocol {
 public:
@@ -13,17 +11,24 @@ public:
     ~PassphraseAesProtocol() override;
 
     void init(WriteCallback writeCb, QueueCallback recvCb) override;
-    void appendReceived(const uint8_t* data, size_t len) override;
-    bool send(const uint8_t* data, size_t len) override;
+    size_t frameOverhead() const override { return crypto.overhead(); }
+
+protected:
+    void onFrame(std::span<uint8_t> frame) override;
+    bool sendFrame(const uint8_t* data, size_t len) override;
 
 private:
     bool handshakeReceived = false;
     std::string _passPhrase;
     CryptoEcdhAes crypto;
+    // Outgoing frames are sealed here in place; allocated once per session.
+    // Frames are decrypted in place in the receive buffer.
+    std::unique_ptr<uint8_t[]> sealBuf;
+    std::mutex sealMtx;
 
     void sendCode(uint8_t code);
-    void sendHandshake();
-    bool parseHandshake(const std::vector<uint8_t>& frame);
-    std::vector<uint8_t> encryptFrame(const std::vector<uint8_t>& plain);
-    std::vector<uint8_t> decryptFrame(const std::vector<uint8_t>& enc);
+    bool sendHandshake();
+    bool parseHandshake(std::span<const uint8_t> frame);
+    bool sealAndWrite(const uint8_t* data, size_t len);
+    bool decryptFrame(std::span<uint8_t> enc, std::span<const uint8_t>& plain);
 };
@@ -1,27 +1,31 @@
 #pragma once
 #include <vector>
+#include <span>
 #include <functional>
-#include "freertos/FreeRTOS.h"
-#include "freertos/semphr.h"
 #include <atomic>
+#include <deque>
+#include <mutex>
 #include "esp_log.h"
+#include "os_port.hpp"
+#include "link_metrics.hpp"
+#include "frame_codec.hpp"
+#include "frame_decoder.hpp"
+#include "link_caps.hpp"
+#include "timeline.hpp"
 
 class Protocol {
 public:
     using ReadyCallback = std::function<void()>;
-    using QueueCallback = std::function<void(std::vector<uint8_t>)>;
+    // The span is only valid for the duration of the call.
+    using QueueCallback = std::function<void(std::span<const uint8_t>)>;
     using WriteCallback = std::function<void(const uint8_t* data, size_t len)>;
 
-    Protocol() {
-        sendReady = xSemaphoreCreateBinaryStatic(&sendReadyStorage_);
-        if (!sendReady) {
-            ESP_LOGE("Protocol", "Failed to create sendReady semaphore");
-        }
-    }
+    enum class State : uint8_t { Connecting, Ready, Closed };
+
+    Protocol() = default;
 
     virtual ~Protocol() {
-		ESP_LOGI("Protocol", "destructor this=%p sendReady=%p", this, sendReady); 
-        sendReady = nullptr;
+		ESP_LOGI("Protocol", "destructor this=%p", this); 
     }
     
     Protocol(const Protocol&) = delete;
@@ -31,24 +35,174 @@ public:
 
     virtual void init(WriteCallback writeCb, QueueCallback recvCb) = 0;
 
-    virtual void appendReceived(const uint8_t* data, size_t len) = 0;
+    // Feeds received bytes to the shared frame decoder; every complete frame
+    // is passed to onFrame() in place.
+    void appendReceived(const uint8_t* data, size_t len) {
+        if (isClosed()) return;
+        while (len > 0) {
+            size_t taken = decoder.push(data, len);
+            data += taken;
+            len -= taken;
+            bool ok = decoder.drain(codec, [this](std::span<uint8_t> frame) {
+                LinkMetrics::add(linkMetrics().framesIn);
+                if (!isClosed()) onFrame(frame);
+            });
+            if (!ok) ESP_LOGE("Protocol", "Malformed frame length, receive buffer dropped");
+            if (taken == 0 && ok) {
+                // Cannot happen with a codec limit below the decoder capacity.
+                ESP_LOGE("Protocol", "Frame decoder stalled, dropping %u bytes", (unsigned)decoder.size());
+                decoder.reset();
+            }
+        }
+    }
+
+    // Ready sessions go straight to sendFrame() after one atomic load. Before
+    // the handshake the frame is parked and flushed by markReady(); only when
+    // the park queue is full does the caller wait, bounded, for the handshake.
+    bool send(const uint8_t* data, size_t len) {
+        State s = state.load(std::memory_order_acquire);
+        if (s == State::Ready) return sendFrame(data, len);
+        if (s == State::Closed) return false;
+        if (park(data, len)) return true;
+        if (events.wait(kReadyBit | kClosedBit, kParkWaitMs) & kReadyBit) return sendFrame(data, len);
+        ESP_LOGW("Protocol", "Handshake not complete, frame dropped");
+        return false;
+    }
+
+    // Waits for the handshake; returns false on timeout or close.
+    bool waitReady(uint32_t timeoutMs) {
+        return (events.wait(kReadyBit | kClosedBit, timeoutMs) & kReadyBit) && !isClosed();
+    }
+
+    State sessionState() const { return state.load(std::memory_order_acquire); }
+    bool isClosed() const { return sessionState() == State::Closed; }
 
-    virtual bool send(const uint8_t* data, size_t len) = 0;
-    
     void close() { 
-		isClosed.store(true);
+		state.store(State::Closed, std::memory_order_release);
+		events.set(kClosedBit);
+		{
+		    std::lock_guard<std::mutex> lock(parkMtx);
+		    parked.clear();
+		}
 		ESP_LOGI("Protocol", "Protocol closed");
 	}
     
     void setReadyCallback(ReadyCallback cb) { readyCallback = std::move(cb); }
+
+    // Applies the capabilities accepted for this session (see acceptCaps()); call before init().
+    // `announced` is false for a plain "guard" line, which keeps the original session.
+    // Ciphers bind `offered` and `accepted` into the session key.
+    void negotiate(uint32_t offered, uint32_t accepted, bool announced) {
+        offeredCaps = offered;
+        acceptedCaps = accepted;
+        capsAnnounced = announced;
+        codec.setFraming((acceptedCaps & linkcaps::FramingVarint) ? FrameCodec::Framing::Varint
+                                                                  : FrameCodec::Framing::Byte);
+    }
+
+    uint32_t caps() const { return acceptedCaps; }
+    size_t maxFrame() const { return codec.maxFrame(); }
+    // Bytes the protocol adds to every payload before framing (IV, tag).
+    virtual size_t frameOverhead() const { return 0; }
+    size_t maxPayload() const { return maxFrame() - frameOverhead(); }
     
  protected:
+    static constexpr size_t kMaxParkedFrames = 16;
+    static constexpr uint32_t kParkWaitMs = 100;
+    static constexpr uint32_t kReadyBit = 1u << 0;
+    static constexpr uint32_t kClosedBit = 1u << 1;
+
+    // One complete frame, still encrypted if the protocol encrypts.
+    virtual void onFrame(std::span<uint8_t> frame) = 0;
+    // Encrypts and writes one frame of an established session.
+    virtual bool sendFrame(const uint8_t* data, size_t len) = 0;
+
+    // Resets the session state machine; called from init().
+    void beginSession() {
+        std::lock_guard<std::mutex> lock(parkMtx);
+        parked.clear();
+        events.clear(kReadyBit | kClosedBit);
+        state.store(State::Connecting, std::memory_order_release);
+        decoder.reset();
+        noteHandshakeStart();
+        TIMELINE_MARK(HandshakeBegin, acceptedCaps);
+    }
+
+    // Called once the handshake reply is written: flushes parked frames in
+    // order, opens the fast path, then notifies the owner.
+    void markReady() {
+        {
+            std::lock_guard<std::mutex> lock(parkMtx);
+            for (auto& frame : parked) sendFrame(frame.data(), frame.size());
+            parked.clear();
+            State expected = State::Connecting;
+            if (!state.compare_exchange_strong(expected, State::Ready, std::memory_order_acq_rel)) return;
+            events.set(kReadyBit);
+        }
+        TIMELINE_MARK(SessionReady, acceptedCaps);
+        if (readyCallback) readyCallback();
+    }
+
+    // Session header sent by init(): a length byte followed by the accepted caps.
+    void writeSessionHeader() {
+        if (!capsAnnounced) {
+            uint8_t headerLen = 0;
+            writeCb(&headerLen, 1);
+            return;
+        }
+        uint8_t header[5] = {4,
+                             static_cast<uint8_t>(acceptedCaps),
+                             static_cast<uint8_t>(acceptedCaps >> 8),
+                             static_cast<uint8_t>(acceptedCaps >> 16),
+                             static_cast<uint8_t>(acceptedCaps >> 24)};
+        writeCb(header, sizeof(header));
+    }
+
+    // Writes one length-prefixed frame. Frames that do not fit the negotiated
+    // framing are refused instead of being sent with a truncated length.
+    bool writeFrame(const uint8_t* data, size_t len) {
+        uint8_t header[FrameCodec::kMaxHeaderLen];
+        size_t headerLen = codec.encodeHeader(len, header);
+        if (headerLen == 0) {
+            ESP_LOGW("Protocol", "Frame of %u bytes exceeds limit %u", (unsigned)len, (unsigned)codec.maxFrame());
+            return false;
+        }
+        writeCb(header, headerLen);
+        writeCb(data, len);
+        return true;
+    }
+
+    void noteHandshakeStart() { handshakeStartUs = osport::nowUs(); }
+    void noteHandshakeDone() {
+        TIMELINE_MARK(HandshakeEnd, acceptedCaps);
+        linkMetrics().handshakeMs.store(static_cast<uint32_t>((osport::nowUs() - handshakeStartUs) / 1000),
+                                        std::memory_order_relaxed);
+    }
+
     ReadyCallback readyCallback;
     WriteCallback writeCb;
     QueueCallback recvCb;
-    SemaphoreHandle_t sendReady = nullptr;
-    std::vector<uint8_t> buffer;
-    std::atomic<bool> isClosed{false};
- private:
-    StaticSemaphore_t  sendReadyStorage_; 
+    FrameDecoder decoder;
+    std::atomic<State> state{State::Connecting};
+    osport::EventFlags events;
+    int64_t handshakeStartUs = 0;
+    FrameCodec codec;
+    uint32_t offeredCaps = 0;
+    uint32_t acceptedCaps = 0;
+    bool capsAnnounced = false;
+
+private:
+    bool park(const uint8_t* data, size_t len) {
+        std::lock_guard<std::mutex> lock(parkMtx);
+        // Re-check under the lock: markReady() may have run since the fast-path load.
+        State s = state.load(std::memory_order_acquire);
+        if (s == State::Ready) return sendFrame(data, len);
+        if (s == State::Closed) return false;
+        if (parked.size() >= kMaxParkedFrames) return false;
+        parked.emplace_back(data, data + len);
+        return true;
+    }
+
+    std::mutex parkMtx;
+    std::deque<std::vector<uint8_t>> parked;
 };
@@ -8,14 +8,16 @@ public:
     ~RawProtocol() override;
 
     void init(WriteCallback writeCb, QueueCallback recvCb) override;
-    void appendReceived(const uint8_t* data, size_t len) override;
-    bool send(const uint8_t* data, size_t len) override;
+
+protected:
+    void onFrame(std::span<uint8_t> frame) override;
+    bool sendFrame(const uint8_t* data, size_t len) override;
 
 private:
     bool handshakeReceived = false;
     std::string _passPhrase;
     
     void sendCode(uint8_t code);
-    void sendHandshake();
-    bool parseHandshake(const std::vector<uint8_t>& frame);
+    bool sendHandshake();
+    bool parseHandshake(std::span<const uint8_t> frame);
 };
@@ -0,0 +1,94 @@
+#pragma once
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <mutex>
+#include "sdkconfig.h"
+#include "os_port.hpp"
+
+#ifndef CONFIG_PROTOCOL_RESUME_SLOTS
+#define CONFIG_PROTOCOL_RESUME_SLOTS 4
+#endif
+#ifndef CONFIG_PROTOCOL_RESUME_LIFETIME_S
+#define CONFIG_PROTOCOL_RESUME_LIFETIME_S 600
+#endif
+#ifndef CONFIG_PROTOCOL_RESUME_MAX_USES
+#define CONFIG_PROTOCOL_RESUME_MAX_USES 8
+#endif
+
+// Resumption secrets of recent ephemeral sessions, kept in RAM only.
+//
+// After a full ECDH handshake both ends derive
+//     secret = HKDF-SHA256(ikm = ECDH shared secret, salt = "", info = "esp-conf resume")
+// and the device hands out a random ticket id that names it. A reconnecting
+// client offers the id plus a fresh nonce; the session key is then
+//     key = HKDF-SHA256(ikm = secret, salt = clientNonce | deviceNonce, info = "esp-conf session")
+// truncated to the negotiated AEAD's key length (16 bytes for AES-GCM, 32 for
+// ChaCha20-Poly1305), so no EC operation is needed. A ticket expires after a fixed lifetime or a
+// bounded number of resumptions, whichever comes first.
+class SessionTickets {
+public:
+    static constexpr size_t kIdLen = 16;
+    static constexpr size_t kSecretLen = 32;
+    using Id = std::array<uint8_t, kIdLen>;
+
+    // Stores secret under id, evicting an expired or the oldest ticket.
+    void issue(const Id& id, const uint8_t* secret) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        int64_t now = osport::nowUs();
+        Slot* victim = &slots_[0];
+        for (auto& slot : slots_) {
+            if (!live(slot, now)) {
+                victim = &slot;
+                break;
+            }
+            if (slot.issuedUs < victim->issuedUs) victim = &slot;
+        }
+        victim->id = id;
+        memcpy(victim->secret, secret, kSecretLen);
+        victim->issuedUs = now;
+        victim->usesLeft = CONFIG_PROTOCOL_RESUME_MAX_USES;
+    }
+
+    // Copies the secret out and spends one use; false if the ticket is unknown,
+    // expired or used up.
+    bool redeem(const Id& id, uint8_t* secretOut) {
+        std::lock_guard<std::mutex> lock(mtx_);
+        int64_t now = osport::nowUs();
+        for (auto& slot : slots_) {
+            if (!live(slot, now) || slot.id != id) continue;
+            memcpy(secretOut, slot.secret, kSecretLen);
+            if (--slot.usesLeft == 0) wipe(slot);
+            return true;
+        }
+        return false;
+    }
+
+private:
+    static constexpr int64_t kLifetimeUs = int64_t(CONFIG_PROTOCOL_RESUME_LIFETIME_S) * 1000000;
+
+    struct Slot {
+        Id id{};
+        uint8_t secret[kSecretLen]{};
+        int64_t issuedUs = 0;
+        uint32_t usesLeft = 0;
+    };
+
+    static bool live(const Slot& slot, int64_t now) {
+        return slot.usesLeft > 0 && now - slot.issuedUs < kLifetimeUs;
+    }
+
+    static void wipe(Slot& slot) {
+        volatile uint8_t* p = slot.secret;
+        for (size_t i = 0; i < kSecretLen; i++) p[i] = 0;
+        slot.usesLeft = 0;
+    }
+
+    std::mutex mtx_;
+    std::array<Slot, CONFIG_PROTOCOL_RESUME_SLOTS> slots_{};
+};
+
+inline SessionTickets& sessionTickets() {
+    static SessionTickets tickets;
+    return tickets;
+}
@@ -0,0 +1,98 @@
+#include "random_service.hpp"
+
+#include <climits>
+#include <cstdio>
+#include <cstring>
+#include "esp_log.h"
+
+namespace {
+    static const char* TAG = "RandomService";
+}
+
+RandomService::RandomService() {
+    mbedtls_entropy_init(&_entropy);
+    for (size_t i = 0; i < kInstances; i++) {
+        mbedtls_ctr_drbg_init(&_instances[i].drbg);
+        seed(_instances[i], i);
+    }
+}
+
+RandomService::~RandomService() {
+    for (auto& inst : _instances) mbedtls_ctr_drbg_free(&inst.drbg);
+    mbedtls_entropy_free(&_entropy);
+}
+
+bool RandomService::seed(Instance& inst, size_t index) {
+    char pers[16];
+    snprintf(pers, sizeof(pers), "esp-conf rng%u", (unsigned)index);
+    int ret = mbedtls_ctr_drbg_seed(&inst.drbg, &RandomService::entropy, this,
+                                    reinterpret_cast<const unsigned char*>(pers), strlen(pers));
+    if (ret != 0) {
+        ESP_LOGE(TAG, "ctr_drbg_seed failed: %d", ret);
+        return false;
+    }
+    inst.seeded = true;
+    return true;
+}
+
+void RandomService::start(osport::Priority priority) {
+    if (_task) return;
+    if (!osport::createTask(&RandomService::taskEntry, "rng_reseed", 3072, this, priority, &_task)) {
+        ESP_LOGE(TAG, "Failed to create reseed task, DRBGs reseed inline");
+        _task = nullptr;
+        return;
+    }
+    for (auto& inst : _instances) {
+        std::lock_guard<std::mutex> lock(inst.mtx);
+        mbedtls_ctr_drbg_set_reseed_interval(&inst.drbg, INT_MAX);
+    }
+}
+
+bool RandomService::fill(uint8_t* out, size_t len) {
+    Instance& inst = _instances[osport::currentCore() % kInstances];
+    std::lock_guard<std::mutex> lock(inst.mtx);
+    if (!inst.seeded && !seed(inst, &inst - _instances.data())) return false;
+    // One call returns at most MBEDTLS_CTR_DRBG_MAX_REQUEST bytes.
+    while (len > 0) {
+        size_t n = len < MBEDTLS_CTR_DRBG_MAX_REQUEST ? len : MBEDTLS_CTR_DRBG_MAX_REQUEST;
+        int ret = mbedtls_ctr_drbg_random(&inst.drbg, out, n);
+        if (ret != 0) {
+            ESP_LOGE(TAG, "ctr_drbg_random failed: %d", ret);
+            return false;
+        }
+        out += n;
+        len -= n;
+    }
+    return true;
+}
+
+int RandomService::rng(void* self, unsigned char* out, size_t len) {
+    return static_cast<RandomService*>(self)->fill(out, len) ? 0 : MBEDTLS_ERR_CTR_DRBG_ENTROPY_SOURCE_FAILED;
+}
+
+int RandomService::entropy(void* self, unsigned char* out, size_t len) {
+    auto* service = static_cast<RandomService*>(self);
+    std::lock_guard<std::mutex> lock(service->_entropyMtx);
+    return mbedtls_entropy_func(&service->_entropy, out, len);
+}
+
+void RandomService::taskEntry(void* arg) {
+    static_cast<RandomService*>(arg)->run();
+    osport::exitTask();
+}
+
+void RandomService::run() {
+    while (true) {
+        osport::delayMs(CONFIG_RANDOM_RESEED_INTERVAL_S * 1000u);
+        for (auto& inst : _instances) {
+            std::lock_guard<std::mutex> lock(inst.mtx);
+            int ret = inst.seeded ? mbedtls_ctr_drbg_reseed(&inst.drbg, nullptr, 0) : -1;
+            if (ret != 0) ESP_LOGW(TAG, "Reseed failed: %d", ret);
+        }
+    }
+}
+
+RandomService& randomService() {
+    static RandomService service;
+    return service;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include "sdkconfig.h"
+#include "mbedtls/entropy.h"
+#include "mbedtls/ctr_drbg.h"
+#include "os_port.hpp"
+
+#ifndef CONFIG_RANDOM_RESEED_INTERVAL_S
+#define CONFIG_RANDOM_RESEED_INTERVAL_S 300
+#endif
+
+// Process-wide CTR_DRBG shared by key generation, IVs, nonces and ticket ids.
+// The entropy source is instantiated and seeded once instead of in every
+// connection. There is one DRBG per core, each behind its own mutex, so
+// callers on different cores never contend; a caller migrating between cores
+// mid-call only costs a lock, not correctness.
+//
+// Once start() has run, a low priority task reseeds every instance
+// periodically and the DRBGs no longer reseed inline on the caller's path.
+class RandomService {
+public:
+    static constexpr size_t kInstances = osport::kNumCores;
+
+    RandomService();
+    ~RandomService();
+
+    RandomService(const RandomService&) = delete;
+    RandomService& operator=(const RandomService&) = delete;
+
+    void start(osport::Priority priority = osport::kIdlePriority + 1);
+
+    bool fill(uint8_t* out, size_t len);
+
+    // mbedTLS f_rng adapter: pass &randomService() as p_rng.
+    static int rng(void* self, unsigned char* out, size_t len);
+
+private:
+    struct Instance {
+        std::mutex mtx;
+        mbedtls_ctr_drbg_context drbg;
+        bool seeded = false;
+    };
+
+    // mbedtls_entropy_func is not thread safe without MBEDTLS_THREADING_C.
+    static int entropy(void* self, unsigned char* out, size_t len);
+    static void taskEntry(void* arg);
+    void run();
+    bool seed(Instance& inst, size_t index);
+
+    std::mutex _entropyMtx;
+    mbedtls_entropy_context _entropy;
+    std::array<Instance, kInstances> _instances;
+    osport::TaskHandle _task = nullptr;
+};
+
+RandomService& randomService();
@@ -0,0 +1,45 @@
+#pragma once
+#include <cstdint>
+
+// Anti-replay state of one receive direction with counter nonces: the highest
+// sequence number accepted so far and a bitmap of the 64 numbers at and below
+// it (RFC 4303 style). A frame is fresh if it is newer than the highest or
+// falls inside the window unseen. check() runs before decryption, accept()
+// only after the frame authenticated, so forged frames never move the window.
+class ReplayWindow {
+public:
+    static constexpr uint64_t kSize = 64;
+
+    void reset() {
+        highest = 0;
+        window = 0;
+        any = false;
+    }
+
+    bool check(uint64_t seq) const {
+        if (!any || seq > highest) return true;
+        uint64_t age = highest - seq;
+        if (age >= kSize) return false;
+        return !(window & (uint64_t(1) << age));
+    }
+
+    void accept(uint64_t seq) {
+        if (!any) {
+            any = true;
+            highest = seq;
+            window = 1;
+        } else if (seq > highest) {
+            uint64_t shift = seq - highest;
+            window = shift >= kSize ? 0 : window << shift;
+            window |= 1;
+            highest = seq;
+        } else {
+            window |= uint64_t(1) << (highest - seq);
+        }
+    }
+
+private:
+    uint64_t highest = 0;
+    uint64_t window = 0;   // bit i: highest - i already seen
+    bool any = false;
+};
@@ -1,36 +1,38 @@
+#include <functional>
 #include "freertos/FreeRTOS.h"
-#include "freertos/queue.h"
 #include "freertos/timers.h"
 
 
-struct DelayedSendContext {
-    QueueHandle_t queue;
-    const void* cmd;
+struct DelayedRunContext {
+    std::function<void()> fn;
 };
 
-static void DelayedSendCallback(TimerHandle_t xTimer) {
-    DelayedSendContext* ctx = static_cast<DelayedSendContext*>(pvTimerGetTimerID(xTimer));
+static void DelayedRunCallback(TimerHandle_t xTimer) {
+    DelayedRunContext* ctx = static_cast<DelayedRunContext*>(pvTimerGetTimerID(xTimer));
     if (ctx) {
-        xQueueSend(ctx->queue, &ctx->cmd, 0);
+        ctx->fn();
         delete ctx;  
     }
     xTimerDelete(xTimer, 0); 
 }
 
-void sendDelayed(QueueHandle_t queue, const void* cmd, uint32_t delayMs) {
-    auto* ctx = new DelayedSendContext{queue, cmd};
+// Runs fn once on the timer service task after delayMs. Returns false, and
+// never runs fn, if the timer could not be created or started.
+inline bool runDelayed(uint32_t delayMs, std::function<void()> fn) {
+    auto* ctx = new DelayedRunContext{std::move(fn)};
 
     TimerHandle_t timer = xTimerCreate(
-        "SendDelayed",
+        "RunDelayed",
         pdMS_TO_TICKS(delayMs),
         pdFALSE, 
         ctx,     
-        DelayedSendCallback
+        DelayedRunCallback
     );
 
-    if (timer != nullptr) {
-        xTimerStart(timer, 0);
-    } else {
-        delete ctx; 
+    if (timer != nullptr && xTimerStart(timer, 0) == pdPASS) {
+        return true;
     }
+    if (timer != nullptr) xTimerDelete(timer, 0);
+    delete ctx; 
+    return false;
 }
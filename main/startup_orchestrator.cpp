@@ -0,0 +1,190 @@
+#include "startup_orchestrator.hpp"
+
+#include <cstring>
+#include "esp_log.h"
+#include "timeline.hpp"
+
+namespace {
+    static const char* TAG = "Startup";
+}
+
+void StartupOrchestrator::add(const char* name, std::initializer_list<const char*> deps, StageFn fn) {
+    _stages.push_back(Stage{name, deps, {}, std::move(fn)});
+    _validated = false;
+}
+
+int StartupOrchestrator::find(const char* name) const {
+    for (size_t i = 0; i < _stages.size(); i++) {
+        if (strcmp(_stages[i].name, name) == 0) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+bool StartupOrchestrator::validate() {
+    bool ok = true;
+    for (size_t i = 0; i < _stages.size(); i++) {
+        Stage& s = _stages[i];
+        if (find(s.name) != static_cast<int>(i)) {
+            ESP_LOGE(TAG, "Stage '%s' declared twice", s.name);
+            ok = false;
+        }
+        s.deps.clear();
+        for (const char* dep : s.depNames) {
+            int d = find(dep);
+            if (d < 0) {
+                ESP_LOGE(TAG, "Stage '%s' depends on unknown stage '%s'", s.name, dep);
+                ok = false;
+            } else {
+                s.deps.push_back(static_cast<size_t>(d));
+            }
+        }
+    }
+    if (!ok) return false;
+
+    // Kahn's algorithm; whatever is left over sits on a cycle.
+    std::vector<size_t> indegree(_stages.size());
+    for (size_t i = 0; i < _stages.size(); i++) indegree[i] = _stages[i].deps.size();
+    std::vector<size_t> ready;
+    for (size_t i = 0; i < _stages.size(); i++) if (indegree[i] == 0) ready.push_back(i);
+    size_t ordered = 0;
+    while (!ready.empty()) {
+        size_t cur = ready.back();
+        ready.pop_back();
+        ordered++;
+        for (size_t i = 0; i < _stages.size(); i++) {
+            for (size_t d : _stages[i].deps) {
+                if (d == cur && --indegree[i] == 0) ready.push_back(i);
+            }
+        }
+    }
+    if (ordered != _stages.size()) {
+        for (size_t i = 0; i < _stages.size(); i++) {
+            if (indegree[i] != 0) ESP_LOGE(TAG, "Stage '%s' is part of a dependency cycle", _stages[i].name);
+        }
+        return false;
+    }
+    _validated = true;
+    return true;
+}
+
+bool StartupOrchestrator::finished() const {
+    for (auto& s : _stages) {
+        if (s.state == State::Pending || s.state == State::Running) return false;
+    }
+    return true;
+}
+
+int StartupOrchestrator::pick() {
+    for (size_t i = 0; i < _stages.size(); i++) {
+        Stage& s = _stages[i];
+        if (s.state != State::Pending) continue;
+        bool ready = true;
+        for (size_t d : s.deps) {
+            State ds = _stages[d].state;
+            if (ds == State::Failed || ds == State::Skipped) {
+                ESP_LOGE(TAG, "Skipping '%s': '%s' did not complete", s.name, _stages[d].name);
+                s.state = State::Skipped;
+                // Earlier stages may depend on this one; rescan.
+                return pick();
+            }
+            if (ds != State::Done) ready = false;
+        }
+        if (ready) return static_cast<int>(i);
+    }
+    return -1;
+}
+
+void StartupOrchestrator::work() {
+    while (true) {
+        int next;
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            next = pick();
+            // pick() may have skipped the last pending stages.
+            if (next < 0 && finished()) break;
+            if (next < 0) {
+                // Cleared under the lock: a stage finishing after this sets it again.
+                _events.clear(kProgressBit);
+            } else {
+                _stages[next].state = State::Running;
+                _stages[next].startUs = osport::nowUs();
+            }
+        }
+        if (next < 0) {
+            _events.wait(kProgressBit, osport::kWaitForever);
+            continue;
+        }
+        TIMELINE_MARK(StageBegin, next);
+        bool ok = _stages[next].fn();
+        TIMELINE_MARK(StageEnd, next);
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _stages[next].endUs = osport::nowUs();
+            _stages[next].state = ok ? State::Done : State::Failed;
+            if (!ok) ESP_LOGE(TAG, "Stage '%s' failed", _stages[next].name);
+        }
+        _events.set(kProgressBit);
+    }
+    _events.set(kProgressBit);
+}
+
+void StartupOrchestrator::workerEntry(void* arg) {
+    auto* self = static_cast<StartupOrchestrator*>(arg);
+    self->work();
+    {
+        // Set under the lock: once run() sees the count reach zero it may
+        // return and the orchestrator go away, so nothing of `self` may be
+        // touched after the unlock.
+        std::lock_guard<std::mutex> lock(self->_mtx);
+        self->_workersAlive--;
+        self->_events.set(kExitBit);
+    }
+    osport::exitTask();
+}
+
+bool StartupOrchestrator::run(size_t workers) {
+    if (!_validated && !validate()) return false;
+    _runStartUs = osport::nowUs();
+    for (auto& s : _stages) s.state = State::Pending;
+    _events.clear(kProgressBit | kExitBit);
+    // The caller is worker 0; the others are pinned to the remaining cores.
+    for (size_t i = 1; i < workers; i++) {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _workersAlive++;
+        }
+        int core = i < osport::kNumCores ? static_cast<int>(i) : osport::kNoAffinity;
+        if (!osport::createTask(&StartupOrchestrator::workerEntry, "startup", 4096, this,
+                                osport::kIdlePriority + 5, nullptr, core)) {
+            std::lock_guard<std::mutex> lock(_mtx);
+            _workersAlive--;
+            ESP_LOGW(TAG, "Worker %u not started", (unsigned)i);
+        }
+    }
+    work();
+    // Workers hold `this` until they exit.
+    while (true) {
+        {
+            std::lock_guard<std::mutex> lock(_mtx);
+            if (_workersAlive == 0) break;
+            _events.clear(kExitBit);
+        }
+        _events.wait(kExitBit, osport::kWaitForever);
+    }
+    bool ok = true;
+    for (auto& s : _stages) ok = ok && s.state == State::Done;
+    return ok;
+}
+
+void StartupOrchestrator::report() const {
+    std::lock_guard<std::mutex> lock(_mtx);
+    for (auto& s : _stages) {
+        if (s.state == State::Done || s.state == State::Failed) {
+            ESP_LOGI(TAG, "%-12s %5u .. %5u ms%s", s.name,
+                     (unsigned)((s.startUs - _runStartUs) / 1000), (unsigned)((s.endUs - _runStartUs) / 1000),
+                     s.state == State::Failed ? " FAILED" : "");
+        } else {
+            ESP_LOGI(TAG, "%-12s skipped", s.name);
+        }
+    }
+}
@@ -0,0 +1,64 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <initializer_list>
+#include <mutex>
+#include <vector>
+#include "os_port.hpp"
+
+// Runs the boot stages of app_main as a dependency graph. Every stage names
+// the stages it needs; a stage starts as soon as all of them have finished,
+// on whichever worker is free. With two cores the caller is one worker and a
+// second one is pinned to the other core, so e.g. NVS loading and Bluetooth
+// controller bring-up overlap.
+//
+// validate() catches unknown dependencies, duplicates and cycles before
+// anything runs. The graph runs the same way off-target (os_port host
+// backend), so a wrong dependency shows up there as a stage starting before
+// the one it needs.
+class StartupOrchestrator {
+public:
+    using StageFn = std::function<bool()>;
+
+    void add(const char* name, std::initializer_list<const char*> deps, StageFn fn);
+
+    bool validate();
+    // Blocks until every stage finished, failed or was skipped because a
+    // dependency failed. Returns true if all stages succeeded.
+    bool run(size_t workers = osport::kNumCores);
+    // Logs start and end of every stage relative to run().
+    void report() const;
+
+private:
+    enum class State : uint8_t { Pending, Running, Done, Failed, Skipped };
+
+    struct Stage {
+        const char* name;
+        std::vector<const char*> depNames;
+        std::vector<size_t> deps;
+        StageFn fn;
+        State state = State::Pending;
+        int64_t startUs = 0;
+        int64_t endUs = 0;
+    };
+
+    static constexpr uint32_t kProgressBit = 1u << 0;
+    // Separate from kProgressBit so waiting for workers never swallows their wakeup.
+    static constexpr uint32_t kExitBit = 1u << 1;
+
+    static void workerEntry(void* arg);
+    void work();
+    // Called with _mtx held. Marks stages behind a failed one as skipped and
+    // returns the next runnable stage, or -1.
+    int pick();
+    bool finished() const;
+    int find(const char* name) const;
+
+    std::vector<Stage> _stages;
+    mutable std::mutex _mtx;
+    osport::EventFlags _events;
+    size_t _workersAlive = 0;
+    int64_t _runStartUs = 0;
+    bool _validated = false;
+};
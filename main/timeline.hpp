@@ -0,0 +1,101 @@
+#pragma once
+// Boot and runtime timeline. TIMELINE_MARK() appends (timestamp, event, arg)
+// to a fixed ring with one 64-bit store (two word stores on the 32-bit
+// cores) and no lock; timeline::dump() prints
+// the ring on the console as "TL <us> <event> <arg>" lines, which
+// tools/timeline_to_trace.py turns into a Chrome trace.
+//
+// Without CONFIG_TIMELINE_ENABLED the macro expands to nothing and neither
+// the ring nor the event names are compiled in.
+
+#include "sdkconfig.h"
+
+#if defined(CONFIG_TIMELINE_ENABLED)
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include "os_port.hpp"
+
+#ifndef CONFIG_TIMELINE_ENTRIES
+#define CONFIG_TIMELINE_ENTRIES 256
+#endif
+
+namespace timeline {
+
+// Names ending in ":begin" / ":end" become duration slices in the trace,
+// everything else an instant event.
+#define TIMELINE_EVENTS(X)                         \
+    X(BootBegin,            "boot:begin")          \
+    X(BootEnd,              "boot:end")            \
+    X(StageBegin,           "stage:begin")         \
+    X(StageEnd,             "stage:end")           \
+    X(BtBringUpBegin,       "bt_up:begin")         \
+    X(BtBringUpEnd,         "bt_up:end")           \
+    X(SppInit,              "spp_init")            \
+    X(SppStarted,           "spp_started")         \
+    X(ClientOpen,           "client_open")         \
+    X(ConnectionStart,      "conn_start")          \
+    X(GuardLine,            "guard_line")          \
+    X(HandshakeBegin,       "handshake:begin")     \
+    X(HandshakeEnd,         "handshake:end")       \
+    X(SessionReady,         "session_ready")       \
+    X(SendInfoBegin,        "send_info:begin")     \
+    X(SendInfoEnd,          "send_info:end")       \
+    X(SendValuesBegin,      "send_values:begin")   \
+    X(SendValuesEnd,        "send_values:end")
+
+enum class Event : uint8_t {
+#define TIMELINE_ENUM(id, name) id,
+    TIMELINE_EVENTS(TIMELINE_ENUM)
+#undef TIMELINE_ENUM
+};
+
+inline const char* name(uint8_t event) {
+    static constexpr const char* kNames[] = {
+#define TIMELINE_NAME(id, name) name,
+        TIMELINE_EVENTS(TIMELINE_NAME)
+#undef TIMELINE_NAME
+    };
+    return event < sizeof(kNames) / sizeof(kNames[0]) ? kNames[event] : "?";
+}
+
+static constexpr uint32_t kEntries = CONFIG_TIMELINE_ENTRIES;
+
+// Low word: timestamp in us (wraps after 71 minutes). High word: event in
+// the top byte, 24-bit argument below it. 0 marks an unused slot.
+inline uint64_t ring[kEntries];
+inline std::atomic<uint32_t> head{0};
+
+inline void mark(Event event, uint32_t arg) {
+    uint32_t slot = head.fetch_add(1, std::memory_order_relaxed) % kEntries;
+    uint64_t hi = (uint64_t(event) << 24) | (arg & 0xFFFFFF);
+    // Timestamp 0 is reserved for empty slots.
+    uint32_t us = static_cast<uint32_t>(osport::nowUs()) | 1;
+    ring[slot] = (hi << 32) | us;
+}
+
+// Oldest record first. Records written during the dump may be torn; the
+// dump is meant for after the interesting part.
+inline void dump() {
+    uint32_t end = head.load(std::memory_order_relaxed);
+    uint32_t begin = end > kEntries ? end - kEntries : 0;
+    printf("TL begin %u\n", (unsigned)(end - begin));
+    for (uint32_t i = begin; i < end; i++) {
+        uint64_t r = ring[i % kEntries];
+        if (r == 0) continue;
+        uint32_t hi = static_cast<uint32_t>(r >> 32);
+        printf("TL %u %s %u\n", (unsigned)static_cast<uint32_t>(r), name(hi >> 24), (unsigned)(hi & 0xFFFFFF));
+    }
+    printf("TL end\n");
+}
+
+} // namespace timeline
+
+#define TIMELINE_MARK(event, arg) ::timeline::mark(::timeline::Event::event, static_cast<uint32_t>(arg))
+
+#else
+
+#define TIMELINE_MARK(event, arg) ((void)0)
+
+#endif
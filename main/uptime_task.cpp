@@ -1,49 +1,33 @@
-#include "freertos/FreeRTOS.h"
-#include "freertos/task.h"
 #include "esp_log.h"
 #include "parameter_store.cpp"
+#include "job_scheduler.hpp"
 
+// Publishes seconds since start as the Uptime parameter, once a second on the
+// shared job scheduler.
 class UptimeTask {
 public:
     UptimeTask(paramstore::ParameterStore& store) : store_(store) {}
 
-    void start(const char* name = "UptimeTask", uint32_t stackSize = 4096, UBaseType_t priority = 5) {
-        xTaskCreatePinnedToCore(
-            &UptimeTask::taskEntry,   
-            name,
-            stackSize,
-            this,                     
-            priority,
-            &taskHandle_,
-            tskNO_AFFINITY
-        );
+    void start(JobScheduler& jobs) {
+        job_ = jobs.every("uptime", 1000, kBudgetUs, [this]{ tick(); });
     }
 
-    void stop() {
-        if (taskHandle_) {
-            vTaskDelete(taskHandle_);
-            taskHandle_ = nullptr;
-        }
+    void stop(JobScheduler& jobs) {
+        jobs.cancel(job_);
+        job_ = JobScheduler::kNoJob;
     }
 
 private:
-    static void taskEntry(void* arg) {
-        auto* self = static_cast<UptimeTask*>(arg);
-        self -> run();
-    }
+    static constexpr uint32_t kBudgetUs = 20000;
 
-    void run() {
-        ESP_LOGI("UptimeTask", "started");
-        int32_t counter = 0;
-        while (true) {
-            esp_err_t err = store_.setInt(paramstore::ParameterId::Uptime, counter++);
-            if (err != ESP_OK) {
-                ESP_LOGW("UptimeTask", "setInt failed: %s", esp_err_to_name(err));
-            }
-            vTaskDelay(pdMS_TO_TICKS(1000)); 
+    void tick() {
+        esp_err_t err = store_.setInt(paramstore::ParameterId::Uptime, counter_++);
+        if (err != ESP_OK) {
+            ESP_LOGW("UptimeTask", "setInt failed: %s", esp_err_to_name(err));
         }
     }
 
     paramstore::ParameterStore& store_;
-    TaskHandle_t taskHandle_ = nullptr;
+    JobScheduler::JobId job_ = JobScheduler::kNoJob;
+    int32_t counter_ = 0;
 };
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""Builds the preset LZ dictionary from the parameter table.
+
+Collects the string literals of every add*Param() call in
+main/parameter_store.cpp (names, descriptions, default string values) and
+writes them to main/protocol/compression_dict.hpp. Rerun after changing the
+parameter table and ship the same header to clients: the dictionary id in
+every compressed message must match on both ends.
+
+    python tools/gen_compression_dict.py
+"""
+import pathlib
+import re
+
+ROOT = pathlib.Path(__file__).resolve().parent.parent
+SOURCE = ROOT / "main" / "parameter_store.cpp"
+TARGET = ROOT / "main" / "protocol" / "compression_dict.hpp"
+
+CALL = re.compile(r"add(?:Int|Float|Bool|String)Param\s*\((.*?)\);", re.S)
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+
+
+def fragments(text):
+    seen = []
+    for call in CALL.finditer(text):
+        for lit in LITERAL.findall(call.group(1)):
+            if lit and lit not in seen:
+                seen.append(lit)
+    return seen
+
+
+def fnv1a16(data):
+    h = 0x811C9DC5
+    for b in data:
+        h = ((h ^ b) * 0x01000193) & 0xFFFFFFFF
+    return (h >> 16) ^ (h & 0xFFFF)
+
+
+def main():
+    parts = fragments(SOURCE.read_text(encoding="utf-8"))
+    blob = "".join(parts).encode("utf-8")
+    lines = "\n".join(f'    "{p}"' for p in parts)
+    TARGET.write_text(f"""\
+// Generated by tools/gen_compression_dict.py from parameter_store.cpp - do not edit.
+#pragma once
+#include <cstdint>
+#include <span>
+
+namespace lz {{
+
+// Preset dictionary: parameter names, descriptions and default strings.
+static constexpr char kDictionaryText[] =
+{lines};
+
+// Sent with every compressed message so a client with another dictionary
+// rejects it instead of decoding garbage.
+static constexpr uint16_t kDictionaryId = 0x{fnv1a16(blob):04X};
+
+inline std::span<const uint8_t> dictionary() {{
+    return {{reinterpret_cast<const uint8_t*>(kDictionaryText), sizeof(kDictionaryText) - 1}};
+}}
+
+}} // namespace lz
+""", encoding="utf-8")
+    print(f"{TARGET.relative_to(ROOT)}: {len(parts)} fragments, {len(blob)} bytes, id 0x{fnv1a16(blob):04X}")
+
+
+if __name__ == "__main__":
+    main()
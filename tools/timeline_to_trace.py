@@ -0,0 +1,80 @@
+#!/usr/bin/env python3
+"""Converts a timeline dump to Chrome trace format.
+
+Enable CONFIG_TIMELINE_ENABLED, type "timeline" on the device console and
+save the monitor output. Every "TL <us> <event> <arg>" line becomes a trace
+event: "<name>:begin" / "<name>:end" pairs become slices on a track per
+(name, arg), anything else an instant event. Open the result in
+chrome://tracing or https://ui.perfetto.dev.
+
+    python tools/timeline_to_trace.py monitor.log -o trace.json
+"""
+import argparse
+import json
+import re
+import sys
+
+RECORD = re.compile(r"TL (\d+) (\S+) (\d+)\s*$")
+WRAP = 1 << 32
+
+
+def records(lines):
+    last = None
+    offset = 0
+    for line in lines:
+        m = RECORD.search(line)
+        if not m:
+            continue
+        us = int(m.group(1))
+        # The device timestamp is 32 bits and wraps after 71 minutes.
+        if last is not None and us + offset < last - WRAP // 2:
+            offset += WRAP
+        last = us + offset
+        yield last, m.group(2), int(m.group(3))
+
+
+def convert(lines):
+    events = []
+    tracks = {}
+
+    def track(name, arg):
+        key = (name, arg)
+        if key not in tracks:
+            tracks[key] = len(tracks) + 1
+            events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": tracks[key],
+                           "args": {"name": f"{name} {arg}"}})
+        return tracks[key]
+
+    events.append({"ph": "M", "name": "thread_name", "pid": 0, "tid": 0, "args": {"name": "events"}})
+    for us, name, arg in records(lines):
+        base, _, phase = name.rpartition(":")
+        if phase in ("begin", "end"):
+            events.append({"ph": "B" if phase == "begin" else "E", "name": base, "pid": 0,
+                           "tid": track(base, arg), "ts": us})
+        else:
+            events.append({"ph": "i", "s": "t", "name": name, "pid": 0, "tid": 0, "ts": us,
+                           "args": {"arg": arg}})
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.splitlines()[0])
+    parser.add_argument("log", nargs="?", help="monitor output, stdin if omitted")
+    parser.add_argument("-o", "--output", help="trace file, stdout if omitted")
+    args = parser.parse_args()
+
+    if args.log:
+        with open(args.log, encoding="utf-8", errors="replace") as f:
+            trace = convert(f)
+    else:
+        trace = convert(sys.stdin)
+
+    if args.output:
+        with open(args.output, "w", encoding="utf-8") as f:
+            json.dump(trace, f)
+    else:
+        json.dump(trace, sys.stdout)
+
+
+if __name__ == "__main__":
+    main()